@@ -21,6 +21,7 @@
 #include "absl/base/optimization.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 
 namespace riegeli {
 
@@ -52,6 +53,9 @@ class Buffer {
   // Returns false if GetData() would allocate the buffer.
   bool is_allocated() const { return data_ != nullptr; }
 
+  // Registers this Buffer with MemoryEstimator, if it is allocated.
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const;
+
  private:
   // If the buffer is allocated, deletes it.
   void DeleteBuffer();
@@ -91,6 +95,11 @@ inline char* Buffer::GetData() {
   return data_;
 }
 
+inline void Buffer::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  if (data_ != nullptr) memory_estimator->RegisterDynamicMemory(size_);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BASE_BUFFER_H_
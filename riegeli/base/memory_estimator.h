@@ -16,8 +16,13 @@
 #define RIEGELI_BASE_MEMORY_STATS_H_
 
 #include <stddef.h>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
+#include "absl/meta/type_traits.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/memory.h"
 
@@ -62,9 +67,23 @@ namespace riegeli {
 //     }
 //   }
 //
+// Object defines a virtual RegisterSubobjects(), so that readers and writers
+// report memory they own, including owned dependencies. Memory of an owned
+// dependency held by unique_ptr<T> is estimated as sizeof(T), which can be
+// smaller than the size of its dynamic type.
+//
 // For objects which do not support these conventions, their owner estimates
 // their memory usage and possible sharing with whatever means have been found.
 // The estimation can thus be inexact.
+//
+// To estimate memory used by many objects, e.g. writers which share Chain
+// blocks, register all of them with the same MemoryEstimator:
+//
+//   MemoryEstimator memory_estimator;
+//   for (const std::unique_ptr<RecordWriter<>>& writer : writers) {
+//     memory_estimator.RegisterUnique(*writer);
+//   }
+//   const size_t memory = memory_estimator.TotalMemory();
 class MemoryEstimator {
  public:
   MemoryEstimator() {}
@@ -94,6 +113,27 @@ class MemoryEstimator {
   // should register its memory and subobjects.
   bool RegisterNode(const void* ptr);
 
+  // Registers subobjects of an object held by value, but does not include the
+  // object itself (sizeof(object)):
+  //  * if T supports RegisterSubobjects(MemoryEstimator*), calls it
+  //  * if T is std::string, registers its heap allocation
+  //  * if T is unique_ptr<U>, registers the owned U if any, as with
+  //    RegisterUnique()
+  //  * if T is std::vector<U>, registers its array and subobjects of its
+  //    elements
+  //  * otherwise registers nothing, e.g. for non-owning pointers
+  template <typename T>
+  void RegisterSubobjects(const T& object);
+  void RegisterSubobjects(const std::string& object);
+  template <typename T, typename Deleter>
+  void RegisterSubobjects(const std::unique_ptr<T, Deleter>& object);
+  template <typename T, typename Alloc>
+  void RegisterSubobjects(const std::vector<T, Alloc>& object);
+
+  // Registers an object held by pointer (sizeof(T)) and its subobjects.
+  template <typename T>
+  void RegisterUnique(const T& object);
+
   // Returns the total amount of memory added.
   size_t TotalMemory() const { return total_memory_; }
 
@@ -102,8 +142,37 @@ class MemoryEstimator {
   absl::flat_hash_set<const void*> objects_seen_;
 };
 
+// Estimates the amount of memory used by an object held by value, including
+// sizeof(T) and its subobjects.
+template <typename T>
+size_t EstimateMemory(const T& object);
+
 // Implementation details follow.
 
+namespace internal {
+
+template <typename T, typename Enable = void>
+struct HasRegisterSubobjects : public std::false_type {};
+
+template <typename T>
+struct HasRegisterSubobjects<
+    T, absl::void_t<decltype(std::declval<const T&>().RegisterSubobjects(
+           std::declval<MemoryEstimator*>()))>> : public std::true_type {};
+
+template <typename T,
+          absl::enable_if_t<HasRegisterSubobjects<T>::value, int> = 0>
+inline void RegisterSubobjectsImpl(const T& object,
+                                   MemoryEstimator* memory_estimator) {
+  object.RegisterSubobjects(memory_estimator);
+}
+
+template <typename T,
+          absl::enable_if_t<!HasRegisterSubobjects<T>::value, int> = 0>
+inline void RegisterSubobjectsImpl(const T& object,
+                                   MemoryEstimator* memory_estimator) {}
+
+}  // namespace internal
+
 inline void MemoryEstimator::RegisterMemory(size_t memory) {
   total_memory_ = SaturatingAdd(total_memory_, memory);
 }
@@ -116,6 +185,49 @@ inline bool MemoryEstimator::RegisterNode(const void* ptr) {
   return objects_seen_.insert(ptr).second;
 }
 
+template <typename T>
+inline void MemoryEstimator::RegisterSubobjects(const T& object) {
+  internal::RegisterSubobjectsImpl(object, this);
+}
+
+inline void MemoryEstimator::RegisterSubobjects(const std::string& object) {
+  // A short string might be stored inline, without a heap allocation. This is
+  // approximated by checking whether the capacity exceeds the inline capacity
+  // of an empty string.
+  if (object.capacity() > std::string().capacity()) {
+    RegisterDynamicMemory(object.capacity() + 1);
+  }
+}
+
+template <typename T, typename Deleter>
+inline void MemoryEstimator::RegisterSubobjects(
+    const std::unique_ptr<T, Deleter>& object) {
+  if (object != nullptr) RegisterUnique(*object);
+}
+
+template <typename T, typename Alloc>
+inline void MemoryEstimator::RegisterSubobjects(
+    const std::vector<T, Alloc>& object) {
+  if (object.capacity() > 0) {
+    RegisterDynamicMemory(object.capacity() * sizeof(T));
+  }
+  for (const T& element : object) RegisterSubobjects(element);
+}
+
+template <typename T>
+inline void MemoryEstimator::RegisterUnique(const T& object) {
+  RegisterDynamicMemory(sizeof(T));
+  RegisterSubobjects(object);
+}
+
+template <typename T>
+inline size_t EstimateMemory(const T& object) {
+  MemoryEstimator memory_estimator;
+  memory_estimator.RegisterMemory(sizeof(T));
+  memory_estimator.RegisterSubobjects(object);
+  return memory_estimator.TotalMemory();
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BASE_MEMORY_STATS_H_
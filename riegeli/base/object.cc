@@ -23,6 +23,7 @@
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/memory.h"
+#include "riegeli/base/memory_estimator.h"
 
 namespace riegeli {
 
@@ -68,4 +69,13 @@ bool Object::Fail(const Object& src) {
 
 TypeId Object::GetTypeId() const { return TypeId(); }
 
+void Object::RegisterSubobjects(MemoryEstimator* memory_estimator) const {
+  const uintptr_t status = status_.load(std::memory_order_acquire);
+  if (status != kHealthy && status != kClosedSuccessfully) {
+    memory_estimator->RegisterDynamicMemory(
+        offsetof(FailedStatus, message_data) +
+        reinterpret_cast<const FailedStatus*>(status)->message_size);
+  }
+}
+
 }  // namespace riegeli
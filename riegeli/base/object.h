@@ -24,6 +24,7 @@
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/memory.h"
+#include "riegeli/base/memory_estimator.h"
 
 namespace riegeli {
 
@@ -120,6 +121,15 @@ class Object {
   // This solution is more limited but faster than typeid or dynamic_cast.
   virtual TypeId GetTypeId() const;
 
+  // Registers subobjects of this Object with MemoryEstimator, but does not
+  // include this Object (sizeof(*this)).
+  //
+  // Derived classes which own memory, including owned dependencies, override
+  // RegisterSubobjects() and call the base class version. Use
+  // EstimateMemory(object) or MemoryEstimator::RegisterUnique() to include the
+  // Object itself.
+  virtual void RegisterSubobjects(MemoryEstimator* memory_estimator) const;
+
  protected:
   // Initial state of the Object.
   enum class State : uintptr_t {
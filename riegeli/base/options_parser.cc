@@ -81,6 +81,23 @@ ValueParser::Function ValueParser::Int(int* out, int min_value, int max_value) {
   };
 }
 
+ValueParser::Function ValueParser::Int(uint64_t* out, uint64_t min_value,
+                                       uint64_t max_value) {
+  RIEGELI_ASSERT_LE(min_value, max_value)
+      << "Failed precondition of OptionsParser::IntOption(): "
+         "bounds in the wrong order";
+  return [out, min_value, max_value](ValueParser* value_parser) {
+    uint64_t int_value;
+    if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(value_parser->value(), &int_value) &&
+                          int_value >= min_value && int_value <= max_value)) {
+      *out = int_value;
+      return true;
+    }
+    return value_parser->InvalidValue(
+        absl::StrCat("integers ", min_value, "..", max_value));
+  };
+}
+
 ValueParser::Function ValueParser::Bytes(uint64_t* out, uint64_t min_value,
                                          uint64_t max_value) {
   RIEGELI_ASSERT_LE(min_value, max_value)
@@ -14,11 +14,14 @@
 
 #include "riegeli/base/parallelism.h"
 
+#include <stddef.h>
+#include <atomic>
 #include <functional>
 #include <thread>
 #include <utility>
 
 #include "absl/base/thread_annotations.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "riegeli/base/base.h"
@@ -73,5 +76,35 @@ ThreadPool& DefaultThreadPool() {
   return *kStaticThreadPool;
 }
 
+size_t HardwareConcurrency() {
+  return UnsignedMax(size_t{std::thread::hardware_concurrency()}, size_t{1});
+}
+
+void ParallelFor(size_t size, size_t max_parallelism,
+                 const std::function<void(size_t)>& function) {
+  // Indices are claimed in order by the calling thread and background tasks.
+  std::atomic<size_t> next_index(0);
+  const auto run = [&] {
+    for (;;) {
+      const size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+      if (index >= size) return;
+      function(index);
+    }
+  };
+  const size_t num_background_tasks =
+      UnsignedMin(size, max_parallelism) <= 1
+          ? size_t{0}
+          : UnsignedMin(size, max_parallelism) - 1;
+  absl::BlockingCounter pending_tasks(IntCast<int>(num_background_tasks));
+  for (size_t i = 0; i < num_background_tasks; ++i) {
+    DefaultThreadPool().Schedule([&] {
+      run();
+      pending_tasks.DecrementCount();
+    });
+  }
+  run();
+  pending_tasks.Wait();
+}
+
 }  // namespace internal
 }  // namespace riegeli
@@ -48,6 +48,21 @@ class ThreadPool {
 
 ThreadPool& DefaultThreadPool();
 
+// Returns the number of hardware threads, or 1 if unknown.
+size_t HardwareConcurrency();
+
+// Calls function(i) for each i in [0, size), concurrently on
+// DefaultThreadPool(), with at most max_parallelism concurrent calls, the
+// calling thread making some of the calls. Returns when all calls have
+// returned.
+//
+// max_parallelism is chosen by the caller, who knows whether it already runs
+// concurrently with other callers, e.g. HardwareConcurrency() divided by the
+// number of such callers. If max_parallelism <= 1, all calls are made by the
+// calling thread.
+void ParallelFor(size_t size, size_t max_parallelism,
+                 const std::function<void(size_t)>& function);
+
 }  // namespace internal
 }  // namespace riegeli
 
@@ -0,0 +1,301 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_RECYCLING_POOL_H_
+#define RIEGELI_BASE_RECYCLING_POOL_H_
+
+#include <stddef.h>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+
+namespace riegeli {
+
+// A thread-safe pool of objects which are expensive to create, e.g.
+// decompression contexts, so that they can be reused instead of being created
+// again for each use.
+//
+// A reused object keeps the state left by its previous user. The caller of
+// Get() is responsible for resetting that state before use.
+template <typename T, typename Deleter = std::default_delete<T>>
+class RecyclingPool {
+ public:
+  // A deleter which returns the object to the pool instead of deleting it.
+  class Recycler {
+   public:
+    Recycler() noexcept {}
+
+    explicit Recycler(RecyclingPool* pool) noexcept : pool_(pool) {}
+
+    void operator()(T* ptr) const;
+
+   private:
+    RecyclingPool* pool_ = nullptr;
+  };
+
+  // An owning pointer to an object borrowed from the pool. Destroying it
+  // returns the object to the pool.
+  using Handle = std::unique_ptr<T, Recycler>;
+
+  // The default maximal number of idle objects kept.
+  static constexpr size_t kDefaultMaxSize = 16;
+
+  explicit RecyclingPool(size_t max_size = kDefaultMaxSize)
+      : max_size_(max_size) {
+    RIEGELI_ASSERT_GT(max_size, 0u)
+        << "Failed precondition of RecyclingPool::RecyclingPool(): "
+           "zero max_size";
+  }
+
+  RecyclingPool(const RecyclingPool&) = delete;
+  RecyclingPool& operator=(const RecyclingPool&) = delete;
+
+  // Returns a pool shared by all users of this type, which is never destroyed.
+  static RecyclingPool& global();
+
+  // Returns an idle object from the pool, or creates a new one with factory()
+  // if there is none. factory() should return std::unique_ptr<T, Deleter>, and
+  // can return nullptr on failure, in which case Get() returns nullptr too.
+  template <typename Factory>
+  Handle Get(Factory factory);
+
+  // Returns an object to the pool. If the pool already holds max_size idle
+  // objects, the object is deleted instead.
+  void Put(std::unique_ptr<T, Deleter> object);
+
+ private:
+  const size_t max_size_;
+  absl::Mutex mutex_;
+  std::vector<std::unique_ptr<T, Deleter>> idle_ GUARDED_BY(mutex_);
+};
+
+// Like RecyclingPool, but objects are grouped by Key, which should include
+// parameters which affect the allocated state of an object, so that an object
+// is reused only by a user with compatible parameters. Key must be hashable by
+// absl::Hash.
+//
+// max_size bounds idle objects of all keys together. When the pool is full,
+// returning an object evicts the least recently returned idle object, so that
+// objects with keys which are no longer used do not stay in the pool.
+//
+// A reused object keeps the state left by its previous user. The caller of
+// Get() is responsible for resetting that state before use.
+template <typename T, typename Key, typename Deleter = std::default_delete<T>>
+class KeyedRecyclingPool {
+ public:
+  // A deleter which returns the object to the pool instead of deleting it.
+  class Recycler {
+   public:
+    Recycler() noexcept {}
+
+    explicit Recycler(KeyedRecyclingPool* pool, Key key)
+        : pool_(pool), key_(std::move(key)) {}
+
+    void operator()(T* ptr) const;
+
+   private:
+    KeyedRecyclingPool* pool_ = nullptr;
+    Key key_;
+  };
+
+  // An owning pointer to an object borrowed from the pool. Destroying it
+  // returns the object to the pool.
+  using Handle = std::unique_ptr<T, Recycler>;
+
+  // The default maximal number of idle objects kept.
+  static constexpr size_t kDefaultMaxSize = 16;
+
+  explicit KeyedRecyclingPool(size_t max_size = kDefaultMaxSize)
+      : max_size_(max_size) {
+    RIEGELI_ASSERT_GT(max_size, 0u)
+        << "Failed precondition of KeyedRecyclingPool::KeyedRecyclingPool(): "
+           "zero max_size";
+  }
+
+  KeyedRecyclingPool(const KeyedRecyclingPool&) = delete;
+  KeyedRecyclingPool& operator=(const KeyedRecyclingPool&) = delete;
+
+  // Returns a pool shared by all users of this type, which is never destroyed.
+  static KeyedRecyclingPool& global();
+
+  // Returns an idle object with the given key from the pool, or creates a new
+  // one with factory() if there is none. factory() should return
+  // std::unique_ptr<T, Deleter>, and can return nullptr on failure, in which
+  // case Get() returns nullptr too.
+  template <typename Factory>
+  Handle Get(Key key, Factory factory);
+
+  // Returns an object to the pool. If the pool already holds max_size idle
+  // objects, the least recently returned one is deleted.
+  void Put(const Key& key, std::unique_ptr<T, Deleter> object);
+
+ private:
+  struct Entry {
+    Key key;
+    std::unique_ptr<T, Deleter> object;
+  };
+  using ByAge = std::list<Entry>;
+
+  const size_t max_size_;
+  absl::Mutex mutex_;
+  // Idle objects, least recently returned first.
+  //
+  // Invariant: by_age_.size() <= max_size_
+  ByAge by_age_ GUARDED_BY(mutex_);
+  // Positions in by_age_ of idle objects with each key, least recently
+  // returned first.
+  //
+  // Invariant: each vector is non-empty
+  absl::flat_hash_map<Key, std::vector<typename ByAge::iterator>> by_key_
+      GUARDED_BY(mutex_);
+};
+
+// Implementation details follow.
+
+// Before C++17 if a constexpr static data member is ODR-used, its definition at
+// namespace scope is required. Since C++17 these definitions are deprecated:
+// http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+template <typename T, typename Deleter>
+constexpr size_t RecyclingPool<T, Deleter>::kDefaultMaxSize;
+template <typename T, typename Key, typename Deleter>
+constexpr size_t KeyedRecyclingPool<T, Key, Deleter>::kDefaultMaxSize;
+#endif
+
+template <typename T, typename Deleter>
+void RecyclingPool<T, Deleter>::Recycler::operator()(T* ptr) const {
+  RIEGELI_ASSERT(pool_ != nullptr)
+      << "Failed precondition of RecyclingPool::Recycler: "
+         "object not borrowed from a pool";
+  pool_->Put(std::unique_ptr<T, Deleter>(ptr));
+}
+
+template <typename T, typename Deleter>
+RecyclingPool<T, Deleter>& RecyclingPool<T, Deleter>::global() {
+  static NoDestructor<RecyclingPool> kStaticRecyclingPool;
+  return *kStaticRecyclingPool;
+}
+
+template <typename T, typename Deleter>
+template <typename Factory>
+typename RecyclingPool<T, Deleter>::Handle RecyclingPool<T, Deleter>::Get(
+    Factory factory) {
+  std::unique_ptr<T, Deleter> object;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!idle_.empty()) {
+      object = std::move(idle_.back());
+      idle_.pop_back();
+    }
+  }
+  if (object == nullptr) {
+    object = factory();
+    if (ABSL_PREDICT_FALSE(object == nullptr)) return Handle();
+  }
+  return Handle(object.release(), Recycler(this));
+}
+
+template <typename T, typename Deleter>
+void RecyclingPool<T, Deleter>::Put(std::unique_ptr<T, Deleter> object) {
+  if (ABSL_PREDICT_FALSE(object == nullptr)) return;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (idle_.size() < max_size_) {
+      idle_.push_back(std::move(object));
+      return;
+    }
+  }
+  // Delete the object outside of the lock.
+}
+
+template <typename T, typename Key, typename Deleter>
+void KeyedRecyclingPool<T, Key, Deleter>::Recycler::operator()(T* ptr) const {
+  RIEGELI_ASSERT(pool_ != nullptr)
+      << "Failed precondition of KeyedRecyclingPool::Recycler: "
+         "object not borrowed from a pool";
+  pool_->Put(key_, std::unique_ptr<T, Deleter>(ptr));
+}
+
+template <typename T, typename Key, typename Deleter>
+KeyedRecyclingPool<T, Key, Deleter>&
+KeyedRecyclingPool<T, Key, Deleter>::global() {
+  static NoDestructor<KeyedRecyclingPool> kStaticKeyedRecyclingPool;
+  return *kStaticKeyedRecyclingPool;
+}
+
+template <typename T, typename Key, typename Deleter>
+template <typename Factory>
+typename KeyedRecyclingPool<T, Key, Deleter>::Handle
+KeyedRecyclingPool<T, Key, Deleter>::Get(Key key, Factory factory) {
+  std::unique_ptr<T, Deleter> object;
+  {
+    absl::MutexLock lock(&mutex_);
+    const auto iter = by_key_.find(key);
+    if (iter != by_key_.end()) {
+      RIEGELI_ASSERT(!iter->second.empty())
+          << "Failed invariant of KeyedRecyclingPool: "
+             "empty list of idle objects";
+      // Reuse the most recently returned object with this key.
+      const typename ByAge::iterator entry = iter->second.back();
+      object = std::move(entry->object);
+      by_age_.erase(entry);
+      iter->second.pop_back();
+      if (iter->second.empty()) by_key_.erase(iter);
+    }
+  }
+  if (object == nullptr) {
+    object = factory();
+    if (ABSL_PREDICT_FALSE(object == nullptr)) return Handle();
+  }
+  return Handle(object.release(), Recycler(this, std::move(key)));
+}
+
+template <typename T, typename Key, typename Deleter>
+void KeyedRecyclingPool<T, Key, Deleter>::Put(
+    const Key& key, std::unique_ptr<T, Deleter> object) {
+  if (ABSL_PREDICT_FALSE(object == nullptr)) return;
+  std::unique_ptr<T, Deleter> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (by_age_.size() == max_size_) {
+      // Evict the least recently returned object. It is also the least
+      // recently returned object with its key.
+      const typename ByAge::iterator oldest = by_age_.begin();
+      const auto iter = by_key_.find(oldest->key);
+      RIEGELI_ASSERT(iter != by_key_.end() && iter->second.front() == oldest)
+          << "Failed invariant of KeyedRecyclingPool: "
+             "oldest object not indexed by its key";
+      iter->second.erase(iter->second.begin());
+      if (iter->second.empty()) by_key_.erase(iter);
+      evicted = std::move(oldest->object);
+      by_age_.erase(oldest);
+    }
+    by_age_.push_back(Entry{key, std::move(object)});
+    by_key_[key].push_back(std::prev(by_age_.end()));
+  }
+  // Delete the evicted object outside of the lock.
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_RECYCLING_POOL_H_
@@ -0,0 +1,112 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/base/recycling_pool.h"
+
+#include <stddef.h>
+#include <memory>
+
+#include "absl/memory/memory.h"
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+namespace {
+
+// Counts live objects, so that tests can observe which objects were deleted.
+struct Counted {
+  explicit Counted(int id) : id(id) { ++num_live; }
+  ~Counted() { --num_live; }
+
+  int id;
+  static size_t num_live;
+};
+
+size_t Counted::num_live = 0;
+
+std::unique_ptr<Counted> MakeCounted(int id) {
+  return absl::make_unique<Counted>(id);
+}
+
+void TestRecyclingPool() {
+  RecyclingPool<Counted> pool(2);
+  {
+    RecyclingPool<Counted>::Handle a = pool.Get([] { return MakeCounted(1); });
+    RecyclingPool<Counted>::Handle b = pool.Get([] { return MakeCounted(2); });
+    RecyclingPool<Counted>::Handle c = pool.Get([] { return MakeCounted(3); });
+    RIEGELI_CHECK_EQ(Counted::num_live, 3u);
+  }
+  // Only max_size objects are kept.
+  RIEGELI_CHECK_EQ(Counted::num_live, 2u);
+  RecyclingPool<Counted>::Handle reused =
+      pool.Get([] { return MakeCounted(4); });
+  RIEGELI_CHECK_NE(reused->id, 4);
+}
+
+void TestKeyedRecyclingPool() {
+  {
+    KeyedRecyclingPool<Counted, int> pool(3);
+    {
+      // Return objects with keys 1, 2, 1, 2, in this order.
+      KeyedRecyclingPool<Counted, int>::Handle a =
+          pool.Get(1, [] { return MakeCounted(10); });
+      KeyedRecyclingPool<Counted, int>::Handle b =
+          pool.Get(2, [] { return MakeCounted(20); });
+      KeyedRecyclingPool<Counted, int>::Handle c =
+          pool.Get(1, [] { return MakeCounted(11); });
+      KeyedRecyclingPool<Counted, int>::Handle d =
+          pool.Get(2, [] { return MakeCounted(21); });
+      a.reset();
+      b.reset();
+      c.reset();
+      d.reset();
+    }
+    // The pool is bounded across keys: the first returned object was evicted.
+    RIEGELI_CHECK_EQ(Counted::num_live, 3u);
+    {
+      // The most recently returned object with the key is reused.
+      KeyedRecyclingPool<Counted, int>::Handle a =
+          pool.Get(1, [] { return MakeCounted(12); });
+      RIEGELI_CHECK_EQ(a->id, 11);
+      // No object with key 1 is left, so a new one is created.
+      KeyedRecyclingPool<Counted, int>::Handle b =
+          pool.Get(1, [] { return MakeCounted(13); });
+      RIEGELI_CHECK_EQ(b->id, 13);
+    }
+    RIEGELI_CHECK_EQ(Counted::num_live, 3u);
+    {
+      // Objects with a new key evict objects with keys which are no longer
+      // used.
+      KeyedRecyclingPool<Counted, int>::Handle a =
+          pool.Get(3, [] { return MakeCounted(30); });
+      KeyedRecyclingPool<Counted, int>::Handle b =
+          pool.Get(3, [] { return MakeCounted(31); });
+      KeyedRecyclingPool<Counted, int>::Handle c =
+          pool.Get(3, [] { return MakeCounted(32); });
+    }
+    RIEGELI_CHECK_EQ(Counted::num_live, 3u);
+    KeyedRecyclingPool<Counted, int>::Handle a =
+        pool.Get(2, [] { return MakeCounted(22); });
+    RIEGELI_CHECK_EQ(a->id, 22);
+  }
+  RIEGELI_CHECK_EQ(Counted::num_live, 0u);
+}
+
+}  // namespace
+}  // namespace riegeli
+
+int main() {
+  riegeli::TestRecyclingPool();
+  riegeli::TestKeyedRecyclingPool();
+  return 0;
+}
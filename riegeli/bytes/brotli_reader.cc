@@ -22,6 +22,7 @@
 #include "absl/strings/str_cat.h"
 #include "brotli/decode.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 
@@ -119,6 +120,12 @@ bool BrotliReaderBase::PullSlow() {
   }
 }
 
+void BrotliReaderBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Reader::RegisterSubobjects(memory_estimator);
+  // Brotli does not report the size of its state, so it is not included.
+}
+
 template class BrotliReader<Reader*>;
 template class BrotliReader<std::unique_ptr<Reader>>;
 
@@ -22,6 +22,7 @@
 #include "absl/utility/utility.h"
 #include "brotli/decode.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 
@@ -35,6 +36,7 @@ class BrotliReaderBase : public Reader {
   // Returns the compressed Reader. Unchanged by Close().
   virtual Reader* src_reader() = 0;
   virtual const Reader* src_reader() const = 0;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   explicit BrotliReaderBase(State state) noexcept : Reader(state) {}
@@ -94,6 +96,7 @@ class BrotliReader : public BrotliReaderBase {
   const Src& src() const { return src_.manager(); }
   Reader* src_reader() override { return src_.ptr(); }
   const Reader* src_reader() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -151,6 +154,13 @@ void BrotliReader<Src>::VerifyEnd() {
   if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) src_->VerifyEnd();
 }
 
+template <typename Src>
+void BrotliReader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  BrotliReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
 extern template class BrotliReader<Reader*>;
 extern template class BrotliReader<std::unique_ptr<Reader>>;
 
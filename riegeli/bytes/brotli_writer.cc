@@ -22,6 +22,7 @@
 #include "absl/strings/string_view.h"
 #include "brotli/encode.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
 
@@ -153,6 +154,12 @@ bool BrotliWriterBase::Flush(FlushType flush_type) {
   return true;
 }
 
+void BrotliWriterBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  BufferedWriter::RegisterSubobjects(memory_estimator);
+  // Brotli does not report the size of its state, so it is not included.
+}
+
 template class BrotliWriter<Writer*>;
 template class BrotliWriter<std::unique_ptr<Writer>>;
 
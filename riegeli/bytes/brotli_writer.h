@@ -24,6 +24,7 @@
 #include "brotli/encode.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
 
@@ -127,6 +128,7 @@ class BrotliWriterBase : public BufferedWriter {
   virtual const Writer* dest_writer() const = 0;
 
   bool Flush(FlushType flush_type) override;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   BrotliWriterBase() noexcept {}
@@ -184,6 +186,7 @@ class BrotliWriter : public BrotliWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   Writer* dest_writer() override { return dest_.ptr(); }
   const Writer* dest_writer() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -233,6 +236,13 @@ void BrotliWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+void BrotliWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  BrotliWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class BrotliWriter<Writer*>;
 extern template class BrotliWriter<std::unique_ptr<Writer>>;
 
@@ -24,6 +24,7 @@
 #include "absl/types/span.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
@@ -296,4 +297,10 @@ void BufferedReader::ClearBuffer() {
   buffer_.RemoveSuffix(flat_buffer.size());
 }
 
+void BufferedReader::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Reader::RegisterSubobjects(memory_estimator);
+  buffer_.RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
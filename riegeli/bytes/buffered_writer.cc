@@ -20,6 +20,7 @@
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/writer.h"
 
 namespace riegeli {
@@ -64,4 +65,10 @@ bool BufferedWriter::WriteSlow(absl::string_view src) {
   return Writer::WriteSlow(src);
 }
 
+void BufferedWriter::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Writer::RegisterSubobjects(memory_estimator);
+  buffer_.RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
@@ -25,6 +25,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 
@@ -124,6 +125,7 @@ class ChainBackwardWriter : public ChainBackwardWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   Chain* dest_chain() override { return dest_.ptr(); }
   const Chain* dest_chain() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  private:
   void MoveDest(ChainBackwardWriter&& that);
@@ -190,6 +192,13 @@ inline void ChainBackwardWriter<Dest>::MoveDest(ChainBackwardWriter&& that) {
   }
 }
 
+template <typename Dest>
+void ChainBackwardWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ChainBackwardWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class ChainBackwardWriter<Chain*>;
 extern template class ChainBackwardWriter<Chain>;
 
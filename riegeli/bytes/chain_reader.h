@@ -22,6 +22,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
@@ -90,6 +91,7 @@ class ChainReader : public ChainReaderBase {
   Src& src() { return src_.manager(); }
   const Src& src() const { return src_.manager(); }
   const Chain* src_chain() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  private:
   void MoveSrc(ChainReader&& that);
@@ -159,6 +161,13 @@ inline void ChainReader<Src>::MoveSrc(ChainReader&& that) {
   }
 }
 
+template <typename Src>
+void ChainReader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ChainReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
 extern template class ChainReader<const Chain*>;
 extern template class ChainReader<Chain>;
 
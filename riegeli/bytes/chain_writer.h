@@ -25,6 +25,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 
@@ -126,6 +127,7 @@ class ChainWriter : public ChainWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   Chain* dest_chain() override { return dest_.ptr(); }
   const Chain* dest_chain() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  private:
   void MoveDest(ChainWriter&& that);
@@ -188,6 +190,13 @@ inline void ChainWriter<Dest>::MoveDest(ChainWriter&& that) {
   }
 }
 
+template <typename Dest>
+void ChainWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ChainWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class ChainWriter<Chain*>;
 extern template class ChainWriter<Chain>;
 
@@ -12,12 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// Make pwrite() and ftruncate() available.
+// Make pread(), pwrite(), and ftruncate() available.
 #if !defined(_XOPEN_SOURCE) || _XOPEN_SOURCE < 500
 #undef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 500
 #endif
 
+// Make O_DIRECT and sync_file_range() available.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 // Make off_t 64-bit even on 32-bit systems.
 #undef _FILE_OFFSET_BITS
 #define _FILE_OFFSET_BITS 64
@@ -26,18 +31,25 @@
 
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <cerrno>
+#include <cstring>
 #include <limits>
 #include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/str_error.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/fd_dependency.h"
@@ -77,15 +89,36 @@ bool FdWriterCommon::FailOperation(absl::string_view operation) {
 
 }  // namespace internal
 
+// Before C++17 if a constexpr static data member is ODR-used, its definition at
+// namespace scope is required. Since C++17 these definitions are deprecated:
+// http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+constexpr size_t FdWriterBase::kDirectIoAlignment;
+#endif
+
+int FdWriterBase::DirectIoFlags(int flags) {
+#ifdef O_DIRECT
+  return (flags & ~O_APPEND) | O_DIRECT;
+#else
+  return flags;
+#endif
+}
+
 void FdWriterBase::Initialize(absl::optional<Position> initial_pos, int dest) {
   int flags = 0;
-  if (!initial_pos.has_value()) {
+  if (!initial_pos.has_value() || direct_io_) {
     // If initial_pos.has_value() then flags are not needed, so avoid fcntl().
     flags = fcntl(dest, F_GETFL);
     if (ABSL_PREDICT_FALSE(flags < 0)) {
       FailOperation("fcntl()");
       return;
     }
+    if (direct_io_ && DirectIoFlags(flags) != flags) {
+      if (ABSL_PREDICT_FALSE(fcntl(dest, F_SETFL, DirectIoFlags(flags)) < 0)) {
+        FailOperation("fcntl()");
+        return;
+      }
+    }
   }
   return Initialize(initial_pos, flags, dest);
 }
@@ -108,6 +141,64 @@ void FdWriterBase::Initialize(absl::optional<Position> initial_pos, int flags,
     }
     start_pos_ = IntCast<Position>(file_pos);
   }
+  ResetWriteback();
+  if (direct_io_) InitializeDirectIo(dest);
+  if (max_pending_writes_ > 0 && ABSL_PREDICT_TRUE(healthy())) {
+    const int pending_writes_dest = dup(dest);
+    if (ABSL_PREDICT_FALSE(pending_writes_dest < 0)) {
+      FailOperation("dup()");
+      return;
+    }
+    pending_writes_ = absl::make_unique<PendingWrites>(
+        pending_writes_dest, max_pending_writes_,
+        RoundUp<kDirectIoAlignment>(buffer_size_));
+  }
+}
+
+void FdWriterBase::Done() {
+  pending_writes_.reset();
+  FdWriterCommon::Done();
+}
+
+bool FdWriterBase::WaitForPendingWrites() {
+  if (pending_writes_ != nullptr) {
+    if (ABSL_PREDICT_FALSE(!pending_writes_->Wait())) {
+      return FailOperation(pending_writes_->failed_operation());
+    }
+  }
+  return true;
+}
+
+void FdWriterBase::InitializeDirectIo(int dest) {
+#ifdef O_DIRECT
+  direct_buffer_.reset(NewAligned<char, kDirectIoAlignment>(
+      direct_buffer_.get_deleter().size));
+  LoadDirectTail(dest);
+#else
+  Fail("O_DIRECT is not supported on this platform");
+#endif
+}
+
+bool FdWriterBase::LoadDirectTail(int dest) {
+  direct_buffered_ = IntCast<size_t>(start_pos_ % kDirectIoAlignment);
+  if (direct_buffered_ == 0) return true;
+  const Position block_pos = start_pos_ - direct_buffered_;
+again:
+  const ssize_t length_read = pread(dest, direct_buffer_.get(),
+                                    kDirectIoAlignment,
+                                    IntCast<off_t>(block_pos));
+  if (ABSL_PREDICT_FALSE(length_read < 0)) {
+    if (errno == EINTR) goto again;
+    return FailOperation("pread()");
+  }
+  if (ABSL_PREDICT_FALSE(IntCast<size_t>(length_read) < direct_buffered_)) {
+    return Fail(absl::StrCat(
+        "Position ", start_pos_,
+        " is not aligned for direct I/O and is beyond the end of file, "
+        "writing ",
+        filename_));
+  }
+  return true;
 }
 
 bool FdWriterBase::SyncPos(int dest) {
@@ -138,12 +229,30 @@ bool FdWriterBase::WriteInternal(absl::string_view src) {
                              start_pos_)) {
     return FailOverflow();
   }
+  if (direct_io_) {
+    if (ABSL_PREDICT_FALSE(!WriteDirect(src, dest))) return false;
+  } else {
+    if (ABSL_PREDICT_FALSE(!WriteToFd(src, &start_pos_, dest))) return false;
+  }
+  if (writeback_size_ > 0) return StartWriteback(dest);
+  return true;
+}
+
+inline bool FdWriterBase::WriteToFd(absl::string_view src, Position* pos,
+                                    int dest) {
+  if (pending_writes_ != nullptr) {
+    if (ABSL_PREDICT_FALSE(!pending_writes_->Write(src, *pos))) {
+      return FailOperation(pending_writes_->failed_operation());
+    }
+    *pos += src.size();
+    return true;
+  }
   do {
   again:
     const ssize_t length_written = pwrite(
         dest, src.data(),
         UnsignedMin(src.size(), size_t{std::numeric_limits<ssize_t>::max()}),
-        IntCast<off_t>(start_pos_));
+        IntCast<off_t>(*pos));
     if (ABSL_PREDICT_FALSE(length_written < 0)) {
       if (errno == EINTR) goto again;
       return FailOperation("pwrite()");
@@ -151,21 +260,168 @@ bool FdWriterBase::WriteInternal(absl::string_view src) {
     RIEGELI_ASSERT_GT(length_written, 0) << "pwrite() returned 0";
     RIEGELI_ASSERT_LE(IntCast<size_t>(length_written), src.size())
         << "pwrite() wrote more than requested";
-    start_pos_ += IntCast<size_t>(length_written);
+    *pos += IntCast<size_t>(length_written);
     src.remove_prefix(IntCast<size_t>(length_written));
   } while (!src.empty());
   return true;
 }
 
+inline bool FdWriterBase::WriteDirect(absl::string_view src, int dest) {
+  const size_t buffer_size = direct_buffer_.get_deleter().size;
+  do {
+    if (direct_buffered_ == 0 && src.size() >= kDirectIoAlignment &&
+        reinterpret_cast<uintptr_t>(src.data()) % kDirectIoAlignment == 0) {
+      // src is suitably aligned. Write whole blocks directly from src, avoiding
+      // copying them to direct_buffer_.
+      const size_t length = RoundDown<kDirectIoAlignment>(src.size());
+      if (ABSL_PREDICT_FALSE(!WriteToFd(absl::string_view(src.data(), length),
+                                        &start_pos_, dest))) {
+        return false;
+      }
+      src.remove_prefix(length);
+      continue;
+    }
+    const size_t length =
+        UnsignedMin(src.size(), buffer_size - direct_buffered_);
+    std::memcpy(direct_buffer_.get() + direct_buffered_, src.data(), length);
+    direct_buffered_ += length;
+    start_pos_ += length;
+    src.remove_prefix(length);
+    if (direct_buffered_ == buffer_size) {
+      Position block_pos = start_pos_ - direct_buffered_;
+      if (ABSL_PREDICT_FALSE(!WriteToFd(
+              absl::string_view(direct_buffer_.get(), direct_buffered_),
+              &block_pos, dest))) {
+        return false;
+      }
+      direct_buffered_ = 0;
+    }
+  } while (!src.empty());
+  return true;
+}
+
+inline bool FdWriterBase::StartWriteback(int dest) {
+  // Data staged for direct I/O are not written to the fd yet.
+  const Position written_pos = start_pos_ - direct_buffered_;
+  if (written_pos < writeback_pos_ ||
+      written_pos - writeback_pos_ < writeback_size_) {
+    return true;
+  }
+  const Position end_pos = written_pos - written_pos % writeback_size_;
+#ifdef SYNC_FILE_RANGE_WRITE
+  if (pending_writes_ != nullptr) {
+    if (ABSL_PREDICT_FALSE(!pending_writes_->StartWriteback(
+            writeback_pos_, end_pos - writeback_pos_))) {
+      return FailOperation(pending_writes_->failed_operation());
+    }
+    writeback_pos_ = end_pos;
+    return true;
+  }
+  const off_t offset = IntCast<off_t>(writeback_pos_);
+  const off_t length = IntCast<off_t>(end_pos - writeback_pos_);
+again:
+  if (ABSL_PREDICT_FALSE(
+          sync_file_range(dest, offset, length, SYNC_FILE_RANGE_WRITE) < 0)) {
+    if (errno == EINTR) goto again;
+    if (errno == ESPIPE || errno == EINVAL || errno == ENOSYS) {
+      // Writeback is only advisory. Skip it for fds which do not support it.
+      writeback_size_ = 0;
+      return true;
+    }
+    return FailOperation("sync_file_range()");
+  }
+#endif
+  writeback_pos_ = end_pos;
+  return true;
+}
+
+void FdWriterBase::ResetWriteback() {
+  if (writeback_size_ > 0) {
+    writeback_pos_ = start_pos_ - start_pos_ % writeback_size_;
+  }
+}
+
+bool FdWriterBase::WriteDirectTail(int dest) {
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of FdWriterBase::WriteDirectTail(): "
+         "buffer not empty";
+  if (direct_buffered_ == 0) return true;
+  struct stat stat_info;
+  if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
+    return FailOperation("fstat()");
+  }
+  const size_t padded_size = RoundUp<kDirectIoAlignment>(direct_buffered_);
+  const Position block_pos = start_pos_ - direct_buffered_;
+  size_t padding_from_file = 0;
+  if (IntCast<Position>(stat_info.st_size) > start_pos_) {
+    // The file continues after start_pos_. Preserve its contents in the
+    // padding.
+    char* const block =
+        NewAligned<char, kDirectIoAlignment>(kDirectIoAlignment);
+    const Position last_block_pos =
+        block_pos + padded_size - kDirectIoAlignment;
+  again_read:
+    const ssize_t length_read = pread(dest, block, kDirectIoAlignment,
+                                      IntCast<off_t>(last_block_pos));
+    if (ABSL_PREDICT_FALSE(length_read < 0)) {
+      if (errno == EINTR) goto again_read;
+      DeleteAligned<char, kDirectIoAlignment>(block, kDirectIoAlignment);
+      return FailOperation("pread()");
+    }
+    const size_t tail_begin = IntCast<size_t>(start_pos_ - last_block_pos);
+    if (IntCast<size_t>(length_read) > tail_begin) {
+      padding_from_file = IntCast<size_t>(length_read) - tail_begin;
+      std::memcpy(direct_buffer_.get() + direct_buffered_, block + tail_begin,
+                  padding_from_file);
+    }
+    DeleteAligned<char, kDirectIoAlignment>(block, kDirectIoAlignment);
+  }
+  std::memset(direct_buffer_.get() + direct_buffered_ + padding_from_file, 0,
+              padded_size - direct_buffered_ - padding_from_file);
+  Position end_pos = block_pos;
+  if (ABSL_PREDICT_FALSE(!WriteToFd(
+          absl::string_view(direct_buffer_.get(), padded_size), &end_pos,
+          dest)) ||
+      ABSL_PREDICT_FALSE(!WaitForPendingWrites())) {
+    return false;
+  }
+  const Position size =
+      UnsignedMax(IntCast<Position>(stat_info.st_size), start_pos_);
+  if (end_pos > size) {
+    // Remove the padding.
+  again:
+    if (ABSL_PREDICT_FALSE(ftruncate(dest, IntCast<off_t>(size)) < 0)) {
+      if (errno == EINTR) goto again;
+      return FailOperation("ftruncate()");
+    }
+  }
+  // Keep the partial last block for subsequent writes.
+  const size_t tail_size = direct_buffered_ % kDirectIoAlignment;
+  std::memmove(direct_buffer_.get(),
+               direct_buffer_.get() + direct_buffered_ - tail_size, tail_size);
+  direct_buffered_ = tail_size;
+  return true;
+}
+
 bool FdWriterBase::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  if (ABSL_PREDICT_FALSE(!WaitForPendingWrites())) return false;
   const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(!WriteDirectTail(dest))) return false;
   if (ABSL_PREDICT_FALSE(!SyncPos(dest))) return false;
   switch (flush_type) {
     case FlushType::kFromObject:
     case FlushType::kFromProcess:
       return true;
     case FlushType::kFromMachine:
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+      if (writeback_size_ > 0) {
+        if (ABSL_PREDICT_FALSE(fdatasync(dest) < 0)) {
+          return FailOperation("fdatasync()");
+        }
+        return true;
+      }
+#endif
       if (ABSL_PREDICT_FALSE(fsync(dest) < 0)) {
         return FailOperation("fsync()");
       }
@@ -182,9 +438,12 @@ bool FdWriterBase::SeekSlow(Position new_pos) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
   RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
       << "BufferedWriter::PushInternal() did not empty the buffer";
+  if (ABSL_PREDICT_FALSE(!WaitForPendingWrites())) return false;
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(!WriteDirectTail(dest))) return false;
+  direct_buffered_ = 0;
   if (new_pos >= start_pos_) {
     // Seeking forwards.
-    const int dest = dest_fd();
     struct stat stat_info;
     if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
       return FailOperation("fstat()");
@@ -192,15 +451,20 @@ bool FdWriterBase::SeekSlow(Position new_pos) {
     if (ABSL_PREDICT_FALSE(new_pos > IntCast<Position>(stat_info.st_size))) {
       // File ends.
       start_pos_ = IntCast<Position>(stat_info.st_size);
+      ResetWriteback();
+      if (direct_io_) LoadDirectTail(dest);
       return false;
     }
   }
   start_pos_ = new_pos;
+  ResetWriteback();
+  if (direct_io_) return LoadDirectTail(dest);
   return true;
 }
 
 bool FdWriterBase::Size(Position* size) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!WaitForPendingWrites())) return false;
   const int dest = dest_fd();
   struct stat stat_info;
   if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
@@ -210,11 +474,27 @@ bool FdWriterBase::Size(Position* size) {
   return true;
 }
 
+void FdWriterBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  FdWriterCommon::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(filename_);
+  if (direct_buffer_ != nullptr) {
+    memory_estimator->RegisterDynamicMemory(direct_buffer_.get_deleter().size);
+  }
+  if (pending_writes_ != nullptr) {
+    memory_estimator->RegisterDynamicMemory(sizeof(PendingWrites));
+    pending_writes_->RegisterSubobjects(memory_estimator);
+  }
+}
+
 bool FdWriterBase::Truncate(Position new_size) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
   RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
       << "BufferedWriter::PushInternal() did not empty the buffer";
+  if (ABSL_PREDICT_FALSE(!WaitForPendingWrites())) return false;
   const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(!WriteDirectTail(dest))) return false;
+  direct_buffered_ = 0;
   if (new_size >= start_pos_) {
     // Seeking forwards.
     struct stat stat_info;
@@ -224,6 +504,8 @@ bool FdWriterBase::Truncate(Position new_size) {
     if (ABSL_PREDICT_FALSE(new_size > IntCast<Position>(stat_info.st_size))) {
       // File ends.
       start_pos_ = IntCast<Position>(stat_info.st_size);
+      ResetWriteback();
+      if (direct_io_) LoadDirectTail(dest);
       return false;
     }
   }
@@ -233,9 +515,186 @@ again:
     return FailOperation("ftruncate()");
   }
   start_pos_ = new_size;
+  ResetWriteback();
+  if (direct_io_) return LoadDirectTail(dest);
+  return true;
+}
+
+FdWriterBase::PendingWrites::PendingWrites(int dest, size_t max_pending_writes,
+                                           size_t max_buffer_size)
+    : dest_(dest),
+      max_pending_writes_(max_pending_writes),
+      max_buffer_size_(max_buffer_size) {
+  internal::DefaultThreadPool().Schedule([this] {
+    mutex_.Lock();
+    for (;;) {
+      mutex_.Await(absl::Condition(
+          +[](PendingWrites* self) {
+            return !self->operations_.empty() || self->exiting_;
+          },
+          this));
+      if (operations_.empty()) break;
+      const Operation& operation = operations_.front();
+      // After a failure, remaining operations are skipped.
+      const bool skip = error_code_ != 0;
+      mutex_.Unlock();
+      const char* const failed_operation =
+          skip ? nullptr : Perform(operation);
+      const int error_code = failed_operation == nullptr ? 0 : errno;
+      mutex_.Lock();
+      if (ABSL_PREDICT_FALSE(failed_operation != nullptr)) {
+        error_code_ = error_code;
+        failed_operation_ = failed_operation;
+      }
+      if (operations_.front().data != nullptr) {
+        RecycleBuffer(std::move(operations_.front().data));
+      }
+      operations_.pop_front();
+    }
+    exited_ = true;
+    mutex_.Unlock();
+  });
+}
+
+FdWriterBase::PendingWrites::~PendingWrites() {
+  {
+    absl::MutexLock lock(&mutex_);
+    exiting_ = true;
+    mutex_.Await(absl::Condition(
+        +[](bool* exited) { return *exited; }, &exited_));
+  }
+  internal::CloseFd(dest_);
+}
+
+inline bool FdWriterBase::PendingWrites::HasCapacity() const {
+  return operations_.size() < max_pending_writes_ || error_code_ != 0;
+}
+
+inline bool FdWriterBase::PendingWrites::Finished() const {
+  return operations_.empty() || error_code_ != 0;
+}
+
+bool FdWriterBase::PendingWrites::Write(absl::string_view src, Position pos) {
+  absl::MutexLock lock(&mutex_);
+  mutex_.Await(absl::Condition(this, &PendingWrites::HasCapacity));
+  if (ABSL_PREDICT_FALSE(error_code_ != 0)) {
+    errno = error_code_;
+    return false;
+  }
+  std::unique_ptr<char, DirectBufferDeleter> data;
+  if (!free_buffers_.empty()) {
+    // A buffer which is too small is freed rather than kept, so that free
+    // buffers do not accumulate while writes are larger.
+    data = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+  }
+  if (data == nullptr || data.get_deleter().size < src.size()) {
+    const size_t size = RoundUp<kDirectIoAlignment>(src.size());
+    data = std::unique_ptr<char, DirectBufferDeleter>(
+        NewAligned<char, kDirectIoAlignment>(size), DirectBufferDeleter{size});
+  }
+  // Copy outside the lock, so that the background thread may proceed.
+  mutex_.Unlock();
+  std::memcpy(data.get(), src.data(), src.size());
+  mutex_.Lock();
+  return Schedule(Operation{pos, src.size(), std::move(data)});
+}
+
+bool FdWriterBase::PendingWrites::StartWriteback(Position pos,
+                                                 Position length) {
+  absl::MutexLock lock(&mutex_);
+  mutex_.Await(absl::Condition(this, &PendingWrites::HasCapacity));
+  return Schedule(Operation{pos, length,
+                            std::unique_ptr<char, DirectBufferDeleter>(
+                                nullptr, DirectBufferDeleter{0})});
+}
+
+inline bool FdWriterBase::PendingWrites::Schedule(Operation operation) {
+  if (ABSL_PREDICT_FALSE(error_code_ != 0)) {
+    errno = error_code_;
+    return false;
+  }
+  operations_.push_back(std::move(operation));
   return true;
 }
 
+inline void FdWriterBase::PendingWrites::RecycleBuffer(
+    std::unique_ptr<char, DirectBufferDeleter> buffer) {
+  if (buffer.get_deleter().size <= max_buffer_size_ &&
+      free_buffers_.size() < max_pending_writes_) {
+    free_buffers_.push_back(std::move(buffer));
+  }
+}
+
+bool FdWriterBase::PendingWrites::Wait() {
+  absl::MutexLock lock(&mutex_);
+  mutex_.Await(absl::Condition(this, &PendingWrites::Finished));
+  if (ABSL_PREDICT_FALSE(error_code_ != 0)) {
+    errno = error_code_;
+    return false;
+  }
+  return true;
+}
+
+absl::string_view FdWriterBase::PendingWrites::failed_operation() const {
+  absl::MutexLock lock(&mutex_);
+  return failed_operation_;
+}
+
+void FdWriterBase::PendingWrites::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  absl::MutexLock lock(&mutex_);
+  for (const Operation& operation : operations_) {
+    if (operation.data != nullptr) {
+      memory_estimator->RegisterDynamicMemory(
+          operation.data.get_deleter().size);
+    }
+  }
+  for (const std::unique_ptr<char, DirectBufferDeleter>& buffer :
+       free_buffers_) {
+    memory_estimator->RegisterDynamicMemory(buffer.get_deleter().size);
+  }
+}
+
+const char* FdWriterBase::PendingWrites::Perform(const Operation& operation) {
+  if (operation.data == nullptr) {
+#ifdef SYNC_FILE_RANGE_WRITE
+  again_sync:
+    if (ABSL_PREDICT_FALSE(sync_file_range(dest_, IntCast<off_t>(operation.pos),
+                                           IntCast<off_t>(operation.length),
+                                           SYNC_FILE_RANGE_WRITE) < 0)) {
+      if (errno == EINTR) goto again_sync;
+      // Writeback is only advisory.
+      if (errno != ESPIPE && errno != EINVAL && errno != ENOSYS) {
+        return "sync_file_range()";
+      }
+    }
+#endif
+    return nullptr;
+  }
+  const char* src = operation.data.get();
+  size_t length = IntCast<size_t>(operation.length);
+  Position pos = operation.pos;
+  do {
+  again:
+    const ssize_t length_written = pwrite(
+        dest_, src,
+        UnsignedMin(length, size_t{std::numeric_limits<ssize_t>::max()}),
+        IntCast<off_t>(pos));
+    if (ABSL_PREDICT_FALSE(length_written < 0)) {
+      if (errno == EINTR) goto again;
+      return "pwrite()";
+    }
+    RIEGELI_ASSERT_GT(length_written, 0) << "pwrite() returned 0";
+    RIEGELI_ASSERT_LE(IntCast<size_t>(length_written), length)
+        << "pwrite() wrote more than requested";
+    src += length_written;
+    length -= IntCast<size_t>(length_written);
+    pos += IntCast<size_t>(length_written);
+  } while (length > 0);
+  return nullptr;
+}
+
 void FdStreamWriterBase::Initialize(absl::optional<Position> assumed_pos,
                                     int flags, int dest) {
   if (assumed_pos.has_value()) {
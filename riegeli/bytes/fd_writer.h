@@ -18,16 +18,23 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <sys/types.h>
+#include <deque>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/fd_dependency.h"
 
@@ -120,6 +127,77 @@ class FdWriterBase : public internal::FdWriterCommon {
       return std::move(set_buffer_size(buffer_size));
     }
 
+    // If true, the file is written with O_DIRECT, bypassing the page cache.
+    // This keeps written data from evicting other data from the page cache
+    // and makes write bandwidth more predictable.
+    //
+    // Data are staged in a buffer aligned to kDirectIoAlignment and written in
+    // whole aligned blocks. A partial last block is padded to a whole block
+    // when it is written by Flush() or Close(), the file is then truncated
+    // back to its actual size, and the partial block is rewritten by
+    // subsequent writes.
+    // RecordWriterBase::Options::set_pad_to_block_boundary() keeps flushed
+    // positions aligned, which avoids these rewrites.
+    //
+    // If the initial position is not a multiple of kDirectIoAlignment, the
+    // partial block before it is read back, which requires the fd to be
+    // readable (O_RDWR).
+    //
+    // O_APPEND is removed from the fd flags because it would prevent
+    // rewriting the partial last block. Appending still starts at the end of
+    // the file.
+    //
+    // This is supported only where O_DIRECT is available (Linux).
+    //
+    // Default: false
+    Options& set_direct_io(bool direct_io) & {
+      direct_io_ = direct_io;
+      return *this;
+    }
+    Options&& set_direct_io(bool direct_io) && {
+      return std::move(set_direct_io(direct_io));
+    }
+
+    // If positive, whenever another writeback_size bytes are written to the
+    // fd, writeback of these bytes to the device is started in the background
+    // with sync_file_range(), without waiting for its completion. This keeps
+    // the amount of dirty data small, so that Flush(FlushType::kFromMachine)
+    // takes time proportional to the data written since the last writeback
+    // instead of stalling on all data written since the last Flush().
+    // Flush(FlushType::kFromMachine) then uses fdatasync() instead of fsync(),
+    // which skips syncing metadata not needed to read the data back.
+    //
+    // Background writeback is supported only where sync_file_range() is
+    // available (Linux), and is skipped elsewhere.
+    //
+    // Default: 0 (disabled)
+    Options& set_writeback_size(Position writeback_size) & {
+      writeback_size_ = writeback_size;
+      return *this;
+    }
+    Options&& set_writeback_size(Position writeback_size) && {
+      return std::move(set_writeback_size(writeback_size));
+    }
+
+    // If positive, writes to the fd are performed asynchronously by a
+    // background thread, in order, with at most max_pending_writes of them in
+    // flight. Filling the next buffer then overlaps with writing the previous
+    // ones, and the writer blocks only when max_pending_writes writes are
+    // pending, or in Flush(), Close(), Seek(), Size(), and Truncate().
+    //
+    // Written data are copied to the pending write, so this costs memory for
+    // up to max_pending_writes buffers, and an extra memcpy. An error of an
+    // asynchronous write is reported by a later operation.
+    //
+    // Default: 0 (synchronous writes)
+    Options& set_max_pending_writes(size_t max_pending_writes) & {
+      max_pending_writes_ = max_pending_writes;
+      return *this;
+    }
+    Options&& set_max_pending_writes(size_t max_pending_writes) && {
+      return std::move(set_max_pending_writes(max_pending_writes));
+    }
+
    private:
     template <typename Dest>
     friend class FdWriter;
@@ -127,32 +205,191 @@ class FdWriterBase : public internal::FdWriterCommon {
     mode_t permissions_ = 0666;
     absl::optional<Position> initial_pos_;
     size_t buffer_size_ = kDefaultBufferSize;
+    bool direct_io_ = false;
+    Position writeback_size_ = 0;
+    size_t max_pending_writes_ = 0;
   };
 
+  // Alignment of memory, file positions, and lengths used with
+  // Options::set_direct_io().
+  static constexpr size_t kDirectIoAlignment = size_t{4} << 10;
+
   bool Flush(FlushType flush_type) override;
   bool SupportsRandomAccess() const override { return true; }
   bool Size(Position* size) override;
   bool SupportsTruncate() const override { return true; }
   bool Truncate(Position new_size) override;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   FdWriterBase() noexcept {}
 
-  explicit FdWriterBase(size_t buffer_size, bool sync_pos)
-      : FdWriterCommon(buffer_size), sync_pos_(sync_pos) {}
+  explicit FdWriterBase(size_t buffer_size, bool sync_pos, bool direct_io,
+                        Position writeback_size, size_t max_pending_writes)
+      : FdWriterCommon(buffer_size),
+        buffer_size_(buffer_size),
+        sync_pos_(sync_pos),
+        direct_io_(direct_io),
+        writeback_size_(writeback_size),
+        max_pending_writes_(max_pending_writes),
+        direct_buffer_(nullptr,
+                       DirectBufferDeleter{
+                           direct_io ? RoundUp<kDirectIoAlignment>(buffer_size)
+                                     : 0}) {}
 
   FdWriterBase(FdWriterBase&& that) noexcept;
   FdWriterBase& operator=(FdWriterBase&& that) noexcept;
 
+  // Returns flags to be passed to open() when Options::set_direct_io() is
+  // used.
+  static int DirectIoFlags(int flags);
+
+  void Done() override;
   void Initialize(absl::optional<Position> initial_pos, int dest);
   void Initialize(absl::optional<Position> initial_pos, int flags, int dest);
   bool SyncPos(int dest);
+  // Waits until asynchronous writes complete.
+  bool WaitForPendingWrites();
+  // Writes the partial last block staged for direct I/O, padded to
+  // kDirectIoAlignment, and keeps it staged for subsequent writes.
+  //
+  // Precondition: written_to_buffer() == 0
+  bool WriteDirectTail(int dest);
   bool WriteInternal(absl::string_view src) override;
   bool SeekSlow(Position new_pos) override;
 
+  // The size of the buffer of BufferedWriter, which bounds the size of
+  // buffers of pending writes kept for reuse.
+  size_t buffer_size_ = 0;
   bool sync_pos_ = false;
+  bool direct_io_ = false;
+  Position writeback_size_ = 0;
+  // If writeback_size_ > 0, the position up to which background writeback was
+  // started, or the position of the last Seek() or Truncate() rounded down to
+  // a multiple of writeback_size_.
+  Position writeback_pos_ = 0;
+  size_t max_pending_writes_ = 0;
 
   // Invariant: start_pos_ <= numeric_limits<off_t>::max()
+
+ private:
+  class PendingWrites;
+
+  struct DirectBufferDeleter {
+    void operator()(char* ptr) const {
+      DeleteAligned<char, kDirectIoAlignment>(ptr, size);
+    }
+    size_t size;
+  };
+
+  void InitializeDirectIo(int dest);
+  // Reads the partial block before start_pos_ into direct_buffer_.
+  bool LoadDirectTail(int dest);
+  bool WriteDirect(absl::string_view src, int dest);
+  // Starts background writeback of whole writeback_size_ ranges written since
+  // writeback_pos_.
+  bool StartWriteback(int dest);
+  // Sets writeback_pos_ after changing start_pos_ other than by writing.
+  void ResetWriteback();
+  // Writes src at *pos, incrementing *pos by the length written.
+  bool WriteToFd(absl::string_view src, Position* pos, int dest);
+
+  // If direct_io_, data which are logically written but not yet written to
+  // the fd in whole aligned blocks, starting at a kDirectIoAlignment boundary
+  // and ending at start_pos_. The size of the allocated buffer is a multiple
+  // of kDirectIoAlignment, stored in the deleter, and allocation is deferred
+  // to Initialize().
+  std::unique_ptr<char, DirectBufferDeleter> direct_buffer_{
+      nullptr, DirectBufferDeleter{0}};
+  // Invariant:
+  //   direct_buffered_ < direct_buffer_.get_deleter().size
+  //   start_pos_ - direct_buffered_ is a multiple of kDirectIoAlignment
+  //       if direct_io_ && healthy()
+  size_t direct_buffered_ = 0;
+  // If max_pending_writes_ > 0 and the fd is open, writes to a dup() of the
+  // fd in a background thread.
+  std::unique_ptr<PendingWrites> pending_writes_;
+};
+
+// Writes to a fd in a background thread, in the order of scheduling.
+class FdWriterBase::PendingWrites {
+ public:
+  // Takes ownership of dest.
+  //
+  // Buffers of completed writes are kept for reuse if they are not larger
+  // than max_buffer_size, up to max_pending_writes of them.
+  explicit PendingWrites(int dest, size_t max_pending_writes,
+                         size_t max_buffer_size);
+
+  PendingWrites(const PendingWrites&) = delete;
+  PendingWrites& operator=(const PendingWrites&) = delete;
+
+  // Waits until scheduled operations complete, then closes the fd.
+  ~PendingWrites();
+
+  // Schedules writing a copy of src at pos.
+  //
+  // Blocks while max_pending_writes operations are pending.
+  //
+  // Return values:
+  //  * true  - success
+  //  * false - an earlier operation failed (errno and failed_operation()
+  //            describe the failure)
+  bool Write(absl::string_view src, Position pos);
+
+  // Schedules starting writeback of length bytes at pos with
+  // sync_file_range().
+  //
+  // Return values are as for Write().
+  bool StartWriteback(Position pos, Position length);
+
+  // Waits until scheduled operations complete.
+  //
+  // Return values are as for Write().
+  bool Wait();
+
+  absl::string_view failed_operation() const;
+
+  // Registers buffers of pending writes with MemoryEstimator.
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const;
+
+ private:
+  struct Operation {
+    Position pos;
+    Position length;
+    // Data to pwrite(), or nullptr for sync_file_range().
+    std::unique_ptr<char, DirectBufferDeleter> data;
+  };
+
+  bool HasCapacity() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool Finished() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool Schedule(Operation operation) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Keeps the buffer of a completed write for reuse if it fits the limits.
+  void RecycleBuffer(std::unique_ptr<char, DirectBufferDeleter> buffer)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Performs the operation. Returns the name of the failed function with
+  // errno set, or nullptr on success.
+  const char* Perform(const Operation& operation);
+
+  const int dest_;
+  const size_t max_pending_writes_;
+  const size_t max_buffer_size_;
+  mutable absl::Mutex mutex_;
+  // Scheduled operations. The front operation is being performed by the
+  // background thread if it is running.
+  std::deque<Operation> operations_ GUARDED_BY(mutex_);
+  bool exiting_ GUARDED_BY(mutex_) = false;
+  bool exited_ GUARDED_BY(mutex_) = false;
+  // Buffers of completed writes, for reuse.
+  //
+  // Invariants:
+  //   free_buffers_.size() <= max_pending_writes_
+  //   each buffer size <= max_buffer_size_
+  std::vector<std::unique_ptr<char, DirectBufferDeleter>> free_buffers_
+      GUARDED_BY(mutex_);
+  // errno value of the first failed operation, or 0 if none.
+  int error_code_ GUARDED_BY(mutex_) = 0;
+  const char* failed_operation_ GUARDED_BY(mutex_) = "";
 };
 
 // Template parameter invariant part of FdStreamWriter.
@@ -233,13 +470,23 @@ class FdStreamWriterBase : public internal::FdWriterCommon {
 //
 // The fd should support:
 //  * fcntl()     - for the constructor from fd
-//                  unless Options::set_initial_pos(pos)
-//  * close()     - if the fd is owned
+//                  unless Options::set_initial_pos(pos),
+//                  or for Options::set_direct_io()
+//  * close()     - if the fd is owned,
+//                  or for Options::set_max_pending_writes()
+//  * dup()       - for Options::set_max_pending_writes()
 //  * pwrite()
+//  * pread()     - for Options::set_direct_io() unless writing starts at an
+//                  aligned position
 //  * lseek()     - unless Options::set_initial_pos(pos)
-//  * fstat()     - for Seek(), Size(), or Truncate()
+//  * fstat()     - for Seek(), Size(), or Truncate(),
+//                  or for Flush() or Close() with Options::set_direct_io()
 //  * fsync()     - for Flush(FlushType::kFromMachine)
-//  * ftruncate() - for Truncate()
+//                  unless Options::set_writeback_size()
+//  * fdatasync() - for Flush(FlushType::kFromMachine)
+//                  with Options::set_writeback_size()
+//  * sync_file_range() - for Options::set_writeback_size()
+//  * ftruncate() - for Truncate(), or with Options::set_direct_io()
 //
 // The Dest template parameter specifies the type of the object providing and
 // possibly owning the fd being written to. Dest must support
@@ -368,11 +615,27 @@ inline FdWriterCommon& FdWriterCommon::operator=(
 
 inline FdWriterBase::FdWriterBase(FdWriterBase&& that) noexcept
     : FdWriterCommon(std::move(that)),
-      sync_pos_(absl::exchange(that.sync_pos_, false)) {}
+      buffer_size_(absl::exchange(that.buffer_size_, 0)),
+      sync_pos_(absl::exchange(that.sync_pos_, false)),
+      direct_io_(absl::exchange(that.direct_io_, false)),
+      writeback_size_(absl::exchange(that.writeback_size_, 0)),
+      writeback_pos_(absl::exchange(that.writeback_pos_, 0)),
+      max_pending_writes_(absl::exchange(that.max_pending_writes_, 0)),
+      direct_buffer_(std::move(that.direct_buffer_)),
+      direct_buffered_(absl::exchange(that.direct_buffered_, 0)),
+      pending_writes_(std::move(that.pending_writes_)) {}
 
 inline FdWriterBase& FdWriterBase::operator=(FdWriterBase&& that) noexcept {
   FdWriterCommon::operator=(std::move(that));
+  buffer_size_ = absl::exchange(that.buffer_size_, 0);
   sync_pos_ = absl::exchange(that.sync_pos_, false);
+  direct_io_ = absl::exchange(that.direct_io_, false);
+  writeback_size_ = absl::exchange(that.writeback_size_, 0);
+  writeback_pos_ = absl::exchange(that.writeback_pos_, 0);
+  max_pending_writes_ = absl::exchange(that.max_pending_writes_, 0);
+  direct_buffer_ = std::move(that.direct_buffer_);
+  direct_buffered_ = absl::exchange(that.direct_buffered_, 0);
+  pending_writes_ = std::move(that.pending_writes_);
   return *this;
 }
 
@@ -388,7 +651,9 @@ inline FdStreamWriterBase& FdStreamWriterBase::operator=(
 
 template <typename Dest>
 FdWriter<Dest>::FdWriter(type_identity_t<Dest> dest, Options options)
-    : FdWriterBase(options.buffer_size_, !options.initial_pos_.has_value()),
+    : FdWriterBase(options.buffer_size_, !options.initial_pos_.has_value(),
+                   options.direct_io_, options.writeback_size_,
+                   options.max_pending_writes_),
       dest_(std::move(dest)) {
   RIEGELI_ASSERT_GE(dest_.ptr(), 0)
       << "Failed precondition of FdWriter<Dest>::FdWriter(Dest): "
@@ -399,12 +664,15 @@ FdWriter<Dest>::FdWriter(type_identity_t<Dest> dest, Options options)
 
 template <typename Dest>
 FdWriter<Dest>::FdWriter(absl::string_view filename, int flags, Options options)
-    : FdWriterBase(options.buffer_size_, !options.initial_pos_.has_value()) {
+    : FdWriterBase(options.buffer_size_, !options.initial_pos_.has_value(),
+                   options.direct_io_, options.writeback_size_,
+                   options.max_pending_writes_) {
   RIEGELI_ASSERT((flags & O_ACCMODE) == O_WRONLY ||
                  (flags & O_ACCMODE) == O_RDWR)
       << "Failed precondition of FdWriter::FdWriter(string_view): "
          "flags must include O_WRONLY or O_RDWR";
-  const int dest = OpenFd(filename, flags, options.permissions_);
+  const int dest = OpenFd(filename, direct_io_ ? DirectIoFlags(flags) : flags,
+                          options.permissions_);
   if (ABSL_PREDICT_FALSE(dest < 0)) return;
   dest_ = Dependency<int, Dest>(Dest(dest));
   Initialize(options.initial_pos_, flags, dest_.ptr());
@@ -423,7 +691,11 @@ inline FdWriter<Dest>& FdWriter<Dest>::operator=(FdWriter&& that) noexcept {
 
 template <typename Dest>
 void FdWriter<Dest>::Done() {
-  if (ABSL_PREDICT_TRUE(PushInternal())) SyncPos(dest_.ptr());
+  if (ABSL_PREDICT_TRUE(PushInternal()) &&
+      ABSL_PREDICT_TRUE(WaitForPendingWrites()) &&
+      ABSL_PREDICT_TRUE(WriteDirectTail(dest_.ptr()))) {
+    SyncPos(dest_.ptr());
+  }
   FdWriterBase::Done();
   if (dest_.is_owning() && dest_.ptr() >= 0) {
     const int dest = dest_.Release();
@@ -0,0 +1,181 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Write-then-read tests of FdWriter with direct I/O, background writeback,
+// and asynchronous writes, alone and combined. Each test writes data with
+// several sets of options and checks that FdReader reads back exactly the
+// same data.
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+namespace {
+
+std::string TempFilename(absl::string_view name) {
+  const char* const dir = getenv("TEST_TMPDIR");
+  return absl::StrCat(dir == nullptr ? "/tmp" : dir, "/fd_writer_test_",
+                      getpid(), "_", name);
+}
+
+// Returns true if the file system of filename supports O_DIRECT, which e.g.
+// tmpfs does not.
+bool SupportsDirectIo(const std::string& filename) {
+#ifdef O_DIRECT
+  const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_DIRECT, 0666);
+  if (fd < 0) return false;
+  close(fd);
+  unlink(filename.c_str());
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::string ReadFile(const std::string& filename) {
+  FdReader<> reader(filename, O_RDONLY);
+  std::string contents;
+  RIEGELI_CHECK(ReadAll(&reader, &contents))
+      << "Reading " << filename << " failed: " << reader.message();
+  RIEGELI_CHECK(reader.Close()) << reader.message();
+  return contents;
+}
+
+struct Config {
+  bool direct_io;
+  Position writeback_size;
+  size_t max_pending_writes;
+};
+
+std::string Describe(const Config& config) {
+  return absl::StrCat("direct_io: ", config.direct_io,
+                      ", writeback_size: ", config.writeback_size,
+                      ", max_pending_writes: ", config.max_pending_writes);
+}
+
+FdWriterBase::Options MakeOptions(const Config& config) {
+  return FdWriterBase::Options()
+      .set_direct_io(config.direct_io)
+      .set_writeback_size(config.writeback_size)
+      .set_max_pending_writes(config.max_pending_writes);
+}
+
+// Writes pieces of varying sizes, some larger than the buffer, flushing
+// occasionally and checking that flushed data are visible in the file.
+void TestWrite(const std::string& filename, const Config& config) {
+  const std::string description = Describe(config);
+  std::string expected;
+  {
+    // The buffer size is not a multiple of the direct I/O alignment.
+    FdWriter<> writer(filename, O_WRONLY | O_CREAT | O_TRUNC,
+                      MakeOptions(config).set_buffer_size(10000));
+    RIEGELI_CHECK(writer.healthy()) << description << ": " << writer.message();
+    for (int i = 0; i < 3000; ++i) {
+      const std::string piece =
+          i % 500 == 499 ? std::string(30000 + i, 'z')
+                         : absl::StrCat(i, std::string(i % 37, 'a' + i % 26));
+      expected.append(piece);
+      RIEGELI_CHECK(writer.Write(piece))
+          << description << ": " << writer.message();
+      if (i % 997 == 0) {
+        RIEGELI_CHECK(writer.Flush(FlushType::kFromProcess))
+            << description << ": " << writer.message();
+        RIEGELI_CHECK(ReadFile(filename) == expected)
+            << description << ": contents differ after Flush() at " << i;
+      }
+    }
+    RIEGELI_CHECK(writer.Flush(FlushType::kFromMachine))
+        << description << ": " << writer.message();
+    RIEGELI_CHECK_EQ(writer.pos(), expected.size()) << description;
+    RIEGELI_CHECK(writer.Close()) << description << ": " << writer.message();
+  }
+  RIEGELI_CHECK(ReadFile(filename) == expected)
+      << description << ": contents differ";
+
+  // Append to the file, whose end is not aligned, then overwrite some data
+  // after Seek(). O_APPEND is not used because it makes pwrite() ignore the
+  // position on Linux.
+  {
+    FdWriter<> writer(filename, O_RDWR,
+                      MakeOptions(config).set_initial_pos(expected.size()));
+    RIEGELI_CHECK(writer.healthy()) << description << ": " << writer.message();
+    RIEGELI_CHECK_EQ(writer.pos(), expected.size()) << description;
+    RIEGELI_CHECK(writer.Write("appended"))
+        << description << ": " << writer.message();
+    expected.append("appended");
+    RIEGELI_CHECK(writer.Seek(3)) << description << ": " << writer.message();
+    RIEGELI_CHECK(writer.Write("XY"))
+        << description << ": " << writer.message();
+    expected.replace(3, 2, "XY");
+    RIEGELI_CHECK(writer.Close()) << description << ": " << writer.message();
+  }
+  RIEGELI_CHECK(ReadFile(filename) == expected)
+      << description << ": contents differ after appending";
+  unlink(filename.c_str());
+}
+
+// An asynchronous write which fails is reported by a later operation.
+void TestAsyncWriteFailure(const std::string& filename) {
+  {
+    FdWriter<> writer(filename, O_WRONLY | O_CREAT | O_TRUNC);
+    RIEGELI_CHECK(writer.Close()) << writer.message();
+  }
+  // Writing to a read-only fd fails in the background thread.
+  FdWriter<> writer(
+      open(filename.c_str(), O_RDONLY),
+      FdWriterBase::Options().set_initial_pos(0).set_max_pending_writes(2));
+  RIEGELI_CHECK(writer.healthy()) << writer.message();
+  bool failed = false;
+  const std::string piece(100000, 'x');
+  for (int i = 0; i < 10 && !failed; ++i) {
+    failed = !writer.Write(piece);
+  }
+  if (!failed) failed = !writer.Close();
+  RIEGELI_CHECK(failed) << "Failure of an asynchronous write was not reported";
+  RIEGELI_CHECK(!writer.healthy());
+  unlink(filename.c_str());
+}
+
+}  // namespace
+}  // namespace riegeli
+
+int main() {
+  const std::string filename = riegeli::TempFilename("file");
+  std::vector<bool> direct_io_values = {false};
+  if (riegeli::SupportsDirectIo(filename)) direct_io_values.push_back(true);
+  for (const bool direct_io : direct_io_values) {
+    for (const riegeli::Position writeback_size :
+         {riegeli::Position{0}, riegeli::Position{8192}}) {
+      for (const size_t max_pending_writes :
+           {size_t{0}, size_t{1}, size_t{3}}) {
+        riegeli::TestWrite(filename,
+                           {direct_io, writeback_size, max_pending_writes});
+      }
+    }
+  }
+  riegeli::TestAsyncWriteFailure(filename);
+  return 0;
+}
@@ -25,6 +25,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 
@@ -121,6 +122,7 @@ class LimitingBackwardWriter : public LimitingBackwardWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   BackwardWriter* dest_writer() override { return dest_.ptr(); }
   const BackwardWriter* dest_writer() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -221,6 +223,13 @@ void LimitingBackwardWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+void LimitingBackwardWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  LimitingBackwardWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class LimitingBackwardWriter<BackwardWriter*>;
 extern template class LimitingBackwardWriter<std::unique_ptr<BackwardWriter>>;
 
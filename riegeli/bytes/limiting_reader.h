@@ -25,6 +25,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
@@ -122,6 +123,7 @@ class LimitingReader : public LimitingReaderBase {
   const Src& src() const { return src_.manager(); }
   Reader* src_reader() override { return src_.ptr(); }
   const Reader* src_reader() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -254,6 +256,13 @@ void LimitingReader<Src>::VerifyEnd() {
   }
 }
 
+template <typename Src>
+void LimitingReader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  LimitingReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
 extern template class LimitingReader<Reader*>;
 extern template class LimitingReader<std::unique_ptr<Reader>>;
 
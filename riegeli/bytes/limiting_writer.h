@@ -25,6 +25,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 
@@ -123,6 +124,7 @@ class LimitingWriter : public LimitingWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   Writer* dest_writer() override { return dest_.ptr(); }
   const Writer* dest_writer() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -218,6 +220,13 @@ void LimitingWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+void LimitingWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  LimitingWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class LimitingWriter<Writer*>;
 extern template class LimitingWriter<std::unique_ptr<Writer>>;
 
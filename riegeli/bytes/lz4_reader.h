@@ -0,0 +1,198 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_LZ4_READER_H_
+#define RIEGELI_BYTES_LZ4_READER_H_
+
+#include <stddef.h>
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/utility/utility.h"
+#include "lz4frame.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/recycling_pool.h"
+#include "riegeli/bytes/buffered_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of Lz4Reader.
+class Lz4ReaderBase : public BufferedReader {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Tunes how much data is buffered after calling the decompression engine.
+    //
+    // Default: 64K
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "Lz4ReaderBase::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+   private:
+    template <typename Src>
+    friend class Lz4Reader;
+
+    size_t buffer_size_ = kDefaultBufferSize;
+  };
+
+  // Returns the compressed Reader. Unchanged by Close().
+  virtual Reader* src_reader() = 0;
+  virtual const Reader* src_reader() const = 0;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
+ protected:
+  Lz4ReaderBase() noexcept {}
+
+  explicit Lz4ReaderBase(size_t buffer_size) noexcept
+      : BufferedReader(buffer_size) {}
+
+  Lz4ReaderBase(Lz4ReaderBase&& that) noexcept;
+  Lz4ReaderBase& operator=(Lz4ReaderBase&& that) noexcept;
+
+  void Initialize(Reader* src);
+  void Done() override;
+  bool PullSlow() override;
+  bool ReadInternal(char* dest, size_t min_length, size_t max_length) override;
+
+ private:
+  struct LZ4F_dctxDeleter {
+    void operator()(LZ4F_dctx* ptr) const {
+      LZ4F_freeDecompressionContext(ptr);
+    }
+  };
+
+  // LZ4F_dctx objects are reused across Lz4Reader objects.
+  using DCtxPool = RecyclingPool<LZ4F_dctx, LZ4F_dctxDeleter>;
+
+  // If true, the source is truncated (without a clean end of the compressed
+  // stream) at the current position. If the source does not grow, Close() will
+  // fail.
+  bool truncated_ = false;
+  // If healthy() but decompressor_ == nullptr then all data have been
+  // decompressed. In this case LZ4F_decompress() must not be called again.
+  // decompressor_ is returned to DCtxPool::global() when no longer needed.
+  DCtxPool::Handle decompressor_;
+};
+
+// A Reader which decompresses data with LZ4 (frame format) after getting it
+// from another Reader.
+//
+// The Src template parameter specifies the type of the object providing and
+// possibly owning the compressed Reader. Src must support
+// Dependency<Reader*, Src>, e.g. Reader* (not owned, default),
+// unique_ptr<Reader> (owned), ChainReader<> (owned).
+//
+// The compressed Reader must not be accessed until the Lz4Reader is closed or
+// no longer used.
+template <typename Src = Reader*>
+class Lz4Reader : public Lz4ReaderBase {
+ public:
+  // Creates a closed Lz4Reader.
+  Lz4Reader() noexcept {}
+
+  // Will read from the compressed Reader provided by src.
+  explicit Lz4Reader(Src src, Options options = Options());
+
+  Lz4Reader(Lz4Reader&& that) noexcept;
+  Lz4Reader& operator=(Lz4Reader&& that) noexcept;
+
+  // Returns the object providing and possibly owning the compressed Reader.
+  // Unchanged by Close().
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  Reader* src_reader() override { return src_.ptr(); }
+  const Reader* src_reader() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
+ protected:
+  void Done() override;
+  void VerifyEnd() override;
+
+ private:
+  // The object providing and possibly owning the compressed Reader.
+  Dependency<Reader*, Src> src_;
+};
+
+// Implementation details follow.
+
+inline Lz4ReaderBase::Lz4ReaderBase(Lz4ReaderBase&& that) noexcept
+    : BufferedReader(std::move(that)),
+      truncated_(absl::exchange(that.truncated_, false)),
+      decompressor_(std::move(that.decompressor_)) {}
+
+inline Lz4ReaderBase& Lz4ReaderBase::operator=(Lz4ReaderBase&& that) noexcept {
+  BufferedReader::operator=(std::move(that));
+  truncated_ = absl::exchange(that.truncated_, false);
+  decompressor_ = std::move(that.decompressor_);
+  return *this;
+}
+
+template <typename Src>
+Lz4Reader<Src>::Lz4Reader(Src src, Options options)
+    : Lz4ReaderBase(options.buffer_size_), src_(std::move(src)) {
+  Initialize(src_.ptr());
+}
+
+template <typename Src>
+inline Lz4Reader<Src>::Lz4Reader(Lz4Reader&& that) noexcept
+    : Lz4ReaderBase(std::move(that)), src_(std::move(that.src_)) {}
+
+template <typename Src>
+inline Lz4Reader<Src>& Lz4Reader<Src>::operator=(Lz4Reader&& that) noexcept {
+  Lz4ReaderBase::operator=(std::move(that));
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+void Lz4Reader<Src>::Done() {
+  Lz4ReaderBase::Done();
+  if (src_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!src_->Close())) Fail(*src_);
+  }
+}
+
+template <typename Src>
+void Lz4Reader<Src>::VerifyEnd() {
+  Lz4ReaderBase::VerifyEnd();
+  if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) src_->VerifyEnd();
+}
+
+template <typename Src>
+void Lz4Reader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Lz4ReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
+extern template class Lz4Reader<Reader*>;
+extern template class Lz4Reader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_LZ4_READER_H_
@@ -0,0 +1,179 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/lz4_writer.h"
+
+#include <stddef.h>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "lz4.h"
+#include "lz4frame.h"
+#include "lz4hc.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/recycling_pool.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// Before C++17 if a constexpr static data member is ODR-used, its definition at
+// namespace scope is required. Since C++17 these definitions are deprecated:
+// http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+constexpr int Lz4WriterBase::Options::kMinCompressionLevel;
+constexpr int Lz4WriterBase::Options::kMaxCompressionLevel;
+constexpr int Lz4WriterBase::Options::kDefaultCompressionLevel;
+constexpr size_t Lz4WriterBase::kMaxSliceSize;
+#endif
+
+void Lz4WriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(PushInternal())) {
+    Writer* const dest = dest_writer();
+    RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+        << "BufferedWriter::PushInternal() did not empty the buffer";
+    if (ABSL_PREDICT_TRUE(EnsureCCtxStarted(dest))) {
+      WriteCompressed(
+          LZ4F_compressEnd(compressor_.get(), compressed_buffer_.GetData(),
+                           compressed_buffer_.size(), nullptr),
+          "LZ4F_compressEnd()", dest);
+    }
+  }
+  compressor_.reset();
+  BufferedWriter::Done();
+}
+
+inline LZ4F_preferences_t Lz4WriterBase::Preferences() const {
+  LZ4F_preferences_t preferences;
+  std::memset(&preferences, 0, sizeof(preferences));
+  preferences.compressionLevel = compression_level_;
+  // Data are passed to LZ4F_compressUpdate() in slices of at most
+  // kMaxSliceSize, so there is no point in buffering them again inside LZ4.
+  preferences.autoFlush = 1;
+  return preferences;
+}
+
+inline bool Lz4WriterBase::EnsureCCtxStarted(Writer* dest) {
+  if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
+    size_t result = 0;
+    compressor_ = CCtxPool::global().Get(compression_level_, [&result] {
+      LZ4F_cctx* compressor = nullptr;
+      result = LZ4F_createCompressionContext(&compressor, LZ4F_VERSION);
+      if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) compressor = nullptr;
+      return std::unique_ptr<LZ4F_cctx, LZ4F_cctxDeleter>(compressor);
+    });
+    if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
+      return Fail(absl::StrCat("LZ4F_createCompressionContext() failed: ",
+                               LZ4F_getErrorName(result)));
+    }
+    // LZ4F_compressBegin() starts a new frame, discarding any state left in a
+    // LZ4F_cctx reused from CCtxPool.
+    const LZ4F_preferences_t preferences = Preferences();
+    compressed_buffer_ = Buffer(UnsignedMax(
+        size_t{LZ4F_HEADER_SIZE_MAX},
+        LZ4F_compressBound(kMaxSliceSize, &preferences)));
+    return WriteCompressed(
+        LZ4F_compressBegin(compressor_.get(), compressed_buffer_.GetData(),
+                           compressed_buffer_.size(), &preferences),
+        "LZ4F_compressBegin()", dest);
+  }
+  return true;
+}
+
+inline bool Lz4WriterBase::WriteCompressed(size_t result,
+                                           absl::string_view function_name,
+                                           Writer* dest) {
+  if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+    return Fail(
+        absl::StrCat(function_name, " failed: ", LZ4F_getErrorName(result)));
+  }
+  if (result > 0) {
+    if (ABSL_PREDICT_FALSE(!dest->Write(
+            absl::string_view(compressed_buffer_.GetData(), result)))) {
+      return Fail(*dest);
+    }
+  }
+  return true;
+}
+
+bool Lz4WriterBase::WriteInternal(absl::string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+      << message();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not empty";
+  Writer* const dest = dest_writer();
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - limit_pos())) {
+    return FailOverflow();
+  }
+  if (ABSL_PREDICT_FALSE(!EnsureCCtxStarted(dest))) return false;
+  do {
+    const size_t length = UnsignedMin(src.size(), kMaxSliceSize);
+    if (ABSL_PREDICT_FALSE(!WriteCompressed(
+            LZ4F_compressUpdate(compressor_.get(), compressed_buffer_.GetData(),
+                                compressed_buffer_.size(), src.data(), length,
+                                nullptr),
+            "LZ4F_compressUpdate()", dest))) {
+      return false;
+    }
+    start_pos_ += length;
+    src.remove_prefix(length);
+  } while (!src.empty());
+  return true;
+}
+
+bool Lz4WriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  Writer* const dest = dest_writer();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "BufferedWriter::PushInternal() did not empty the buffer";
+  if (ABSL_PREDICT_FALSE(!EnsureCCtxStarted(dest))) return false;
+  if (ABSL_PREDICT_FALSE(!WriteCompressed(
+          LZ4F_flush(compressor_.get(), compressed_buffer_.GetData(),
+                     compressed_buffer_.size(), nullptr),
+          "LZ4F_flush()", dest))) {
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!dest->Flush(flush_type))) return Fail(*dest);
+  return true;
+}
+
+void Lz4WriterBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  BufferedWriter::RegisterSubobjects(memory_estimator);
+  compressed_buffer_.RegisterSubobjects(memory_estimator);
+  if (compressor_ != nullptr) {
+    // LZ4 does not report the size of a compression context. Its dominant part
+    // is the state of the block compressor.
+    memory_estimator->RegisterDynamicMemory(IntCast<size_t>(
+        compression_level_ < LZ4HC_CLEVEL_MIN ? LZ4_sizeofState()
+                                              : LZ4_sizeofStateHC()));
+  }
+}
+
+template class Lz4Writer<Writer*>;
+template class Lz4Writer<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
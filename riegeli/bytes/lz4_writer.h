@@ -0,0 +1,244 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_LZ4_WRITER_H_
+#define RIEGELI_BYTES_LZ4_WRITER_H_
+
+#include <stddef.h>
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "lz4frame.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/recycling_pool.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of Lz4Writer.
+class Lz4WriterBase : public BufferedWriter {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Tunes the tradeoff between compression density and compression speed
+    // (higher = better density but slower).
+    //
+    // Negative levels select the fast acceleration mode (lower = faster),
+    // level 0 selects the default fast mode, and levels 3 and above select
+    // the high compression mode.
+    //
+    // compression_level must be between kMinCompressionLevel (-32) and
+    // kMaxCompressionLevel (12). Default: kDefaultCompressionLevel (0).
+    static constexpr int kMinCompressionLevel = -32;
+    static constexpr int kMaxCompressionLevel = 12;  // LZ4HC_CLEVEL_MAX
+    static constexpr int kDefaultCompressionLevel = 0;
+    Options& set_compression_level(int compression_level) & {
+      RIEGELI_ASSERT_GE(compression_level, kMinCompressionLevel)
+          << "Failed precondition of "
+             "Lz4WriterBase::Options::set_compression_level(): "
+             "compression level out of range";
+      RIEGELI_ASSERT_LE(compression_level, kMaxCompressionLevel)
+          << "Failed precondition of "
+             "Lz4WriterBase::Options::set_compression_level(): "
+             "compression level out of range";
+      compression_level_ = compression_level;
+      return *this;
+    }
+    Options&& set_compression_level(int level) && {
+      return std::move(set_compression_level(level));
+    }
+
+    // Tunes how much data is buffered before calling the compression engine.
+    //
+    // Default: 64K
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "Lz4WriterBase::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+   private:
+    template <typename Dest>
+    friend class Lz4Writer;
+
+    int compression_level_ = kDefaultCompressionLevel;
+    size_t buffer_size_ = kDefaultBufferSize;
+  };
+
+  // Returns the compressed Writer. Unchanged by Close().
+  virtual Writer* dest_writer() = 0;
+  virtual const Writer* dest_writer() const = 0;
+
+  bool Flush(FlushType flush_type) override;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
+ protected:
+  Lz4WriterBase() noexcept {}
+
+  explicit Lz4WriterBase(int compression_level, size_t buffer_size) noexcept;
+
+  Lz4WriterBase(Lz4WriterBase&& that) noexcept;
+  Lz4WriterBase& operator=(Lz4WriterBase&& that) noexcept;
+
+  void Done() override;
+  bool WriteInternal(absl::string_view src) override;
+
+ private:
+  struct LZ4F_cctxDeleter {
+    void operator()(LZ4F_cctx* ptr) const { LZ4F_freeCompressionContext(ptr); }
+  };
+
+  // LZ4F_cctx objects are reused across Lz4Writer objects with the same
+  // compression_level, because the context of the high compression mode
+  // allocates large tables.
+  using CCtxPool = KeyedRecyclingPool<LZ4F_cctx, int, LZ4F_cctxDeleter>;
+
+  // Length of uncompressed data passed to LZ4F_compressUpdate() at once. This
+  // bounds the size of compressed_buffer_.
+  static constexpr size_t kMaxSliceSize = size_t{64} << 10;
+
+  bool EnsureCCtxStarted(Writer* dest);
+  LZ4F_preferences_t Preferences() const;
+  bool WriteCompressed(size_t result, absl::string_view function_name,
+                       Writer* dest);
+
+  int compression_level_ = 0;
+  // Compressed data are produced here before being written to dest_writer().
+  Buffer compressed_buffer_;
+  // If healthy() but compressor_ == nullptr then compressor_ was not obtained
+  // yet and the frame header was not written yet. It is returned to
+  // CCtxPool::global() by Done().
+  CCtxPool::Handle compressor_;
+};
+
+// A Writer which compresses data with LZ4 (frame format) before passing it to
+// another Writer.
+//
+// LZ4 trades compression density for speed: it is much faster than Zstd or
+// Brotli, and is suitable for short-lived data where throughput matters more
+// than size.
+//
+// The Dest template parameter specifies the type of the object providing and
+// possibly owning the compressed Writer. Dest must support
+// Dependency<Writer*, Dest>, e.g. Writer* (not owned, default),
+// unique_ptr<Writer> (owned), ChainWriter<> (owned).
+//
+// The compressed Writer must not be accessed until the Lz4Writer is closed or
+// no longer used, except that it is allowed to read the destination of the
+// compressed Writer immediately after Flush().
+template <typename Dest = Writer*>
+class Lz4Writer : public Lz4WriterBase {
+ public:
+  // Creates a closed Lz4Writer.
+  Lz4Writer() noexcept {}
+
+  // Will write to the compressed Writer provided by dest.
+  explicit Lz4Writer(Dest dest, Options options = Options());
+
+  Lz4Writer(Lz4Writer&& that) noexcept;
+  Lz4Writer& operator=(Lz4Writer&& that) noexcept;
+
+  // Returns the object providing and possibly owning the compressed Writer.
+  // Unchanged by Close().
+  Dest& dest() { return dest_.manager(); }
+  const Dest& dest() const { return dest_.manager(); }
+  Writer* dest_writer() override { return dest_.ptr(); }
+  const Writer* dest_writer() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
+ protected:
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the compressed Writer.
+  Dependency<Writer*, Dest> dest_;
+};
+
+// Implementation details follow.
+
+inline Lz4WriterBase::Lz4WriterBase(int compression_level,
+                                    size_t buffer_size) noexcept
+    : BufferedWriter(buffer_size), compression_level_(compression_level) {}
+
+inline Lz4WriterBase::Lz4WriterBase(Lz4WriterBase&& that) noexcept
+    : BufferedWriter(std::move(that)),
+      compression_level_(absl::exchange(that.compression_level_, 0)),
+      compressed_buffer_(std::move(that.compressed_buffer_)),
+      compressor_(std::move(that.compressor_)) {}
+
+inline Lz4WriterBase& Lz4WriterBase::operator=(Lz4WriterBase&& that) noexcept {
+  BufferedWriter::operator=(std::move(that));
+  compression_level_ = absl::exchange(that.compression_level_, 0);
+  compressed_buffer_ = std::move(that.compressed_buffer_);
+  compressor_ = std::move(that.compressor_);
+  return *this;
+}
+
+template <typename Dest>
+inline Lz4Writer<Dest>::Lz4Writer(Dest dest, Options options)
+    : Lz4WriterBase(options.compression_level_, options.buffer_size_),
+      dest_(std::move(dest)) {
+  RIEGELI_ASSERT(dest_.ptr() != nullptr)
+      << "Failed precondition of Lz4Writer<Dest>::Lz4Writer(Dest): "
+         "null Writer pointer";
+  if (ABSL_PREDICT_FALSE(!dest_->healthy())) Fail(*dest_);
+}
+
+template <typename Dest>
+inline Lz4Writer<Dest>::Lz4Writer(Lz4Writer&& that) noexcept
+    : Lz4WriterBase(std::move(that)), dest_(std::move(that.dest_)) {}
+
+template <typename Dest>
+inline Lz4Writer<Dest>& Lz4Writer<Dest>::operator=(Lz4Writer&& that) noexcept {
+  Lz4WriterBase::operator=(std::move(that));
+  dest_ = std::move(that.dest_);
+  return *this;
+}
+
+template <typename Dest>
+void Lz4Writer<Dest>::Done() {
+  Lz4WriterBase::Done();
+  if (dest_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!dest_->Close())) Fail(*dest_);
+  }
+}
+
+template <typename Dest>
+void Lz4Writer<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Lz4WriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
+extern template class Lz4Writer<Writer*>;
+extern template class Lz4Writer<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_LZ4_WRITER_H_
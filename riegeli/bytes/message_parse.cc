@@ -20,6 +20,7 @@
 
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
@@ -108,21 +109,17 @@ google::protobuf::int64 ReaderInputStream::ByteCount() const {
   return IntCast<google::protobuf::int64>(relative_pos());
 }
 
-}  // namespace
-
-namespace internal {
-
-bool ParseFromReaderImpl(google::protobuf::MessageLite* dest, Reader* src,
-                         std::string* error_message) {
-  ReaderInputStream input_stream(src);
-  if (ABSL_PREDICT_FALSE(
-          !dest->ParsePartialFromZeroCopyStream(&input_stream))) {
-    if (error_message != nullptr) {
-      *error_message =
-          absl::StrCat("Failed to parse message of type ", dest->GetTypeName());
-    }
-    return false;
+bool ParseFailed(google::protobuf::MessageLite* dest,
+                 std::string* error_message) {
+  if (error_message != nullptr) {
+    *error_message =
+        absl::StrCat("Failed to parse message of type ", dest->GetTypeName());
   }
+  return false;
+}
+
+bool CheckInitialized(google::protobuf::MessageLite* dest,
+                      std::string* error_message) {
   if (ABSL_PREDICT_FALSE(!dest->IsInitialized())) {
     if (error_message != nullptr) {
       *error_message =
@@ -135,6 +132,20 @@ bool ParseFromReaderImpl(google::protobuf::MessageLite* dest, Reader* src,
   return true;
 }
 
+}  // namespace
+
+namespace internal {
+
+bool ParseFromReaderImpl(google::protobuf::MessageLite* dest, Reader* src,
+                         std::string* error_message) {
+  ReaderInputStream input_stream(src);
+  if (ABSL_PREDICT_FALSE(
+          !dest->ParsePartialFromZeroCopyStream(&input_stream))) {
+    return ParseFailed(dest, error_message);
+  }
+  return CheckInitialized(dest, error_message);
+}
+
 }  // namespace internal
 
 bool ParseFromChain(google::protobuf::MessageLite* dest, const Chain& src,
@@ -142,4 +153,17 @@ bool ParseFromChain(google::protobuf::MessageLite* dest, const Chain& src,
   return ParseFromReader(dest, ChainReader<>(&src), error_message);
 }
 
+bool ParseFromString(google::protobuf::MessageLite* dest, absl::string_view src,
+                     std::string* error_message) {
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         size_t{std::numeric_limits<int>::max()})) {
+    return ParseFailed(dest, error_message);
+  }
+  if (ABSL_PREDICT_FALSE(
+          !dest->ParsePartialFromArray(src.data(), IntCast<int>(src.size())))) {
+    return ParseFailed(dest, error_message);
+  }
+  return CheckInitialized(dest, error_message);
+}
+
 }  // namespace riegeli
@@ -19,6 +19,7 @@
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
@@ -50,6 +51,18 @@ bool ParseFromReader(google::protobuf::MessageLite* dest, Src src,
 bool ParseFromChain(google::protobuf::MessageLite* dest, const Chain& src,
                     std::string* error_message = nullptr);
 
+// Reads a message in binary format from the given flat array. Fails if some
+// required fields are missing.
+//
+// This is faster than reading from a Reader or a Chain, because the parser
+// does not need to handle boundaries between fragments of data.
+//
+// Return values:
+//  * true  - success (*dest is filled)
+//  * false - failure (*dest is unspecified, *error_message is set)
+bool ParseFromString(google::protobuf::MessageLite* dest, absl::string_view src,
+                     std::string* error_message = nullptr);
+
 // Implementation details follow.
 
 namespace internal {
@@ -93,12 +93,9 @@ google::protobuf::int64 WriterOutputStream::ByteCount() const {
   return IntCast<google::protobuf::int64>(relative_pos());
 }
 
-}  // namespace
-
-namespace internal {
-
-bool SerializeToWriterImpl(const google::protobuf::MessageLite& src,
-                           Writer* dest, std::string* error_message) {
+// Checks that the message can be serialized, and sets *size to its size.
+bool CheckSerializable(const google::protobuf::MessageLite& src, size_t* size,
+                       std::string* error_message) {
   if (ABSL_PREDICT_FALSE(!src.IsInitialized())) {
     if (error_message != nullptr) {
       *error_message = absl::StrCat("Failed to serialize message of type ",
@@ -108,15 +105,28 @@ bool SerializeToWriterImpl(const google::protobuf::MessageLite& src,
     }
     return false;
   }
-  const size_t size = src.ByteSizeLong();
-  if (ABSL_PREDICT_FALSE(size > size_t{std::numeric_limits<int>::max()})) {
+  *size = src.ByteSizeLong();
+  if (ABSL_PREDICT_FALSE(*size > size_t{std::numeric_limits<int>::max()})) {
     if (error_message != nullptr) {
       *error_message = absl::StrCat(
           "Failed to serialize message of type ", src.GetTypeName(),
-          " because it exceeds maximum protobuf size of 2GB: ", size);
+          " because it exceeds maximum protobuf size of 2GB: ", *size);
     }
     return false;
   }
+  return true;
+}
+
+}  // namespace
+
+namespace internal {
+
+bool SerializeToWriterImpl(const google::protobuf::MessageLite& src,
+                           Writer* dest, std::string* error_message) {
+  size_t size;
+  if (ABSL_PREDICT_FALSE(!CheckSerializable(src, &size, error_message))) {
+    return false;
+  }
   WriterOutputStream output_stream(dest);
   if (ABSL_PREDICT_FALSE(
           !src.SerializePartialToZeroCopyStream(&output_stream))) {
@@ -134,6 +144,23 @@ bool SerializeToWriterImpl(const google::protobuf::MessageLite& src,
 
 }  // namespace internal
 
+bool SerializeToString(const google::protobuf::MessageLite& src,
+                       std::string* dest, std::string* error_message) {
+  size_t size;
+  if (ABSL_PREDICT_FALSE(!CheckSerializable(src, &size, error_message))) {
+    return false;
+  }
+  dest->resize(size);
+  google::protobuf::uint8* const end = src.SerializeWithCachedSizesToArray(
+      reinterpret_cast<google::protobuf::uint8*>(&(*dest)[0]));
+  RIEGELI_ASSERT_EQ(PtrDistance(reinterpret_cast<char*>(&(*dest)[0]),
+                                reinterpret_cast<char*>(end)),
+                    size)
+      << "Failed to serialize message of type " << src.GetTypeName()
+      << ": SerializeWithCachedSizesToArray() wrote an unexpected size";
+  return true;
+}
+
 bool SerializeToChain(const google::protobuf::MessageLite& src, Chain* dest,
                       std::string* error_message) {
   dest->Clear();
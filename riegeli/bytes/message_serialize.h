@@ -50,6 +50,18 @@ bool SerializeToWriter(const google::protobuf::MessageLite& src, Dest dest,
 bool SerializeToChain(const google::protobuf::MessageLite& src, Chain* dest,
                       std::string* error_message = nullptr);
 
+// Writes the message in binary format to the given string, replacing its
+// contents. Fails if some required fields are missing.
+//
+// This is faster than SerializeToWriter() because the destination is flat,
+// and it reuses the capacity of *dest.
+//
+// Return values:
+//  * true  - success
+//  * false - failure (*error_message is set)
+bool SerializeToString(const google::protobuf::MessageLite& src,
+                       std::string* dest, std::string* error_message = nullptr);
+
 // Implementation details follow.
 
 namespace internal {
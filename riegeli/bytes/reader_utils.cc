@@ -16,6 +16,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <cstring>
 #include <string>
 #include <utility>
 
@@ -119,6 +120,47 @@ char* CopyVarint64Slow(Reader* src, char* dest) {
 
 }  // namespace internal
 
+bool ReadVarints64(Reader* src, size_t num_values, uint64_t* dest) {
+  uint64_t* const dest_end = dest + num_values;
+  while (dest != dest_end) {
+    if (ABSL_PREDICT_FALSE(src->available() < kMaxLengthVarint64)) {
+      // Near the end of the buffer read one value at a time, which can pull
+      // more data.
+      if (ABSL_PREDICT_FALSE(!ReadVarint64(src, dest))) return false;
+      ++dest;
+      continue;
+    }
+    // Every value which starts before safe_limit can be read from the buffer
+    // without checking its bounds.
+    const char* cursor = src->cursor();
+    const char* const safe_limit = src->limit() - (kMaxLengthVarint64 - 1);
+    do {
+      if (PtrDistance(cursor, safe_limit) >= sizeof(uint64_t) &&
+          PtrDistance(dest, dest_end) >= sizeof(uint64_t)) {
+        // Check 8 bytes at once: if none of them has the continuation bit
+        // set, they are 8 single-byte values.
+        uint64_t word;
+        std::memcpy(&word, cursor, sizeof(word));
+        if ((word & uint64_t{0x8080808080808080}) == 0) {
+          for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+            dest[i] = static_cast<uint8_t>(cursor[i]);
+          }
+          cursor += sizeof(uint64_t);
+          dest += sizeof(uint64_t);
+          continue;
+        }
+      }
+      if (ABSL_PREDICT_FALSE(!ReadVarint64(&cursor, dest))) {
+        src->set_cursor(cursor);
+        return false;
+      }
+      ++dest;
+    } while (cursor < safe_limit && dest != dest_end);
+    src->set_cursor(cursor);
+  }
+  return true;
+}
+
 bool ReadAll(Reader* src, absl::string_view* dest, std::string* scratch) {
   if (src->SupportsRandomAccess()) {
     Position size;
@@ -15,6 +15,7 @@
 #ifndef RIEGELI_BYTES_READER_UTILS_H_
 #define RIEGELI_BYTES_READER_UTILS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 
@@ -47,6 +48,12 @@ bool ReadVarint64(const char** src, uint64_t* data);
 bool ReadVarint32(Reader* src, uint32_t* data);
 bool ReadVarint64(Reader* src, uint64_t* data);
 
+// Reads num_values consecutive varints to dest[0..num_values).
+//
+// This is equivalent to calling ReadVarint64() num_values times, but is faster
+// when many values are stored together, especially if most of them are small.
+bool ReadVarints64(Reader* src, size_t num_values, uint64_t* dest);
+
 // Variants which accept only the canonical representation, i.e. the shortest:
 // rejecting a trailing zero byte, except for 0 itself.
 bool ReadCanonicalVarint32(Reader* src, uint32_t* data);
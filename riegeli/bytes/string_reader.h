@@ -22,6 +22,7 @@
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/string_view_dependency.h"
@@ -77,6 +78,7 @@ class StringReader : public StringReaderBase {
   Src& src() { return src_.manager(); }
   const Src& src() const { return src_.manager(); }
   absl::string_view src_string_view() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  private:
   void MoveSrc(StringReader&& that);
@@ -135,6 +137,13 @@ inline void StringReader<Src>::MoveSrc(StringReader&& that) {
   }
 }
 
+template <typename Src>
+void StringReader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  StringReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
 extern template class StringReader<absl::string_view>;
 extern template class StringReader<const std::string*>;
 extern template class StringReader<std::string>;
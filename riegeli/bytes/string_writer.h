@@ -23,6 +23,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 
@@ -116,6 +117,7 @@ class StringWriter : public StringWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   std::string* dest_string() override { return dest_.ptr(); }
   const std::string* dest_string() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  private:
   void MoveDest(StringWriter&& that);
@@ -179,6 +181,13 @@ inline void StringWriter<Dest>::MoveDest(StringWriter&& that) {
   }
 }
 
+template <typename Dest>
+void StringWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  StringWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class StringWriter<std::string*>;
 extern template class StringWriter<std::string>;
 
@@ -23,6 +23,7 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "zconf.h"
@@ -49,6 +50,8 @@ void ZlibReaderBase::Initialize(Reader* src, int window_bits) {
     Fail(*src);
     return;
   }
+  // window_bits encodes the header too.
+  window_log_ = (window_bits < 0 ? -window_bits : window_bits) & 15;
   decompressor_.reset(new z_stream());
   if (ABSL_PREDICT_FALSE(inflateInit2(decompressor_.get(), window_bits) !=
                          Z_OK)) {
@@ -132,6 +135,18 @@ bool ZlibReaderBase::ReadInternal(char* dest, size_t min_length,
   }
 }
 
+void ZlibReaderBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  BufferedReader::RegisterSubobjects(memory_estimator);
+  if (decompressor_ != nullptr) {
+    memory_estimator->RegisterDynamicMemory(sizeof(z_stream));
+    // zlib does not report the size of its state. This follows the estimate
+    // from zconf.h, plus the state itself.
+    memory_estimator->RegisterMemory((size_t{1} << window_log_) +
+                                     (size_t{7} << 10));
+  }
+}
+
 template class ZlibReader<Reader*>;
 template class ZlibReader<std::unique_ptr<Reader>>;
 
@@ -25,6 +25,7 @@
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "zconf.h"
@@ -112,6 +113,7 @@ class ZlibReaderBase : public BufferedReader {
   // Returns the compressed Reader. Unchanged by Close().
   virtual Reader* src_reader() = 0;
   virtual const Reader* src_reader() const = 0;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   ZlibReaderBase() noexcept {}
@@ -142,6 +144,8 @@ class ZlibReaderBase : public BufferedReader {
   // stream) at the current position. If the source does not grow, Close() will
   // fail.
   bool truncated_ = false;
+  // Window size used by decompressor_, for RegisterSubobjects().
+  int window_log_ = 0;
   std::unique_ptr<z_stream, ZStreamDeleter> decompressor_;
 };
 
@@ -173,6 +177,7 @@ class ZlibReader : public ZlibReaderBase {
   const Src& src() const { return src_.manager(); }
   Reader* src_reader() override { return src_.ptr(); }
   const Reader* src_reader() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -188,12 +193,14 @@ class ZlibReader : public ZlibReaderBase {
 inline ZlibReaderBase::ZlibReaderBase(ZlibReaderBase&& that) noexcept
     : BufferedReader(std::move(that)),
       truncated_(absl::exchange(that.truncated_, false)),
+      window_log_(absl::exchange(that.window_log_, 0)),
       decompressor_(std::move(that.decompressor_)) {}
 
 inline ZlibReaderBase& ZlibReaderBase::operator=(
     ZlibReaderBase&& that) noexcept {
   BufferedReader::operator=(std::move(that));
   truncated_ = absl::exchange(that.truncated_, false);
+  window_log_ = absl::exchange(that.window_log_, 0);
   decompressor_ = std::move(that.decompressor_);
   return *this;
 }
@@ -232,6 +239,13 @@ void ZlibReader<Src>::VerifyEnd() {
   if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) src_->VerifyEnd();
 }
 
+template <typename Src>
+void ZlibReader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ZlibReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
 extern template class ZlibReader<Reader*>;
 extern template class ZlibReader<std::unique_ptr<Reader>>;
 
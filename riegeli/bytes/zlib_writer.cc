@@ -22,6 +22,7 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "zconf.h"
@@ -52,6 +53,8 @@ void ZlibWriterBase::Initialize(Writer* dest, int compression_level,
     Fail(*dest);
     return;
   }
+  // window_bits encodes the header too.
+  window_log_ = (window_bits < 0 ? -window_bits : window_bits) & 15;
   compressor_.reset(new z_stream());
   if (ABSL_PREDICT_FALSE(deflateInit2(compressor_.get(), compression_level,
                                       Z_DEFLATED, window_bits, 8,
@@ -162,6 +165,19 @@ bool ZlibWriterBase::Flush(FlushType flush_type) {
   return true;
 }
 
+void ZlibWriterBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  BufferedWriter::RegisterSubobjects(memory_estimator);
+  if (compressor_ != nullptr) {
+    memory_estimator->RegisterDynamicMemory(sizeof(z_stream));
+    // zlib does not report the size of its state. This follows the estimate
+    // from zconf.h for memLevel = 8, plus the state itself.
+    memory_estimator->RegisterMemory((size_t{1} << (window_log_ + 2)) +
+                                     (size_t{1} << (8 + 9)) +
+                                     (size_t{6} << 10));
+  }
+}
+
 template class ZlibWriter<Writer*>;
 template class ZlibWriter<std::unique_ptr<Writer>>;
 
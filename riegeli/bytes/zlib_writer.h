@@ -24,6 +24,7 @@
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "zconf.h"
@@ -135,6 +136,7 @@ class ZlibWriterBase : public BufferedWriter {
   virtual const Writer* dest_writer() const = 0;
 
   bool Flush(FlushType flush_type) override;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   ZlibWriterBase() noexcept {}
@@ -162,6 +164,8 @@ class ZlibWriterBase : public BufferedWriter {
   ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
   bool WriteInternal(absl::string_view src, Writer* dest, int flush);
 
+  // Window size used by compressor_, for RegisterSubobjects().
+  int window_log_ = 0;
   std::unique_ptr<z_stream, ZStreamDeleter> compressor_;
 };
 
@@ -193,6 +197,7 @@ class ZlibWriter : public ZlibWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   Writer* dest_writer() override { return dest_.ptr(); }
   const Writer* dest_writer() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -206,11 +211,13 @@ class ZlibWriter : public ZlibWriterBase {
 
 inline ZlibWriterBase::ZlibWriterBase(ZlibWriterBase&& that) noexcept
     : BufferedWriter(std::move(that)),
+      window_log_(absl::exchange(that.window_log_, 0)),
       compressor_(std::move(that.compressor_)) {}
 
 inline ZlibWriterBase& ZlibWriterBase::operator=(
     ZlibWriterBase&& that) noexcept {
   BufferedWriter::operator=(std::move(that));
+  window_log_ = absl::exchange(that.window_log_, 0);
   compressor_ = std::move(that.compressor_);
   return *this;
 }
@@ -244,6 +251,13 @@ void ZlibWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+void ZlibWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ZlibWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class ZlibWriter<Writer*>;
 extern template class ZlibWriter<std::unique_ptr<Writer>>;
 
@@ -19,10 +19,13 @@
 
 #include <stddef.h>
 #include <limits>
+#include <memory>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "zstd.h"
@@ -37,12 +40,17 @@ void ZstdReaderBase::Initialize(Reader* src) {
     Fail(*src);
     return;
   }
-  decompressor_.reset(ZSTD_createDStream());
+  decompressor_ = DStreamPool::global().Get([] {
+    return std::unique_ptr<ZSTD_DStream, ZSTD_DStreamDeleter>(
+        ZSTD_createDStream());
+  });
   if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) {
     Fail("ZSTD_createDStream() failed");
     return;
   }
   {
+    // A ZSTD_DStream reused from DStreamPool might contain state left from a
+    // previous stream; ZSTD_initDStream() resets it.
     const size_t result = ZSTD_initDStream(decompressor_.get());
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
       Fail(absl::StrCat("ZSTD_initDStream() failed: ",
@@ -62,6 +70,7 @@ void ZstdReaderBase::Initialize(Reader* src) {
 
 void ZstdReaderBase::Done() {
   if (ABSL_PREDICT_FALSE(truncated_)) Fail("Truncated Zstd-compressed stream");
+  decompressor_.reset();
   BufferedReader::Done();
 }
 
@@ -125,6 +134,14 @@ bool ZstdReaderBase::ReadInternal(char* dest, size_t min_length,
   }
 }
 
+void ZstdReaderBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  BufferedReader::RegisterSubobjects(memory_estimator);
+  if (decompressor_ != nullptr) {
+    memory_estimator->RegisterMemory(ZSTD_sizeof_DStream(decompressor_.get()));
+  }
+}
+
 template class ZstdReader<Reader*>;
 template class ZstdReader<std::unique_ptr<Reader>>;
 
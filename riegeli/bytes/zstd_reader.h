@@ -23,6 +23,8 @@
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "zstd.h"
@@ -62,6 +64,7 @@ class ZstdReaderBase : public BufferedReader {
   // Returns the compressed Reader. Unchanged by Close().
   virtual Reader* src_reader() = 0;
   virtual const Reader* src_reader() const = 0;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   ZstdReaderBase() noexcept {}
@@ -82,14 +85,18 @@ class ZstdReaderBase : public BufferedReader {
     void operator()(ZSTD_DStream* ptr) const { ZSTD_freeDStream(ptr); }
   };
 
+  // ZSTD_DStream objects are reused across ZstdReader objects.
+  using DStreamPool = RecyclingPool<ZSTD_DStream, ZSTD_DStreamDeleter>;
+
   // If true, the source is truncated (without a clean end of the compressed
   // stream) at the current position. If the source does not grow, Close() will
   // fail.
   bool truncated_ = false;
   // If healthy() but decompressor_ == nullptr then all data have been
   // decompressed. In this case ZSTD_decompressStream() must not be called
-  // again.
-  std::unique_ptr<ZSTD_DStream, ZSTD_DStreamDeleter> decompressor_;
+  // again. decompressor_ is returned to DStreamPool::global() when no longer
+  // needed.
+  DStreamPool::Handle decompressor_;
 };
 
 // A Reader which decompresses data with Zstd after getting it from another
@@ -120,6 +127,7 @@ class ZstdReader : public ZstdReaderBase {
   const Src& src() const { return src_.manager(); }
   Reader* src_reader() override { return src_.ptr(); }
   const Reader* src_reader() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -176,6 +184,13 @@ void ZstdReader<Src>::VerifyEnd() {
   if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) src_->VerifyEnd();
 }
 
+template <typename Src>
+void ZstdReader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ZstdReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
 extern template class ZstdReader<Reader*>;
 extern template class ZstdReader<std::unique_ptr<Reader>>;
 
@@ -20,11 +20,15 @@
 
 #include <stddef.h>
 #include <limits>
+#include <memory>
+#include <utility>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "zstd.h"
@@ -50,15 +54,22 @@ void ZstdWriterBase::Done() {
         << "BufferedWriter::PushInternal() did not empty the buffer";
     FlushInternal(ZSTD_endStream, "ZSTD_endStream()", dest);
   }
+  compressor_.reset();
   BufferedWriter::Done();
 }
 
 inline bool ZstdWriterBase::EnsureCStreamCreated() {
   if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
-    compressor_.reset(ZSTD_createCStream());
+    compressor_ = CStreamPool::global().Get(
+        std::make_pair(compression_level_, window_log_), [] {
+          return std::unique_ptr<ZSTD_CStream, ZSTD_CStreamDeleter>(
+              ZSTD_createCStream());
+        });
     if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
       return Fail("ZSTD_createCStream() failed");
     }
+    // A ZSTD_CStream reused from CStreamPool might contain state left from a
+    // previous stream; ZSTD_initCStream_advanced() resets it.
     return InitializeCStream();
   }
   return true;
@@ -155,6 +166,14 @@ bool ZstdWriterBase::FlushInternal(Function function,
   }
 }
 
+void ZstdWriterBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  BufferedWriter::RegisterSubobjects(memory_estimator);
+  if (compressor_ != nullptr) {
+    memory_estimator->RegisterMemory(ZSTD_sizeof_CStream(compressor_.get()));
+  }
+}
+
 template class ZstdWriter<Writer*>;
 template class ZstdWriter<std::unique_ptr<Writer>>;
 
@@ -24,6 +24,8 @@
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "zstd.h"
@@ -138,6 +140,7 @@ class ZstdWriterBase : public BufferedWriter {
   virtual const Writer* dest_writer() const = 0;
 
   bool Flush(FlushType flush_type) override;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   ZstdWriterBase() noexcept {}
@@ -156,6 +159,12 @@ class ZstdWriterBase : public BufferedWriter {
     void operator()(ZSTD_CStream* ptr) const { ZSTD_freeCStream(ptr); }
   };
 
+  // ZSTD_CStream objects are reused across ZstdWriter objects with the same
+  // compression_level and window_log, because creating them allocates large
+  // tables.
+  using CStreamPool = KeyedRecyclingPool<ZSTD_CStream, std::pair<int, int>,
+                                         ZSTD_CStreamDeleter>;
+
   bool EnsureCStreamCreated();
   bool InitializeCStream();
 
@@ -166,9 +175,9 @@ class ZstdWriterBase : public BufferedWriter {
   int compression_level_ = 0;
   int window_log_ = 0;
   Position size_hint_ = 0;
-  // If healthy() but compressor_ == nullptr then compressor_ was not created
-  // yet.
-  std::unique_ptr<ZSTD_CStream, ZSTD_CStreamDeleter> compressor_;
+  // If healthy() but compressor_ == nullptr then compressor_ was not obtained
+  // yet. It is returned to CStreamPool::global() by Done().
+  CStreamPool::Handle compressor_;
 };
 
 // A Writer which compresses data with Zstd before passing it to another Writer.
@@ -199,6 +208,7 @@ class ZstdWriter : public ZstdWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   Writer* dest_writer() override { return dest_.ptr(); }
   const Writer* dest_writer() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -229,15 +239,9 @@ inline ZstdWriterBase& ZstdWriterBase::operator=(
     ZstdWriterBase&& that) noexcept {
   BufferedWriter::operator=(std::move(that));
   compression_level_ = absl::exchange(that.compression_level_, 0);
-  window_log_ = absl::exchange(that.window_log_, 0),
+  window_log_ = absl::exchange(that.window_log_, 0);
   size_hint_ = absl::exchange(that.size_hint_, 0);
-  if (that.compressor_ != nullptr || ABSL_PREDICT_FALSE(!healthy())) {
-    compressor_ = std::move(that.compressor_);
-  } else if (compressor_ != nullptr) {
-    // Reuse this ZSTD_CStream because if options are the same then reusing it
-    // is faster than creating it again.
-    InitializeCStream();
-  }
+  compressor_ = std::move(that.compressor_);
   return *this;
 }
 
@@ -272,6 +276,13 @@ void ZstdWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+void ZstdWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ZstdWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class ZstdWriter<Writer*>;
 extern template class ZstdWriter<std::unique_ptr<Writer>>;
 
@@ -16,34 +16,108 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/bytes/array_backward_writer.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/limiting_reader.h"
 #include "riegeli/bytes/message_parse.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/string_reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/column_values.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/chunk_encoding/simple_decoder.h"
 #include "riegeli/chunk_encoding/transpose_decoder.h"
+#include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
 
+namespace {
+
+// Appends to *dest a flat buffer of exactly length bytes, and returns it.
+//
+// Precondition: dest->empty()
+absl::Span<char> AppendFlatBuffer(size_t length, Chain* dest) {
+  RIEGELI_ASSERT(dest->empty())
+      << "Failed precondition of AppendFlatBuffer(): Chain not empty";
+  const absl::Span<char> buffer = dest->AppendBuffer(length, length, length);
+  RIEGELI_ASSERT_GE(buffer.size(), length)
+      << "Chain::AppendBuffer() returned a buffer too small";
+  dest->RemoveSuffix(buffer.size() - length);
+  return absl::Span<char>(buffer.data(), length);
+}
+
+inline bool ReadValue(Reader* src, absl::string_view* dest,
+                      std::string* scratch, size_t length) {
+  return src->Read(dest, scratch, length);
+}
+
+inline bool ReadValue(Reader* src, std::string* dest, std::string* scratch,
+                      size_t length) {
+  dest->clear();
+  return src->Read(dest, length);
+}
+
+inline bool ReadValue(Reader* src, Chain* dest, std::string* scratch,
+                      size_t length) {
+  dest->Clear();
+  return src->Read(dest, length);
+}
+
+// Ensures that *dest remains valid when further data are read from the source.
+inline void StabilizeValue(absl::string_view* dest, std::string* scratch) {
+  if (dest->data() != scratch->data()) {
+    scratch->assign(dest->data(), dest->size());
+    *dest = *scratch;
+  }
+}
+
+inline void StabilizeValue(std::string* dest, std::string* scratch) {}
+
+inline void StabilizeValue(Chain* dest, std::string* scratch) {}
+
+// Parses a record of the given length from *src.
+//
+// If the record is contiguous in the buffer of *src, which is usual, it is
+// parsed from a flat array, which is faster than parsing from a stream.
+bool ParseRecord(google::protobuf::MessageLite* record, Reader* src,
+                 size_t length, std::string* error_message) {
+  if (ABSL_PREDICT_TRUE(src->available() >= length)) {
+    const absl::string_view data(src->cursor(), length);
+    src->set_cursor(src->cursor() + length);
+    return ParseFromString(record, data, error_message);
+  }
+  return ParseFromReader(record, LimitingReader<>(src, src->pos() + length),
+                         error_message);
+}
+
+}  // namespace
+
 void ChunkDecoder::Done() { recoverable_ = false; }
 
 void ChunkDecoder::Reset() {
   MarkHealthy();
   limits_.clear();
   values_reader_ = ChainReader<Chain>(Chain());
+  lazy_values_.reset();
   index_ = 0;
   recoverable_ = false;
 }
@@ -58,6 +132,24 @@ bool ChunkDecoder::Reset(const Chunk& chunk) {
                          record_scratch_.max_size())) {
     return Fail("Too large chunk");
   }
+  if ((chunk.header.chunk_type() == ChunkType::kSimple ||
+       chunk.header.chunk_type() == ChunkType::kFramed) &&
+      !flat_values_) {
+    if (ABSL_PREDICT_FALSE(!ParseLazily(chunk))) {
+      limits_.clear();  // Ensure that index() == num_records().
+      return false;
+    }
+    return true;
+  }
+  if (chunk.header.chunk_type() == ChunkType::kTransposed && !flat_values_ &&
+      field_projection_.includes_all()) {
+    if (ABSL_PREDICT_FALSE(!ParseTransposedLazily(chunk))) {
+      limits_.clear();  // Ensure that index() == num_records().
+      lazy_values_.reset();
+      return false;
+    }
+    return true;
+  }
   Chain values;
   if (ABSL_PREDICT_FALSE(!Parse(chunk.header, &data_reader, &values))) {
     limits_.clear();  // Ensure that index() == num_records().
@@ -80,6 +172,166 @@ bool ChunkDecoder::Reset(const Chunk& chunk) {
   return true;
 }
 
+bool ChunkDecoder::ScanField(const Chunk& chunk, const Field& field,
+                             ColumnValues* dest) {
+  RIEGELI_ASSERT(!field.path().empty())
+      << "Failed precondition of ChunkDecoder::ScanField(): empty field path";
+  dest->Clear();
+  if (chunk.header.chunk_type() != ChunkType::kTransposed) {
+    return ScanRecords(chunk, field, dest);
+  }
+  Reset();
+  if (ABSL_PREDICT_FALSE(chunk.header.num_records() > limits_.max_size())) {
+    return Fail("Too many records");
+  }
+  ChainReader<> data_reader(&chunk.data);
+  TransposeDecoder transpose_decoder;
+  if (ABSL_PREDICT_FALSE(!transpose_decoder.ScanField(
+          &data_reader, chunk.header.num_records(), field, dest))) {
+    if (ABSL_PREDICT_FALSE(!transpose_decoder.healthy())) {
+      return Fail("Invalid transposed chunk", transpose_decoder);
+    }
+    // Some values were broken down as submessages, so their bytes are found
+    // by decoding records.
+    return ScanRecords(chunk, field, dest);
+  }
+  if (ABSL_PREDICT_FALSE(!data_reader.VerifyEndAndClose())) {
+    return Fail("Invalid transposed chunk", data_reader);
+  }
+  // Records are not decoded, so they are left as read, with empty values.
+  limits_.assign(IntCast<size_t>(chunk.header.num_records()), 0);
+  index_ = num_records();
+  return true;
+}
+
+inline bool ChunkDecoder::ScanRecords(const Chunk& chunk, const Field& field,
+                                      ColumnValues* dest) {
+  if (ABSL_PREDICT_FALSE(!Reset(chunk))) return false;
+  dest->Clear();
+  absl::string_view record;
+  while (ReadRecord(&record)) {
+    StringReader<> record_reader(record);
+    // Like in a transposed chunk, a record which is not a proto message does
+    // not have values.
+    if (!internal::IsProtoMessage(&record_reader)) continue;
+    if (ABSL_PREDICT_FALSE(!ScanMessage(record, field, 0, index_ - 1, dest))) {
+      return false;
+    }
+  }
+  return healthy();
+}
+
+bool ChunkDecoder::ScanMessage(absl::string_view message, const Field& field,
+                               size_t depth, uint64_t record_index,
+                               ColumnValues* dest) {
+  const Field::Path& path = field.path();
+  const char* cursor = message.data();
+  const char* const limit = message.data() + message.size();
+  // The number of open groups which are not along the field path.
+  size_t num_skipped_groups = 0;
+  while (cursor < limit) {
+    uint32_t tag;
+    if (!ReadVarint32(&cursor, &tag)) {
+      RIEGELI_ASSERT_UNREACHABLE() << "Invalid tag";
+    }
+    const bool on_path = num_skipped_groups == 0 && (tag >> 3) == path[depth];
+    const bool is_last = depth == path.size() - 1;
+    switch (static_cast<internal::WireType>(tag & 7)) {
+      case internal::WireType::kVarint: {
+        uint64_t value;
+        if (!ReadVarint64(&cursor, &value)) {
+          RIEGELI_ASSERT_UNREACHABLE() << "Invalid varint";
+        }
+        if (on_path && is_last) {
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kVarint))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->varints.push_back(value);
+        }
+      } break;
+      case internal::WireType::kFixed32:
+        if (on_path && is_last) {
+          uint32_t word;
+          std::memcpy(&word, cursor, sizeof(word));
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kFixed32))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->fixed32s.push_back(ReadLittleEndian32(word));
+        }
+        cursor += sizeof(uint32_t);
+        break;
+      case internal::WireType::kFixed64:
+        if (on_path && is_last) {
+          uint64_t word;
+          std::memcpy(&word, cursor, sizeof(word));
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kFixed64))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->fixed64s.push_back(ReadLittleEndian64(word));
+        }
+        cursor += sizeof(uint64_t);
+        break;
+      case internal::WireType::kLengthDelimited: {
+        uint32_t length;
+        if (!ReadVarint32(&cursor, &length)) {
+          RIEGELI_ASSERT_UNREACHABLE() << "Invalid length";
+        }
+        const absl::string_view value(cursor, length);
+        cursor += length;
+        if (!on_path) break;
+        if (is_last) {
+          // The value is reported as it is, whether it is a string or a
+          // submessage.
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kString))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->strings.append(value.data(), value.size());
+          dest->string_limits.push_back(dest->strings.size());
+          break;
+        }
+        // Like TransposeEncoder, treat a non-empty value along the path as a
+        // submessage if it is a valid proto message.
+        if (depth < internal::kMaxRecursionDepth && length != 0) {
+          StringReader<> value_reader(value);
+          if (internal::IsProtoMessage(&value_reader) &&
+              ABSL_PREDICT_FALSE(!ScanMessage(value, field, depth + 1,
+                                              record_index, dest))) {
+            return false;
+          }
+        }
+      } break;
+      case internal::WireType::kStartGroup:
+        if (on_path) {
+          if (ABSL_PREDICT_FALSE(is_last)) {
+            return Fail("Column scan of a group field");
+          }
+          ++depth;
+        } else {
+          ++num_skipped_groups;
+        }
+        break;
+      case internal::WireType::kEndGroup:
+        if (num_skipped_groups > 0) {
+          --num_skipped_groups;
+        } else {
+          --depth;
+        }
+        break;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE() << "Invalid wire type: " << (tag & 7);
+    }
+  }
+  return true;
+}
+
 bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
   switch (header.chunk_type()) {
     case ChunkType::kFileSignature:
@@ -118,17 +370,24 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
             header.decoded_data_size()));
       }
       return true;
-    case ChunkType::kSimple: {
+    case ChunkType::kSimple:
+    case ChunkType::kFramed: {
       SimpleDecoder simple_decoder;
-      if (ABSL_PREDICT_FALSE(!simple_decoder.Reset(src, header.num_records(),
-                                                   header.decoded_data_size(),
-                                                   &limits_))) {
+      if (ABSL_PREDICT_FALSE(!simple_decoder.Reset(
+              src, header.num_records(), header.decoded_data_size(), &limits_,
+              header.chunk_type() == ChunkType::kFramed))) {
         return Fail("Invalid simple chunk", simple_decoder);
       }
       dest->Clear();
-      if (ABSL_PREDICT_FALSE(!simple_decoder.reader()->Read(
-              dest, IntCast<size_t>(header.decoded_data_size())))) {
-        return Fail("Reading record values failed", *simple_decoder.reader());
+      const size_t size = IntCast<size_t>(header.decoded_data_size());
+      if (flat_values_) {
+        const absl::Span<char> flat_buffer = AppendFlatBuffer(size, dest);
+        if (ABSL_PREDICT_FALSE(!simple_decoder.ReadValues(
+                flat_buffer.data(), flat_buffer.size()))) {
+          return Fail("Reading record values failed", simple_decoder);
+        }
+      } else if (ABSL_PREDICT_FALSE(!simple_decoder.ReadValues(dest, size))) {
+        return Fail("Reading record values failed", simple_decoder);
       }
       if (ABSL_PREDICT_FALSE(!simple_decoder.VerifyEndAndClose())) {
         return Fail(simple_decoder);
@@ -139,8 +398,29 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
       return true;
     }
     case ChunkType::kTransposed: {
-      TransposeDecoder transpose_decoder;
+      TransposeDecoder& transpose_decoder = GetTransposeDecoder();
       dest->Clear();
+      if (flat_values_) {
+        // Records are decoded backwards into the end of the flat buffer. With
+        // field projection the decoded size can be smaller than declared, then
+        // the unused beginning of the buffer is removed.
+        const absl::Span<char> flat_buffer = AppendFlatBuffer(
+            IntCast<size_t>(header.decoded_data_size()), dest);
+        ArrayBackwardWriter<> dest_writer(flat_buffer);
+        const bool ok = transpose_decoder.Reset(
+            src, header.num_records(), header.decoded_data_size(),
+            field_projection_, &dest_writer, &limits_,
+            parallel_decompression_);
+        if (ABSL_PREDICT_FALSE(!dest_writer.Close())) return Fail(dest_writer);
+        if (ABSL_PREDICT_FALSE(!ok)) {
+          return Fail("Invalid transposed chunk", transpose_decoder);
+        }
+        dest->RemovePrefix(flat_buffer.size() - dest_writer.written().size());
+        if (ABSL_PREDICT_FALSE(!src->VerifyEndAndClose())) {
+          return Fail("Invalid transposed chunk", *src);
+        }
+        return true;
+      }
       ChainBackwardWriter<> dest_writer(
           dest,
           ChainBackwardWriterBase::Options().set_size_hint(
@@ -148,7 +428,7 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
                                                : uint64_t{0}));
       const bool ok = transpose_decoder.Reset(
           src, header.num_records(), header.decoded_data_size(),
-          field_projection_, &dest_writer, &limits_);
+          field_projection_, &dest_writer, &limits_, parallel_decompression_);
       if (ABSL_PREDICT_FALSE(!dest_writer.Close())) return Fail(dest_writer);
       if (ABSL_PREDICT_FALSE(!ok)) {
         return Fail("Invalid transposed chunk", transpose_decoder);
@@ -167,15 +447,200 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
                            static_cast<uint64_t>(header.chunk_type())));
 }
 
+inline TransposeDecoder& ChunkDecoder::GetTransposeDecoder() {
+  if (transpose_decoder_ == nullptr) {
+    transpose_decoder_ = absl::make_unique<TransposeDecoder>();
+  }
+  return *transpose_decoder_;
+}
+
+bool ChunkDecoder::ParseLazily(const Chunk& chunk) {
+  std::unique_ptr<LazyValues> lazy_values =
+      absl::make_unique<LazyValues>(chunk.data);
+  if (ABSL_PREDICT_FALSE(!lazy_values->decoder.Reset(
+          &lazy_values->src, chunk.header.num_records(),
+          chunk.header.decoded_data_size(), &limits_,
+          chunk.header.chunk_type() == ChunkType::kFramed))) {
+    return Fail("Invalid simple chunk", lazy_values->decoder);
+  }
+  lazy_values_ = std::move(lazy_values);
+  // Without records, values are not going to be read, so verify now that they
+  // are empty.
+  if (limits_.empty()) return VerifyLazyValuesEnd();
+  return true;
+}
+
+bool ChunkDecoder::ParseTransposedLazily(const Chunk& chunk) {
+  std::unique_ptr<LazyValues> lazy_values =
+      absl::make_unique<LazyValues>(chunk.data);
+  lazy_values->transposed = true;
+  TransposeDecoder& decoder = GetTransposeDecoder();
+  if (ABSL_PREDICT_FALSE(!decoder.ResetForRanges(
+          &lazy_values->src, chunk.header.num_records(),
+          chunk.header.decoded_data_size(), parallel_decompression_))) {
+    return Fail("Invalid transposed chunk", decoder);
+  }
+  const size_t num_records = IntCast<size_t>(chunk.header.num_records());
+  const uint64_t range_num_records = decoder.range_num_records();
+  limits_.reserve(num_records);
+  for (size_t index = 0; index < num_records; ++index) {
+    limits_.push_back(decoder.range_limits()[IntCast<size_t>(
+        IntCast<uint64_t>(index) / range_num_records)]);
+  }
+  lazy_values_ = std::move(lazy_values);
+  if (decoder.range_limits().size() == 1) {
+    // Without checkpoints there is nothing to gain from decoding on demand.
+    // Transitions are read while decoding, so the end of the chunk is reached
+    // only then.
+    if (ABSL_PREDICT_FALSE(!DecodeLazyRange(0))) return false;
+    if (ABSL_PREDICT_FALSE(!lazy_values_->src.VerifyEndAndClose())) {
+      return Fail("Invalid transposed chunk", lazy_values_->src);
+    }
+    values_reader_ = std::move(lazy_values_->range_values);
+    lazy_values_.reset();
+    return true;
+  }
+  if (ABSL_PREDICT_FALSE(!lazy_values_->src.VerifyEndAndClose())) {
+    return Fail("Invalid transposed chunk", lazy_values_->src);
+  }
+  return true;
+}
+
+bool ChunkDecoder::DecodeLazyRange(size_t range_index) {
+  LazyValues& lazy_values = *lazy_values_;
+  TransposeDecoder& decoder = *transpose_decoder_;
+  const size_t range_begin =
+      range_index == 0 ? size_t{0} : decoder.range_limits()[range_index - 1];
+  Chain values;
+  ChainBackwardWriter<> values_writer(
+      &values, ChainBackwardWriterBase::Options().set_size_hint(
+                   decoder.range_limits()[range_index] - range_begin));
+  std::vector<size_t> range_limits;
+  const bool ok =
+      decoder.DecodeRange(range_index, &values_writer, &range_limits);
+  if (ABSL_PREDICT_FALSE(!values_writer.Close())) return Fail(values_writer);
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    return Fail("Invalid transposed chunk", decoder);
+  }
+  const size_t first_index = IntCast<size_t>(IntCast<uint64_t>(range_index) *
+                                             decoder.range_num_records());
+  for (size_t i = 0; i < range_limits.size(); ++i) {
+    limits_[first_index + i] = range_begin + range_limits[i];
+  }
+  lazy_values.range_values = ChainReader<Chain>(std::move(values));
+  lazy_values.range_index = range_index;
+  return true;
+}
+
+Reader* ChunkDecoder::SeekLazyValues() {
+  LazyValues& lazy_values = *lazy_values_;
+  if (lazy_values.transposed) {
+    const size_t range_index = IntCast<size_t>(
+        index_ / transpose_decoder_->range_num_records());
+    if (range_index != lazy_values.range_index &&
+        ABSL_PREDICT_FALSE(!DecodeLazyRange(range_index))) {
+      return nullptr;
+    }
+  }
+  const size_t start =
+      index_ == 0 ? size_t{0} : limits_[IntCast<size_t>(index_ - 1)];
+  if (lazy_values.transposed) {
+    const size_t range_begin =
+        lazy_values.range_index == 0
+            ? size_t{0}
+            : transpose_decoder_->range_limits()[lazy_values.range_index - 1];
+    if (!lazy_values.range_values.Seek(start - range_begin)) {
+      RIEGELI_ASSERT_UNREACHABLE() << "Failed seeking range values: "
+                                   << lazy_values.range_values.message();
+    }
+    return &lazy_values.range_values;
+  }
+  SimpleDecoder& decoder = lazy_values.decoder;
+  if (ABSL_PREDICT_FALSE(!decoder.SeekValues(start))) {
+    Fail(decoder);
+    return nullptr;
+  }
+  return decoder.reader();
+}
+
+bool ChunkDecoder::VerifyLazyValuesEnd() {
+  // Values of a transposed chunk were verified when they were decoded.
+  if (lazy_values_->transposed) return true;
+  // SimpleDecoder::VerifyEnd() also verifies that the chunk has no data after
+  // record values.
+  lazy_values_->decoder.VerifyEnd();
+  if (ABSL_PREDICT_FALSE(!lazy_values_->decoder.healthy())) {
+    return Fail(lazy_values_->decoder);
+  }
+  return true;
+}
+
+template <typename Record>
+bool ChunkDecoder::ReadLazyRecord(Record* record) {
+  Reader* const reader = SeekLazyValues();
+  if (ABSL_PREDICT_FALSE(reader == nullptr)) return false;
+  const size_t start =
+      index_ == 0 ? size_t{0} : limits_[IntCast<size_t>(index_ - 1)];
+  const size_t limit = limits_[IntCast<size_t>(index_)];
+  RIEGELI_ASSERT_LE(start, limit)
+      << "Failed invariant of ChunkDecoder: record end positions not sorted";
+  if (ABSL_PREDICT_FALSE(
+          !ReadValue(reader, record, &record_scratch_, limit - start))) {
+    return Fail("Reading record values failed", *reader);
+  }
+  if (index_ + 1 == num_records()) {
+    // Verifying the end reads further, which could invalidate the record.
+    StabilizeValue(record, &record_scratch_);
+    if (ABSL_PREDICT_FALSE(!VerifyLazyValuesEnd())) return false;
+  }
+  ++index_;
+  return true;
+}
+
+template bool ChunkDecoder::ReadLazyRecord(absl::string_view* record);
+template bool ChunkDecoder::ReadLazyRecord(std::string* record);
+template bool ChunkDecoder::ReadLazyRecord(Chain* record);
+
+bool ChunkDecoder::ReadLazyRecord(google::protobuf::MessageLite* record) {
+  Reader* const reader = SeekLazyValues();
+  if (ABSL_PREDICT_FALSE(reader == nullptr)) return false;
+  const size_t start =
+      index_ == 0 ? size_t{0} : limits_[IntCast<size_t>(index_ - 1)];
+  const size_t limit = limits_[IntCast<size_t>(index_)];
+  RIEGELI_ASSERT_LE(start, limit)
+      << "Failed invariant of ChunkDecoder: record end positions not sorted";
+  std::string error_message;
+  if (ABSL_PREDICT_FALSE(
+          !ParseRecord(record, reader, limit - start, &error_message))) {
+    if (ABSL_PREDICT_FALSE(!reader->healthy())) {
+      return Fail("Reading record values failed", *reader);
+    }
+    if (!lazy_values_->transposed &&
+        ABSL_PREDICT_FALSE(!lazy_values_->decoder.SeekValues(limit))) {
+      return Fail(lazy_values_->decoder);
+    }
+    recoverable_ = true;
+    return Fail(error_message);
+  }
+  if (index_ + 1 == num_records()) {
+    if (ABSL_PREDICT_FALSE(!VerifyLazyValuesEnd())) return false;
+  }
+  ++index_;
+  return true;
+}
+
 bool ChunkDecoder::ReadRecord(google::protobuf::MessageLite* record) {
   if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
+  if (ABSL_PREDICT_FALSE(lazy_values_ != nullptr)) {
+    return ReadLazyRecord(record);
+  }
   const size_t start = IntCast<size_t>(values_reader_.pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
       << "Failed invariant of ChunkDecoder: record end positions not sorted";
   std::string error_message;
-  if (ABSL_PREDICT_FALSE(!ParseFromReader(
-          record, LimitingReader<>(&values_reader_, limit), &error_message))) {
+  if (ABSL_PREDICT_FALSE(!ParseRecord(record, &values_reader_, limit - start,
+                                      &error_message))) {
     if (!values_reader_.Seek(limit)) {
       RIEGELI_ASSERT_UNREACHABLE()
           << "Seeking record values failed: " << values_reader_.message();
@@ -197,4 +662,21 @@ bool ChunkDecoder::Recover() {
   return true;
 }
 
+void ChunkDecoder::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Object::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(limits_);
+  memory_estimator->RegisterSubobjects(values_reader_);
+  memory_estimator->RegisterSubobjects(lazy_values_);
+  memory_estimator->RegisterSubobjects(transpose_decoder_);
+  memory_estimator->RegisterSubobjects(record_scratch_);
+}
+
+void ChunkDecoder::LazyValues::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  memory_estimator->RegisterSubobjects(src);
+  memory_estimator->RegisterSubobjects(decoder);
+  memory_estimator->RegisterSubobjects(range_values);
+}
+
 }  // namespace riegeli
@@ -17,6 +17,8 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <limits>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -27,11 +29,15 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/column_values.h"
 #include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/simple_decoder.h"
+#include "riegeli/chunk_encoding/transpose_decoder.h"
 
 namespace riegeli {
 
@@ -52,10 +58,49 @@ class ChunkDecoder : public Object {
       return std::move(set_field_projection(std::move(field_projection)));
     }
 
+    // If true, values of all records of a chunk are decoded into a single flat
+    // array, allocated upfront with the decoded data size declared in the
+    // chunk header. ReadRecord(string_view*) then never copies a record.
+    //
+    // If false, values are decoded into a Chain with blocks of a bounded size,
+    // and a record which spans a block boundary is copied when read as a
+    // string_view. Values of a simple chunk are decompressed on demand while
+    // reading records, so that reading only some records, e.g. after
+    // SetIndex(), does not decompress the remaining part of the chunk. In a
+    // framed chunk, reading a record after SetIndex() decompresses only the
+    // frame containing it. In a transposed chunk with decoder checkpoints,
+    // if all fields are included, records are decoded on demand one range
+    // between checkpoints at a time.
+    //
+    // Default: false
+    Options& set_flat_values(bool flat_values) & {
+      flat_values_ = flat_values;
+      return *this;
+    }
+    Options&& set_flat_values(bool flat_values) && {
+      return std::move(set_flat_values(flat_values));
+    }
+
+    // If true, data buckets of a transposed chunk are decompressed
+    // concurrently in background threads, which reduces the latency of
+    // decoding a single large chunk at the cost of using more threads. This
+    // applies if all fields are included.
+    //
+    // Default: false
+    Options& set_parallel_decompression(bool parallel_decompression) & {
+      parallel_decompression_ = parallel_decompression;
+      return *this;
+    }
+    Options&& set_parallel_decompression(bool parallel_decompression) && {
+      return std::move(set_parallel_decompression(parallel_decompression));
+    }
+
    private:
     friend class ChunkDecoder;
 
     FieldProjection field_projection_ = FieldProjection::All();
+    bool flat_values_ = false;
+    bool parallel_decompression_ = false;
   };
 
   // Creates an empty ChunkDecoder.
@@ -74,10 +119,37 @@ class ChunkDecoder : public Object {
   //  * false - failure (!healthy())
   bool Reset(const Chunk& chunk);
 
+  // Resets the ChunkDecoder and scans values of a single field in records of
+  // the chunk, instead of making the records available for reading.
+  // Afterwards index() == num_records().
+  //
+  // Values of a transposed chunk are read directly from data buffers of the
+  // field, without decoding records, unless some values of the field were
+  // broken down as submessages. Records of other chunks are decoded and parsed.
+  // Values are found the same way in both cases: a record, or a
+  // length-delimited value along the field path before its last element, which
+  // is not a valid proto message in the canonical encoding does not have
+  // values.
+  //
+  // Values of a length-delimited field are reported as strings with their
+  // bytes, whether they are strings, packed repeated fields, or submessages.
+  // Group fields are not supported: scanning them fails.
+  //
+  // The field projection specified in Options is not applied.
+  //
+  // Precondition: !field.path().empty()
+  //
+  // Return values:
+  //  * true  - success (*dest is set, healthy())
+  //  * false - failure (!healthy())
+  bool ScanField(const Chunk& chunk, const Field& field, ColumnValues* dest);
+
   // Reads the next record.
   //
   // ReadRecord(MessageLite*) parses raw bytes to a proto message after reading.
-  // The remaining overloads read raw bytes (they never generate a new failure).
+  // The remaining overloads read raw bytes (they generate a new failure only if
+  // values of a simple chunk are decompressed on demand and turn out to be
+  // invalid).
   // For ReadRecord(string_view*) the string_view is valid until the next
   // non-const operation on this ChunkDecoder.
   //
@@ -116,19 +188,72 @@ class ChunkDecoder : public Object {
   // Returns the number of records. Unchanged by Close().
   uint64_t num_records() const { return IntCast<uint64_t>(limits_.size()); }
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  protected:
   void Done() override;
 
  private:
+  // Values of a simple or framed chunk, decompressed on demand, or values of
+  // a transposed chunk, decoded on demand one range of records at a time.
+  struct LazyValues {
+    explicit LazyValues(const Chain& data) : src(data) {}
+
+    void RegisterSubobjects(MemoryEstimator* memory_estimator) const;
+
+    ChainReader<Chain> src;
+    // Used for a simple or framed chunk.
+    SimpleDecoder decoder;
+    // Whether the chunk is transposed. Then transpose_decoder_ holds the
+    // parsed chunk.
+    bool transposed = false;
+    // Index of the range of records whose values are in range_values.
+    size_t range_index = std::numeric_limits<size_t>::max();
+    ChainReader<Chain> range_values;
+  };
+
+  // Returns transpose_decoder_, creating it if needed.
+  TransposeDecoder& GetTransposeDecoder();
   bool Parse(const ChunkHeader& header, Reader* src, Chain* dest);
+  // Implements ScanField() by decoding and parsing records of the chunk.
+  bool ScanRecords(const Chunk& chunk, const Field& field, ColumnValues* dest);
+  // Appends to *dest values of the field at "depth" in the field path, found
+  // in "message" of the record with "record_index".
+  //
+  // Precondition: "message" is a valid proto message in the canonical encoding
+  bool ScanMessage(absl::string_view message, const Field& field, size_t depth,
+                   uint64_t record_index, ColumnValues* dest);
+  bool ParseLazily(const Chunk& chunk);
+  bool ParseTransposedLazily(const Chunk& chunk);
+  bool DecodeLazyRange(size_t range_index);
+  // Positions lazy values at the beginning of the record at index_, and
+  // returns the Reader to read it from, or nullptr on failure.
+  Reader* SeekLazyValues();
+  bool ReadLazyRecord(google::protobuf::MessageLite* record);
+  template <typename Record>
+  bool ReadLazyRecord(Record* record);
+  bool VerifyLazyValuesEnd();
 
   FieldProjection field_projection_;
+  bool flat_values_ = false;
+  bool parallel_decompression_ = false;
   // Invariants if healthy():
   //   limits_ are sorted
-  //   (limits_.empty() ? 0 : limits_.back()) == size of values_reader_
-  //   (index_ == 0 ? 0 : limits_[index_ - 1]) == values_reader_.pos()
+  //   (limits_.empty() ? 0 : limits_.back()) == size of values
+  //   if lazy_values_ == nullptr:
+  //     (index_ == 0 ? 0 : limits_[index_ - 1]) == values_reader_.pos()
+  //   if lazy_values_ != nullptr && lazy_values_->transposed:
+  //     limits_ of records in ranges not decoded yet are the end position of
+  //     their range
   std::vector<size_t> limits_;
   ChainReader<Chain> values_reader_;
+  // If not nullptr, values are read from lazy_values_ instead of
+  // values_reader_, which are positioned at the beginning of the record at
+  // index_ when the record is read.
+  std::unique_ptr<LazyValues> lazy_values_;
+  // Decodes transposed chunks. It is kept between chunks, because it reuses
+  // the state machine of the previous chunk if it is the same.
+  std::unique_ptr<TransposeDecoder> transpose_decoder_;
   // Invariant: index_ <= num_records()
   uint64_t index_ = 0;
   std::string record_scratch_;
@@ -143,14 +268,20 @@ class ChunkDecoder : public Object {
 inline ChunkDecoder::ChunkDecoder(Options options)
     : Object(State::kOpen),
       field_projection_(std::move(options.field_projection_)),
+      flat_values_(options.flat_values_),
+      parallel_decompression_(options.parallel_decompression_),
       values_reader_(Chain()) {}
 
 inline ChunkDecoder::ChunkDecoder(ChunkDecoder&& that) noexcept
     : Object(std::move(that)),
       field_projection_(std::move(that.field_projection_)),
+      flat_values_(that.flat_values_),
+      parallel_decompression_(that.parallel_decompression_),
       limits_(std::move(that.limits_)),
       values_reader_(
           absl::exchange(that.values_reader_, ChainReader<Chain>(Chain()))),
+      lazy_values_(std::move(that.lazy_values_)),
+      transpose_decoder_(std::move(that.transpose_decoder_)),
       index_(absl::exchange(that.index_, 0)),
       record_scratch_(absl::exchange(that.record_scratch_, std::string())),
       recoverable_(absl::exchange(that.recoverable_, false)) {}
@@ -158,9 +289,13 @@ inline ChunkDecoder::ChunkDecoder(ChunkDecoder&& that) noexcept
 inline ChunkDecoder& ChunkDecoder::operator=(ChunkDecoder&& that) noexcept {
   Object::operator=(std::move(that));
   field_projection_ = std::move(that.field_projection_);
+  flat_values_ = that.flat_values_;
+  parallel_decompression_ = that.parallel_decompression_;
   limits_ = std::move(that.limits_);
   values_reader_ =
       absl::exchange(that.values_reader_, ChainReader<Chain>(Chain()));
+  lazy_values_ = std::move(that.lazy_values_);
+  transpose_decoder_ = std::move(that.transpose_decoder_);
   index_ = absl::exchange(that.index_, 0);
   record_scratch_ = absl::exchange(that.record_scratch_, std::string());
   recoverable_ = absl::exchange(that.recoverable_, false);
@@ -169,6 +304,9 @@ inline ChunkDecoder& ChunkDecoder::operator=(ChunkDecoder&& that) noexcept {
 
 inline bool ChunkDecoder::ReadRecord(absl::string_view* record) {
   if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
+  if (ABSL_PREDICT_FALSE(lazy_values_ != nullptr)) {
+    return ReadLazyRecord(record);
+  }
   const size_t start = IntCast<size_t>(values_reader_.pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
@@ -183,6 +321,9 @@ inline bool ChunkDecoder::ReadRecord(absl::string_view* record) {
 
 inline bool ChunkDecoder::ReadRecord(std::string* record) {
   if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
+  if (ABSL_PREDICT_FALSE(lazy_values_ != nullptr)) {
+    return ReadLazyRecord(record);
+  }
   const size_t start = IntCast<size_t>(values_reader_.pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
@@ -198,6 +339,9 @@ inline bool ChunkDecoder::ReadRecord(std::string* record) {
 
 inline bool ChunkDecoder::ReadRecord(Chain* record) {
   if (ABSL_PREDICT_FALSE(index() == num_records() || !healthy())) return false;
+  if (ABSL_PREDICT_FALSE(lazy_values_ != nullptr)) {
+    return ReadLazyRecord(record);
+  }
   const size_t start = IntCast<size_t>(values_reader_.pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
@@ -215,6 +359,8 @@ inline void ChunkDecoder::SetIndex(uint64_t index) {
   RIEGELI_ASSERT(healthy())
       << "Failed precondition of ChunkDecoder::SetIndex(): " << message();
   index_ = UnsignedMin(index, num_records());
+  // Lazy values are positioned when the record is read.
+  if (lazy_values_ != nullptr) return;
   const size_t start =
       index_ == 0 ? size_t{0} : limits_[IntCast<size_t>(index_ - 1)];
   if (!values_reader_.Seek(start)) {
@@ -0,0 +1,106 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_COLUMN_VALUES_H_
+#define RIEGELI_CHUNK_ENCODING_COLUMN_VALUES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+// Values of a single proto field in records of a chunk, as found by a column
+// scan. Values are ordered by record, and within a record in the order of
+// occurrence.
+struct ColumnValues {
+  // Wire type of the values.
+  enum class Type : uint8_t {
+    kNone,     // There are no values.
+    kVarint,   // int32, int64, uint32, uint64, sint32, sint64, bool, enum.
+    kFixed32,  // fixed32, sfixed32, float.
+    kFixed64,  // fixed64, sfixed64, double.
+    kString,   // string, bytes, packed repeated field.
+  };
+
+  // Removes all values.
+  void Clear();
+
+  // Sets the type if there are no values yet. Returns false if there are
+  // values of a different type.
+  bool SetType(Type new_type);
+
+  // Returns the number of values.
+  size_t size() const { return record_indices.size(); }
+
+  // Returns the string value with the given index.
+  //
+  // Precondition:
+  //   type == Type::kString
+  //   index < size()
+  absl::string_view string(size_t index) const;
+
+  Type type = Type::kNone;
+  // Index of the record within the chunk, for each value.
+  std::vector<uint64_t> record_indices;
+  // Values if type == Type::kVarint, as they are encoded: sint32 and sint64
+  // are ZigZag encoded, negative int32 values are sign extended to 64 bits.
+  std::vector<uint64_t> varints;
+  // Values if type == Type::kFixed32.
+  std::vector<uint32_t> fixed32s;
+  // Values if type == Type::kFixed64.
+  std::vector<uint64_t> fixed64s;
+  // Concatenated values if type == Type::kString.
+  std::string strings;
+  // Sorted end positions of values in strings, if type == Type::kString.
+  std::vector<size_t> string_limits;
+};
+
+// Implementation details follow.
+
+inline void ColumnValues::Clear() {
+  type = Type::kNone;
+  record_indices.clear();
+  varints.clear();
+  fixed32s.clear();
+  fixed64s.clear();
+  strings.clear();
+  string_limits.clear();
+}
+
+inline bool ColumnValues::SetType(Type new_type) {
+  if (ABSL_PREDICT_TRUE(type == new_type)) return true;
+  if (ABSL_PREDICT_FALSE(type != Type::kNone)) return false;
+  type = new_type;
+  return true;
+}
+
+inline absl::string_view ColumnValues::string(size_t index) const {
+  RIEGELI_ASSERT(type == Type::kString)
+      << "Failed precondition of ColumnValues::string(): values not strings";
+  RIEGELI_ASSERT_LT(index, string_limits.size())
+      << "Failed precondition of ColumnValues::string(): index out of range";
+  const size_t start = index == 0 ? size_t{0} : string_limits[index - 1];
+  return absl::string_view(strings.data() + start,
+                           string_limits[index] - start);
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_COLUMN_VALUES_H_
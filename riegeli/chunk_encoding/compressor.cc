@@ -21,9 +21,11 @@
 #include "absl/types/variant.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/brotli_writer.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/bytes/writer_utils.h"
 #include "riegeli/bytes/zstd_writer.h"
@@ -68,6 +70,12 @@ void Compressor::Reset() {
               .set_window_log(options_.window_log())
               .set_size_hint(size_hint_));
       return;
+    case CompressionType::kLz4:
+      writer_ = Lz4Writer<ChainWriter<>>(
+          std::move(compressed_writer),
+          Lz4WriterBase::Options().set_compression_level(
+              options_.compression_level()));
+      return;
   }
   RIEGELI_ASSERT_UNREACHABLE()
       << "Unknown compression type: "
@@ -90,5 +98,15 @@ bool Compressor::EncodeAndClose(Writer* dest) {
   return Close();
 }
 
+void Compressor::RegisterSubobjects(MemoryEstimator* memory_estimator) const {
+  Object::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(compressed_);
+  absl::visit(
+      [memory_estimator](const Writer& writer) {
+        writer.RegisterSubobjects(memory_estimator);
+      },
+      writer_);
+}
+
 }  // namespace internal
 }  // namespace riegeli
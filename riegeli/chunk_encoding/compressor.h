@@ -20,9 +20,11 @@
 #include "absl/types/variant.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/brotli_writer.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
@@ -59,6 +61,8 @@ class Compressor : public Object {
   //  * false - failure (!healthy())
   bool EncodeAndClose(Writer* dest);
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  private:
   CompressorOptions options_;
   uint64_t size_hint_ = 0;
@@ -67,7 +71,7 @@ class Compressor : public Object {
   //   options_.compression_type() is consistent with
   //       the active member of writer_
   absl::variant<ChainWriter<>, BrotliWriter<ChainWriter<>>,
-                ZstdWriter<ChainWriter<>>>
+                ZstdWriter<ChainWriter<>>, Lz4Writer<ChainWriter<>>>
       writer_;
 };
 
@@ -21,6 +21,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/options_parser.h"
 #include "riegeli/bytes/brotli_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/constants.h"
 
@@ -36,6 +37,9 @@ constexpr int CompressorOptions::kDefaultBrotli;
 constexpr int CompressorOptions::kMinZstd;
 constexpr int CompressorOptions::kMaxZstd;
 constexpr int CompressorOptions::kDefaultZstd;
+constexpr int CompressorOptions::kMinLz4;
+constexpr int CompressorOptions::kMaxLz4;
+constexpr int CompressorOptions::kDefaultLz4;
 constexpr int CompressorOptions::kMinWindowLog;
 constexpr int CompressorOptions::kMaxWindowLog;
 constexpr int CompressorOptions::kDefaultWindowLog;
@@ -49,25 +53,32 @@ bool CompressorOptions::FromString(absl::string_view text,
     OptionsParser options_parser;
     options_parser.AddOption(
         "uncompressed",
-        ValueParser::And(ValueParser::FailIfSeen("brotli", "zstd"),
+        ValueParser::And(ValueParser::FailIfSeen("brotli", "zstd", "lz4"),
                          [this](ValueParser* value_parser) {
                            compression_type_ = CompressionType::kNone;
                            return true;
                          }));
     options_parser.AddOption(
         "brotli",
-        ValueParser::And(ValueParser::FailIfSeen("uncompressed", "zstd"),
+        ValueParser::And(ValueParser::FailIfSeen("uncompressed", "zstd", "lz4"),
                          [this](ValueParser* value_parser) {
                            compression_type_ = CompressionType::kBrotli;
                            return true;
                          }));
     options_parser.AddOption(
-        "zstd",
-        ValueParser::And(ValueParser::FailIfSeen("uncompressed", "brotli"),
-                         [this](ValueParser* value_parser) {
-                           compression_type_ = CompressionType::kZstd;
-                           return true;
-                         }));
+        "zstd", ValueParser::And(
+                    ValueParser::FailIfSeen("uncompressed", "brotli", "lz4"),
+                    [this](ValueParser* value_parser) {
+                      compression_type_ = CompressionType::kZstd;
+                      return true;
+                    }));
+    options_parser.AddOption(
+        "lz4", ValueParser::And(
+                   ValueParser::FailIfSeen("uncompressed", "brotli", "zstd"),
+                   [this](ValueParser* value_parser) {
+                     compression_type_ = CompressionType::kLz4;
+                     return true;
+                   }));
     options_parser.AddOption("window_log",
                              [](ValueParser* value_parser) { return true; });
     if (ABSL_PREDICT_FALSE(!options_parser.FromString(text))) {
@@ -99,6 +110,17 @@ bool CompressorOptions::FromString(absl::string_view text,
           ValueParser::Int(&compression_level_,
                            ZstdWriterBase::Options::kMinCompressionLevel,
                            ZstdWriterBase::Options::kMaxCompressionLevel)));
+  options_parser.AddOption(
+      "lz4",
+      ValueParser::And(
+          ValueParser::FailIfSeen("window_log"),
+          ValueParser::Or(
+              ValueParser::Empty(
+                  &compression_level_,
+                  Lz4WriterBase::Options::kDefaultCompressionLevel),
+              ValueParser::Int(&compression_level_,
+                               Lz4WriterBase::Options::kMinCompressionLevel,
+                               Lz4WriterBase::Options::kMaxCompressionLevel))));
   options_parser.AddOption("window_log", [&] {
     switch (compression_type_) {
       case CompressionType::kNone:
@@ -115,6 +137,8 @@ bool CompressorOptions::FromString(absl::string_view text,
             ValueParser::Int(&window_log_,
                              ZstdWriterBase::Options::kMinWindowLog,
                              ZstdWriterBase::Options::kMaxWindowLog));
+      case CompressionType::kLz4:
+        return ValueParser::FailIfSeen("lz4");
     }
     RIEGELI_ASSERT_UNREACHABLE() << "Unknown compression type: "
                                  << static_cast<unsigned>(compression_type_);
@@ -158,6 +182,10 @@ int CompressorOptions::window_log() const {
                "window log out of range for zstd";
         return window_log_;
       }
+    case CompressionType::kLz4:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed precondition of CompressorOptions::window_log(): "
+             "lz4 has a fixed window";
   }
   RIEGELI_ASSERT_UNREACHABLE() << "Unknown compression type: "
                                << static_cast<unsigned>(compression_type_);
@@ -21,6 +21,7 @@
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/bytes/brotli_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/constants.h"
 
@@ -37,9 +38,11 @@ class CompressorOptions {
   //     "uncompressed" |
   //     "brotli" (":" brotli_level)? |
   //     "zstd" (":" zstd_level)? |
+  //     "lz4" (":" lz4_level)? |
   //     "window_log" ":" window_log
   //   brotli_level ::= integer 0..11 (default 9)
   //   zstd_level ::= integer -32..22 (default 9)
+  //   lz4_level ::= integer -32..12 (default 0)
   //   window_log ::= "auto" or integer 10..31
   //
   // Return values:
@@ -111,6 +114,35 @@ class CompressorOptions {
     return std::move(set_zstd(compression_level));
   }
 
+  // Changes compression algorithm to LZ4. Sets compression level which tunes
+  // the tradeoff between compression density and compression speed (higher =
+  // better density but slower).
+  //
+  // LZ4 is much faster than Brotli or Zstd but compresses worse. It is suitable
+  // for short-lived data where throughput matters more than size.
+  //
+  // compression_level must be between kMinLz4 (-32) and kMaxLz4 (12). Negative
+  // levels select the fast acceleration mode, levels 3 and above select the
+  // high compression mode. Default: kDefaultLz4 (0).
+  static constexpr int kMinLz4 = Lz4WriterBase::Options::kMinCompressionLevel;
+  static constexpr int kMaxLz4 = Lz4WriterBase::Options::kMaxCompressionLevel;
+  static constexpr int kDefaultLz4 =
+      Lz4WriterBase::Options::kDefaultCompressionLevel;
+  CompressorOptions& set_lz4(int compression_level = kDefaultLz4) & {
+    RIEGELI_ASSERT_GE(compression_level, kMinLz4)
+        << "Failed precondition of CompressorOptions::set_lz4(): "
+           "compression level out of range";
+    RIEGELI_ASSERT_LE(compression_level, kMaxLz4)
+        << "Failed precondition of CompressorOptions::set_lz4(): "
+           "compression level out of range";
+    compression_type_ = CompressionType::kLz4;
+    compression_level_ = compression_level;
+    return *this;
+  }
+  CompressorOptions&& set_lz4(int compression_level = kDefaultLz4) && {
+    return std::move(set_lz4(compression_level));
+  }
+
   CompressionType compression_type() const { return compression_type_; }
 
   int compression_level() const { return compression_level_; }
@@ -122,7 +154,7 @@ class CompressorOptions {
   // Special value kDefaultWindowLog (-1) means to keep the default
   // (brotli: 22, zstd: derived from compression level and chunk size).
   //
-  // For uncompressed, window_log must be kDefaultWindowLog (-1).
+  // For uncompressed and lz4, window_log must be kDefaultWindowLog (-1).
   //
   // For brotli, window_log must be kDefaultWindowLog (-1) or between
   // BrotliWriterBase::Options::kMinWindowLog (10) and
@@ -159,7 +191,9 @@ class CompressorOptions {
 
   // Returns window_log translated for BrotliWriter or ZstdWriter.
   //
-  // Precondition: compression_type_ != CompressionType::kNone
+  // Precondition:
+  //   compression_type_ == CompressionType::kBrotli ||
+  //   compression_type_ == CompressionType::kZstd
   int window_log() const;
 
  private:
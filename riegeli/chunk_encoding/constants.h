@@ -29,6 +29,7 @@ enum class ChunkType : uint8_t {
   kPadding = 'p',
   kSimple = 'r',
   kTransposed = 't',
+  kFramed = 'f',
 };
 
 // These values are frozen in the file format.
@@ -36,6 +37,7 @@ enum class CompressionType : uint8_t {
   kNone = 0,
   kBrotli = 'b',
   kZstd = 'z',
+  kLz4 = 'l',
 };
 
 RIEGELI_INLINE_CONSTEXPR(uint64_t, kMaxNumRecords,
@@ -14,13 +14,23 @@
 
 #include "riegeli/chunk_encoding/decompressor.h"
 
+#include <stddef.h>
 #include <stdint.h>
+#include <memory>
+#include <string>
 
+#include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "zstd.h"
 
 namespace riegeli {
 namespace internal {
@@ -36,6 +46,53 @@ bool UncompressedSize(const Chain& compressed_data,
   return ReadVarint64(&compressed_data_reader, uncompressed_size);
 }
 
+namespace {
+
+struct ZSTD_DCtxDeleter {
+  void operator()(ZSTD_DCtx* ptr) const { ZSTD_freeDCtx(ptr); }
+};
+
+// ZSTD_DCtx objects are reused across chunks and buckets.
+using DCtxPool = RecyclingPool<ZSTD_DCtx, ZSTD_DCtxDeleter>;
+
+}  // namespace
+
+bool DecompressZstd(Reader* src, uint64_t decompressed_size, Chain* dest,
+                    std::string* message) {
+  RIEGELI_ASSERT_LE(decompressed_size, kMaxZstdOneShotSize)
+      << "Failed precondition of DecompressZstd(): "
+         "decompressed size too large";
+  absl::string_view compressed;
+  std::string scratch;
+  if (ABSL_PREDICT_FALSE(!ReadAll(src, &compressed, &scratch))) return false;
+  const DCtxPool::Handle decompressor = DCtxPool::global().Get([] {
+    return std::unique_ptr<ZSTD_DCtx, ZSTD_DCtxDeleter>(ZSTD_createDCtx());
+  });
+  if (ABSL_PREDICT_FALSE(decompressor == nullptr)) {
+    *message = "ZSTD_createDCtx() failed";
+    return false;
+  }
+  const size_t size = IntCast<size_t>(decompressed_size);
+  const absl::Span<char> buffer = dest->AppendBuffer(size, size, size);
+  // ZSTD_decompressDCtx() starts a new frame, discarding any state left in a
+  // ZSTD_DCtx reused from DCtxPool.
+  const size_t result =
+      ZSTD_decompressDCtx(decompressor.get(), buffer.data(), size,
+                          compressed.data(), compressed.size());
+  if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+    dest->RemoveSuffix(buffer.size());
+    *message = absl::StrCat("ZSTD_decompressDCtx() failed: ",
+                            ZSTD_getErrorName(result));
+    return false;
+  }
+  dest->RemoveSuffix(buffer.size() - result);
+  if (ABSL_PREDICT_FALSE(result != size)) {
+    *message = "Decompressed size smaller than expected";
+    return false;
+  }
+  return true;
+}
+
 template class Decompressor<Reader*>;
 template class Decompressor<std::unique_ptr<Reader>>;
 
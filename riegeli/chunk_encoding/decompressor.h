@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
@@ -25,8 +26,11 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/brotli_reader.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/lz4_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
 #include "riegeli/bytes/zstd_reader.h"
@@ -48,6 +52,24 @@ bool UncompressedSize(const Chain& compressed_data,
                       CompressionType compression_type,
                       uint64_t* uncompressed_size);
 
+// Zstd-compressed data with a known decompressed size of at most this many
+// bytes are decompressed at once by DecompressZstd() rather than incrementally
+// by ZstdReader. The decompressed size is read from the input and space for it
+// is allocated upfront, so it is trusted only up to this limit.
+constexpr uint64_t kMaxZstdOneShotSize = uint64_t{16} << 20;
+
+// Reads all remaining Zstd-compressed data from *src and decompresses them at
+// once with ZSTD_decompressDCtx() into *dest, which avoids the buffering of
+// ZstdReader.
+//
+// Precondition: decompressed_size <= kMaxZstdOneShotSize
+//
+// Return values:
+//  * true  - success
+//  * false - failure (if src->healthy() then *message is set)
+bool DecompressZstd(Reader* src, uint64_t decompressed_size, Chain* dest,
+                    std::string* message);
+
 template <typename Src = Reader*>
 class Decompressor : public Object {
  public:
@@ -83,11 +105,15 @@ class Decompressor : public Object {
   // Decompressor if not.
   void VerifyEnd();
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  protected:
   void Done() override;
 
  private:
-  absl::variant<Dependency<Reader*, Src>, BrotliReader<Src>, ZstdReader<Src>>
+  // ChainReader<Chain> holds data decompressed at once by DecompressZstd().
+  absl::variant<Dependency<Reader*, Src>, BrotliReader<Src>, ZstdReader<Src>,
+                Lz4Reader<Src>, ChainReader<Chain>>
       reader_;
 };
 
@@ -113,8 +139,34 @@ Decompressor<Src>::Decompressor(Src src, CompressionType compression_type)
     case CompressionType::kBrotli:
       reader_ = BrotliReader<Src>(std::move(compressed_reader.manager()));
       return;
-    case CompressionType::kZstd:
-      reader_ = ZstdReader<Src>(std::move(compressed_reader.manager()));
+    case CompressionType::kZstd: {
+      if (decompressed_size > kMaxZstdOneShotSize) {
+        reader_ = ZstdReader<Src>(std::move(compressed_reader.manager()));
+        return;
+      }
+      Chain decompressed;
+      std::string message;
+      if (ABSL_PREDICT_FALSE(!DecompressZstd(compressed_reader.ptr(),
+                                             decompressed_size, &decompressed,
+                                             &message))) {
+        if (ABSL_PREDICT_FALSE(!compressed_reader->healthy())) {
+          Fail(*compressed_reader);
+        } else {
+          Fail(message);
+        }
+        return;
+      }
+      if (compressed_reader.is_owning()) {
+        if (ABSL_PREDICT_FALSE(!compressed_reader->Close())) {
+          Fail(*compressed_reader);
+          return;
+        }
+      }
+      reader_ = ChainReader<Chain>(std::move(decompressed));
+      return;
+    }
+    case CompressionType::kLz4:
+      reader_ = Lz4Reader<Src>(std::move(compressed_reader.manager()));
       return;
   }
   Fail(absl::StrCat("Unknown compression type: ",
@@ -172,11 +224,34 @@ template <typename Src>
 inline void Decompressor<Src>::VerifyEnd() {
   struct Visitor {
     void operator()(Dependency<Reader*, Src>& reader) const {
-      if (reader.is_owning()) reader->VerifyEnd();
+      if (reader.is_owning()) {
+        reader->VerifyEnd();
+        if (ABSL_PREDICT_FALSE(!reader->healthy())) self->Fail(*reader);
+      }
+    }
+    void operator()(Reader& reader) const {
+      reader.VerifyEnd();
+      if (ABSL_PREDICT_FALSE(!reader.healthy())) self->Fail(reader);
+    }
+    Decompressor* self;
+  };
+  if (ABSL_PREDICT_TRUE(healthy())) absl::visit(Visitor{this}, reader_);
+}
+
+template <typename Src>
+void Decompressor<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  struct Visitor {
+    void operator()(const Dependency<Reader*, Src>& reader) const {
+      memory_estimator->RegisterSubobjects(reader.manager());
+    }
+    void operator()(const Reader& reader) const {
+      reader.RegisterSubobjects(memory_estimator);
     }
-    void operator()(Reader& reader) const { reader.VerifyEnd(); }
+    MemoryEstimator* memory_estimator;
   };
-  if (ABSL_PREDICT_TRUE(healthy())) absl::visit(Visitor(), reader_);
+  Object::RegisterSubobjects(memory_estimator);
+  absl::visit(Visitor{memory_estimator}, reader_);
 }
 
 extern template class Decompressor<Reader*>;
@@ -26,6 +26,7 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/message_serialize.h"
 #include "riegeli/chunk_encoding/constants.h"
@@ -139,4 +140,12 @@ bool DeferredEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
   return Close();
 }
 
+void DeferredEncoder::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ChunkEncoder::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(base_encoder_);
+  memory_estimator->RegisterSubobjects(records_writer_);
+  memory_estimator->RegisterSubobjects(limits_);
+}
+
 }  // namespace riegeli
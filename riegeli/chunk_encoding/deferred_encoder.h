@@ -25,6 +25,7 @@
 #include "absl/strings/string_view.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
@@ -54,6 +55,8 @@ class DeferredEncoder : public ChunkEncoder {
                       uint64_t* num_records,
                       uint64_t* decoded_data_size) override;
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  private:
   template <typename Record>
   bool AddRecordImpl(Record&& record);
@@ -16,10 +16,14 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <algorithm>
 #include <limits>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/limiting_reader.h"
 #include "riegeli/bytes/reader.h"
@@ -33,11 +37,12 @@ void SimpleDecoder::Done() {
   if (ABSL_PREDICT_FALSE(!values_decompressor_.Close())) {
     Fail(values_decompressor_);
   }
+  if (ABSL_PREDICT_FALSE(!frame_src_.Close())) Fail(frame_src_);
 }
 
 bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
                           uint64_t decoded_data_size,
-                          std::vector<size_t>* limits) {
+                          std::vector<size_t>* limits, bool framed) {
   MarkHealthy();
   if (ABSL_PREDICT_FALSE(num_records > limits->max_size())) {
     return Fail("Too many records");
@@ -70,16 +75,23 @@ bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
   }
   limits->clear();
   size_t limit = 0;
+  // Sizes are decoded in batches, which is faster than one at a time.
+  constexpr size_t kMaxNumSizes = 256;
+  uint64_t sizes[kMaxNumSizes];
   while (limits->size() != num_records) {
-    uint64_t size;
-    if (ABSL_PREDICT_FALSE(!ReadVarint64(sizes_decompressor.reader(), &size))) {
+    const size_t num_sizes = UnsignedMin(
+        IntCast<size_t>(num_records) - limits->size(), kMaxNumSizes);
+    if (ABSL_PREDICT_FALSE(
+            !ReadVarints64(sizes_decompressor.reader(), num_sizes, sizes))) {
       return Fail("Reading record size failed", *sizes_decompressor.reader());
     }
-    if (ABSL_PREDICT_FALSE(size > decoded_data_size - limit)) {
-      return Fail("Decoded data size larger than expected");
+    for (size_t i = 0; i < num_sizes; ++i) {
+      if (ABSL_PREDICT_FALSE(sizes[i] > decoded_data_size - limit)) {
+        return Fail("Decoded data size larger than expected");
+      }
+      limit += IntCast<size_t>(sizes[i]);
+      limits->push_back(limit);
     }
-    limit += IntCast<size_t>(size);
-    limits->push_back(limit);
   }
   if (ABSL_PREDICT_FALSE(!sizes_decompressor.VerifyEndAndClose())) {
     return Fail(sizes_decompressor);
@@ -88,16 +100,237 @@ bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
     return Fail("Decoded data size smaller than expected");
   }
 
-  values_decompressor_ = internal::Decompressor<>(src, compression_type);
+  compression_type_ = compression_type;
+  frames_.clear();
+  if (framed) {
+    if (ABSL_PREDICT_FALSE(!ReadFrames(src, num_records, *limits))) {
+      return false;
+    }
+  } else {
+    frames_.push_back(Frame{0, src->pos()});
+    frames_.push_back(
+        Frame{decoded_data_size, LimitingReaderBase::kNoSizeLimit});
+  }
+  frame_src_ = LimitingReader<>(src);
+  return StartFrame(0);
+}
+
+inline bool SimpleDecoder::ReadFrames(Reader* src, uint64_t num_records,
+                                      const std::vector<size_t>& limits) {
+  uint64_t num_frames;
+  if (ABSL_PREDICT_FALSE(!ReadVarint64(src, &num_frames))) {
+    return Fail("Reading number of frames failed", *src);
+  }
+  // Frames end at record boundaries, so there are no more frames than records,
+  // except for a single empty frame if there are no records.
+  if (ABSL_PREDICT_FALSE(num_frames == 0 ||
+                         num_frames > UnsignedMax(num_records, uint64_t{1}))) {
+    return Fail("Invalid number of frames");
+  }
+  frames_.reserve(IntCast<size_t>(num_frames) + 1);
+  // src_begin of frames is first computed relative to the end of the frame
+  // table, which is not known yet.
+  uint64_t record_index = 0;
+  Position src_offset = 0;
+  for (uint64_t i = 0; i < num_frames; ++i) {
+    uint64_t frame_num_records, compressed_frame_size;
+    if (ABSL_PREDICT_FALSE(!ReadVarint64(src, &frame_num_records)) ||
+        ABSL_PREDICT_FALSE(!ReadVarint64(src, &compressed_frame_size))) {
+      return Fail("Reading frame table failed", *src);
+    }
+    frames_.push_back(Frame{
+        record_index == 0 ? Position{0}
+                          : Position{limits[IntCast<size_t>(record_index - 1)]},
+        src_offset});
+    if (ABSL_PREDICT_FALSE(frame_num_records > num_records - record_index)) {
+      return Fail("Number of records in frames larger than expected");
+    }
+    record_index += frame_num_records;
+    if (ABSL_PREDICT_FALSE(compressed_frame_size >
+                           std::numeric_limits<Position>::max() - src_offset)) {
+      return Fail("Frame sizes too large");
+    }
+    src_offset += compressed_frame_size;
+  }
+  if (ABSL_PREDICT_FALSE(record_index != num_records)) {
+    return Fail("Number of records in frames smaller than expected");
+  }
+  frames_.push_back(Frame{
+      limits.empty() ? Position{0} : Position{limits.back()}, src_offset});
+  const Position frames_src_begin = src->pos();
+  if (ABSL_PREDICT_FALSE(src_offset >
+                         std::numeric_limits<Position>::max() -
+                             frames_src_begin)) {
+    return Fail("Frame sizes too large");
+  }
+  for (Frame& frame : frames_) frame.src_begin += frames_src_begin;
+  return true;
+}
+
+bool SimpleDecoder::StartFrame(size_t frame_index) {
+  RIEGELI_ASSERT_LT(frame_index + 1, frames_.size())
+      << "Failed precondition of SimpleDecoder::StartFrame(): "
+         "frame index out of range";
+  frame_src_.set_size_limit(LimitingReaderBase::kNoSizeLimit);
+  if (ABSL_PREDICT_FALSE(!frame_src_.Seek(frames_[frame_index].src_begin))) {
+    return Fail("Seeking to record values failed", frame_src_);
+  }
+  frame_src_.set_size_limit(frames_[frame_index + 1].src_begin);
+  values_decompressor_ =
+      internal::Decompressor<>(&frame_src_, compression_type_);
   if (ABSL_PREDICT_FALSE(!values_decompressor_.healthy())) {
     return Fail(values_decompressor_);
   }
+  frame_index_ = frame_index;
+  frame_reader_begin_ = values_decompressor_.reader()->pos();
   return true;
 }
 
-bool SimpleDecoder::VerifyEndAndClose() {
+inline bool SimpleDecoder::VerifyFrameEnd() {
   values_decompressor_.VerifyEnd();
+  if (ABSL_PREDICT_FALSE(!values_decompressor_.healthy())) {
+    return Fail(values_decompressor_);
+  }
+  Reader* const frame_src = &frame_src_;
+  frame_src->VerifyEnd();
+  if (ABSL_PREDICT_FALSE(!frame_src->healthy())) {
+    return Fail("Invalid frame", *frame_src);
+  }
+  return true;
+}
+
+bool SimpleDecoder::SeekValues(Position new_pos) {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of SimpleDecoder::SeekValues(): " << message();
+  size_t frame_index = frame_index_;
+  if (new_pos < frames_[frame_index].values_begin ||
+      new_pos >= frames_[frame_index + 1].values_begin) {
+    if (ABSL_PREDICT_FALSE(new_pos > frames_.back().values_begin)) {
+      return Fail("Record values position out of range");
+    }
+    // Find the last frame (excluding the sentinel) which begins at or before
+    // new_pos. At a frame boundary this is the later frame, which contains
+    // the record beginning there.
+    const std::vector<Frame>::const_iterator next_frame = std::upper_bound(
+        frames_.cbegin() + 1, frames_.cend() - 1, new_pos,
+        [](Position pos, const Frame& frame) {
+          return pos < frame.values_begin;
+        });
+    frame_index = IntCast<size_t>(next_frame - frames_.cbegin()) - 1;
+  }
+  if (frame_index != frame_index_) {
+    if (frame_index > frame_index_ &&
+        values_pos() == frames_[frame_index_ + 1].values_begin) {
+      // The current frame was read to its end. Verify that it has no more
+      // data before leaving it. Empty frames passed on the way to new_pos are
+      // verified too, because they were read to their end as well.
+      if (ABSL_PREDICT_FALSE(!VerifyFrameEnd())) return false;
+      while (frame_index_ + 1 < frame_index &&
+             frames_[frame_index_ + 1].values_begin ==
+                 frames_[frame_index_ + 2].values_begin) {
+        if (ABSL_PREDICT_FALSE(!StartFrame(frame_index_ + 1)) ||
+            ABSL_PREDICT_FALSE(!VerifyFrameEnd())) {
+          return false;
+        }
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!StartFrame(frame_index))) return false;
+  } else if (new_pos < values_pos() && !reader()->SupportsRandomAccess()) {
+    // Seeking backwards is not supported by the decompressor. Decompress again
+    // from the beginning of the frame. This does not try to seek backwards
+    // within the buffer, because after VerifyEnd() the buffer is no longer
+    // valid.
+    if (ABSL_PREDICT_FALSE(!StartFrame(frame_index))) return false;
+  }
+  Reader* const reader = values_decompressor_.reader();
+  if (ABSL_PREDICT_FALSE(!reader->Seek(
+          frame_reader_begin_ +
+          (new_pos - frames_[frame_index_].values_begin)))) {
+    return Fail("Record values truncated", *reader);
+  }
+  return true;
+}
+
+inline bool SimpleDecoder::PrepareReadValues(size_t length,
+                                             size_t* length_in_frame) {
+  Position pos = values_pos();
+  if (pos == frames_[frame_index_ + 1].values_begin) {
+    // The current frame is exhausted. Continue with the next non-empty frame.
+    if (ABSL_PREDICT_FALSE(!SeekValues(pos))) return false;
+  }
+  *length_in_frame = IntCast<size_t>(UnsignedMin(
+      Position{length}, frames_[frame_index_ + 1].values_begin - pos));
+  if (ABSL_PREDICT_FALSE(*length_in_frame == 0)) {
+    return Fail("Reading beyond the end of record values");
+  }
+  return true;
+}
+
+bool SimpleDecoder::ReadValues(char* dest, size_t length) {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of SimpleDecoder::ReadValues(char*): "
+      << message();
+  while (length > 0) {
+    size_t length_in_frame;
+    if (ABSL_PREDICT_FALSE(!PrepareReadValues(length, &length_in_frame))) {
+      return false;
+    }
+    if (ABSL_PREDICT_FALSE(!reader()->Read(dest, length_in_frame))) {
+      return Fail("Record values truncated", *reader());
+    }
+    dest += length_in_frame;
+    length -= length_in_frame;
+  }
+  return true;
+}
+
+bool SimpleDecoder::ReadValues(Chain* dest, size_t length) {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of SimpleDecoder::ReadValues(Chain*): "
+      << message();
+  while (length > 0) {
+    size_t length_in_frame;
+    if (ABSL_PREDICT_FALSE(!PrepareReadValues(length, &length_in_frame))) {
+      return false;
+    }
+    if (ABSL_PREDICT_FALSE(!reader()->Read(dest, length_in_frame))) {
+      return Fail("Record values truncated", *reader());
+    }
+    length -= length_in_frame;
+  }
+  return true;
+}
+
+void SimpleDecoder::VerifyEnd() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+  const Position end_pos = frames_.back().values_begin;
+  if (ABSL_PREDICT_FALSE(values_pos() != end_pos)) {
+    Fail("End of record values expected");
+    return;
+  }
+  // Pass any empty frames at the end.
+  if (ABSL_PREDICT_FALSE(!SeekValues(end_pos))) return;
+  if (ABSL_PREDICT_FALSE(!VerifyFrameEnd())) return;
+  // The last frame ends at the end of the chunk.
+  SizeLimitSetter no_size_limit(&frame_src_, LimitingReaderBase::kNoSizeLimit);
+  Reader* const frame_src = &frame_src_;
+  frame_src->VerifyEnd();
+  if (ABSL_PREDICT_FALSE(!frame_src->healthy())) {
+    Fail("Invalid chunk", *frame_src);
+  }
+}
+
+bool SimpleDecoder::VerifyEndAndClose() {
+  VerifyEnd();
   return Close();
 }
 
+void SimpleDecoder::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Object::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(frames_);
+  memory_estimator->RegisterSubobjects(frame_src_);
+  memory_estimator->RegisterSubobjects(values_decompressor_);
+}
+
 }  // namespace riegeli
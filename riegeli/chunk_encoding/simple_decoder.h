@@ -20,8 +20,12 @@
 #include <vector>
 
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/bytes/limiting_reader.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/decompressor.h"
 
 namespace riegeli {
@@ -35,6 +39,10 @@ class SimpleDecoder : public Object {
 
   // Resets the SimpleDecoder and parses the chunk.
   //
+  // If framed is true, the chunk is a framed chunk (ChunkType::kFramed), where
+  // record values are compressed in independent frames, otherwise it is a
+  // simple chunk (ChunkType::kSimple).
+  //
   // Makes concatenated record values available for reading from reader().
   // Sets *limits to sorted record end positions.
   //
@@ -45,13 +53,52 @@ class SimpleDecoder : public Object {
   //  * true  - success (healthy())
   //  * false - failure (!healthy())
   bool Reset(Reader* src, uint64_t num_records, uint64_t decoded_data_size,
-             std::vector<size_t>* limits);
+             std::vector<size_t>* limits, bool framed = false);
 
   // Returns the Reader from which concatenated record values should be read.
   //
+  // In a framed chunk, reader() ends at the end of the current frame. Frames
+  // end at record boundaries, so a record can be read from reader() after
+  // SeekValues() to its beginning.
+  //
   // Precondition: healthy()
   Reader* reader();
 
+  // Returns the position of reader() relative to the beginning of concatenated
+  // record values.
+  //
+  // Precondition: healthy()
+  Position values_pos();
+
+  // Positions reader() at new_pos relative to the beginning of concatenated
+  // record values.
+  //
+  // Values are decompressed only as far as needed. In a framed chunk, only the
+  // frame containing new_pos is decompressed. If new_pos is before the current
+  // position and reader() does not support seeking backwards, decompression
+  // restarts from the beginning of the frame, which requires the src passed to
+  // Reset() to support random access.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool SeekValues(Position new_pos);
+
+  // Reads length bytes of concatenated record values, crossing frame
+  // boundaries if needed.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool ReadValues(char* dest, size_t length);
+  bool ReadValues(Chain* dest, size_t length);
+
+  // Verifies that the concatenated record values end at the current position,
+  // and that the chunk has no data after them, failing the SimpleDecoder if
+  // not. Unlike VerifyEndAndClose(), keeps the SimpleDecoder open, so that
+  // SeekValues() can still be used.
+  void VerifyEnd();
+
   // Verifies that the concatenated record values end at the current position,
   // failing the SimpleDecoder if not. Closes the SimpleDecoder.
   //
@@ -62,10 +109,42 @@ class SimpleDecoder : public Object {
   //            position or the SimpleDecoder was not healthy before closing)
   bool VerifyEndAndClose();
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  protected:
   void Done() override;
 
  private:
+  struct Frame {
+    // Position in concatenated record values where the frame begins.
+    Position values_begin;
+    // Position of the src passed to Reset() where compressed data of the frame
+    // begin.
+    Position src_begin;
+  };
+
+  bool ReadFrames(Reader* src, uint64_t num_records,
+                  const std::vector<size_t>& limits);
+  bool StartFrame(size_t frame_index);
+  bool VerifyFrameEnd();
+  // Moves to the next non-empty frame if the current frame is exhausted, and
+  // sets *length_in_frame to how many of the next length bytes of record values
+  // can be read from the current frame.
+  bool PrepareReadValues(size_t length, size_t* length_in_frame);
+
+  CompressionType compression_type_ = CompressionType::kNone;
+  // Frames in the order of their positions, followed by a sentinel with the
+  // end positions. A simple chunk has a single frame, with the end of its
+  // compressed data not known in advance (LimitingReaderBase::kNoSizeLimit).
+  //
+  // Invariant if healthy(): frames_.size() >= 2
+  std::vector<Frame> frames_;
+  // Invariant if healthy(): frame_index_ + 1 < frames_.size()
+  size_t frame_index_ = 0;
+  // Reads compressed data of the current frame from the src passed to Reset().
+  LimitingReader<> frame_src_;
+  // Position of reader() where the current frame begins.
+  Position frame_reader_begin_ = 0;
   internal::Decompressor<> values_decompressor_;
 };
 
@@ -77,6 +156,11 @@ inline Reader* SimpleDecoder::reader() {
   return values_decompressor_.reader();
 }
 
+inline Position SimpleDecoder::values_pos() {
+  return frames_[frame_index_].values_begin +
+         (reader()->pos() - frame_reader_begin_);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_CHUNK_ENCODING_SIMPLE_DECODER_H_
@@ -0,0 +1,140 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests of SimpleDecoder on framed chunks written by hand, including frames
+// which SimpleEncoder does not write: empty frames, and frames with data after
+// their record values. Data after record values in any frame passed while
+// reading must make decoding fail.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/string_reader.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/simple_decoder.h"
+
+namespace riegeli {
+namespace {
+
+void AppendVarint(uint64_t value, std::string* dest) {
+  while (value >= 0x80) {
+    dest->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  dest->push_back(static_cast<char>(value));
+}
+
+struct Frame {
+  // Record values in the frame.
+  std::vector<std::string> records;
+  // Data after record values, which make the frame invalid if not empty.
+  std::string garbage;
+};
+
+// Returns an uncompressed framed chunk with the given frames.
+std::string FramedChunk(const std::vector<Frame>& frames) {
+  std::string sizes;
+  for (const Frame& frame : frames) {
+    for (const std::string& record : frame.records) {
+      AppendVarint(record.size(), &sizes);
+    }
+  }
+  std::string chunk;
+  chunk.push_back(static_cast<char>(CompressionType::kNone));
+  AppendVarint(sizes.size(), &chunk);
+  chunk.append(sizes);
+  AppendVarint(frames.size(), &chunk);
+  std::string frames_data;
+  for (const Frame& frame : frames) {
+    const size_t frame_begin = frames_data.size();
+    for (const std::string& record : frame.records) frames_data.append(record);
+    frames_data.append(frame.garbage);
+    AppendVarint(frame.records.size(), &chunk);
+    AppendVarint(frames_data.size() - frame_begin, &chunk);
+  }
+  chunk.append(frames_data);
+  return chunk;
+}
+
+// Decodes "chunk" by reading all records in order and verifying the end.
+// Returns true if this succeeded with the expected records.
+bool DecodeSequentially(absl::string_view chunk,
+                        const std::vector<Frame>& frames) {
+  std::vector<std::string> records;
+  size_t decoded_data_size = 0;
+  for (const Frame& frame : frames) {
+    for (const std::string& record : frame.records) {
+      records.push_back(record);
+      decoded_data_size += record.size();
+    }
+  }
+  StringReader<> src(chunk);
+  SimpleDecoder decoder;
+  std::vector<size_t> limits;
+  if (!decoder.Reset(&src, records.size(), decoded_data_size, &limits,
+                     true)) {
+    return false;
+  }
+  for (const std::string& record : records) {
+    std::string value(record.size(), '\0');
+    if (!decoder.ReadValues(&value[0], value.size())) return false;
+    RIEGELI_CHECK(value == record) << "Record differs";
+  }
+  return decoder.VerifyEndAndClose();
+}
+
+void TestFrames() {
+  const std::vector<std::vector<Frame>> valid_chunks = {
+      {{{"ab"}, ""}},
+      {{{"ab"}, ""}, {{""}, ""}, {{"cd"}, ""}},
+      {{{"ab"}, ""}, {{""}, ""}, {{"", ""}, ""}, {{"cd", "e"}, ""}},
+      {{{"ab"}, ""}, {{""}, ""}, {{""}, ""}},
+      {{{""}, ""}, {{""}, ""}},
+  };
+  for (const std::vector<Frame>& frames : valid_chunks) {
+    RIEGELI_CHECK(DecodeSequentially(FramedChunk(frames), frames))
+        << "Decoding a valid chunk failed";
+  }
+
+  const std::vector<std::vector<Frame>> invalid_chunks = {
+      // Data after the last frame.
+      {{{"ab"}, "X"}},
+      // Data after a frame followed by an empty frame.
+      {{{"ab"}, "X"}, {{""}, ""}, {{"cd"}, ""}},
+      // Data after an empty frame between non-empty frames.
+      {{{"ab"}, ""}, {{""}, "X"}, {{"cd"}, ""}},
+      {{{"ab"}, ""}, {{""}, ""}, {{""}, "X"}, {{"cd"}, ""}},
+      // Data after an empty frame at the end.
+      {{{"ab"}, ""}, {{""}, "X"}, {{""}, ""}},
+      {{{"ab"}, ""}, {{""}, ""}, {{""}, "X"}},
+      // Data after an empty frame at the beginning.
+      {{{""}, "X"}, {{""}, ""}, {{"ab"}, ""}},
+  };
+  for (const std::vector<Frame>& frames : invalid_chunks) {
+    RIEGELI_CHECK(!DecodeSequentially(FramedChunk(frames), frames))
+        << "Data after record values of a frame were not detected";
+  }
+}
+
+}  // namespace
+}  // namespace riegeli
+
+int main() {
+  riegeli::TestFrames();
+  return 0;
+}
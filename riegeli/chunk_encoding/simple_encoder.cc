@@ -26,7 +26,9 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/message_serialize.h"
 #include "riegeli/bytes/writer.h"
@@ -36,15 +38,52 @@
 
 namespace riegeli {
 
-SimpleEncoder::SimpleEncoder(CompressorOptions options, uint64_t size_hint)
+SimpleEncoder::SimpleEncoder(CompressorOptions options, uint64_t size_hint,
+                             uint64_t frame_size)
     : compression_type_(options.compression_type()),
+      frame_size_(compression_type_ == CompressionType::kNone ? uint64_t{0}
+                                                              : frame_size),
       sizes_compressor_(options),
-      values_compressor_(options, size_hint) {}
+      values_compressor_(options, frame_size_ == 0
+                                      ? size_hint
+                                      : UnsignedMin(size_hint, frame_size_)) {}
 
 void SimpleEncoder::Reset() {
   ChunkEncoder::Reset();
   sizes_compressor_.Reset();
   values_compressor_.Reset();
+  frames_.clear();
+  compressed_frames_.Clear();
+  frame_num_records_ = 0;
+  frame_decoded_size_ = 0;
+}
+
+inline bool SimpleEncoder::AddedToFrame(uint64_t size) {
+  ++frame_num_records_;
+  frame_decoded_size_ += size;
+  if (frame_size_ > 0 && frame_decoded_size_ >= frame_size_) {
+    return FinishFrame();
+  }
+  return true;
+}
+
+bool SimpleEncoder::FinishFrame() {
+  const size_t compressed_size_before = compressed_frames_.size();
+  ChainWriter<> compressed_frames_writer(&compressed_frames_);
+  if (ABSL_PREDICT_FALSE(
+          !values_compressor_.EncodeAndClose(&compressed_frames_writer))) {
+    return Fail(values_compressor_);
+  }
+  if (ABSL_PREDICT_FALSE(!compressed_frames_writer.Close())) {
+    return Fail(compressed_frames_writer);
+  }
+  frames_.push_back(Frame{
+      frame_num_records_,
+      IntCast<uint64_t>(compressed_frames_.size() - compressed_size_before)});
+  values_compressor_.Reset();
+  frame_num_records_ = 0;
+  frame_decoded_size_ = 0;
+  return true;
 }
 
 bool SimpleEncoder::AddRecord(const google::protobuf::MessageLite& record) {
@@ -68,7 +107,7 @@ bool SimpleEncoder::AddRecord(const google::protobuf::MessageLite& record) {
                                             &error_message))) {
     return Fail(error_message);
   }
-  return true;
+  return AddedToFrame(IntCast<uint64_t>(size));
 }
 
 bool SimpleEncoder::AddRecord(absl::string_view record) {
@@ -103,11 +142,12 @@ bool SimpleEncoder::AddRecordImpl(Record&& record) {
                                         IntCast<uint64_t>(record.size())))) {
     return Fail(*sizes_compressor_.writer());
   }
+  const uint64_t size = IntCast<uint64_t>(record.size());
   if (ABSL_PREDICT_FALSE(
           !values_compressor_.writer()->Write(std::forward<Record>(record)))) {
     return Fail(*values_compressor_.writer());
   }
-  return true;
+  return AddedToFrame(size);
 }
 
 bool SimpleEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
@@ -138,9 +178,25 @@ bool SimpleEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
     }
     start = limit;
   }
-  if (ABSL_PREDICT_FALSE(
-          !values_compressor_.writer()->Write(std::move(records)))) {
-    return Fail(*values_compressor_.writer());
+  if (frame_size_ == 0) {
+    if (ABSL_PREDICT_FALSE(
+            !values_compressor_.writer()->Write(std::move(records)))) {
+      return Fail(*values_compressor_.writer());
+    }
+    return true;
+  }
+  // Copy records one by one, so that frames end at record boundaries.
+  ChainReader<> records_reader(&records);
+  start = 0;
+  for (const size_t limit : limits) {
+    if (ABSL_PREDICT_FALSE(!records_reader.CopyTo(values_compressor_.writer(),
+                                                  limit - start))) {
+      return Fail(*values_compressor_.writer());
+    }
+    if (ABSL_PREDICT_FALSE(!AddedToFrame(IntCast<uint64_t>(limit - start)))) {
+      return false;
+    }
+    start = limit;
   }
   return true;
 }
@@ -149,7 +205,7 @@ bool SimpleEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
                                    uint64_t* num_records,
                                    uint64_t* decoded_data_size) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  *chunk_type = ChunkType::kSimple;
+  *chunk_type = frame_size_ == 0 ? ChunkType::kSimple : ChunkType::kFramed;
   *num_records = num_records_;
   *decoded_data_size = decoded_data_size_;
 
@@ -173,10 +229,40 @@ bool SimpleEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
     return Fail(*dest);
   }
 
-  if (ABSL_PREDICT_FALSE(!values_compressor_.EncodeAndClose(dest))) {
-    return Fail(values_compressor_);
+  if (frame_size_ == 0) {
+    if (ABSL_PREDICT_FALSE(!values_compressor_.EncodeAndClose(dest))) {
+      return Fail(values_compressor_);
+    }
+    return Close();
+  }
+
+  // Finish the last frame. There is always at least one frame, possibly empty.
+  if (frame_num_records_ > 0 || frames_.empty()) {
+    if (ABSL_PREDICT_FALSE(!FinishFrame())) return false;
+  }
+  if (ABSL_PREDICT_FALSE(
+          !WriteVarint64(dest, IntCast<uint64_t>(frames_.size())))) {
+    return Fail(*dest);
+  }
+  for (const Frame& frame : frames_) {
+    if (ABSL_PREDICT_FALSE(!WriteVarint64(dest, frame.num_records)) ||
+        ABSL_PREDICT_FALSE(!WriteVarint64(dest, frame.compressed_size))) {
+      return Fail(*dest);
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!dest->Write(std::move(compressed_frames_)))) {
+    return Fail(*dest);
   }
   return Close();
 }
 
+void SimpleEncoder::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ChunkEncoder::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(sizes_compressor_);
+  memory_estimator->RegisterSubobjects(values_compressor_);
+  memory_estimator->RegisterSubobjects(frames_);
+  memory_estimator->RegisterSubobjects(compressed_frames_);
+}
+
 }  // namespace riegeli
@@ -23,6 +23,7 @@
 #include "absl/strings/string_view.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
@@ -40,12 +41,31 @@ namespace riegeli {
 //  - Record values (possibly compressed):
 //    - Concatenated record data (bytes)
 //
+// If frame_size > 0 and compression is used, record values are instead split
+// into frames compressed independently (ChunkType::kFramed):
+//  - Compression type
+//  - Size of record sizes (compressed if applicable)
+//  - Record sizes (possibly compressed):
+//    - Array of "num_records" varints: sizes of records
+//  - Number of frames (varint)
+//  - For each frame:
+//    - Number of records in the frame (varint)
+//    - Size of compressed record values of the frame (varint)
+//  - For each frame, record values of the frame (compressed):
+//    - Concatenated record data (bytes)
+//
 // If compression is used, a compressed block is prefixed by its varint-encoded
 // uncompressed size.
 class SimpleEncoder : public ChunkEncoder {
  public:
   // Creates an empty SimpleEncoder.
-  explicit SimpleEncoder(CompressorOptions options, uint64_t size_hint);
+  //
+  // If frame_size > 0, a frame of record values is finished after the first
+  // record which makes its uncompressed size at least frame_size. This lets a
+  // reader decompress only the frame containing the requested record, at the
+  // cost of compression density. Ignored without compression.
+  explicit SimpleEncoder(CompressorOptions options, uint64_t size_hint,
+                         uint64_t frame_size = 0);
 
   void Reset() override;
 
@@ -62,13 +82,33 @@ class SimpleEncoder : public ChunkEncoder {
                       uint64_t* num_records,
                       uint64_t* decoded_data_size) override;
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  private:
+  struct Frame {
+    uint64_t num_records;
+    uint64_t compressed_size;
+  };
+
   template <typename Record>
   bool AddRecordImpl(Record&& record);
+  // Accounts for a record of the given size written to values_compressor_,
+  // finishing the current frame if it is large enough.
+  bool AddedToFrame(uint64_t size);
+  bool FinishFrame();
 
   CompressionType compression_type_;
+  // 0 if record values are not split into frames.
+  uint64_t frame_size_;
   internal::Compressor sizes_compressor_;
   internal::Compressor values_compressor_;
+  // Finished frames.
+  std::vector<Frame> frames_;
+  // Concatenated compressed record values of frames_.
+  Chain compressed_frames_;
+  // Number of records and uncompressed size of the current frame.
+  uint64_t frame_num_records_ = 0;
+  uint64_t frame_decoded_size_ = 0;
 };
 
 }  // namespace riegeli
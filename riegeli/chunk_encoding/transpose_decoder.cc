@@ -16,8 +16,10 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <algorithm>
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -25,25 +27,54 @@
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
 #include "riegeli/base/memory.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/backward_writer_utils.h"
 #include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/limiting_backward_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
 #include "riegeli/bytes/string_reader.h"
 #include "riegeli/bytes/writer_utils.h"
+#include "riegeli/chunk_encoding/column_values.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/decompressor.h"
+#include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
 
+namespace internal {
+
+// How a data buffer is stored, if it must be converted before decoding.
+enum class BufferEncoding : uint8_t {
+  kPlain,
+  // Delta encoded varints (internal::Subtype::kVarintDelta1 and above).
+  kVarintDelta,
+  // Byte shuffled fixed32 or fixed64 (internal::Subtype::kFixedByteShuffled).
+  kByteShuffled32,
+  kByteShuffled64,
+  // Dictionary encoded strings
+  // (internal::Subtype::kLengthDelimitedDictionary).
+  kStringDictionary,
+  // Packed repeated fields (internal::Subtype::kLengthDelimitedPackedVarint
+  // and following).
+  kPackedVarint,
+  kPackedFixed32,
+  kPackedFixed64,
+};
+
+}  // namespace internal
+
 namespace {
 
 Reader* kEmptyReader() {
@@ -65,6 +96,8 @@ struct DataBucket {
   Chain compressed_data;
   // True if the bucket was already decompressed.
   bool decompressed = false;
+  // Encoding of each buffer, or empty if all buffers are plain.
+  std::vector<internal::BufferEncoding> buffer_encodings;
 };
 
 // Should the data content of the field be decoded?
@@ -74,6 +107,175 @@ enum class FieldIncluded {
   kExistenceOnly,
 };
 
+// Replaces a delta encoded buffer of varints with values in the form used by
+// varint callbacks: canonical varints with the highest bit of each byte
+// stripped. Returns false if the buffer is invalid.
+bool DecodeVarintDeltas(Chain* buffer) {
+  ChainReader<> src(buffer);
+  ChainWriter<Chain> dest((Chain()), ChainWriterBase::Options().set_size_hint(
+                                         buffer->size()));
+  uint64_t value = 0;
+  while (src.Pull()) {
+    uint64_t delta;
+    if (ABSL_PREDICT_FALSE(!ReadVarint64(&src, &delta))) return false;
+    value += internal::DecodeZigZag64(delta);
+    char bytes[kMaxLengthVarint64];
+    char* const bytes_end = WriteVarint64(bytes, value);
+    for (char* byte = bytes; byte < bytes_end; ++byte) *byte &= 0x7f;
+    if (ABSL_PREDICT_FALSE(!dest.Write(
+            absl::string_view(bytes, PtrDistance(bytes, bytes_end))))) {
+      return false;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!dest.Close())) return false;
+  *buffer = std::move(dest.dest());
+  return true;
+}
+
+// Replaces a dictionary encoded buffer of strings with values in the usual
+// form: length varints followed by contents. Returns false if the buffer is
+// invalid.
+bool DecodeStringDictionary(Chain* buffer) {
+  ChainReader<> src(buffer);
+  uint32_t dictionary_size;
+  if (ABSL_PREDICT_FALSE(!ReadVarint32(&src, &dictionary_size))) return false;
+  // Each dictionary entry has at least one byte.
+  if (ABSL_PREDICT_FALSE(dictionary_size > buffer->size() - src.pos())) {
+    return false;
+  }
+  std::vector<std::string> dictionary(dictionary_size);
+  for (std::string& value : dictionary) {
+    const Position value_pos = src.pos();
+    uint32_t length;
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(&src, &length))) return false;
+    const size_t length_length = IntCast<size_t>(src.pos() - value_pos);
+    if (ABSL_PREDICT_FALSE(!src.Seek(value_pos)) ||
+        ABSL_PREDICT_FALSE(!src.Read(&value, length_length + size_t{length}))) {
+      return false;
+    }
+  }
+  ChainWriter<Chain> dest((Chain()));
+  while (src.Pull()) {
+    uint32_t index;
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(&src, &index))) return false;
+    if (ABSL_PREDICT_FALSE(index >= dictionary_size)) return false;
+    if (ABSL_PREDICT_FALSE(!dest.Write(dictionary[index]))) return false;
+  }
+  if (ABSL_PREDICT_FALSE(!dest.Close())) return false;
+  *buffer = std::move(dest.dest());
+  return true;
+}
+
+// Replaces a packed buffer of packed repeated fields with values in the usual
+// form: length varints followed by contents. "width" is the width of fixed
+// width elements, or 0 for varint elements. Returns false if the buffer is
+// invalid.
+bool DecodePackedFields(size_t width, Chain* buffer) {
+  ChainReader<> src(buffer);
+  uint32_t num_values;
+  if (ABSL_PREDICT_FALSE(!ReadVarint32(&src, &num_values))) return false;
+  // Each element count has at least one byte.
+  if (ABSL_PREDICT_FALSE(num_values > buffer->size() - src.pos())) {
+    return false;
+  }
+  std::vector<uint32_t> counts(num_values);
+  uint64_t num_elements = 0;
+  for (uint32_t& count : counts) {
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(&src, &count))) return false;
+    num_elements += count;
+  }
+  ChainWriter<Chain> dest((Chain()));
+  if (width != 0) {
+    const Position elements_size = buffer->size() - src.pos();
+    if (ABSL_PREDICT_FALSE(elements_size != num_elements * width)) {
+      return false;
+    }
+    Chain elements;
+    if (ABSL_PREDICT_FALSE(!src.Read(&elements, elements_size))) return false;
+    internal::UnshuffleBytes(width, &elements);
+    ChainReader<> elements_reader(&elements);
+    for (const uint32_t count : counts) {
+      const uint64_t length = uint64_t{count} * width;
+      if (ABSL_PREDICT_FALSE(length > std::numeric_limits<uint32_t>::max())) {
+        return false;
+      }
+      if (ABSL_PREDICT_FALSE(
+              !WriteVarint32(&dest, IntCast<uint32_t>(length))) ||
+          ABSL_PREDICT_FALSE(!elements_reader.CopyTo(&dest, length))) {
+        return false;
+      }
+    }
+  } else {
+    std::string value;
+    for (const uint32_t count : counts) {
+      value.clear();
+      for (uint32_t i = 0; i < count; ++i) {
+        char element[kMaxLengthVarint64];
+        const char* const element_end = CopyVarint64(&src, element);
+        if (ABSL_PREDICT_FALSE(element_end == nullptr)) return false;
+        value.append(element, PtrDistance(element, element_end));
+      }
+      if (ABSL_PREDICT_FALSE(value.size() >
+                             std::numeric_limits<uint32_t>::max())) {
+        return false;
+      }
+      if (ABSL_PREDICT_FALSE(
+              !WriteVarint32(&dest, IntCast<uint32_t>(value.size()))) ||
+          ABSL_PREDICT_FALSE(!dest.Write(value))) {
+        return false;
+      }
+    }
+    if (ABSL_PREDICT_FALSE(src.Pull())) return false;
+  }
+  if (ABSL_PREDICT_FALSE(!dest.Close())) return false;
+  *buffer = std::move(dest.dest());
+  return true;
+}
+
+// Replaces a buffer stored with the given encoding with its plain form.
+// Returns false if the buffer is invalid.
+bool DecodeBuffer(internal::BufferEncoding encoding, Chain* buffer) {
+  switch (encoding) {
+    case internal::BufferEncoding::kPlain:
+      return true;
+    case internal::BufferEncoding::kVarintDelta:
+      return DecodeVarintDeltas(buffer);
+    case internal::BufferEncoding::kByteShuffled32:
+      if (ABSL_PREDICT_FALSE(buffer->size() % sizeof(uint32_t) != 0)) {
+        return false;
+      }
+      internal::UnshuffleBytes(sizeof(uint32_t), buffer);
+      return true;
+    case internal::BufferEncoding::kByteShuffled64:
+      if (ABSL_PREDICT_FALSE(buffer->size() % sizeof(uint64_t) != 0)) {
+        return false;
+      }
+      internal::UnshuffleBytes(sizeof(uint64_t), buffer);
+      return true;
+    case internal::BufferEncoding::kStringDictionary:
+      return DecodeStringDictionary(buffer);
+    case internal::BufferEncoding::kPackedVarint:
+      return DecodePackedFields(0, buffer);
+    case internal::BufferEncoding::kPackedFixed32:
+      return DecodePackedFields(sizeof(uint32_t), buffer);
+    case internal::BufferEncoding::kPackedFixed64:
+      return DecodePackedFields(sizeof(uint64_t), buffer);
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown buffer encoding: " << static_cast<int>(encoding);
+}
+
+// Reads a varint and adds it to *pos. Returns false on failure or overflow.
+bool ReadPositionDelta(Reader* src, Position* pos) {
+  uint64_t delta;
+  if (ABSL_PREDICT_FALSE(!ReadVarint64(src, &delta))) return false;
+  if (ABSL_PREDICT_FALSE(delta > std::numeric_limits<Position>::max() - *pos)) {
+    return false;
+  }
+  *pos += delta;
+  return true;
+}
+
 // Return true if "tag" is a valid protocol buffer tag.
 bool ValidTag(uint32_t tag) {
   switch (static_cast<internal::WireType>(tag & 7)) {
@@ -172,8 +374,12 @@ inline CallbackType GetCopyTagCallbackType(size_t tag_length) {
 inline CallbackType GetVarintCallbackType(Subtype subtype, size_t tag_length) {
   RIEGELI_ASSERT_GT(tag_length, 0u) << "Zero tag length";
   RIEGELI_ASSERT_LE(tag_length, kMaxLengthVarint32) << "Tag length too large";
-  if (subtype > Subtype::kVarintInlineMax) return CallbackType::kUnknown;
-  if (subtype >= Subtype::kVarintInline0) {
+  if (IsVarintDelta(subtype)) {
+    // Delta encoded buffers are decoded before decoding records.
+    subtype = Subtype::kVarint1 + (subtype - Subtype::kVarintDelta1);
+  } else if (subtype > Subtype::kVarintInlineMax) {
+    return CallbackType::kUnknown;
+  } else if (subtype >= Subtype::kVarintInline0) {
     return GetCopyTagCallbackType(tag_length + 1);
   }
   return CallbackType::kVarint_1_1 +
@@ -339,11 +545,30 @@ inline bool IsImplicit(CallbackType callback_type) {
   return (callback_type & CallbackType::kImplicit) == CallbackType::kImplicit;
 }
 
+inline CallbackType RemoveImplicit(CallbackType callback_type) {
+  return callback_type & static_cast<CallbackType>(static_cast<uint8_t>(
+                             ~static_cast<uint8_t>(CallbackType::kImplicit)));
+}
+
 }  // namespace internal
 
+struct TransposeDecoder::Checkpoint {
+  // Node to resume decoding from. Its callback was already performed.
+  uint32_t node = 0;
+  // Decoded data size of records decoded before the checkpoint.
+  Position decoded_data_size = 0;
+  // Position in transitions.
+  Position transitions_pos = 0;
+  // Positions in data buffers.
+  std::vector<Position> buffer_positions;
+};
+
 struct TransposeDecoder::Context {
   // Compression type of the input.
   CompressionType compression_type = CompressionType::kNone;
+  // Whether to decompress buckets concurrently.
+  // Note: Used only when projection is disabled.
+  bool parallel_decompression = false;
   // Buffer containing all the data.
   // Note: Used only when projection is disabled.
   std::vector<ChainReader<Chain>> buffers;
@@ -355,6 +580,12 @@ struct TransposeDecoder::Context {
   uint32_t first_node = 0;
   // State machine transitions. One byte = one transition.
   internal::Decompressor<> transitions;
+  // Decompressed transitions, used when decoding ranges of records.
+  ChainReader<Chain> transitions_data;
+  // Number of records between decoder checkpoints, 0 if there are none.
+  uint64_t checkpoint_interval = 0;
+  // Decoder checkpoints, in the order of decoding.
+  std::vector<Checkpoint> checkpoints;
 
   // --- Fields used in projection. ---
   // We number used fields with indices into "existence_only" vector below.
@@ -371,11 +602,36 @@ struct TransposeDecoder::Context {
   std::vector<StateMachineNodeTemplate> node_templates;
 };
 
+// State machine of the last chunk parsed with all fields included and without
+// decoder checkpoints, which the next chunk can reuse.
+struct TransposeDecoder::StateMachineCache {
+  // The part of the chunk header after buffers, from which the state machine
+  // was parsed.
+  std::string header;
+  // Number of buffers of the chunk. Buffer indices in the state machine were
+  // validated against it.
+  uint32_t num_buffers = 0;
+  // Parsed state machine, including failure nodes. "next_node" and "buffer"
+  // are not meaningful here. They are stored as indices instead.
+  std::vector<StateMachineNode> state_machine_nodes;
+  std::vector<uint32_t> next_node_indices;
+  // Buffer index for each node, or kInvalidPos if the node has no buffer.
+  std::vector<uint32_t> buffer_indices;
+  uint32_t first_node = 0;
+  bool has_nonproto_op = false;
+  std::vector<internal::BufferEncoding> buffer_encodings;
+};
+
+TransposeDecoder::TransposeDecoder() noexcept : Object(State::kClosed) {}
+
+TransposeDecoder::~TransposeDecoder() {}
+
 bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
                              uint64_t decoded_data_size,
                              const FieldProjection& field_projection,
                              BackwardWriter* dest,
-                             std::vector<size_t>* limits) {
+                             std::vector<size_t>* limits,
+                             bool parallel_decompression) {
   RIEGELI_ASSERT_EQ(dest->pos(), 0u)
       << "Failed precondition of TransposeDecoder::Reset(): "
          "non-zero destination position";
@@ -389,13 +645,22 @@ bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
   }
 
   Context context;
-  if (ABSL_PREDICT_FALSE(!Parse(&context, src, field_projection))) return false;
-  LimitingBackwardWriter<> limiting_dest(dest, decoded_data_size);
+  context.parallel_decompression = parallel_decompression;
   if (ABSL_PREDICT_FALSE(
-          !Decode(&context, num_records, &limiting_dest, limits))) {
+          !Parse(&context, src, num_records, field_projection))) {
+    return false;
+  }
+  LimitingBackwardWriter<> limiting_dest(dest, decoded_data_size);
+  if (ABSL_PREDICT_FALSE(!Decode(&context, context.transitions.reader(),
+                                 nullptr, true, num_records, &limiting_dest,
+                                 limits))) {
     limiting_dest.Close();
     return false;
   }
+  if (ABSL_PREDICT_FALSE(!context.transitions.VerifyEndAndClose())) {
+    limiting_dest.Close();
+    return Fail(context.transitions);
+  }
   if (ABSL_PREDICT_FALSE(!limiting_dest.Close())) return Fail(limiting_dest);
   RIEGELI_ASSERT_LE(dest->pos(), decoded_data_size)
       << "Decoded data size larger than expected";
@@ -406,7 +671,169 @@ bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
   return true;
 }
 
+bool TransposeDecoder::ResetForRanges(Reader* src, uint64_t num_records,
+                                      uint64_t decoded_data_size,
+                                      bool parallel_decompression) {
+  MarkHealthy();
+  context_.reset();
+  num_records_ = 0;
+  range_num_records_ = 0;
+  range_limits_.clear();
+  if (ABSL_PREDICT_FALSE(num_records > range_limits_.max_size())) {
+    return Fail("Too many records");
+  }
+  if (ABSL_PREDICT_FALSE(decoded_data_size >
+                         std::numeric_limits<size_t>::max())) {
+    return Fail("Records too large");
+  }
+
+  std::unique_ptr<Context> context = absl::make_unique<Context>();
+  context->parallel_decompression = parallel_decompression;
+  if (ABSL_PREDICT_FALSE(
+          !Parse(context.get(), src, num_records, FieldProjection::All()))) {
+    return false;
+  }
+  const std::vector<Checkpoint>& checkpoints = context->checkpoints;
+  const size_t size = IntCast<size_t>(decoded_data_size);
+  if (checkpoints.empty()) {
+    // The only range is decoded like in Reset(), reading transitions as they
+    // are decompressed.
+    range_num_records_ = num_records;
+  } else {
+    // Transitions are decompressed upfront, so that decoding can start from
+    // any checkpoint.
+    Chain transitions;
+    if (ABSL_PREDICT_FALSE(
+            !ReadAll(context->transitions.reader(), &transitions))) {
+      return Fail("Reading transitions failed",
+                  *context->transitions.reader());
+    }
+    if (ABSL_PREDICT_FALSE(!context->transitions.VerifyEndAndClose())) {
+      return Fail(context->transitions);
+    }
+    context->transitions_data = ChainReader<Chain>(std::move(transitions));
+
+    if (ABSL_PREDICT_FALSE(checkpoints.back().decoded_data_size > size)) {
+      return Fail("Invalid checkpoint: decoded data size too large");
+    }
+    range_num_records_ = context->checkpoint_interval;
+    range_limits_.reserve(checkpoints.size() + 1);
+    // Checkpoints are in the order of decoding, i.e. from the last record
+    // backwards.
+    for (size_t index = checkpoints.size(); index > 0; --index) {
+      range_limits_.push_back(
+          size - IntCast<size_t>(checkpoints[index - 1].decoded_data_size));
+    }
+  }
+  range_limits_.push_back(size);
+  num_records_ = num_records;
+  context_ = std::move(context);
+  return true;
+}
+
+bool TransposeDecoder::DecodeRange(size_t range_index, BackwardWriter* dest,
+                                   std::vector<size_t>* limits) {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of TransposeDecoder::DecodeRange(): "
+      << message();
+  RIEGELI_ASSERT(context_ != nullptr)
+      << "Failed precondition of TransposeDecoder::DecodeRange(): "
+         "ResetForRanges() not called";
+  RIEGELI_ASSERT_LT(range_index, range_limits_.size())
+      << "Failed precondition of TransposeDecoder::DecodeRange(): "
+         "range index out of range";
+  RIEGELI_ASSERT_EQ(dest->pos(), 0u)
+      << "Failed precondition of TransposeDecoder::DecodeRange(): "
+         "non-zero destination position";
+  Context* const context = context_.get();
+  if (context->checkpoints.empty()) {
+    RIEGELI_ASSERT(context->transitions.healthy())
+        << "Failed precondition of TransposeDecoder::DecodeRange(): "
+           "the only range already decoded";
+    LimitingBackwardWriter<> limiting_dest(dest, range_limits_[0]);
+    if (ABSL_PREDICT_FALSE(!Decode(context, context->transitions.reader(),
+                                   nullptr, true, num_records_,
+                                   &limiting_dest, limits))) {
+      limiting_dest.Close();
+      return false;
+    }
+    if (ABSL_PREDICT_FALSE(!context->transitions.VerifyEndAndClose())) {
+      limiting_dest.Close();
+      return Fail(context->transitions);
+    }
+    if (ABSL_PREDICT_FALSE(!limiting_dest.Close())) return Fail(limiting_dest);
+    if (ABSL_PREDICT_FALSE(dest->pos() != range_limits_[0])) {
+      return Fail("Decoded data size smaller than expected");
+    }
+    return true;
+  }
+  const size_t last_range_index = range_limits_.size() - 1;
+  const uint64_t range_begin = IntCast<uint64_t>(range_index) *
+                               range_num_records_;
+  const uint64_t num_records = range_index == last_range_index
+                                   ? num_records_ - range_begin
+                                   : range_num_records_;
+  // The last range is decoded first, from the beginning of transitions.
+  const Checkpoint* const checkpoint =
+      range_index == last_range_index
+          ? nullptr
+          : &context->checkpoints[last_range_index - 1 - range_index];
+  if (ABSL_PREDICT_FALSE(!context->transitions_data.Seek(
+          checkpoint == nullptr ? Position{0} : checkpoint->transitions_pos))) {
+    return Fail("Invalid checkpoint: transitions position out of range");
+  }
+  for (size_t i = 0; i < context->buffers.size(); ++i) {
+    if (ABSL_PREDICT_FALSE(!context->buffers[i].Seek(
+            checkpoint == nullptr ? Position{0}
+                                  : checkpoint->buffer_positions[i]))) {
+      return Fail("Invalid checkpoint: buffer position out of range");
+    }
+  }
+  const size_t size = range_limits_[range_index] -
+                      (range_index == 0 ? size_t{0}
+                                        : range_limits_[range_index - 1]);
+  LimitingBackwardWriter<> limiting_dest(dest, size);
+  if (ABSL_PREDICT_FALSE(!Decode(context, &context->transitions_data,
+                                 checkpoint, range_index == 0, num_records,
+                                 &limiting_dest, limits))) {
+    limiting_dest.Close();
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!limiting_dest.Close())) return Fail(limiting_dest);
+  if (ABSL_PREDICT_FALSE(dest->pos() != size)) {
+    return Fail("Decoded data size smaller than expected");
+  }
+  return true;
+}
+
+bool TransposeDecoder::ScanField(Reader* src, uint64_t num_records,
+                                 const Field& field, ColumnValues* dest) {
+  RIEGELI_ASSERT(!field.path().empty())
+      << "Failed precondition of TransposeDecoder::ScanField(): "
+         "empty field path";
+  MarkHealthy();
+  dest->Clear();
+  if (ABSL_PREDICT_FALSE(num_records > dest->record_indices.max_size())) {
+    return Fail("Too many records");
+  }
+
+  Context context;
+  if (ABSL_PREDICT_FALSE(
+          !Parse(&context, src, num_records, FieldProjection({field})))) {
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(
+          !Scan(&context, num_records, field.path().size() - 1, dest))) {
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!context.transitions.VerifyEndAndClose())) {
+    return Fail(context.transitions);
+  }
+  return true;
+}
+
 inline bool TransposeDecoder::Parse(Context* context, Reader* src,
+                                    uint64_t num_records,
                                     const FieldProjection& field_projection) {
   const bool projection_enabled = !field_projection.includes_all();
   if (projection_enabled) {
@@ -465,11 +892,115 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
     num_buffers = IntCast<uint32_t>(context->buffers.size());
   }
 
+  bool has_nonproto_op;
+  // Encoding of each buffer, or empty if all buffers are plain.
+  // Note: Used only when projection is disabled. In projection mode this is
+  // stored in DataBucket::buffer_encodings.
+  std::vector<internal::BufferEncoding> buffer_encodings;
+  // Buffers of non-proto records in projection mode are looked up after all
+  // states are parsed, because looking up a buffer decompresses its bucket,
+  // and encodings of all buffers must be known before that.
+  std::vector<std::pair<size_t, uint32_t>> nonproto_buffer_indices;
+  if (projection_enabled) {
+    if (ABSL_PREDICT_FALSE(!ParseStateMachine(
+            context, header_decompressor.reader(), num_records,
+            projection_enabled, num_buffers, first_buffer_indices,
+            bucket_indices, &has_nonproto_op, &buffer_encodings,
+            &nonproto_buffer_indices))) {
+      return false;
+    }
+  } else {
+    // The rest of the header is the state machine, followed by decoder
+    // checkpoints if any. Consecutive chunks often have the same state
+    // machine, then it is not parsed again.
+    std::string state_machine_header;
+    if (ABSL_PREDICT_FALSE(
+            !ReadAll(header_decompressor.reader(), &state_machine_header))) {
+      return Fail("Reading state machine failed",
+                  *header_decompressor.reader());
+    }
+    if (!RestoreStateMachine(context, state_machine_header, num_buffers,
+                             &has_nonproto_op, &buffer_encodings)) {
+      StringReader<> state_machine_reader(state_machine_header);
+      if (ABSL_PREDICT_FALSE(!ParseStateMachine(
+              context, &state_machine_reader, num_records, projection_enabled,
+              num_buffers, first_buffer_indices, bucket_indices,
+              &has_nonproto_op, &buffer_encodings,
+              &nonproto_buffer_indices))) {
+        return false;
+      }
+      // A state machine followed by checkpoints is not cached, because
+      // checkpoints differ between chunks.
+      if (context->checkpoints.empty()) {
+        SaveStateMachine(*context, std::move(state_machine_header),
+                         num_buffers, has_nonproto_op, buffer_encodings);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < buffer_encodings.size(); ++i) {
+    if (buffer_encodings[i] == internal::BufferEncoding::kPlain) continue;
+    Chain buffer = std::move(context->buffers[i].src());
+    if (ABSL_PREDICT_FALSE(!DecodeBuffer(buffer_encodings[i], &buffer))) {
+      return Fail("Invalid encoded buffer");
+    }
+    // The address of the reader is kept, because state machine nodes point
+    // to it.
+    context->buffers[i] = ChainReader<Chain>(std::move(buffer));
+  }
+  for (const std::pair<size_t, uint32_t>& nonproto_buffer_index :
+       nonproto_buffer_indices) {
+    const uint32_t bucket = bucket_indices[nonproto_buffer_index.second];
+    Reader* const buffer =
+        GetBuffer(context, bucket,
+                  nonproto_buffer_index.second - first_buffer_indices[bucket]);
+    if (ABSL_PREDICT_FALSE(buffer == nullptr)) return false;
+    context->state_machine_nodes[nonproto_buffer_index.first].buffer = buffer;
+  }
+
+  if (has_nonproto_op) {
+    // If non-proto state exists then the last buffer is the
+    // nonproto_lengths buffer.
+    if (ABSL_PREDICT_FALSE(num_buffers == 0)) {
+      return Fail("Missing buffer for non-proto records");
+    }
+    if (projection_enabled) {
+      const uint32_t bucket = bucket_indices[num_buffers - 1];
+      context->nonproto_lengths = GetBuffer(
+          context, bucket, num_buffers - 1 - first_buffer_indices[bucket]);
+      if (ABSL_PREDICT_FALSE(context->nonproto_lengths == nullptr)) {
+        return false;
+      }
+    } else {
+      context->nonproto_lengths = &context->buffers.back();
+    }
+  }
+
+  if (ABSL_PREDICT_FALSE(!header_decompressor.VerifyEndAndClose())) {
+    return Fail(header_decompressor);
+  }
+  context->transitions =
+      internal::Decompressor<>(src, context->compression_type);
+  if (ABSL_PREDICT_FALSE(!context->transitions.healthy())) {
+    return Fail(context->transitions);
+  }
+  return true;
+}
+
+inline bool TransposeDecoder::ParseStateMachine(
+    Context* context, Reader* header_reader, uint64_t num_records,
+    bool projection_enabled, uint32_t num_buffers,
+    const std::vector<uint32_t>& first_buffer_indices,
+    const std::vector<uint32_t>& bucket_indices, bool* has_nonproto_op,
+    std::vector<internal::BufferEncoding>* buffer_encodings,
+    std::vector<std::pair<size_t, uint32_t>>* nonproto_buffer_indices) {
+  *has_nonproto_op = false;
+  buffer_encodings->clear();
+  nonproto_buffer_indices->clear();
+
   uint32_t state_machine_size;
-  if (ABSL_PREDICT_FALSE(
-          !ReadVarint32(header_decompressor.reader(), &state_machine_size))) {
-    return Fail("Reading state machine size failed",
-                *header_decompressor.reader());
+  if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &state_machine_size))) {
+    return Fail("Reading state machine size failed", *header_reader);
   }
   // Additional 0xff nodes to correctly handle invalid/malicious inputs.
   // TODO: Handle overflow.
@@ -477,35 +1008,38 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
   if (projection_enabled) context->node_templates.resize(state_machine_size);
   std::vector<StateMachineNode>& state_machine_nodes =
       context->state_machine_nodes;
-  bool has_nonproto_op = false;
   size_t num_subtypes = 0;
   std::vector<uint32_t> tags;
   tags.reserve(state_machine_size);
   for (size_t i = 0; i < state_machine_size; ++i) {
     uint32_t tag;
-    if (ABSL_PREDICT_FALSE(!ReadVarint32(header_decompressor.reader(), &tag))) {
-      return Fail("Reading field tag failed", *header_decompressor.reader());
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &tag))) {
+      return Fail("Reading field tag failed", *header_reader);
     }
     tags.push_back(tag);
-    if (ValidTag(tag) && internal::HasSubtype(tag)) ++num_subtypes;
+    if (static_cast<internal::WireType>(tag & 7) ==
+        internal::WireType::kEncodedBuffer) {
+      // The actual wire type is stored in place of the subtype.
+      if (tag >= 8) ++num_subtypes;
+    } else if (ValidTag(tag) && internal::HasSubtype(tag)) {
+      ++num_subtypes;
+    }
   }
   std::vector<uint32_t> next_node_indices;
   next_node_indices.reserve(state_machine_size);
   for (size_t i = 0; i < state_machine_size; ++i) {
     uint32_t next_node;
-    if (ABSL_PREDICT_FALSE(
-            !ReadVarint32(header_decompressor.reader(), &next_node))) {
-      return Fail("Reading next node index failed",
-                  *header_decompressor.reader());
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &next_node))) {
+      return Fail("Reading next node index failed", *header_reader);
     }
     next_node_indices.push_back(next_node);
   }
   std::string subtypes;
-  if (ABSL_PREDICT_FALSE(
-          !header_decompressor.reader()->Read(&subtypes, num_subtypes))) {
-    return Fail("Reading subtypes failed", *header_decompressor.reader());
+  if (ABSL_PREDICT_FALSE(!header_reader->Read(&subtypes, num_subtypes))) {
+    return Fail("Reading subtypes failed", *header_reader);
   }
   size_t subtype_index = 0;
+  bool has_encoded_buffers = false;
   for (size_t i = 0; i < state_machine_size; ++i) {
     uint32_t tag = tags[i];
     StateMachineNode& state_machine_node = state_machine_nodes[i];
@@ -517,25 +1051,18 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
       case internal::MessageId::kNonProto: {
         state_machine_node.callback_type = internal::CallbackType::kNonProto;
         uint32_t buffer_index;
-        if (ABSL_PREDICT_FALSE(
-                !ReadVarint32(header_decompressor.reader(), &buffer_index))) {
-          return Fail("Reading buffer index failed",
-                      *header_decompressor.reader());
+        if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &buffer_index))) {
+          return Fail("Reading buffer index failed", *header_reader);
         }
         if (ABSL_PREDICT_FALSE(buffer_index >= num_buffers)) {
           return Fail("Buffer index too large");
         }
         if (projection_enabled) {
-          const uint32_t bucket = bucket_indices[buffer_index];
-          state_machine_node.buffer = GetBuffer(
-              context, bucket, buffer_index - first_buffer_indices[bucket]);
-          if (ABSL_PREDICT_FALSE(state_machine_node.buffer == nullptr)) {
-            return false;
-          }
+          nonproto_buffer_indices->emplace_back(i, buffer_index);
         } else {
           state_machine_node.buffer = &context->buffers[buffer_index];
         }
-        has_nonproto_op = true;
+        *has_nonproto_op = true;
       } break;
       case internal::MessageId::kStartOfMessage:
         state_machine_node.callback_type =
@@ -566,6 +1093,52 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
                  internal::WireType::kLengthDelimited;
           subtype = internal::Subtype::kLengthDelimitedEndOfSubmessage;
         }
+        internal::BufferEncoding buffer_encoding =
+            internal::BufferEncoding::kPlain;
+        // A buffer stored in a special form is encoded as
+        // WireType::kEncodedBuffer, followed by the actual wire type in place
+        // of the subtype.
+        if (static_cast<internal::WireType>(tag & 7) ==
+            internal::WireType::kEncodedBuffer) {
+          if (ABSL_PREDICT_FALSE(tag < 8)) return Fail("Invalid tag");
+          const uint8_t encoded_buffer_byte =
+              static_cast<uint8_t>(subtypes[subtype_index++]);
+          switch (encoded_buffer_byte) {
+            case internal::EncodedBufferByte(
+                internal::WireType::kFixed32,
+                internal::Subtype::kFixedByteShuffled):
+              buffer_encoding = internal::BufferEncoding::kByteShuffled32;
+              break;
+            case internal::EncodedBufferByte(
+                internal::WireType::kFixed64,
+                internal::Subtype::kFixedByteShuffled):
+              buffer_encoding = internal::BufferEncoding::kByteShuffled64;
+              break;
+            case internal::EncodedBufferByte(
+                internal::WireType::kLengthDelimited,
+                internal::Subtype::kLengthDelimitedDictionary):
+              buffer_encoding = internal::BufferEncoding::kStringDictionary;
+              break;
+            case internal::EncodedBufferByte(
+                internal::WireType::kLengthDelimited,
+                internal::Subtype::kLengthDelimitedPackedVarint):
+              buffer_encoding = internal::BufferEncoding::kPackedVarint;
+              break;
+            case internal::EncodedBufferByte(
+                internal::WireType::kLengthDelimited,
+                internal::Subtype::kLengthDelimitedPackedFixed32):
+              buffer_encoding = internal::BufferEncoding::kPackedFixed32;
+              break;
+            case internal::EncodedBufferByte(
+                internal::WireType::kLengthDelimited,
+                internal::Subtype::kLengthDelimitedPackedFixed64):
+              buffer_encoding = internal::BufferEncoding::kPackedFixed64;
+              break;
+            default:
+              return Fail("Invalid form of encoded buffer");
+          }
+          tag = (tag & ~uint32_t{7}) | (encoded_buffer_byte & 7);
+        }
         if (ABSL_PREDICT_FALSE((!ValidTag(tag)))) return Fail("Invalid tag");
         char* const tag_end =
             WriteVarint32(state_machine_node.tag_data.data, tag);
@@ -574,13 +1147,17 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
         if (internal::HasSubtype(tag)) {
           subtype = static_cast<internal::Subtype>(subtypes[subtype_index++]);
         }
+        if (static_cast<internal::WireType>(tag & 7) ==
+                internal::WireType::kVarint &&
+            internal::IsVarintDelta(subtype)) {
+          buffer_encoding = internal::BufferEncoding::kVarintDelta;
+        }
         if (projection_enabled) {
           if (internal::HasDataBuffer(tag, subtype)) {
             uint32_t buffer_index;
-            if (ABSL_PREDICT_FALSE(!ReadVarint32(header_decompressor.reader(),
-                                                 &buffer_index))) {
-              return Fail("Reading buffer index failed",
-                          *header_decompressor.reader());
+            if (ABSL_PREDICT_FALSE(
+                    !ReadVarint32(header_reader, &buffer_index))) {
+              return Fail("Reading buffer index failed", *header_reader);
             }
             if (ABSL_PREDICT_FALSE(buffer_index >= num_buffers)) {
               return Fail("Buffer index too large");
@@ -589,6 +1166,16 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
             context->node_templates[i].bucket_index = bucket;
             context->node_templates[i].buffer_within_bucket_index =
                 buffer_index - first_buffer_indices[bucket];
+            if (buffer_encoding != internal::BufferEncoding::kPlain) {
+              std::vector<internal::BufferEncoding>& bucket_buffer_encodings =
+                  context->buckets[bucket].buffer_encodings;
+              bucket_buffer_encodings.resize(
+                  context->buckets[bucket].buffer_sizes.size());
+              bucket_buffer_encodings[context->node_templates[i]
+                                          .buffer_within_bucket_index] =
+                  buffer_encoding;
+              has_encoded_buffers = true;
+            }
           } else {
             context->node_templates[i].bucket_index = kInvalidPos;
           }
@@ -601,15 +1188,19 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
         } else {
           if (internal::HasDataBuffer(tag, subtype)) {
             uint32_t buffer_index;
-            if (ABSL_PREDICT_FALSE(!ReadVarint32(header_decompressor.reader(),
-                                                 &buffer_index))) {
-              return Fail("Reading buffer index failed",
-                          *header_decompressor.reader());
+            if (ABSL_PREDICT_FALSE(
+                    !ReadVarint32(header_reader, &buffer_index))) {
+              return Fail("Reading buffer index failed", *header_reader);
             }
             if (ABSL_PREDICT_FALSE(buffer_index >= num_buffers)) {
               return Fail("Buffer index too large");
             }
             state_machine_node.buffer = &context->buffers[buffer_index];
+            if (buffer_encoding != internal::BufferEncoding::kPlain) {
+              buffer_encodings->resize(num_buffers);
+              (*buffer_encodings)[buffer_index] = buffer_encoding;
+              has_encoded_buffers = true;
+            }
           }
           state_machine_node.callback_type =
               internal::GetCallbackType(FieldIncluded::kYes, tag, subtype,
@@ -622,7 +1213,8 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
         // Store subtype right past tag in case this is inline numeric.
         if (static_cast<internal::WireType>(tag & 7) ==
                 internal::WireType::kVarint &&
-            subtype >= internal::Subtype::kVarintInline0) {
+            subtype >= internal::Subtype::kVarintInline0 &&
+            subtype <= internal::Subtype::kVarintInlineMax) {
           state_machine_node.tag_data.data[tag_length] =
               subtype - internal::Subtype::kVarintInline0;
         } else {
@@ -645,33 +1237,26 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
     state_machine_node.next_node = &state_machine_nodes[next_node_id];
   }
 
-  if (has_nonproto_op) {
-    // If non-proto state exists then the last buffer is the
-    // nonproto_lengths buffer.
-    if (ABSL_PREDICT_FALSE(num_buffers == 0)) {
-      return Fail("Missing buffer for non-proto records");
-    }
-    if (projection_enabled) {
-      const uint32_t bucket = bucket_indices[num_buffers - 1];
-      context->nonproto_lengths = GetBuffer(
-          context, bucket, num_buffers - 1 - first_buffer_indices[bucket]);
-      if (ABSL_PREDICT_FALSE(context->nonproto_lengths == nullptr)) {
-        return false;
-      }
-    } else {
-      context->nonproto_lengths = &context->buffers.back();
-    }
-  }
-
-  if (ABSL_PREDICT_FALSE(
-          !ReadVarint32(header_decompressor.reader(), &context->first_node))) {
-    return Fail("Reading first node index failed",
-                *header_decompressor.reader());
+  if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &context->first_node))) {
+    return Fail("Reading first node index failed", *header_reader);
   }
   if (ABSL_PREDICT_FALSE(context->first_node >= state_machine_size)) {
     return Fail("First node index too large");
   }
 
+  if (header_reader->Pull()) {
+    // Positions in delta encoded or byte shuffled buffers would not be
+    // meaningful after they are decoded.
+    if (ABSL_PREDICT_FALSE(has_encoded_buffers)) {
+      return Fail("Decoder checkpoints with encoded buffers");
+    }
+    if (ABSL_PREDICT_FALSE(!ParseCheckpoints(context, header_reader,
+                                             num_records, state_machine_size,
+                                             num_buffers))) {
+      return false;
+    }
+  }
+
   // Add 0xff failure nodes so we never overflow this array.
   for (uint64_t i = state_machine_size; i < state_machine_size + 0xff; ++i) {
     state_machine_nodes[i].callback_type = internal::CallbackType::kFailure;
@@ -681,13 +1266,108 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
     return Fail("Nodes contain an implicit loop");
   }
 
-  if (ABSL_PREDICT_FALSE(!header_decompressor.VerifyEndAndClose())) {
-    return Fail(header_decompressor);
+  return true;
+}
+
+inline bool TransposeDecoder::RestoreStateMachine(
+    Context* context, absl::string_view header, uint32_t num_buffers,
+    bool* has_nonproto_op,
+    std::vector<internal::BufferEncoding>* buffer_encodings) {
+  const StateMachineCache* const cache = state_machine_cache_.get();
+  if (cache == nullptr || cache->num_buffers != num_buffers ||
+      cache->header != header) {
+    return false;
   }
-  context->transitions =
-      internal::Decompressor<>(src, context->compression_type);
-  if (ABSL_PREDICT_FALSE(!context->transitions.healthy())) {
-    return Fail(context->transitions);
+  std::vector<StateMachineNode>& state_machine_nodes =
+      context->state_machine_nodes;
+  state_machine_nodes = cache->state_machine_nodes;
+  for (size_t i = 0; i < cache->next_node_indices.size(); ++i) {
+    StateMachineNode& state_machine_node = state_machine_nodes[i];
+    state_machine_node.next_node =
+        &state_machine_nodes[cache->next_node_indices[i]];
+    state_machine_node.buffer =
+        cache->buffer_indices[i] == kInvalidPos
+            ? nullptr
+            : &context->buffers[cache->buffer_indices[i]];
+  }
+  context->first_node = cache->first_node;
+  *has_nonproto_op = cache->has_nonproto_op;
+  *buffer_encodings = cache->buffer_encodings;
+  return true;
+}
+
+inline void TransposeDecoder::SaveStateMachine(
+    const Context& context, std::string&& header, uint32_t num_buffers,
+    bool has_nonproto_op,
+    const std::vector<internal::BufferEncoding>& buffer_encodings) {
+  if (state_machine_cache_ == nullptr) {
+    state_machine_cache_ = absl::make_unique<StateMachineCache>();
+  }
+  StateMachineCache* const cache = state_machine_cache_.get();
+  const std::vector<StateMachineNode>& state_machine_nodes =
+      context.state_machine_nodes;
+  cache->header = std::move(header);
+  cache->num_buffers = num_buffers;
+  cache->state_machine_nodes = state_machine_nodes;
+  // Failure nodes at the end do not have "next_node" nor "buffer".
+  const size_t state_machine_size = state_machine_nodes.size() - 0xff;
+  cache->next_node_indices.clear();
+  cache->buffer_indices.clear();
+  for (size_t i = 0; i < state_machine_size; ++i) {
+    const StateMachineNode& state_machine_node = state_machine_nodes[i];
+    cache->next_node_indices.push_back(IntCast<uint32_t>(
+        state_machine_node.next_node - state_machine_nodes.data()));
+    cache->buffer_indices.push_back(
+        state_machine_node.buffer == nullptr
+            ? kInvalidPos
+            : IntCast<uint32_t>(static_cast<const ChainReader<Chain>*>(
+                                    state_machine_node.buffer) -
+                                context.buffers.data()));
+  }
+  cache->first_node = context.first_node;
+  cache->has_nonproto_op = has_nonproto_op;
+  cache->buffer_encodings = buffer_encodings;
+}
+
+inline bool TransposeDecoder::ParseCheckpoints(Context* context,
+                                               Reader* header_reader,
+                                               uint64_t num_records,
+                                               uint32_t state_machine_size,
+                                               uint32_t num_buffers) {
+  uint64_t checkpoint_interval;
+  uint64_t num_checkpoints;
+  if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &checkpoint_interval)) ||
+      ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &num_checkpoints))) {
+    return Fail("Reading checkpoints failed", *header_reader);
+  }
+  if (ABSL_PREDICT_FALSE(checkpoint_interval == 0 || num_records == 0 ||
+                         num_checkpoints !=
+                             (num_records - 1) / checkpoint_interval)) {
+    return Fail("Invalid number of checkpoints");
+  }
+  context->checkpoint_interval = checkpoint_interval;
+  Checkpoint checkpoint;
+  checkpoint.buffer_positions.resize(num_buffers);
+  for (uint64_t i = 0; i < num_checkpoints; ++i) {
+    if (ABSL_PREDICT_FALSE(!ReadVarint32(header_reader, &checkpoint.node))) {
+      return Fail("Reading checkpoint node index failed", *header_reader);
+    }
+    if (ABSL_PREDICT_FALSE(checkpoint.node >= state_machine_size)) {
+      return Fail("Checkpoint node index too large");
+    }
+    if (ABSL_PREDICT_FALSE(
+            !ReadPositionDelta(header_reader, &checkpoint.decoded_data_size)) ||
+        ABSL_PREDICT_FALSE(
+            !ReadPositionDelta(header_reader, &checkpoint.transitions_pos))) {
+      return Fail("Reading checkpoint failed", *header_reader);
+    }
+    for (Position& buffer_position : checkpoint.buffer_positions) {
+      if (ABSL_PREDICT_FALSE(
+              !ReadPositionDelta(header_reader, &buffer_position))) {
+        return Fail("Reading checkpoint failed", *header_reader);
+      }
+    }
+    context->checkpoints.push_back(checkpoint);
   }
   return true;
 }
@@ -710,11 +1390,11 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
     return true;
   }
   context->buffers.reserve(num_buffers);
-  std::vector<internal::Decompressor<ChainReader<Chain>>> bucket_decompressors;
-  if (ABSL_PREDICT_FALSE(num_buckets > bucket_decompressors.max_size())) {
+  std::vector<Chain> buckets;
+  if (ABSL_PREDICT_FALSE(num_buckets > buckets.max_size())) {
     return Fail("Too many buckets");
   }
-  bucket_decompressors.reserve(num_buckets);
+  buckets.reserve(num_buckets);
   for (uint32_t bucket_index = 0; bucket_index < num_buckets; ++bucket_index) {
     uint64_t bucket_length;
     if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &bucket_length))) {
@@ -724,13 +1404,26 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
                            std::numeric_limits<size_t>::max())) {
       return Fail("Bucket too large");
     }
-    Chain bucket;
+    buckets.emplace_back();
     if (ABSL_PREDICT_FALSE(
-            !src->Read(&bucket, IntCast<size_t>(bucket_length)))) {
+            !src->Read(&buckets.back(), IntCast<size_t>(bucket_length)))) {
       return Fail("Reading bucket failed", *src);
     }
+  }
+  CompressionType buckets_compression_type = context->compression_type;
+  if (context->parallel_decompression &&
+      buckets_compression_type != CompressionType::kNone && num_buckets > 1) {
+    if (ABSL_PREDICT_FALSE(
+            !DecompressBuckets(buckets_compression_type, &buckets))) {
+      return false;
+    }
+    buckets_compression_type = CompressionType::kNone;
+  }
+  std::vector<internal::Decompressor<ChainReader<Chain>>> bucket_decompressors;
+  bucket_decompressors.reserve(num_buckets);
+  for (Chain& bucket : buckets) {
     bucket_decompressors.emplace_back(ChainReader<Chain>(std::move(bucket)),
-                                      context->compression_type);
+                                      buckets_compression_type);
     if (ABSL_PREDICT_FALSE(!bucket_decompressors.back().healthy())) {
       return Fail(bucket_decompressors.back());
     }
@@ -772,6 +1465,47 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
   return true;
 }
 
+bool TransposeDecoder::DecompressBuckets(CompressionType compression_type,
+                                         std::vector<Chain>* buckets) {
+  // Empty if decompression of the corresponding bucket succeeded.
+  std::vector<std::string> error_messages(buckets->size());
+  const auto decompress_bucket = [&](size_t index) {
+    Chain& bucket = (*buckets)[index];
+    uint64_t decompressed_size;
+    if (ABSL_PREDICT_FALSE(!internal::UncompressedSize(
+            bucket, compression_type, &decompressed_size))) {
+      error_messages[index] = "Reading uncompressed size failed";
+      return;
+    }
+    if (ABSL_PREDICT_FALSE(decompressed_size >
+                           std::numeric_limits<size_t>::max())) {
+      error_messages[index] = "Bucket too large";
+      return;
+    }
+    internal::Decompressor<ChainReader<>> decompressor(
+        (ChainReader<>(&bucket)), compression_type);
+    Chain decompressed;
+    if (ABSL_PREDICT_FALSE(!decompressor.healthy()) ||
+        ABSL_PREDICT_FALSE(!decompressor.reader()->Read(
+            &decompressed, IntCast<size_t>(decompressed_size))) ||
+        ABSL_PREDICT_FALSE(!decompressor.VerifyEndAndClose())) {
+      error_messages[index] = decompressor.healthy()
+                                  ? std::string("Reading bucket failed")
+                                  : std::string(decompressor.message());
+      return;
+    }
+    bucket = std::move(decompressed);
+  };
+  internal::ParallelFor(buckets->size(), internal::HardwareConcurrency(),
+                        decompress_bucket);
+  for (const std::string& error_message : error_messages) {
+    if (ABSL_PREDICT_FALSE(!error_message.empty())) {
+      return Fail(error_message);
+    }
+  }
+  return true;
+}
+
 inline bool TransposeDecoder::ParseBuffersForFitering(
     Context* context, Reader* header_reader, Reader* src,
     std::vector<uint32_t>* first_buffer_indices,
@@ -882,6 +1616,12 @@ inline Reader* TransposeDecoder::GetBuffer(Context* context,
         Fail("Reading buffer failed", *decompressor.reader());
         return nullptr;
       }
+      if (!bucket.buffer_encodings.empty() &&
+          ABSL_PREDICT_FALSE(!DecodeBuffer(
+              bucket.buffer_encodings[bucket.buffers.size()], &buffer))) {
+        Fail("Invalid encoded buffer");
+        return nullptr;
+      }
       bucket.buffers.emplace_back(std::move(buffer));
     }
     if (ABSL_PREDICT_FALSE(!decompressor.VerifyEndAndClose())) {
@@ -891,6 +1631,7 @@ inline Reader* TransposeDecoder::GetBuffer(Context* context,
     // Free memory of fields which are no longer needed.
     bucket.buffer_sizes = std::vector<size_t>();
     bucket.compressed_data = Chain();
+    bucket.buffer_encodings = std::vector<internal::BufferEncoding>();
     bucket.decompressed = true;
   }
   return &bucket.buffers[index_within_bucket];
@@ -1018,7 +1759,10 @@ inline bool TransposeDecoder::ContainsImplicitLoop(
     }                                                                         \
   } while (false)
 
-inline bool TransposeDecoder::Decode(Context* context, uint64_t num_records,
+inline bool TransposeDecoder::Decode(Context* context,
+                                     Reader* transitions_reader,
+                                     const Checkpoint* checkpoint,
+                                     bool verify_end, uint64_t num_records,
                                      BackwardWriter* dest,
                                      std::vector<size_t>* limits) {
   // For now positions reported by *dest are pushed to limits directly.
@@ -1032,7 +1776,6 @@ inline bool TransposeDecoder::Decode(Context* context, uint64_t num_records,
   // excluded in projection.
   int skipped_submessage_level = 0;
 
-  Reader* const transitions_reader = context->transitions.reader();
   // Stack of all open sub-messages.
   std::vector<SubmessageStackElement> submessage_stack;
   submessage_stack.reserve(16);
@@ -1080,6 +1823,13 @@ inline bool TransposeDecoder::Decode(Context* context, uint64_t num_records,
                ~static_cast<uint8_t>(internal::CallbackType::kImplicit)];
   }
 
+  if (checkpoint != nullptr) {
+    // The callback of the checkpoint node, which starts the record following
+    // the records being decoded, was performed before the checkpoint.
+    node = &context->state_machine_nodes[checkpoint->node];
+    if (internal::IsImplicit(node->callback_type)) ++num_iters;
+    goto do_transition;
+  }
   if (internal::IsImplicit(node->callback_type)) ++num_iters;
   goto * node->callback;
 
@@ -1207,6 +1957,7 @@ message_start:
     return Fail("Too many records");
   }
   limits->push_back(IntCast<size_t>(dest->pos()));
+  if (ABSL_PREDICT_FALSE(limits->size() == num_records)) goto done;
   // Fall through to do_transition.
 
 do_transition:
@@ -1226,8 +1977,11 @@ do_transition:
   }
 
 done:
-  if (ABSL_PREDICT_FALSE(!context->transitions.VerifyEndAndClose())) {
-    return Fail(context->transitions);
+  if (verify_end) {
+    transitions_reader->VerifyEnd();
+    if (ABSL_PREDICT_FALSE(!transitions_reader->healthy())) {
+      return Fail(*transitions_reader);
+    }
   }
   if (ABSL_PREDICT_FALSE(!submessage_stack.empty())) {
     return Fail("Submessages still open");
@@ -1262,6 +2016,240 @@ done:
   return true;
 }
 
+inline bool TransposeDecoder::Scan(Context* context, uint64_t num_records,
+                                   size_t field_depth, ColumnValues* dest) {
+  Reader* const transitions_reader = context->transitions.reader();
+  // Set current node to the initial node.
+  StateMachineNode* node = &context->state_machine_nodes[context->first_node];
+  // The depth of the current field relative to the parent submessage that was
+  // excluded in projection.
+  int skipped_submessage_level = 0;
+  // Stack of all open sub-messages. Only tags are used.
+  std::vector<SubmessageStackElement> submessage_stack;
+  submessage_stack.reserve(16);
+  // Number of following iteration that go directly to node->next_node without
+  // reading transition byte.
+  int num_iters = 0;
+  // Records are scanned from the last one backwards, so values belong to the
+  // record with index num_records - 1 - num_finished_records.
+  uint64_t num_finished_records = 0;
+
+  // Only nodes which include the field have data buffers other than
+  // kEmptyReader(). Such nodes occur only with field_depth enclosing
+  // submessages, because scanning a submessage or a group fails before its
+  // contents.
+  if (internal::IsImplicit(node->callback_type)) ++num_iters;
+  for (;;) {
+    internal::CallbackType callback_type =
+        internal::RemoveImplicit(node->callback_type);
+    if (callback_type == internal::CallbackType::kSelectCallback) {
+      if (ABSL_PREDICT_FALSE(!SetCallbackType(
+              context, skipped_submessage_level, submessage_stack, node))) {
+        return false;
+      }
+      callback_type = internal::RemoveImplicit(node->callback_type);
+    }
+    switch (callback_type) {
+      case internal::CallbackType::kNoOp:
+        break;
+      case internal::CallbackType::kNonProto:
+      case internal::CallbackType::kMessageStart:
+        if (ABSL_PREDICT_FALSE(!submessage_stack.empty())) {
+          return Fail("Submessages still open");
+        }
+        if (ABSL_PREDICT_FALSE(num_finished_records == num_records)) {
+          return Fail("Too many records");
+        }
+        ++num_finished_records;
+        if (ABSL_PREDICT_FALSE(num_finished_records == num_records)) {
+          goto done;
+        }
+        break;
+      case internal::CallbackType::kSubmessageStart:
+        if (ABSL_PREDICT_FALSE(submessage_stack.empty())) {
+          return Fail("Submessage stack underflow");
+        }
+        submessage_stack.pop_back();
+        break;
+      case internal::CallbackType::kSubmessageEnd:
+        // A value of the field broken down as a submessage. Its bytes are
+        // not available without decoding the record.
+        if (ABSL_PREDICT_FALSE(submessage_stack.size() == field_depth)) {
+          return false;
+        }
+        submessage_stack.push_back({0, node->tag_data});
+        break;
+      case internal::CallbackType::kSkippedSubmessageStart:
+        if (ABSL_PREDICT_FALSE(skipped_submessage_level == 0)) {
+          return Fail("Skipped submessage stack underflow");
+        }
+        --skipped_submessage_level;
+        break;
+      case internal::CallbackType::kSkippedSubmessageEnd:
+        ++skipped_submessage_level;
+        break;
+      case internal::CallbackType::kSelectCallback:
+      case internal::CallbackType::kFailure:
+      case internal::CallbackType::kUnknown:
+        return Fail("Invalid node");
+      default: {
+        // The remaining callback types are TYPES_FOR_TAG_LEN for some tag
+        // length, or kCopyTag_6.
+        const uint8_t kind =
+            callback_type == internal::CallbackType::kCopyTag_6
+                ? uint8_t{0}
+                : static_cast<uint8_t>(
+                      (callback_type - internal::CallbackType::kCopyTag_1) %
+                      (internal::CallbackType::kCopyTag_2 -
+                       internal::CallbackType::kCopyTag_1));
+        const uint64_t record_index = num_records - 1 - num_finished_records;
+        if (kind == internal::CallbackType::kCopyTag_1 -
+                        internal::CallbackType::kCopyTag_1) {
+          // An inline varint, or an empty submessage whose existence is
+          // included.
+          if (static_cast<internal::WireType>(node->tag_data.data[0] & 7) !=
+              internal::WireType::kVarint) {
+            break;
+          }
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kVarint))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->varints.push_back(static_cast<uint8_t>(
+              node->tag_data.data[node->tag_data.size]));
+        } else if (kind <= internal::CallbackType::kVarint_10_1 -
+                               internal::CallbackType::kCopyTag_1) {
+          const size_t length = kind - (internal::CallbackType::kVarint_1_1 -
+                                        internal::CallbackType::kCopyTag_1) +
+                                1;
+          char bytes[kMaxLengthVarint64];
+          if (ABSL_PREDICT_FALSE(!node->buffer->Read(bytes, length))) {
+            return Fail("Reading varint field failed", *node->buffer);
+          }
+          // Bytes are stored without their continuation bits.
+          uint64_t value = 0;
+          for (size_t i = 0; i < length; ++i) {
+            value |= uint64_t{static_cast<uint8_t>(bytes[i])} << (7 * i);
+          }
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kVarint))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->varints.push_back(value);
+        } else if (kind == internal::CallbackType::kFixed32_1 -
+                               internal::CallbackType::kCopyTag_1) {
+          uint32_t word;
+          if (ABSL_PREDICT_FALSE(!node->buffer->Read(
+                  reinterpret_cast<char*>(&word), sizeof(word)))) {
+            return Fail("Reading fixed field failed", *node->buffer);
+          }
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kFixed32))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->fixed32s.push_back(ReadLittleEndian32(word));
+        } else if (kind == internal::CallbackType::kFixed64_1 -
+                               internal::CallbackType::kCopyTag_1) {
+          uint64_t word;
+          if (ABSL_PREDICT_FALSE(!node->buffer->Read(
+                  reinterpret_cast<char*>(&word), sizeof(word)))) {
+            return Fail("Reading fixed field failed", *node->buffer);
+          }
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kFixed64))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->fixed64s.push_back(ReadLittleEndian64(word));
+        } else if (kind == internal::CallbackType::kString_1 -
+                               internal::CallbackType::kCopyTag_1) {
+          uint32_t length;
+          if (ABSL_PREDICT_FALSE(!ReadVarint32(node->buffer, &length))) {
+            return Fail("Reading string length failed", *node->buffer);
+          }
+          if (ABSL_PREDICT_FALSE(length > dest->strings.max_size() -
+                                              dest->strings.size())) {
+            return Fail("Strings too large");
+          }
+          if (ABSL_PREDICT_FALSE(!node->buffer->Read(&dest->strings, length))) {
+            return Fail("Reading string field failed", *node->buffer);
+          }
+          if (ABSL_PREDICT_FALSE(
+                  !dest->SetType(ColumnValues::Type::kString))) {
+            return Fail("Field has values of different wire types");
+          }
+          dest->record_indices.push_back(record_index);
+          dest->string_limits.push_back(dest->strings.size());
+        } else if (kind == internal::CallbackType::kStartProjectionGroup_1 -
+                               internal::CallbackType::kCopyTag_1) {
+          if (ABSL_PREDICT_FALSE(submessage_stack.empty())) {
+            return Fail("Submessage stack underflow");
+          }
+          submessage_stack.pop_back();
+        } else {
+          if (ABSL_PREDICT_FALSE(submessage_stack.size() == field_depth)) {
+            return Fail("Column scan of a group field");
+          }
+          submessage_stack.push_back({0, node->tag_data});
+        }
+      } break;
+    }
+
+    node = node->next_node;
+    if (num_iters == 0) {
+      uint8_t transition_byte;
+      if (ABSL_PREDICT_FALSE(!ReadByte(transitions_reader, &transition_byte))) {
+        goto done;
+      }
+      node += (transition_byte >> 2);
+      num_iters = transition_byte & 3;
+      if (internal::IsImplicit(node->callback_type)) ++num_iters;
+    } else {
+      if (!internal::IsImplicit(node->callback_type)) --num_iters;
+    }
+  }
+
+done:
+  transitions_reader->VerifyEnd();
+  if (ABSL_PREDICT_FALSE(!transitions_reader->healthy())) {
+    return Fail(*transitions_reader);
+  }
+  if (ABSL_PREDICT_FALSE(!submessage_stack.empty())) {
+    return Fail("Submessages still open");
+  }
+  if (ABSL_PREDICT_FALSE(skipped_submessage_level != 0)) {
+    return Fail("Skipped submessages still open");
+  }
+  if (ABSL_PREDICT_FALSE(num_finished_records != num_records)) {
+    return Fail("Too few records");
+  }
+
+  // Values were found from the last one backwards.
+  std::reverse(dest->record_indices.begin(), dest->record_indices.end());
+  std::reverse(dest->varints.begin(), dest->varints.end());
+  std::reverse(dest->fixed32s.begin(), dest->fixed32s.end());
+  std::reverse(dest->fixed64s.begin(), dest->fixed64s.end());
+  if (!dest->string_limits.empty()) {
+    std::string strings;
+    strings.reserve(dest->strings.size());
+    std::vector<size_t> string_limits;
+    string_limits.reserve(dest->string_limits.size());
+    for (size_t index = dest->string_limits.size(); index > 0; --index) {
+      const size_t start =
+          index == 1 ? size_t{0} : dest->string_limits[index - 2];
+      strings.append(dest->strings, start,
+                     dest->string_limits[index - 1] - start);
+      string_limits.push_back(strings.size());
+    }
+    dest->strings = std::move(strings);
+    dest->string_limits = std::move(string_limits);
+  }
+  return true;
+}
+
 // Do not inline this function. This helps Clang to generate better code for
 // the main loop in Decode().
 ABSL_ATTRIBUTE_NOINLINE inline bool TransposeDecoder::SetCallbackType(
@@ -1355,4 +2343,31 @@ ABSL_ATTRIBUTE_NOINLINE inline bool TransposeDecoder::SetCallbackType(
   return true;
 }
 
+void TransposeDecoder::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Object::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(context_);
+  if (context_ != nullptr) {
+    memory_estimator->RegisterSubobjects(context_->buffers);
+    memory_estimator->RegisterSubobjects(context_->state_machine_nodes);
+    memory_estimator->RegisterSubobjects(context_->transitions_data);
+    memory_estimator->RegisterSubobjects(context_->checkpoints);
+    for (const Checkpoint& checkpoint : context_->checkpoints) {
+      memory_estimator->RegisterSubobjects(checkpoint.buffer_positions);
+    }
+  }
+  memory_estimator->RegisterSubobjects(range_limits_);
+  memory_estimator->RegisterSubobjects(state_machine_cache_);
+  if (state_machine_cache_ != nullptr) {
+    memory_estimator->RegisterSubobjects(state_machine_cache_->header);
+    memory_estimator->RegisterSubobjects(
+        state_machine_cache_->state_machine_nodes);
+    memory_estimator->RegisterSubobjects(
+        state_machine_cache_->next_node_indices);
+    memory_estimator->RegisterSubobjects(state_machine_cache_->buffer_indices);
+    memory_estimator->RegisterSubobjects(
+        state_machine_cache_->buffer_encodings);
+  }
+}
+
 }  // namespace riegeli
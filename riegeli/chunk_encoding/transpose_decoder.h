@@ -17,34 +17,50 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "absl/strings/string_view.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/chunk_encoding/column_values.h"
+#include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
 
 namespace internal {
+enum class BufferEncoding : uint8_t;
 enum class CallbackType : uint8_t;
 }  // namespace internal
 
 class TransposeDecoder : public Object {
  public:
-  TransposeDecoder() noexcept : Object(State::kClosed) {}
+  TransposeDecoder() noexcept;
 
   TransposeDecoder(const TransposeDecoder&) = delete;
   TransposeDecoder& operator=(const TransposeDecoder&) = delete;
 
+  ~TransposeDecoder();
+
   // Resets the TransposeDecoder and parses the chunk.
   //
   // Writes concatenated record values to *dest. Sets *limits to sorted record
   // end positions.
   //
+  // If parallel_decompression is true and all fields are included, data
+  // buckets are decompressed concurrently in background threads before
+  // decoding. With field projection buckets are decompressed on demand during
+  // decoding, which is not parallelized.
+  //
   // Precondition: dest->pos() == 0
   //
   // Return values:
@@ -53,7 +69,75 @@ class TransposeDecoder : public Object {
   //            if !dest->healthy() then the problem was at dest
   bool Reset(Reader* src, uint64_t num_records, uint64_t decoded_data_size,
              const FieldProjection& field_projection, BackwardWriter* dest,
-             std::vector<size_t>* limits);
+             std::vector<size_t>* limits, bool parallel_decompression = false);
+
+  // Resets the TransposeDecoder and parses the chunk without decoding records,
+  // so that ranges of records can be decoded later by DecodeRange().
+  //
+  // Records are split into ranges at decoder checkpoints stored in the chunk.
+  // If the chunk has no checkpoints, all records form a single range. All
+  // fields are included.
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy())
+  bool ResetForRanges(Reader* src, uint64_t num_records,
+                      uint64_t decoded_data_size,
+                      bool parallel_decompression = false);
+
+  // Returns the number of records in each range, except that the last range
+  // can have fewer records. Range i starts at the record with index
+  // i * range_num_records().
+  //
+  // Precondition: ResetForRanges() succeeded
+  uint64_t range_num_records() const { return range_num_records_; }
+
+  // Returns sorted end positions of concatenated record values of consecutive
+  // ranges. The number of ranges is range_limits().size().
+  //
+  // Precondition: ResetForRanges() succeeded
+  const std::vector<size_t>& range_limits() const { return range_limits_; }
+
+  // Writes concatenated record values of records of the given range to *dest.
+  // Sets *limits to sorted record end positions relative to the beginning of
+  // the range.
+  //
+  // If the chunk has no checkpoints, its only range is decoded like in Reset(),
+  // without decompressing transitions upfront, and it can be decoded once.
+  //
+  // Precondition:
+  //   ResetForRanges() succeeded
+  //   range_index < range_limits().size()
+  //   dest->pos() == 0
+  //   if range_limits().size() == 1, DecodeRange() was not called yet
+  //
+  // Return values:
+  //  * true  - success (healthy())
+  //  * false - failure (!healthy());
+  //            if !dest->healthy() then the problem was at dest
+  bool DecodeRange(size_t range_index, BackwardWriter* dest,
+                   std::vector<size_t>* limits);
+
+  // Resets the TransposeDecoder and scans values of a single field in records
+  // of the chunk, without decoding the records. Only data buckets containing
+  // values of the field are decompressed.
+  //
+  // Values of a length-delimited field are reported as strings. If some of them
+  // were broken down as submessages, their bytes are not available without
+  // decoding records, and ScanField() returns false while healthy(). Group
+  // fields are not supported: scanning them fails.
+  //
+  // Precondition: !field.path().empty()
+  //
+  // Return values:
+  //  * true                    - success (*dest is set)
+  //  * false (when healthy())  - values broken down as submessages
+  //                              (*dest is unspecified)
+  //  * false (when !healthy()) - failure
+  bool ScanField(Reader* src, uint64_t num_records, const Field& field,
+                 ColumnValues* dest);
+
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  private:
   // Information about one proto tag.
@@ -121,16 +205,57 @@ class TransposeDecoder : public Object {
   static_assert(sizeof(StateMachineNode) == 3 * sizeof(void*) + 8,
                 "Unexpected padding in StateMachineNode.");
 
+  struct Checkpoint;
   struct Context;
+  struct StateMachineCache;
 
-  bool Parse(Context* context, Reader* src,
+  bool Parse(Context* context, Reader* src, uint64_t num_records,
              const FieldProjection& field_projection);
 
+  // Parse the state machine in "header_reader", followed by decoder
+  // checkpoints if any, into "context". Sets "*has_nonproto_op", and
+  // "*buffer_encodings" or "*nonproto_buffer_indices" depending on
+  // "projection_enabled".
+  bool ParseStateMachine(
+      Context* context, Reader* header_reader, uint64_t num_records,
+      bool projection_enabled, uint32_t num_buffers,
+      const std::vector<uint32_t>& first_buffer_indices,
+      const std::vector<uint32_t>& bucket_indices, bool* has_nonproto_op,
+      std::vector<internal::BufferEncoding>* buffer_encodings,
+      std::vector<std::pair<size_t, uint32_t>>* nonproto_buffer_indices);
+
+  // If "header" and "num_buffers" are the same as in the chunk whose state
+  // machine was saved by SaveStateMachine(), sets the state machine in
+  // "context" like ParseStateMachine() with projection disabled would, and
+  // returns true. Otherwise returns false.
+  bool RestoreStateMachine(
+      Context* context, absl::string_view header, uint32_t num_buffers,
+      bool* has_nonproto_op,
+      std::vector<internal::BufferEncoding>* buffer_encodings);
+
+  // Saves the state machine parsed into "context" from "header", for
+  // RestoreStateMachine().
+  //
+  // Precondition: projection is disabled and the chunk has no checkpoints.
+  void SaveStateMachine(
+      const Context& context, std::string&& header, uint32_t num_buffers,
+      bool has_nonproto_op,
+      const std::vector<internal::BufferEncoding>& buffer_encodings);
+
+  // Parse decoder checkpoints in "header_reader" into "context->checkpoints".
+  bool ParseCheckpoints(Context* context, Reader* header_reader,
+                        uint64_t num_records, uint32_t state_machine_size,
+                        uint32_t num_buffers);
+
   // Parse data buffers in "header_reader" and "reader" into
   // "context_->buffers". This method is used when projection is disabled and
   // all buffers are initially decompressed.
   bool ParseBuffers(Context* context, Reader* header_reader, Reader* src);
 
+  // Decompress "buckets" in place, concurrently in background threads.
+  bool DecompressBuckets(CompressionType compression_type,
+                         std::vector<Chain>* buckets);
+
   // Parse data buffers in "header_reader" and "reader" into
   // "context_->data_buckets". When projection is enabled, buckets are
   // decompressed on demand. "bucket_indices" contains bucket index for each
@@ -148,15 +273,38 @@ class TransposeDecoder : public Object {
   static bool ContainsImplicitLoop(
       std::vector<StateMachineNode>* state_machine_nodes);
 
-  bool Decode(Context* context, uint64_t num_records, BackwardWriter* dest,
+  // Decode "num_records" records reading transitions from
+  // "transitions_reader", starting from "checkpoint", or from the beginning
+  // if "checkpoint" is nullptr. If "verify_end" is true, transitions must end
+  // after these records.
+  bool Decode(Context* context, Reader* transitions_reader,
+              const Checkpoint* checkpoint, bool verify_end,
+              uint64_t num_records, BackwardWriter* dest,
               std::vector<size_t>* limits);
 
+  // Scan values of the field selected by the field projection of "context",
+  // with "field_depth" enclosing submessages, from "num_records" records.
+  // This walks the state machine like Decode() but reads only data buffers of
+  // the field, and does not write records. Returns false while healthy() if a
+  // value of the field was broken down as a submessage.
+  bool Scan(Context* context, uint64_t num_records, size_t field_depth,
+            ColumnValues* dest);
+
   // Set callback_type in "node" based on "skipped_submessage_level",
   // "submessage_stack" and "node->node_template".
   bool SetCallbackType(
       Context* context, int skipped_submessage_level,
       const std::vector<SubmessageStackElement>& submessage_stack,
       StateMachineNode* node);
+
+  // Parsed chunk, if ResetForRanges() succeeded.
+  std::unique_ptr<Context> context_;
+  uint64_t num_records_ = 0;
+  uint64_t range_num_records_ = 0;
+  std::vector<size_t> range_limits_;
+  // State machine of a previous chunk, reused if the next chunk has the same
+  // state machine.
+  std::unique_ptr<StateMachineCache> state_machine_cache_;
 };
 
 }  // namespace riegeli
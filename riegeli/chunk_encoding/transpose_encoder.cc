@@ -28,14 +28,19 @@
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/backward_writer_utils.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/limiting_reader.h"
+#include "riegeli/bytes/message_serialize.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
 #include "riegeli/bytes/string_reader.h"
@@ -53,67 +58,38 @@ namespace {
 constexpr uint32_t kInvalidPos = std::numeric_limits<uint32_t>::max();
 // Maximum varint value to encode as varint subtype instead of using the buffer.
 constexpr uint8_t kMaxVarintInline = 3;
+// Maximum number of distinct values of a dictionary encoded string field.
+// Fields with more distinct values are not considered low cardinality.
+constexpr size_t kMaxDictionarySize = size_t{1} << 16;
+// Maximum capacity of the serialized record buffer kept across Reset().
+// Larger buffers, left by huge records, are freed.
+constexpr size_t kMaxSerializedRecordCapacity = size_t{1} << 20;
+
+// Compresses "bucket" into "dest". On failure sets "error_message".
+//
+// This may be called concurrently for different buckets, so it uses its own
+// Compressor.
+void CompressBucket(const CompressorOptions& options, const Chain& bucket,
+                    Chain* dest, std::string* error_message) {
+  internal::Compressor compressor(options, bucket.size());
+  if (ABSL_PREDICT_FALSE(!compressor.writer()->Write(bucket))) {
+    *error_message = std::string(compressor.writer()->message());
+    return;
+  }
+  ChainWriter<> dest_writer(dest);
+  if (ABSL_PREDICT_FALSE(!compressor.EncodeAndClose(&dest_writer))) {
+    *error_message = std::string(compressor.message());
+    return;
+  }
+  if (ABSL_PREDICT_FALSE(!dest_writer.Close())) {
+    *error_message = std::string(dest_writer.message());
+  }
+}
 
 static_assert(kMaxVarintInline < 0x80,
               "Only one byte is used to store inline varint and its value must "
               "concide with its varint encoding");
 
-// Maximum depth of the nested message we break into columns. Submessages with
-// deeper nesting are encoded as strings.
-constexpr int kMaxRecursionDepth = 100;
-
-// Returns true if "record" is a valid protocol buffer message in the canonical
-// encoding. The purpose of this method is to distinguish string from a
-// submessage in the proto wire format and to perform validity checks that are
-// asserted later (such as that double proto field is followed by at least 8
-// bytes of data).
-// Note: Protocol buffer with suboptimal varint encoded tags and values (such as
-// 0x87,0x00 instead of 0x07) would parse successfully with the default proto
-// parser. This can happen for binary strings in proto. However, we need to
-// produce exactly the same bytes in the output so we reject message encoded
-// in non-canonical way.
-bool IsProtoMessage(Reader* record) {
-  // We validate that all started proto groups are closed with endgroup tag.
-  std::vector<uint32_t> started_groups;
-  while (record->Pull()) {
-    uint32_t tag;
-    if (!ReadCanonicalVarint32(record, &tag)) return false;
-    const uint32_t field = tag >> 3;
-    if (field == 0) return false;
-    switch (static_cast<internal::WireType>(tag & 7)) {
-      case internal::WireType::kVarint: {
-        uint64_t value;
-        if (!ReadCanonicalVarint64(record, &value)) return false;
-      } break;
-      case internal::WireType::kFixed32:
-        if (!record->Skip(sizeof(uint32_t))) return false;
-        break;
-      case internal::WireType::kFixed64:
-        if (!record->Skip(sizeof(uint64_t))) return false;
-        break;
-      case internal::WireType::kLengthDelimited: {
-        uint32_t length;
-        if (!ReadCanonicalVarint32(record, &length)) return false;
-        if (!record->Skip(length)) return false;
-      } break;
-      case internal::WireType::kStartGroup:
-        started_groups.push_back(field);
-        break;
-      case internal::WireType::kEndGroup:
-        if (started_groups.empty() || started_groups.back() != field) {
-          return false;
-        }
-        started_groups.pop_back();
-        break;
-      default:
-        return false;
-    }
-  }
-  RIEGELI_ASSERT(record->healthy())
-      << "Reading record failed: " << record->message();
-  return started_groups.empty();
-}
-
 // PriorityQueueEntry is used in priority_queue to order destinations by the
 // number of transitions into them.
 struct PriorityQueueEntry {
@@ -139,14 +115,14 @@ bool operator<(PriorityQueueEntry a, PriorityQueueEntry b) {
 
 }  // namespace
 
-inline TransposeEncoder::MessageNode::MessageNode(
-    internal::MessageId message_id)
-    : message_id(message_id) {}
-
 inline TransposeEncoder::NodeId::NodeId(internal::MessageId parent_message_id,
                                         uint32_t tag)
     : parent_message_id(parent_message_id), tag(tag) {}
 
+inline TransposeEncoder::MessageNode::MessageNode(
+    NodeId node_id, internal::MessageId message_id)
+    : node_id(node_id), message_id(message_id) {}
+
 inline TransposeEncoder::StateInfo::StateInfo()
     : etag_index(kInvalidPos),
       base(kInvalidPos),
@@ -159,24 +135,42 @@ inline TransposeEncoder::StateInfo::StateInfo(uint32_t etag_index,
 inline TransposeEncoder::DestInfo::DestInfo() : pos(kInvalidPos) {}
 
 inline TransposeEncoder::EncodedTagInfo::EncodedTagInfo(
-    NodeId node_id, internal::Subtype subtype)
+    NodeId node_id, internal::MessageId message_id, internal::Subtype subtype)
     : node_id(node_id),
+      message_id(message_id),
       subtype(subtype),
       state_machine_pos(kInvalidPos),
       public_list_noop_pos(kInvalidPos),
       base(kInvalidPos) {}
 
-inline TransposeEncoder::BufferWithMetadata::BufferWithMetadata(NodeId node_id)
-    : buffer(absl::make_unique<Chain>()), node_id(node_id) {}
-
-TransposeEncoder::TransposeEncoder(CompressorOptions options,
-                                   uint64_t bucket_size)
-    : compression_type_(options.compression_type()),
-      bucket_size_(options.compression_type() == CompressionType::kNone
+inline TransposeEncoder::BufferWithMetadata::BufferWithMetadata(
+    NodeId node_id, internal::MessageId message_id,
+    ChainBackwardWriter<Chain>* writer)
+    : node_id(node_id), message_id(message_id), writer(writer) {}
+
+TransposeEncoder::TransposeEncoder(CompressorOptions compressor_options,
+                                   uint64_t bucket_size, Options options)
+    : compressor_options_(compressor_options),
+      compression_type_(compressor_options.compression_type()),
+      bucket_size_(compressor_options.compression_type() ==
+                           CompressionType::kNone
                        ? std::numeric_limits<uint64_t>::max()
                        : bucket_size),
-      compressor_(options),
-      nonproto_lengths_writer_(Chain()) {}
+      checkpoint_interval_(options.checkpoint_interval_),
+      delta_encoding_(options.delta_encoding_),
+      byte_shuffle_(options.byte_shuffle_),
+      dictionary_encoding_(options.dictionary_encoding_),
+      packed_fields_(options.packed_fields_),
+      record_type_(options.record_type_),
+      compression_parallelism_(options.compression_parallelism_),
+      compressor_(compressor_options),
+      nonproto_lengths_writer_(Chain()) {
+  for (uint32_t id = 0; id <= static_cast<uint32_t>(internal::MessageId::kRoot);
+       ++id) {
+    message_nodes_.emplace_back(NodeId(internal::MessageId::kNoOp, 0),
+                                static_cast<internal::MessageId>(id));
+  }
+}
 
 TransposeEncoder::~TransposeEncoder() {}
 
@@ -187,9 +181,30 @@ void TransposeEncoder::Reset() {
   encoded_tags_.clear();
   for (std::vector<BufferWithMetadata>& buffers : data_) buffers.clear();
   group_stack_.clear();
-  message_nodes_.clear();
+  // Keep placeholder nodes of reserved message IDs.
+  message_nodes_.erase(
+      message_nodes_.begin() +
+          (static_cast<uint32_t>(internal::MessageId::kRoot) + 1),
+      message_nodes_.end());
+  for (MessageNode& node : message_nodes_) node.children.clear();
+  sparse_children_.clear();
+  num_buffer_writers_ = 0;
   nonproto_lengths_writer_ = ChainBackwardWriter<Chain>(Chain());
-  next_message_id_ = internal::MessageId::kRoot + 1;
+  checkpoints_.clear();
+  if (serialized_record_.capacity() > kMaxSerializedRecordCapacity) {
+    std::string().swap(serialized_record_);
+  }
+}
+
+bool TransposeEncoder::AddRecord(const google::protobuf::MessageLite& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  std::string error_message;
+  if (ABSL_PREDICT_FALSE(
+          !SerializeToString(record, &serialized_record_, &error_message))) {
+    return Fail(error_message);
+  }
+  StringReader<> reader(serialized_record_);
+  return AddRecordInternal(&reader);
 }
 
 bool TransposeEncoder::AddRecord(absl::string_view record) {
@@ -231,6 +246,16 @@ bool TransposeEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
   return true;
 }
 
+bool TransposeEncoder::IsTransposable(absl::string_view record) {
+  StringReader<> reader(record);
+  return internal::IsProtoMessage(&reader);
+}
+
+bool TransposeEncoder::IsTransposable(const Chain& record) {
+  ChainReader<> reader(&record);
+  return internal::IsProtoMessage(&reader);
+}
+
 inline bool TransposeEncoder::AddRecordInternal(Reader* record) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   RIEGELI_ASSERT(record->healthy())
@@ -252,9 +277,13 @@ inline bool TransposeEncoder::AddRecordInternal(Reader* record) {
                                     decoded_data_size_)) {
     return Fail("Decoded data size too large");
   }
+  if (checkpoint_interval_ != 0 && num_records_ != 0 &&
+      num_records_ % checkpoint_interval_ == 0) {
+    AddCheckpoint();
+  }
   ++num_records_;
   decoded_data_size_ += IntCast<uint64_t>(size);
-  const bool is_proto = IsProtoMessage(record);
+  const bool is_proto = internal::IsProtoMessage(record);
   if (!record->Seek(pos_before)) {
     RIEGELI_ASSERT_UNREACHABLE()
         << "Seeking reader of a record failed: " << record->message();
@@ -264,9 +293,9 @@ inline bool TransposeEncoder::AddRecordInternal(Reader* record) {
         GetNode(NodeId(internal::MessageId::kStartOfMessage, 0)),
         internal::Subtype::kTrivial));
     LimitingReader<> message(record);
-    return AddMessage(&message, internal::MessageId::kRoot, 0);
+    return AddMessage(&message, internal::MessageId::kRoot, record_type_, 0);
   } else {
-    Node* node = GetNode(NodeId(internal::MessageId::kNonProto, 0));
+    MessageNode* node = GetNode(NodeId(internal::MessageId::kNonProto, 0));
     encoded_tags_.push_back(
         GetPosInTagsList(node, internal::Subtype::kTrivial));
     BackwardWriter* const buffer = GetBuffer(node, BufferType::kNonProto);
@@ -281,55 +310,95 @@ inline bool TransposeEncoder::AddRecordInternal(Reader* record) {
   }
 }
 
-inline BackwardWriter* TransposeEncoder::GetBuffer(Node* node,
+inline void TransposeEncoder::AddCheckpoint() {
+  checkpoints_.push_back(Checkpoint{encoded_tags_.size(), decoded_data_size_,
+                                    nonproto_lengths_writer_.pos()});
+  for (std::vector<BufferWithMetadata>& buffers : data_) {
+    for (BufferWithMetadata& buffer : buffers) {
+      buffer.checkpoint_sizes.push_back(buffer.writer->pos());
+    }
+  }
+}
+
+inline BackwardWriter* TransposeEncoder::GetBuffer(MessageNode* node,
                                                    BufferType type) {
-  if (!node->second.writer) {
+  if (node->writer == nullptr) {
+    if (num_buffer_writers_ == buffer_writers_.size()) {
+      buffer_writers_.push_back(
+          absl::make_unique<ChainBackwardWriter<Chain>>(Chain()));
+    } else {
+      // Reuse a writer from a previous chunk, together with the first block of
+      // its destination if the block is no longer shared.
+      ChainBackwardWriter<Chain>* const writer =
+          buffer_writers_[num_buffer_writers_].get();
+      writer->Close();
+      Chain& buffer = writer->dest();
+      buffer.Clear();
+      *writer = ChainBackwardWriter<Chain>(std::move(buffer));
+    }
+    node->writer = buffer_writers_[num_buffer_writers_++].get();
     std::vector<BufferWithMetadata>& buffers =
         data_[static_cast<uint32_t>(type)];
-    buffers.emplace_back(node->first);
-    node->second.writer =
-        absl::make_unique<ChainBackwardWriter<>>(buffers.back().buffer.get());
+    buffers.emplace_back(node->node_id, node->message_id, node->writer);
+    // The buffer was empty at checkpoints added so far.
+    buffers.back().checkpoint_sizes.resize(checkpoints_.size());
   }
-  return node->second.writer.get();
+  return node->writer;
 }
 
-inline uint32_t TransposeEncoder::GetPosInTagsList(Node* node,
+inline uint32_t TransposeEncoder::GetPosInTagsList(MessageNode* node,
                                                    internal::Subtype subtype) {
   size_t pos = static_cast<size_t>(subtype);
-  if (node->second.encoded_tag_pos.size() <= pos) {
-    node->second.encoded_tag_pos.resize(pos + 1,
-                                        std::numeric_limits<uint32_t>::max());
+  if (node->encoded_tag_pos.size() <= pos) {
+    node->encoded_tag_pos.resize(pos + 1,
+                                 std::numeric_limits<uint32_t>::max());
   }
-  uint32_t* ret = &node->second.encoded_tag_pos[pos];
+  uint32_t* ret = &node->encoded_tag_pos[pos];
   if (*ret == std::numeric_limits<uint32_t>::max()) {
     *ret = tags_list_.size();
-    tags_list_.emplace_back(node->first, subtype);
+    tags_list_.emplace_back(node->node_id, node->message_id, subtype);
   }
   return *ret;
 }
 
-inline TransposeEncoder::Node* TransposeEncoder::GetNode(NodeId node_id) {
-  auto it = message_nodes_.find(node_id);
-  if (it == message_nodes_.end()) {
-    it = message_nodes_.emplace(node_id, next_message_id_).first;
-    ++next_message_id_;
+inline TransposeEncoder::MessageNode* TransposeEncoder::GetNode(
+    NodeId node_id) {
+  uint32_t* node_index;
+  if (ABSL_PREDICT_TRUE(node_id.tag < kMaxDenseTag)) {
+    std::vector<uint32_t>& children =
+        message_nodes_[static_cast<uint32_t>(node_id.parent_message_id)]
+            .children;
+    if (ABSL_PREDICT_FALSE(children.size() <= node_id.tag)) {
+      children.resize(node_id.tag + 1, kInvalidPos);
+    }
+    node_index = &children[node_id.tag];
+  } else {
+    node_index = &sparse_children_.emplace(node_id, kInvalidPos).first->second;
+  }
+  if (ABSL_PREDICT_TRUE(*node_index != kInvalidPos)) {
+    return &message_nodes_[*node_index];
   }
-  return &*it;
+  // Adding a node can invalidate node_index.
+  const uint32_t new_node_index = IntCast<uint32_t>(message_nodes_.size());
+  *node_index = new_node_index;
+  message_nodes_.emplace_back(node_id,
+                              static_cast<internal::MessageId>(new_node_index));
+  return &message_nodes_.back();
 }
 
 // Precondition: IsProtoMessage returns true for this record.
 // Note: EncodedTags are appended into "encoded_tags_" but data is prepended
 // into respective buffers. "encoded_tags_" will be reversed later in
 // WriteToBuffer call.
-inline bool TransposeEncoder::AddMessage(LimitingReaderBase* record,
-                                         internal::MessageId parent_message_id,
-                                         int depth) {
+inline bool TransposeEncoder::AddMessage(
+    LimitingReaderBase* record, internal::MessageId parent_message_id,
+    const google::protobuf::Descriptor* message_type, int depth) {
   while (record->Pull()) {
     uint32_t tag;
     if (!ReadVarint32(record, &tag)) {
       RIEGELI_ASSERT_UNREACHABLE() << "Invalid tag: " << record->message();
     }
-    Node* node = GetNode(NodeId(parent_message_id, tag));
+    MessageNode* node = GetNode(NodeId(parent_message_id, tag));
     switch (static_cast<internal::WireType>(tag & 7)) {
       case internal::WireType::kVarint: {
         // Storing value as uint64_t[2] instead of uint8_t[10] lets Clang and
@@ -388,10 +457,21 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase* record,
         }
         const Position value_pos = record->pos();
         SizeLimitSetter size_limiter(record, value_pos + length);
+        FieldKind field_kind = FieldKind::kUnknown;
+        if (message_type != nullptr) {
+          LookUpField(message_type, node);
+          field_kind = node->field_kind;
+        }
+        const google::protobuf::Descriptor* const submessage_type =
+            field_kind == FieldKind::kMessage ? node->message_type : nullptr;
         // Non-toplevel empty strings are treated as strings, not messages.
         // They have a simpler encoding this way (one node instead of two).
-        if (depth < kMaxRecursionDepth && length != 0 &&
-            IsProtoMessage(record)) {
+        // Fields known to be strings are not parsed. Fields known to be
+        // submessages are still validated, because their encoding must be
+        // canonical to be reproduced exactly.
+        if (field_kind != FieldKind::kString &&
+            depth < internal::kMaxRecursionDepth && length != 0 &&
+            internal::IsProtoMessage(record)) {
           encoded_tags_.push_back(GetPosInTagsList(
               node, internal::Subtype::kLengthDelimitedStartOfSubmessage));
           if (!record->Seek(value_pos)) {
@@ -400,8 +480,8 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase* record,
           }
           auto end_of_submessage_pos = GetPosInTagsList(
               node, internal::Subtype::kLengthDelimitedEndOfSubmessage);
-          if (ABSL_PREDICT_FALSE(
-                  !AddMessage(record, node->second.message_id, depth + 1))) {
+          if (ABSL_PREDICT_FALSE(!AddMessage(record, node->message_id,
+                                             submessage_type, depth + 1))) {
             return false;
           }
           // Call to AddMessage invalidates "node"
@@ -424,12 +504,19 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase* record,
       case internal::WireType::kStartGroup: {
         encoded_tags_.push_back(
             GetPosInTagsList(node, internal::Subtype::kTrivial));
-        group_stack_.push_back(parent_message_id);
+        group_stack_.emplace_back(parent_message_id, message_type);
+        if (message_type != nullptr) {
+          LookUpField(message_type, node);
+          message_type = node->field_kind == FieldKind::kMessage
+                             ? node->message_type
+                             : nullptr;
+        }
         ++depth;
-        parent_message_id = node->second.message_id;
+        parent_message_id = node->message_id;
       } break;
       case internal::WireType::kEndGroup:
-        parent_message_id = group_stack_.back();
+        parent_message_id = group_stack_.back().first;
+        message_type = group_stack_.back().second;
         group_stack_.pop_back();
         --depth;
         // Note that "parent_message_id" was updated above so the "node" does
@@ -448,42 +535,106 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase* record,
   return true;
 }
 
-inline bool TransposeEncoder::AddBuffer(bool force_new_bucket,
+inline void TransposeEncoder::LookUpField(
+    const google::protobuf::Descriptor* parent_type, MessageNode* node) {
+  if (ABSL_PREDICT_TRUE(node->field_kind != FieldKind::kNotLookedUp)) return;
+  node->field_kind = FieldKind::kUnknown;
+  const google::protobuf::FieldDescriptor* const field =
+      parent_type->FindFieldByNumber(
+          static_cast<int>(node->node_id.tag >> 3));
+  if (field == nullptr) return;
+  switch (static_cast<internal::WireType>(node->node_id.tag & 7)) {
+    case internal::WireType::kLengthDelimited:
+      switch (field->type()) {
+        case google::protobuf::FieldDescriptor::TYPE_MESSAGE:
+          node->field_kind = FieldKind::kMessage;
+          node->message_type = field->message_type();
+          return;
+        case google::protobuf::FieldDescriptor::TYPE_GROUP:
+          return;
+        default:
+          // A string, bytes, or packed repeated field.
+          node->field_kind = FieldKind::kString;
+          return;
+      }
+    case internal::WireType::kStartGroup:
+      // A message field can be encoded as a group too.
+      if (field->type() == google::protobuf::FieldDescriptor::TYPE_GROUP ||
+          field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE) {
+        node->field_kind = FieldKind::kMessage;
+        node->message_type = field->message_type();
+      }
+      return;
+    default:
+      return;
+  }
+}
+
+inline void TransposeEncoder::AddBuffer(bool force_new_bucket,
                                         const Chain& next_chunk,
-                                        Writer* data_writer,
-                                        std::vector<size_t>* bucket_lengths,
+                                        Chain* current_bucket,
+                                        std::vector<Chain>* buckets,
                                         std::vector<size_t>* buffer_lengths) {
   buffer_lengths->push_back(next_chunk.size());
   if (ABSL_PREDICT_FALSE(force_new_bucket ||
-                         compressor_.writer()->pos() + next_chunk.size() >
+                         current_bucket->size() + next_chunk.size() >
                              bucket_size_) &&
-      compressor_.writer()->pos() > 0) {
-    const Position pos_before = data_writer->pos();
-    if (ABSL_PREDICT_FALSE(!compressor_.EncodeAndClose(data_writer))) {
-      return Fail(compressor_);
+      current_bucket->size() > 0) {
+    buckets->push_back(std::move(*current_bucket));
+    current_bucket->Clear();
+  }
+  current_bucket->Append(next_chunk);
+}
+
+inline bool TransposeEncoder::WriteBuckets(
+    const std::vector<Chain>& buckets, Writer* data_writer,
+    std::vector<size_t>* bucket_lengths) {
+  struct CompressedBucket {
+    Chain data;
+    // Empty if compression succeeded.
+    std::string error_message;
+  };
+  std::vector<CompressedBucket> compressed_buckets(buckets.size());
+  const auto compress_bucket = [&](size_t index) {
+    CompressBucket(compressor_options_, buckets[index],
+                   &compressed_buckets[index].data,
+                   &compressed_buckets[index].error_message);
+  };
+  if (compression_type_ == CompressionType::kNone ||
+      compression_parallelism_ <= 1) {
+    for (size_t index = 0; index < buckets.size(); ++index) {
+      compress_bucket(index);
     }
-    RIEGELI_ASSERT_GE(data_writer->pos(), pos_before)
-        << "Data writer position decreased";
-    bucket_lengths->push_back(IntCast<size_t>(data_writer->pos() - pos_before));
-    compressor_.Reset();
+  } else {
+    internal::ParallelFor(buckets.size(),
+                          IntCast<size_t>(compression_parallelism_),
+                          compress_bucket);
   }
-  if (ABSL_PREDICT_FALSE(!compressor_.writer()->Write(next_chunk))) {
-    return Fail(compressor_);
+
+  for (CompressedBucket& compressed_bucket : compressed_buckets) {
+    if (ABSL_PREDICT_FALSE(!compressed_bucket.error_message.empty())) {
+      return Fail(compressed_bucket.error_message);
+    }
+    bucket_lengths->push_back(compressed_bucket.data.size());
+    if (ABSL_PREDICT_FALSE(
+            !data_writer->Write(std::move(compressed_bucket.data)))) {
+      return Fail(*data_writer);
+    }
   }
   return true;
 }
 
 inline bool TransposeEncoder::WriteBuffers(
     Writer* header_writer, Writer* data_writer,
-    absl::flat_hash_map<NodeId, uint32_t>* buffer_pos) {
+    std::vector<uint32_t>* buffer_pos) {
   size_t num_buffers = 0;
   for (size_t i = 0; i < kNumBufferTypes; ++i) {
     // Sort data_ by length, largest to smallest.
     std::sort(
         data_[i].begin(), data_[i].end(),
         [](const BufferWithMetadata& a, const BufferWithMetadata& b) {
-          if (a.buffer->size() != b.buffer->size()) {
-            return a.buffer->size() > b.buffer->size();
+          if (a.writer->dest().size() != b.writer->dest().size()) {
+            return a.writer->dest().size() > b.writer->dest().size();
           }
           if (a.node_id.parent_message_id != b.node_id.parent_message_id) {
             return a.node_id.parent_message_id < b.node_id.parent_message_id;
@@ -497,44 +648,39 @@ inline bool TransposeEncoder::WriteBuffers(
 
   std::vector<size_t> buffer_lengths;
   buffer_lengths.reserve(num_buffers);
-  std::vector<size_t> bucket_lengths;
+  std::vector<Chain> buckets;
+  Chain current_bucket;
 
-  // Write all buffer lengths to the header and data to "bucket_buffer".
+  // Write all buffer lengths to the header and group data into buckets.
+  buffer_pos->assign(message_nodes_.size(), kInvalidPos);
+  uint32_t next_buffer_pos = 0;
   for (size_t i = 0; i < kNumBufferTypes; ++i) {
     for (size_t j = 0; j < data_[i].size(); ++j) {
       const BufferWithMetadata& buffer = data_[i][j];
-      if (ABSL_PREDICT_FALSE(!AddBuffer(j == 0, *buffer.buffer, data_writer,
-                                        &bucket_lengths, &buffer_lengths))) {
-        return false;
-      }
-      const std::pair<absl::flat_hash_map<NodeId, uint32_t>::iterator, bool>
-          insert_result = buffer_pos->emplace(
-              buffer.node_id, IntCast<uint32_t>(buffer_pos->size()));
-      RIEGELI_ASSERT(insert_result.second)
+      AddBuffer(j == 0, buffer.writer->dest(), &current_bucket, &buckets,
+                &buffer_lengths);
+      uint32_t& pos = (*buffer_pos)[static_cast<uint32_t>(buffer.message_id)];
+      RIEGELI_ASSERT_EQ(pos, kInvalidPos)
           << "Field already has buffer assigned: "
           << static_cast<uint32_t>(buffer.node_id.parent_message_id) << "/"
           << buffer.node_id.tag;
+      pos = next_buffer_pos++;
     }
   }
   if (!nonproto_lengths.empty()) {
     // nonproto_lengths_ is the last buffer if non-empty.
-    if (ABSL_PREDICT_FALSE(!AddBuffer(
-            /*force_new_bucket=*/true, nonproto_lengths, data_writer,
-            &bucket_lengths, &buffer_lengths))) {
-      return false;
-    }
+    AddBuffer(/*force_new_bucket=*/true, nonproto_lengths, &current_bucket,
+              &buckets, &buffer_lengths);
     // Note: nonproto_lengths needs no buffer_pos.
   }
+  // Last bucket.
+  if (current_bucket.size() > 0) buckets.push_back(std::move(current_bucket));
 
-  if (compressor_.writer()->pos() > 0) {
-    // Last bucket.
-    const Position pos_before = data_writer->pos();
-    if (ABSL_PREDICT_FALSE(!compressor_.EncodeAndClose(data_writer))) {
-      return Fail(compressor_);
-    }
-    RIEGELI_ASSERT_GE(data_writer->pos(), pos_before)
-        << "Data writer position decreased";
-    bucket_lengths.push_back(IntCast<size_t>(data_writer->pos() - pos_before));
+  std::vector<size_t> bucket_lengths;
+  bucket_lengths.reserve(buckets.size());
+  if (ABSL_PREDICT_FALSE(
+          !WriteBuckets(buckets, data_writer, &bucket_lengths))) {
+    return false;
   }
 
   if (ABSL_PREDICT_FALSE(!WriteVarint32(
@@ -574,7 +720,7 @@ inline bool TransposeEncoder::WriteStatesAndData(
     RIEGELI_ASSERT_NE(tags_list_[encoded_tags_[0]].dest_info.size(), 1u)
         << "Number of transitions from the last state did not increase";
   }
-  absl::flat_hash_map<NodeId, uint32_t> buffer_pos;
+  std::vector<uint32_t> buffer_pos;
   if (ABSL_PREDICT_FALSE(
           !WriteBuffers(header_writer, data_writer, &buffer_pos))) {
     return false;
@@ -625,6 +771,25 @@ inline bool TransposeEncoder::WriteStatesAndData(
                                internal::WireType::kLengthDelimited)))) {
           return Fail(*header_writer);
         }
+      } else if (internal::HasEncodedBuffer(node_id.tag, subtype)) {
+        // A buffer stored in a special form is encoded as
+        // WireType::kEncodedBuffer, followed by the actual wire type in place
+        // of the subtype.
+        if (ABSL_PREDICT_FALSE(!WriteVarint32(
+                header_writer, (node_id.tag & ~uint32_t{7}) |
+                                   internal::WireType::kEncodedBuffer))) {
+          return Fail(*header_writer);
+        }
+        subtype_to_write.push_back(
+            static_cast<char>(internal::EncodedBufferByte(
+                static_cast<internal::WireType>(node_id.tag & 7), subtype)));
+        const uint32_t pos =
+            buffer_pos[static_cast<uint32_t>(etag_info.message_id)];
+        RIEGELI_ASSERT_NE(pos, kInvalidPos)
+            << "Buffer not found: "
+            << static_cast<uint32_t>(node_id.parent_message_id) << "/"
+            << node_id.tag;
+        buffer_index_to_write.push_back(pos);
       } else {
         if (ABSL_PREDICT_FALSE(!WriteVarint32(header_writer, node_id.tag))) {
           return Fail(*header_writer);
@@ -633,13 +798,13 @@ inline bool TransposeEncoder::WriteStatesAndData(
           subtype_to_write.push_back(static_cast<char>(subtype));
         }
         if (internal::HasDataBuffer(node_id.tag, subtype)) {
-          const absl::flat_hash_map<NodeId, uint32_t>::const_iterator iter =
-              buffer_pos.find(NodeId(node_id.parent_message_id, node_id.tag));
-          RIEGELI_ASSERT(iter != buffer_pos.end())
+          const uint32_t pos =
+              buffer_pos[static_cast<uint32_t>(etag_info.message_id)];
+          RIEGELI_ASSERT_NE(pos, kInvalidPos)
               << "Buffer not found: "
               << static_cast<uint32_t>(node_id.parent_message_id) << "/"
               << node_id.tag;
-          buffer_index_to_write.push_back(iter->second);
+          buffer_index_to_write.push_back(pos);
         }
       }
     } else {
@@ -651,11 +816,11 @@ inline bool TransposeEncoder::WriteStatesAndData(
       }
       if (node_id.parent_message_id == internal::MessageId::kNonProto) {
         // NonProto has data buffer.
-        const absl::flat_hash_map<NodeId, uint32_t>::const_iterator iter =
-            buffer_pos.find(NodeId(internal::MessageId::kNonProto, 0));
-        RIEGELI_ASSERT(iter != buffer_pos.end())
+        const uint32_t pos =
+            buffer_pos[static_cast<uint32_t>(etag_info.message_id)];
+        RIEGELI_ASSERT_NE(pos, kInvalidPos)
             << "Buffer of non-proto records not found";
-        buffer_index_to_write.push_back(iter->second);
+        buffer_index_to_write.push_back(pos);
       } else {
         RIEGELI_ASSERT_EQ(
             static_cast<uint32_t>(node_id.parent_message_id),
@@ -703,17 +868,82 @@ inline bool TransposeEncoder::WriteStatesAndData(
   }
 
   compressor_.Reset();
-  if (ABSL_PREDICT_FALSE(!WriteTransitions(max_transition, state_machine))) {
+  std::vector<Position> checkpoint_transitions(checkpoints_.size());
+  if (ABSL_PREDICT_FALSE(!WriteTransitions(max_transition, state_machine,
+                                           &checkpoint_transitions))) {
     return false;
   }
   if (ABSL_PREDICT_FALSE(!compressor_.EncodeAndClose(data_writer))) {
     return Fail(compressor_);
   }
+  return WriteCheckpoints(state_machine, checkpoint_transitions, header_writer);
+}
+
+inline bool TransposeEncoder::WriteCheckpoints(
+    const std::vector<StateInfo>& state_machine,
+    const std::vector<Position>& checkpoint_transitions,
+    Writer* header_writer) {
+  if (checkpoints_.empty()) return true;
+  // Any state of the first tag of the record can be used for the checkpoint,
+  // because all states of the same tag behave the same way.
+  std::vector<uint32_t> tag_states(tags_list_.size(), kInvalidPos);
+  for (uint32_t i = 0; i < state_machine.size(); ++i) {
+    const uint32_t etag_index = state_machine[i].etag_index;
+    if (etag_index != kInvalidPos && tag_states[etag_index] == kInvalidPos) {
+      tag_states[etag_index] = i;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!WriteVarint64(header_writer, checkpoint_interval_)) ||
+      ABSL_PREDICT_FALSE(!WriteVarint64(
+          header_writer, IntCast<uint64_t>(checkpoints_.size())))) {
+    return Fail(*header_writer);
+  }
+  const Chain& nonproto_lengths = nonproto_lengths_writer_.dest();
+  // Checkpoints are written in the order of decoding.
+  for (size_t index = checkpoints_.size(); index > 0; --index) {
+    const Checkpoint& checkpoint = checkpoints_[index - 1];
+    const bool first = index == checkpoints_.size();
+    const uint32_t state =
+        tag_states[encoded_tags_[checkpoint.encoded_tag_index]];
+    RIEGELI_ASSERT_NE(state, kInvalidPos) << "Tag of a checkpoint has no state";
+    if (ABSL_PREDICT_FALSE(!WriteVarint32(header_writer, state)) ||
+        ABSL_PREDICT_FALSE(!WriteVarint64(
+            header_writer,
+            (first ? decoded_data_size_
+                   : checkpoints_[index].decoded_data_size) -
+                checkpoint.decoded_data_size)) ||
+        ABSL_PREDICT_FALSE(!WriteVarint64(
+            header_writer, checkpoint_transitions[index - 1] -
+                               (first ? Position{0}
+                                      : checkpoint_transitions[index])))) {
+      return Fail(*header_writer);
+    }
+    for (const std::vector<BufferWithMetadata>& buffers : data_) {
+      for (const BufferWithMetadata& buffer : buffers) {
+        if (ABSL_PREDICT_FALSE(!WriteVarint64(
+                header_writer, (first ? Position{buffer.writer->dest().size()}
+                                      : buffer.checkpoint_sizes[index]) -
+                                   buffer.checkpoint_sizes[index - 1]))) {
+          return Fail(*header_writer);
+        }
+      }
+    }
+    if (!nonproto_lengths.empty()) {
+      if (ABSL_PREDICT_FALSE(!WriteVarint64(
+              header_writer,
+              (first ? Position{nonproto_lengths.size()}
+                     : checkpoints_[index].nonproto_lengths_size) -
+                  checkpoint.nonproto_lengths_size))) {
+        return Fail(*header_writer);
+      }
+    }
+  }
   return true;
 }
 
 inline bool TransposeEncoder::WriteTransitions(
-    uint32_t max_transition, const std::vector<StateInfo>& state_machine) {
+    uint32_t max_transition, const std::vector<StateInfo>& state_machine,
+    std::vector<Position>* checkpoint_transitions) {
   if (encoded_tags_.empty()) return true;
   uint32_t prev_etag = encoded_tags_.back();
   uint32_t current_base = tags_list_[prev_etag].base;
@@ -727,8 +957,23 @@ inline bool TransposeEncoder::WriteTransitions(
   constexpr size_t kWriteBufSize = 32;
   uint8_t write[kWriteBufSize];
   absl::optional<uint8_t> last_transition;
+  size_t checkpoint_index = checkpoints_.size();
   // Go through all transitions and encode them.
   for (uint32_t i = IntCast<uint32_t>(encoded_tags_.size() - 1); i > 0; --i) {
+    if (checkpoint_index > 0 &&
+        checkpoints_[checkpoint_index - 1].encoded_tag_index == i) {
+      // Decoding can resume at a checkpoint only if no transition byte is
+      // shared with the preceding records, so finish the pending byte.
+      --checkpoint_index;
+      if (last_transition.has_value()) {
+        if (ABSL_PREDICT_FALSE(
+                !WriteByte(compressor_.writer(), *last_transition))) {
+          return Fail(*compressor_.writer());
+        }
+        last_transition = absl::nullopt;
+      }
+      (*checkpoint_transitions)[checkpoint_index] = compressor_.writer()->pos();
+    }
     // There are multiple options how transition may be encoded:
     // 1. Transition is common and it's in the private list for the previous
     //    node.
@@ -836,6 +1081,8 @@ inline bool TransposeEncoder::WriteTransitions(
     prev_etag = tag;
     current_base = tags_list_[prev_etag].base;
   }
+  RIEGELI_ASSERT_EQ(checkpoint_index, 0u)
+      << "Some checkpoints were not reached by transitions";
   if (last_transition.has_value()) {
     if (ABSL_PREDICT_FALSE(
             !WriteByte(compressor_.writer(), *last_transition))) {
@@ -846,14 +1093,37 @@ inline bool TransposeEncoder::WriteTransitions(
 }
 
 inline void TransposeEncoder::CollectTransitionStatistics() {
-  // Go through all the transitions from back to front and collect transition
-  // distribution statistics.
-  uint32_t prev_pos = encoded_tags_.back();
-  for (size_t i = encoded_tags_.size() - 1; i > 0; --i) {
-    const uint32_t pos = encoded_tags_[i - 1];
-    ++tags_list_[prev_pos].dest_info[pos].num_transitions;
-    ++tags_list_[pos].num_incoming_transitions;
-    prev_pos = pos;
+  const size_t num_tags = tags_list_.size();
+  if (num_tags * num_tags <= encoded_tags_.size()) {
+    // With few distinct tags relative to transitions, which is typical for
+    // small chunks of records with the same structure, count transitions in a
+    // dense matrix first. This is faster than updating "dest_info" for each
+    // transition, and clearing the matrix costs at most as much as that.
+    std::vector<uint32_t> num_transitions(num_tags * num_tags);
+    uint32_t prev_pos = encoded_tags_.back();
+    for (size_t i = encoded_tags_.size() - 1; i > 0; --i) {
+      const uint32_t pos = encoded_tags_[i - 1];
+      ++num_transitions[prev_pos * num_tags + pos];
+      prev_pos = pos;
+    }
+    for (uint32_t source = 0; source < num_tags; ++source) {
+      for (uint32_t dest = 0; dest < num_tags; ++dest) {
+        const uint32_t count = num_transitions[source * num_tags + dest];
+        if (count == 0) continue;
+        tags_list_[source].dest_info[dest].num_transitions += count;
+        tags_list_[dest].num_incoming_transitions += count;
+      }
+    }
+  } else {
+    // Go through all the transitions from back to front and collect transition
+    // distribution statistics.
+    uint32_t prev_pos = encoded_tags_.back();
+    for (size_t i = encoded_tags_.size() - 1; i > 0; --i) {
+      const uint32_t pos = encoded_tags_[i - 1];
+      ++tags_list_[prev_pos].dest_info[pos].num_transitions;
+      ++tags_list_[pos].num_incoming_transitions;
+      prev_pos = pos;
+    }
   }
 
   if (tags_list_[encoded_tags_.back()].num_incoming_transitions == 0) {
@@ -1238,6 +1508,363 @@ bool TransposeEncoder::EncodeAndClose(Writer* dest, ChunkType* chunk_type,
                                 num_records, decoded_data_size);
 }
 
+void TransposeEncoder::EncodeVarintDeltas() {
+  std::vector<BufferWithMetadata>& buffers =
+      data_[static_cast<size_t>(BufferType::kVarint)];
+  if (buffers.empty()) return;
+  struct DeltaBuffer {
+    explicit DeltaBuffer(const Chain* src)
+        : reader(src), writer((Chain())) {}
+    // Reads values in the usual form.
+    ChainReader<> reader;
+    // Writes delta encoded values.
+    ChainWriter<Chain> writer;
+    // Whether all values have canonical varint representations, which is
+    // required for delta encoding.
+    bool canonical = true;
+    // The last value read, or 0 before the first value.
+    uint64_t last_value = 0;
+    // Whether the buffer is replaced by its delta encoded form.
+    bool use_deltas = false;
+  };
+  std::vector<DeltaBuffer> delta_buffers;
+  delta_buffers.reserve(buffers.size());
+  // Maps message IDs to indices in "buffers" and "delta_buffers".
+  std::vector<uint32_t> buffer_indices(message_nodes_.size(), kInvalidPos);
+  for (const BufferWithMetadata& buffer : buffers) {
+    buffer_indices[static_cast<uint32_t>(buffer.message_id)] =
+        IntCast<uint32_t>(delta_buffers.size());
+    delta_buffers.emplace_back(&buffer.writer->dest());
+  }
+  // Maps indices in "tags_list_" of varints in buffers to indices in
+  // "delta_buffers".
+  std::vector<uint32_t> etag_buffer_indices(tags_list_.size(), kInvalidPos);
+  for (size_t i = 0; i < tags_list_.size(); ++i) {
+    const EncodedTagInfo& etag_info = tags_list_[i];
+    if (static_cast<internal::WireType>(etag_info.node_id.tag & 7) ==
+            internal::WireType::kVarint &&
+        etag_info.node_id.tag != 0 &&
+        etag_info.subtype <= internal::Subtype::kVarintMax) {
+      etag_buffer_indices[i] =
+          buffer_indices[static_cast<uint32_t>(etag_info.message_id)];
+    }
+  }
+
+  // Buffers are read in the reverse order of "encoded_tags_", like by the
+  // decoder.
+  for (size_t i = encoded_tags_.size(); i > 0; --i) {
+    const uint32_t etag_index = encoded_tags_[i - 1];
+    const uint32_t buffer_index = etag_buffer_indices[etag_index];
+    if (buffer_index == kInvalidPos) continue;
+    DeltaBuffer& delta_buffer = delta_buffers[buffer_index];
+    if (!delta_buffer.canonical) continue;
+    const size_t length =
+        size_t{tags_list_[etag_index].subtype - internal::Subtype::kVarint1} +
+        1;
+    char bytes[kMaxLengthVarint64];
+    if (!delta_buffer.reader.Read(bytes, length)) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Reading varint buffer failed: " << delta_buffer.reader.message();
+    }
+    if (length > 1 && bytes[length - 1] == 0) {
+      delta_buffer.canonical = false;
+      continue;
+    }
+    // The highest bit of each byte is stripped in the buffer.
+    uint64_t value = 0;
+    for (size_t j = length; j > 0; --j) {
+      value = (value << 7) | static_cast<uint8_t>(bytes[j - 1]);
+    }
+    if (!WriteVarint64(
+            &delta_buffer.writer,
+            internal::EncodeZigZag64(value - delta_buffer.last_value))) {
+      RIEGELI_ASSERT_UNREACHABLE() << "Writing delta failed: "
+                                   << delta_buffer.writer.message();
+    }
+    delta_buffer.last_value = value;
+  }
+
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    DeltaBuffer& delta_buffer = delta_buffers[i];
+    if (!delta_buffer.writer.Close()) {
+      RIEGELI_ASSERT_UNREACHABLE() << "Closing delta writer failed: "
+                                   << delta_buffer.writer.message();
+    }
+    Chain& buffer = buffers[i].writer->dest();
+    // Use delta encoding only if it saves at least a quarter of the size, so
+    // that fields which do not consistently change by small steps keep the
+    // usual form.
+    if (delta_buffer.canonical &&
+        delta_buffer.writer.dest().size() < buffer.size() - buffer.size() / 4) {
+      buffer = std::move(delta_buffer.writer.dest());
+      delta_buffer.use_deltas = true;
+    }
+  }
+  for (size_t i = 0; i < tags_list_.size(); ++i) {
+    if (etag_buffer_indices[i] == kInvalidPos ||
+        !delta_buffers[etag_buffer_indices[i]].use_deltas) {
+      continue;
+    }
+    EncodedTagInfo& etag_info = tags_list_[i];
+    etag_info.subtype = internal::Subtype::kVarintDelta1 +
+                        (etag_info.subtype - internal::Subtype::kVarint1);
+  }
+}
+
+void TransposeEncoder::ShuffleFixedBuffers() {
+  for (BufferWithMetadata& buffer :
+       data_[static_cast<size_t>(BufferType::kFixed32)]) {
+    internal::ShuffleBytes(sizeof(uint32_t), &buffer.writer->dest());
+  }
+  for (BufferWithMetadata& buffer :
+       data_[static_cast<size_t>(BufferType::kFixed64)]) {
+    internal::ShuffleBytes(sizeof(uint64_t), &buffer.writer->dest());
+  }
+  // Each fixed32 or fixed64 node has a single encoded tag and its own buffer,
+  // so all such encoded tags change.
+  for (EncodedTagInfo& etag_info : tags_list_) {
+    const internal::WireType wire_type =
+        static_cast<internal::WireType>(etag_info.node_id.tag & 7);
+    if (etag_info.node_id.tag != 0 &&
+        (wire_type == internal::WireType::kFixed32 ||
+         wire_type == internal::WireType::kFixed64)) {
+      etag_info.subtype = internal::Subtype::kFixedByteShuffled;
+    }
+  }
+}
+
+void TransposeEncoder::EncodeStringDictionaries() {
+  std::vector<BufferWithMetadata>& buffers =
+      data_[static_cast<size_t>(BufferType::kString)];
+  if (buffers.empty()) return;
+  // Indexed by message ID.
+  std::vector<bool> use_dictionary(message_nodes_.size(), false);
+  bool any_dictionary = false;
+  absl::flat_hash_map<std::string, uint32_t> dictionary;
+  std::vector<uint32_t> indices;
+  std::string scratch;
+  for (BufferWithMetadata& buffer : buffers) {
+    Chain& values = buffer.writer->dest();
+    // Stop collecting values when the dictionary alone would not save enough.
+    const size_t max_size = values.size() - values.size() / 4;
+    dictionary.clear();
+    indices.clear();
+    size_t dictionary_size = 0;
+    bool use_this_dictionary = true;
+    ChainReader<> reader(&values);
+    while (reader.Pull()) {
+      const Position value_pos = reader.pos();
+      uint32_t length;
+      if (!ReadVarint32(&reader, &length)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Reading string length failed: " << reader.message();
+      }
+      const size_t value_length =
+          IntCast<size_t>(reader.pos() - value_pos) + size_t{length};
+      absl::string_view value;
+      if (!reader.Seek(value_pos) ||
+          !reader.Read(&value, &scratch, value_length)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Reading string failed: " << reader.message();
+      }
+      const std::pair<absl::flat_hash_map<std::string, uint32_t>::iterator,
+                      bool>
+          insert_result = dictionary.emplace(
+              std::string(value), IntCast<uint32_t>(dictionary.size()));
+      if (insert_result.second) {
+        dictionary_size += value_length;
+        if (dictionary.size() > kMaxDictionarySize ||
+            dictionary_size >= max_size) {
+          use_this_dictionary = false;
+          break;
+        }
+      }
+      indices.push_back(insert_result.first->second);
+    }
+    if (!use_this_dictionary) continue;
+    size_t encoded_size =
+        LengthVarint32(IntCast<uint32_t>(dictionary.size())) + dictionary_size;
+    for (const uint32_t index : indices) encoded_size += LengthVarint32(index);
+    // Use dictionary encoding only if it saves at least a quarter of the size.
+    if (encoded_size >= max_size) continue;
+
+    std::vector<const std::string*> entries(dictionary.size());
+    for (const std::pair<const std::string, uint32_t>& entry : dictionary) {
+      entries[entry.second] = &entry.first;
+    }
+    ChainWriter<Chain> writer(
+        (Chain()), ChainWriterBase::Options().set_size_hint(encoded_size));
+    if (!WriteVarint32(&writer, IntCast<uint32_t>(entries.size()))) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Writing dictionary size failed: " << writer.message();
+    }
+    for (const std::string* entry : entries) {
+      if (!writer.Write(*entry)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Writing dictionary failed: " << writer.message();
+      }
+    }
+    for (const uint32_t index : indices) {
+      if (!WriteVarint32(&writer, index)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Writing dictionary index failed: " << writer.message();
+      }
+    }
+    if (!writer.Close()) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Closing dictionary writer failed: " << writer.message();
+    }
+    values = std::move(writer.dest());
+    use_dictionary[static_cast<uint32_t>(buffer.message_id)] = true;
+    any_dictionary = true;
+  }
+  if (!any_dictionary) return;
+  for (EncodedTagInfo& etag_info : tags_list_) {
+    if (etag_info.node_id.tag != 0 &&
+        static_cast<internal::WireType>(etag_info.node_id.tag & 7) ==
+            internal::WireType::kLengthDelimited &&
+        etag_info.subtype == internal::Subtype::kLengthDelimitedString &&
+        use_dictionary[static_cast<uint32_t>(etag_info.message_id)]) {
+      etag_info.subtype = internal::Subtype::kLengthDelimitedDictionary;
+    }
+  }
+}
+
+void TransposeEncoder::EncodePackedFields() {
+  std::vector<BufferWithMetadata>& buffers =
+      data_[static_cast<size_t>(BufferType::kString)];
+  if (buffers.empty()) return;
+  // Subtypes of string buffers, indexed by message ID. Buffers which are
+  // already dictionary encoded are skipped.
+  std::vector<internal::Subtype> subtypes(
+      message_nodes_.size(), internal::Subtype::kLengthDelimitedDictionary);
+  for (const EncodedTagInfo& etag_info : tags_list_) {
+    if (etag_info.node_id.tag != 0 &&
+        static_cast<internal::WireType>(etag_info.node_id.tag & 7) ==
+            internal::WireType::kLengthDelimited &&
+        etag_info.subtype == internal::Subtype::kLengthDelimitedString) {
+      subtypes[static_cast<uint32_t>(etag_info.message_id)] =
+          internal::Subtype::kLengthDelimitedString;
+    }
+  }
+  bool any_packed = false;
+  std::vector<uint32_t> varint_counts;
+  for (BufferWithMetadata& buffer : buffers) {
+    internal::Subtype& subtype =
+        subtypes[static_cast<uint32_t>(buffer.message_id)];
+    if (subtype != internal::Subtype::kLengthDelimitedString) continue;
+    Chain& values = buffer.writer->dest();
+    // Find which interpretations are valid for all values. Fixed width
+    // elements are preferred over varints because floating point numbers
+    // often happen to parse as varints too.
+    bool varint_ok = true;
+    bool fixed32_ok = true;
+    bool fixed64_ok = true;
+    varint_counts.clear();
+    ChainReader<> reader(&values);
+    while (reader.Pull()) {
+      uint32_t length;
+      if (!ReadVarint32(&reader, &length)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Reading string length failed: " << reader.message();
+      }
+      const Position end_pos = reader.pos() + length;
+      if (length % sizeof(uint32_t) != 0) fixed32_ok = false;
+      if (length % sizeof(uint64_t) != 0) fixed64_ok = false;
+      if (varint_ok) {
+        uint32_t count = 0;
+        while (reader.pos() < end_pos) {
+          uint64_t element;
+          // An element must end within the value. A failed read can leave the
+          // reader anywhere, even exactly at the end of the value.
+          if (!ReadCanonicalVarint64(&reader, &element) ||
+              reader.pos() > end_pos) {
+            varint_ok = false;
+            break;
+          }
+          ++count;
+        }
+        if (varint_ok) varint_counts.push_back(count);
+      }
+      if (!varint_ok && !fixed32_ok) break;
+      if (!reader.Seek(end_pos)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Seeking string buffer failed: " << reader.message();
+      }
+    }
+    size_t width;
+    if (fixed64_ok) {
+      subtype = internal::Subtype::kLengthDelimitedPackedFixed64;
+      width = sizeof(uint64_t);
+    } else if (fixed32_ok) {
+      subtype = internal::Subtype::kLengthDelimitedPackedFixed32;
+      width = sizeof(uint32_t);
+    } else if (varint_ok) {
+      subtype = internal::Subtype::kLengthDelimitedPackedVarint;
+      width = 0;
+    } else {
+      continue;
+    }
+
+    ChainWriter<Chain> counts_writer((Chain()));
+    Chain elements;
+    ChainWriter<> elements_writer(&elements);
+    uint32_t num_values = 0;
+    if (!reader.Seek(0)) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Seeking string buffer failed: " << reader.message();
+    }
+    while (reader.Pull()) {
+      uint32_t length;
+      if (!ReadVarint32(&reader, &length)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Reading string length failed: " << reader.message();
+      }
+      const uint32_t count = width == 0 ? varint_counts[num_values]
+                                        : length / IntCast<uint32_t>(width);
+      if (!WriteVarint32(&counts_writer, count)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Writing element count failed: " << counts_writer.message();
+      }
+      if (!reader.CopyTo(&elements_writer, length)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Copying elements failed: " << reader.message();
+      }
+      ++num_values;
+    }
+    if (!counts_writer.Close()) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Closing counts writer failed: " << counts_writer.message();
+    }
+    if (!elements_writer.Close()) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Closing elements writer failed: " << elements_writer.message();
+    }
+    if (width != 0) internal::ShuffleBytes(width, &elements);
+    ChainWriter<Chain> writer(
+        (Chain()), ChainWriterBase::Options().set_size_hint(
+                       kMaxLengthVarint32 + counts_writer.dest().size() +
+                       elements.size()));
+    if (!WriteVarint32(&writer, num_values) ||
+        !writer.Write(std::move(counts_writer.dest())) ||
+        !writer.Write(std::move(elements)) || !writer.Close()) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Writing packed buffer failed: " << writer.message();
+    }
+    values = std::move(writer.dest());
+    any_packed = true;
+  }
+  if (!any_packed) return;
+  for (EncodedTagInfo& etag_info : tags_list_) {
+    if (etag_info.node_id.tag != 0 &&
+        static_cast<internal::WireType>(etag_info.node_id.tag & 7) ==
+            internal::WireType::kLengthDelimited &&
+        etag_info.subtype == internal::Subtype::kLengthDelimitedString) {
+      etag_info.subtype = subtypes[static_cast<uint32_t>(etag_info.message_id)];
+    }
+  }
+}
+
 bool TransposeEncoder::EncodeAndCloseInternal(uint32_t max_transition,
                                               uint32_t min_count_for_state,
                                               Writer* dest,
@@ -1249,16 +1876,21 @@ bool TransposeEncoder::EncodeAndCloseInternal(uint32_t max_transition,
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   *num_records = num_records_;
   *decoded_data_size = decoded_data_size_;
-  for (const std::pair<const NodeId, MessageNode>& entry : message_nodes_) {
-    if (entry.second.writer != nullptr) {
-      if (ABSL_PREDICT_FALSE(!entry.second.writer->Close())) {
-        return Fail(*entry.second.writer);
-      }
-    }
+  for (size_t i = 0; i < num_buffer_writers_; ++i) {
+    ChainBackwardWriter<Chain>* const writer = buffer_writers_[i].get();
+    if (ABSL_PREDICT_FALSE(!writer->Close())) return Fail(*writer);
   }
   if (ABSL_PREDICT_FALSE(!nonproto_lengths_writer_.Close())) {
     return Fail(nonproto_lengths_writer_);
   }
+  // Buffers stored in special forms are decoded upfront, so positions in them
+  // stored in checkpoints would not be meaningful.
+  if (checkpoints_.empty()) {
+    if (delta_encoding_) EncodeVarintDeltas();
+    if (byte_shuffle_) ShuffleFixedBuffers();
+    if (dictionary_encoding_) EncodeStringDictionaries();
+    if (packed_fields_) EncodePackedFields();
+  }
 
   if (ABSL_PREDICT_FALSE(
           !WriteByte(dest, static_cast<uint8_t>(compression_type_)))) {
@@ -1280,8 +1912,8 @@ bool TransposeEncoder::EncodeAndCloseInternal(uint32_t max_transition,
   ChainWriter<Chain> compressed_header_writer((Chain()));
   // Uncompressed header size is known before compression, but a size hint
   // cannot be passed to compressor_ because it is reused for compressing
-  // buckets and transitions. Reusing the compressor brings more benefits
-  // (memory saving) than passing a size hint.
+  // transitions. Reusing the compressor brings more benefits (memory saving)
+  // than passing a size hint.
   compressor_.Reset();
   if (ABSL_PREDICT_FALSE(
           !compressor_.writer()->Write(std::move(header_writer.dest())))) {
@@ -1306,4 +1938,41 @@ bool TransposeEncoder::EncodeAndCloseInternal(uint32_t max_transition,
   return Close();
 }
 
+void TransposeEncoder::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  ChunkEncoder::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(compressor_);
+  memory_estimator->RegisterSubobjects(tags_list_);
+  for (const EncodedTagInfo& tag_info : tags_list_) {
+    // A flat_hash_map allocates a slot and a control byte per element of
+    // its capacity.
+    if (tag_info.dest_info.capacity() > 0) {
+      memory_estimator->RegisterDynamicMemory(
+          tag_info.dest_info.capacity() *
+          (sizeof(decltype(tag_info.dest_info)::value_type) + 1));
+    }
+  }
+  memory_estimator->RegisterSubobjects(encoded_tags_);
+  for (const std::vector<BufferWithMetadata>& buffers : data_) {
+    memory_estimator->RegisterSubobjects(buffers);
+    for (const BufferWithMetadata& buffer : buffers) {
+      memory_estimator->RegisterSubobjects(buffer.checkpoint_sizes);
+    }
+  }
+  memory_estimator->RegisterSubobjects(group_stack_);
+  memory_estimator->RegisterSubobjects(message_nodes_);
+  for (const MessageNode& node : message_nodes_) {
+    memory_estimator->RegisterSubobjects(node.children);
+  }
+  if (sparse_children_.capacity() > 0) {
+    memory_estimator->RegisterDynamicMemory(
+        sparse_children_.capacity() *
+        (sizeof(decltype(sparse_children_)::value_type) + 1));
+  }
+  memory_estimator->RegisterSubobjects(buffer_writers_);
+  memory_estimator->RegisterSubobjects(nonproto_lengths_writer_);
+  memory_estimator->RegisterSubobjects(checkpoints_);
+  memory_estimator->RegisterSubobjects(serialized_record_);
+}
+
 }  // namespace riegeli
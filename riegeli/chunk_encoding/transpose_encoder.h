@@ -25,7 +25,11 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/inlined_vector.h"
 #include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/chain_backward_writer.h"
@@ -58,6 +62,19 @@ class Reader;
 //      - Array of subtypes (for all tags where applicable)
 //      - Array of data buffer indices (for all tags/subtypes where applicable)
 //    - Initial state index
+//    - Optionally, if decoder checkpoints are present:
+//      - Number of records between checkpoints [checkpoint_interval]
+//      - Number of checkpoints [num_checkpoints], equal to
+//        (num_records - 1) / checkpoint_interval
+//      - "num_checkpoints" checkpoints, one before each record whose index is
+//        a positive multiple of "checkpoint_interval", in the order of
+//        decoding (from the last record backwards). Lengths are relative to the
+//        previous checkpoint, or to the beginning of decoding for the first
+//        checkpoint:
+//        - State machine state index
+//        - Length of decoded data
+//        - Length of transitions (uncompressed)
+//        - Array of "num_buffers" lengths of data read from data buffers
 //  - "num_buckets" buckets:
 //    - Bucket data (possibly compressed):
 //      - Concatenated data buffers in this bucket (bytes)
@@ -65,8 +82,129 @@ class Reader;
 //    - State machine transitions (bytes)
 class TransposeEncoder : public ChunkEncoder {
  public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // If num_records > 0, a decoder checkpoint is stored before every record
+    // whose index is a multiple of num_records. This allows to decode only a
+    // range of records between checkpoints, at the cost of a larger header.
+    //
+    // Default: 0
+    Options& set_checkpoint_interval(uint64_t num_records) & {
+      checkpoint_interval_ = num_records;
+      return *this;
+    }
+    Options&& set_checkpoint_interval(uint64_t num_records) && {
+      return std::move(set_checkpoint_interval(num_records));
+    }
+
+    // The following buffer encodings are applied only to chunks without
+    // decoder checkpoints. Chunks using them cannot be read by versions of
+    // Riegeli which do not support them.
+
+    // If true, buffers of varint fields whose values mostly change by small
+    // steps, e.g. timestamps and sequence numbers, store differences between
+    // consecutive values, if this makes them smaller.
+    //
+    // Default: false
+    Options& set_delta_encoding(bool delta_encoding) & {
+      delta_encoding_ = delta_encoding;
+      return *this;
+    }
+    Options&& set_delta_encoding(bool delta_encoding) && {
+      return std::move(set_delta_encoding(delta_encoding));
+    }
+
+    // If true, buffers of fixed32 and fixed64 fields, e.g. float and double,
+    // store byte planes of their values instead of whole values.
+    //
+    // Default: false
+    Options& set_byte_shuffle(bool byte_shuffle) & {
+      byte_shuffle_ = byte_shuffle;
+      return *this;
+    }
+    Options&& set_byte_shuffle(bool byte_shuffle) && {
+      return std::move(set_byte_shuffle(byte_shuffle));
+    }
+
+    // If true, buffers of string fields with few distinct values, e.g. country
+    // codes, store each distinct value once, followed by indices of values,
+    // if this makes them smaller.
+    //
+    // Default: false
+    Options& set_dictionary_encoding(bool dictionary_encoding) & {
+      dictionary_encoding_ = dictionary_encoding;
+      return *this;
+    }
+    Options&& set_dictionary_encoding(bool dictionary_encoding) && {
+      return std::move(set_dictionary_encoding(dictionary_encoding));
+    }
+
+    // If true, buffers of string fields whose values all parse as packed
+    // repeated fixed32, fixed64, or varint elements store element counts
+    // separately from elements, and byte shuffle fixed width elements.
+    //
+    // Default: false
+    Options& set_packed_fields(bool packed_fields) & {
+      packed_fields_ = packed_fields;
+      return *this;
+    }
+    Options&& set_packed_fields(bool packed_fields) && {
+      return std::move(set_packed_fields(packed_fields));
+    }
+
+    // If not nullptr, the expected type of records. Field types from it decide
+    // whether a length-delimited field is a submessage or a string, instead of
+    // guessing this from field contents. Fields absent from record_type are
+    // still guessed. Records and fields not matching record_type are encoded
+    // losslessly anyway. record_type must be valid until the encoder is
+    // destroyed.
+    //
+    // Default: nullptr
+    Options& set_record_type(
+        const google::protobuf::Descriptor* record_type) & {
+      record_type_ = record_type;
+      return *this;
+    }
+    Options&& set_record_type(
+        const google::protobuf::Descriptor* record_type) && {
+      return std::move(set_record_type(record_type));
+    }
+
+    // Sets the maximum number of data buckets compressed concurrently, the
+    // calling thread included. This reduces the latency of encoding a large
+    // chunk at the cost of using more threads. If parallelism <= 1, buckets
+    // are compressed by the calling thread.
+    //
+    // Default: 1
+    Options& set_compression_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of "
+             "TransposeEncoder::Options::set_compression_parallelism(): "
+             "negative parallelism";
+      compression_parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_compression_parallelism(int parallelism) && {
+      return std::move(set_compression_parallelism(parallelism));
+    }
+
+   private:
+    friend class TransposeEncoder;
+
+    uint64_t checkpoint_interval_ = 0;
+    bool delta_encoding_ = false;
+    bool byte_shuffle_ = false;
+    bool dictionary_encoding_ = false;
+    bool packed_fields_ = false;
+    const google::protobuf::Descriptor* record_type_ = nullptr;
+    int compression_parallelism_ = 1;
+  };
+
   // Creates an empty TransposeEncoder.
-  explicit TransposeEncoder(CompressorOptions options, uint64_t bucket_size);
+  explicit TransposeEncoder(CompressorOptions compressor_options,
+                            uint64_t bucket_size, Options options = Options());
 
   ~TransposeEncoder();
 
@@ -76,20 +214,55 @@ class TransposeEncoder : public ChunkEncoder {
   // just fine even if "record" is a corrupted protocol message or an arbitrary
   // string. Such records are internally stored separately -- these are not
   // broken down into columns.
+  //
+  // AddRecord(MessageLite) serializes a proto message to a flat buffer reused
+  // between records, and breaks it down from there.
   using ChunkEncoder::AddRecord;
+  bool AddRecord(const google::protobuf::MessageLite& record) override;
   bool AddRecord(absl::string_view record) override;
   bool AddRecord(std::string&& record) override;
   bool AddRecord(const Chain& record) override;
 
   bool AddRecords(Chain records, std::vector<size_t> limits) override;
 
+  // Returns true if "record" would be broken down into columns, i.e. it is a
+  // proto message in the canonical encoding. Other records are stored as they
+  // are, so transposing them costs time without making them smaller.
+  static bool IsTransposable(absl::string_view record);
+  static bool IsTransposable(const Chain& record);
+
   bool EncodeAndClose(Writer* dest, ChunkType* chunk_type,
                       uint64_t* num_records,
                       uint64_t* decoded_data_size) override;
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  private:
   bool AddRecordInternal(Reader* record);
 
+  // Remember the sizes of data written so far as a decoder checkpoint before
+  // the record about to be added.
+  void AddCheckpoint();
+
+  // Replace buffers of varint fields which become sufficiently smaller with
+  // delta encoding by their delta encoded form, and change subtypes of their
+  // encoded tags accordingly.
+  void EncodeVarintDeltas();
+
+  // Replace buffers of fixed32 and fixed64 fields with their byte planes, and
+  // change subtypes of their encoded tags accordingly.
+  void ShuffleFixedBuffers();
+
+  // Replace buffers of string fields which become sufficiently smaller with
+  // dictionary encoding by their dictionary encoded form, and change subtypes
+  // of their encoded tags accordingly.
+  void EncodeStringDictionaries();
+
+  // Replace buffers of string fields whose values all parse as packed repeated
+  // fields by their packed form, and change subtypes of their encoded tags
+  // accordingly.
+  void EncodePackedFields();
+
   // Encode messages added with AddRecord() calls and write the result to *dest.
   bool EncodeAndCloseInternal(uint32_t max_transition,
                               uint32_t min_count_for_state, Writer* dest,
@@ -117,19 +290,6 @@ class TransposeEncoder : public ChunkEncoder {
   static constexpr size_t kNumBufferTypes =
       static_cast<size_t>(BufferType::kNumBufferTypes);
 
-  // Struct that contains information about a field with unique proto path.
-  struct MessageNode {
-    explicit MessageNode(internal::MessageId message_id);
-    // Some nodes (such as STARTGROUP) contain no data. Buffer is assigned in
-    // the first GetBuffer call when we have data to write.
-    std::unique_ptr<BackwardWriter> writer;
-    // Unique ID for every instance of this class within Encoder.
-    internal::MessageId message_id;
-    // Position of encoded tag in "tags_list_" per subtype.
-    // Size 14 works well with kMaxVarintInline == 3.
-    absl::InlinedVector<uint32_t, 14> encoded_tag_pos;
-  };
-
   // We build a tree structure of protocol buffer tags. NodeId uniquely
   // identifies a node in this tree.
   struct NodeId {
@@ -148,18 +308,69 @@ class TransposeEncoder : public ChunkEncoder {
     uint32_t tag;
   };
 
+  // What the record type tells about a length-delimited or group node.
+  enum class FieldKind : uint8_t {
+    // The field was not looked up in the record type yet.
+    kNotLookedUp,
+    // The field is absent from the record type, or its type does not match
+    // the wire type. Whether it is a submessage is guessed.
+    kUnknown,
+    // The field is a string, bytes, or packed repeated field.
+    kString,
+    // The field is a submessage or group of type "message_type".
+    kMessage,
+  };
+
+  // Struct that contains information about a field with unique proto path.
+  struct MessageNode {
+    explicit MessageNode(NodeId node_id, internal::MessageId message_id);
+    // Path of this node.
+    NodeId node_id;
+    // Unique ID for every instance of this class within Encoder, equal to its
+    // index in "message_nodes_".
+    internal::MessageId message_id;
+    // Some nodes (such as STARTGROUP) contain no data. Buffer is assigned in
+    // the first GetBuffer call when we have data to write. Owned by
+    // "buffer_writers_".
+    ChainBackwardWriter<Chain>* writer = nullptr;
+    // Position of encoded tag in "tags_list_" per subtype.
+    // Size 14 works well with kMaxVarintInline == 3.
+    absl::InlinedVector<uint32_t, 14> encoded_tag_pos;
+    // Indices in "message_nodes_" of children of this node with tags smaller
+    // than kMaxDenseTag, indexed by tag, or kInvalidPos if absent. Children
+    // with larger tags are in "sparse_children_".
+    std::vector<uint32_t> children;
+    // Kind of the field in the record type. Looked up when the node is first
+    // reached within a message of a known type. The type of the parent
+    // message is determined by the path of the node, so this can be cached.
+    FieldKind field_kind = FieldKind::kNotLookedUp;
+    // Type of the submessage or group if field_kind == FieldKind::kMessage.
+    const google::protobuf::Descriptor* message_type = nullptr;
+  };
+
+  // Tags smaller than this are looked up in MessageNode::children instead of
+  // "sparse_children_". This covers field numbers up to 127.
+  static constexpr uint32_t kMaxDenseTag = 1024;
+
   // Add message recursively to the internal data structures.
   // Precondition: "message" is a valid proto message, i.e. IsProtoMessage on
   // this message returns true.
+  // "message_type" is the type of the message, or nullptr if unknown.
   // "depth" is the recursion depth.
   bool AddMessage(LimitingReaderBase* record,
-                  internal::MessageId parent_message_id, int depth);
+                  internal::MessageId parent_message_id,
+                  const google::protobuf::Descriptor* message_type, int depth);
+
+  // Set "field_kind" and "message_type" of "node", which is a child of a
+  // message of type "parent_type", if they were not looked up yet.
+  static void LookUpField(const google::protobuf::Descriptor* parent_type,
+                          MessageNode* node);
 
   // Write all buffer lengths to "header_writer" and data buffers in "data_" to
-  // "data_writer" (compressed using compressor_). Fill map with the sequential
-  // position of each buffer written.
+  // "data_writer" (compressed per bucket). Fill "buffer_pos", indexed by
+  // message IDs of nodes, with the sequential position of each buffer written.
   bool WriteBuffers(Writer* header_writer, Writer* data_writer,
-                    absl::flat_hash_map<NodeId, uint32_t>* buffer_pos);
+                    std::vector<uint32_t>* buffer_pos);
 
   // One state of the state machine created in encoder.
   struct StateInfo {
@@ -178,13 +389,21 @@ class TransposeEncoder : public ChunkEncoder {
     uint32_t canonical_source;
   };
 
-  // Add "next_chunk" to compressor_.writer(). If either the current bucket
-  // would become too large or "force_new_bucket" is true, flush the current
-  // bucket to "data_writer" first and create a new bucket.
-  bool AddBuffer(bool force_new_bucket, const Chain& next_chunk,
-                 Writer* data_writer, std::vector<size_t>* bucket_lengths,
+  // Add "next_chunk" to "current_bucket". If either the current bucket would
+  // become too large or "force_new_bucket" is true, move the current bucket to
+  // "buckets" first and start a new bucket.
+  void AddBuffer(bool force_new_bucket, const Chain& next_chunk,
+                 Chain* current_bucket, std::vector<Chain>* buckets,
                  std::vector<size_t>* buffer_lengths);
 
+  // Compress each of "buckets" separately and write them to "data_writer" in
+  // order. Fill "bucket_lengths" with their compressed sizes.
+  //
+  // If compression is enabled and there are several buckets, they are
+  // compressed concurrently in background threads.
+  bool WriteBuckets(const std::vector<Chain>& buckets, Writer* data_writer,
+                    std::vector<size_t>* bucket_lengths);
+
   // Compute base indices for states in "state_machine" that don't have one yet.
   // "public_list_base" is the index of the start of the public list.
   // "public_list_noops" is the list of NoOp states that don't have a base set
@@ -209,23 +428,28 @@ class TransposeEncoder : public ChunkEncoder {
                           Writer* header_writer, Writer* data_writer);
 
   // Write all state machine transitions from "encoded_tags_" into
-  // compressor_.writer().
+  // compressor_.writer(). Fill "checkpoint_transitions" with the positions in
+  // transitions corresponding to "checkpoints_".
   bool WriteTransitions(uint32_t max_transition,
-                        const std::vector<StateInfo>& state_machine);
+                        const std::vector<StateInfo>& state_machine,
+                        std::vector<Position>* checkpoint_transitions);
 
-  // Value type of node in Nodes map.
-  using Node = absl::flat_hash_map<NodeId, MessageNode>::value_type;
+  // Write decoder checkpoints into "header_writer".
+  bool WriteCheckpoints(const std::vector<StateInfo>& state_machine,
+                        const std::vector<Position>& checkpoint_transitions,
+                        Writer* header_writer);
 
-  // Returns node pointer from "node_id".
-  Node* GetNode(NodeId node_id);
+  // Returns node pointer from "node_id", adding the node if it does not exist
+  // yet. This invalidates pointers to other nodes.
+  MessageNode* GetNode(NodeId node_id);
 
   // Get possition of the (node, subtype) pair in "tags_list_" adding it if not
   // in the list yet.
-  uint32_t GetPosInTagsList(Node* node, internal::Subtype subtype);
+  uint32_t GetPosInTagsList(MessageNode* node, internal::Subtype subtype);
 
   // Get BackwardWriter for node. "type" is used to select the right category
   // for the buffer if not created yet.
-  BackwardWriter* GetBuffer(Node* node, BufferType type);
+  BackwardWriter* GetBuffer(MessageNode* node, BufferType type);
 
   // Information about the state machine transition destination.
   struct DestInfo {
@@ -240,8 +464,11 @@ class TransposeEncoder : public ChunkEncoder {
 
   // Information about encoded tag.
   struct EncodedTagInfo {
-    explicit EncodedTagInfo(NodeId node_id, internal::Subtype subtype);
+    explicit EncodedTagInfo(NodeId node_id, internal::MessageId message_id,
+                            internal::Subtype subtype);
     NodeId node_id;
+    // Message ID of the node.
+    internal::MessageId message_id;
     internal::Subtype subtype;
     // Maps all destinations reachable from this encoded tag to DestInfo.
     absl::flat_hash_map<uint32_t, DestInfo> dest_info;
@@ -262,20 +489,53 @@ class TransposeEncoder : public ChunkEncoder {
 
   // Information about the data buffer.
   struct BufferWithMetadata {
-    explicit BufferWithMetadata(NodeId node_id);
-    // Buffer itself, wrapped in unique_ptr so that its address remains constant
-    // when additional buffers are added.
-    std::unique_ptr<Chain> buffer;
+    explicit BufferWithMetadata(NodeId node_id, internal::MessageId message_id,
+                                ChainBackwardWriter<Chain>* writer);
     // NodeId this buffer belongs to.
     NodeId node_id;
+    // Message ID of the node this buffer belongs to.
+    internal::MessageId message_id;
+    // Writer of the buffer, owned by "buffer_writers_". The buffer itself is
+    // writer->dest().
+    ChainBackwardWriter<Chain>* writer;
+    // Size of the buffer at each of "checkpoints_".
+    std::vector<Position> checkpoint_sizes;
   };
 
+  // Sizes of data written before a record whose index is a positive multiple
+  // of "checkpoint_interval_".
+  struct Checkpoint {
+    // Index in "encoded_tags_" of the first tag of the record.
+    size_t encoded_tag_index;
+    // Decoded data size of records before the record.
+    uint64_t decoded_data_size;
+    // Size of "nonproto_lengths_writer_" before the record.
+    Position nonproto_lengths_size;
+  };
+
+  CompressorOptions compressor_options_;
   CompressionType compression_type_;
   // The default approximate bucket size, used if compression is enabled.
   // Finer bucket granularity (i.e. smaller size) worsens compression density
   // but makes field projection more effective.
   uint64_t bucket_size_;
-
+  // Number of records between decoder checkpoints, or 0 for no checkpoints.
+  uint64_t checkpoint_interval_;
+  // Whether to delta encode varint buffers when this makes them smaller.
+  bool delta_encoding_;
+  // Whether to byte shuffle fixed32 and fixed64 buffers.
+  bool byte_shuffle_;
+  // Whether to dictionary encode string buffers when this makes them smaller.
+  bool dictionary_encoding_;
+  // Whether to store buffers of packed repeated fields in their packed form.
+  bool packed_fields_;
+  // Expected type of records, or nullptr if unknown.
+  const google::protobuf::Descriptor* record_type_;
+  // Maximum number of buckets compressed concurrently.
+  int compression_parallelism_;
+
+  // Compresses transitions and the header. Buckets are compressed by separate
+  // Compressors, so that they can be compressed concurrently.
   internal::Compressor compressor_;
   // List of all distinct Encoded tags.
   std::vector<EncodedTagInfo> tags_list_;
@@ -284,13 +544,28 @@ class TransposeEncoder : public ChunkEncoder {
   // Data buffers in separate vectors per buffer type.
   std::vector<BufferWithMetadata> data_[kNumBufferTypes];
   // Every group creates a new message ID. We keep track of open groups in this
-  // vector.
-  std::vector<internal::MessageId> group_stack_;
-  // Tree of message nodes.
-  absl::flat_hash_map<NodeId, MessageNode> message_nodes_;
+  // vector, together with the types of their enclosing messages.
+  std::vector<
+      std::pair<internal::MessageId, const google::protobuf::Descriptor*>>
+      group_stack_;
+  // Tree of message nodes, indexed by message ID. Reserved message IDs up to
+  // kRoot have placeholder nodes, which hold their children.
+  std::vector<MessageNode> message_nodes_;
+  // Indices in "message_nodes_" of nodes with tags not smaller than
+  // kMaxDenseTag.
+  absl::flat_hash_map<NodeId, uint32_t> sparse_children_;
+  // Writers of data buffers. They are kept when the encoder is reset, and
+  // the first "num_buffer_writers_" of them are used, to avoid allocating
+  // writers and their first blocks again for each chunk.
+  std::vector<std::unique_ptr<ChainBackwardWriter<Chain>>> buffer_writers_;
+  size_t num_buffer_writers_ = 0;
   ChainBackwardWriter<Chain> nonproto_lengths_writer_;
-  // Counter used to assign unique IDs to the message nodes.
-  internal::MessageId next_message_id_ = internal::MessageId::kRoot + 1;
+  // Decoder checkpoints, sorted by "encoded_tag_index".
+  std::vector<Checkpoint> checkpoints_;
+  // Serialized proto message being added by AddRecord(MessageLite). Its
+  // capacity is reused between records, and between chunks unless it is
+  // large.
+  std::string serialized_record_;
 };
 
 }  // namespace riegeli
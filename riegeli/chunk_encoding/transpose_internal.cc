@@ -0,0 +1,152 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/transpose_internal.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/reader_utils.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+// The loops below have a compile time width, so that the compiler unrolls the
+// inner loop and vectorizes the outer loop as interleaved loads or stores.
+
+template <size_t width>
+void ShuffleBytes(const char* src, size_t num_values, char* dest) {
+  for (size_t i = 0; i < num_values; ++i) {
+    for (size_t j = 0; j < width; ++j) {
+      dest[j * num_values + i] = src[i * width + j];
+    }
+  }
+}
+
+template <size_t width>
+void UnshuffleBytes(const char* src, size_t num_values, char* dest) {
+  for (size_t i = 0; i < num_values; ++i) {
+    for (size_t j = 0; j < width; ++j) {
+      dest[i * width + j] = src[j * num_values + i];
+    }
+  }
+}
+
+// Replaces *buffer with the result of transform(src, num_values, dest).
+template <typename Transform>
+void TransformBuffer(size_t width, Chain* buffer, Transform transform) {
+  RIEGELI_ASSERT(width == 4 || width == 8)
+      << "Unsupported width of byte shuffled values: " << width;
+  RIEGELI_ASSERT_EQ(buffer->size() % width, 0u)
+      << "Buffer size not a multiple of value width";
+  const size_t size = buffer->size();
+  if (size <= width) return;
+  const absl::optional<absl::string_view> flat = buffer->TryFlat();
+  Buffer flat_buffer;
+  const char* src;
+  if (flat != absl::nullopt) {
+    src = flat->data();
+  } else {
+    flat_buffer = Buffer(size);
+    buffer->CopyTo(flat_buffer.GetData());
+    src = flat_buffer.GetData();
+  }
+  Chain dest;
+  const absl::Span<char> dest_buffer = dest.AppendBuffer(size, size, size);
+  RIEGELI_ASSERT_GE(dest_buffer.size(), size)
+      << "Chain::AppendBuffer() returned a buffer too small";
+  dest.RemoveSuffix(dest_buffer.size() - size);
+  transform(width, src, size / width, dest_buffer.data());
+  *buffer = std::move(dest);
+}
+
+}  // namespace
+
+bool IsProtoMessage(Reader* record) {
+  // We validate that all started proto groups are closed with endgroup tag.
+  std::vector<uint32_t> started_groups;
+  while (record->Pull()) {
+    uint32_t tag;
+    if (!ReadCanonicalVarint32(record, &tag)) return false;
+    const uint32_t field = tag >> 3;
+    if (field == 0) return false;
+    switch (static_cast<WireType>(tag & 7)) {
+      case WireType::kVarint: {
+        uint64_t value;
+        if (!ReadCanonicalVarint64(record, &value)) return false;
+      } break;
+      case WireType::kFixed32:
+        if (!record->Skip(sizeof(uint32_t))) return false;
+        break;
+      case WireType::kFixed64:
+        if (!record->Skip(sizeof(uint64_t))) return false;
+        break;
+      case WireType::kLengthDelimited: {
+        uint32_t length;
+        if (!ReadCanonicalVarint32(record, &length)) return false;
+        if (!record->Skip(length)) return false;
+      } break;
+      case WireType::kStartGroup:
+        started_groups.push_back(field);
+        break;
+      case WireType::kEndGroup:
+        if (started_groups.empty() || started_groups.back() != field) {
+          return false;
+        }
+        started_groups.pop_back();
+        break;
+      default:
+        return false;
+    }
+  }
+  RIEGELI_ASSERT(record->healthy())
+      << "Reading record failed: " << record->message();
+  return started_groups.empty();
+}
+
+void ShuffleBytes(size_t width, Chain* buffer) {
+  TransformBuffer(width, buffer, [](size_t width, const char* src,
+                                    size_t num_values, char* dest) {
+    if (width == 4) {
+      ShuffleBytes<4>(src, num_values, dest);
+    } else {
+      ShuffleBytes<8>(src, num_values, dest);
+    }
+  });
+}
+
+void UnshuffleBytes(size_t width, Chain* buffer) {
+  TransformBuffer(width, buffer, [](size_t width, const char* src,
+                                    size_t num_values, char* dest) {
+    if (width == 4) {
+      UnshuffleBytes<4>(src, num_values, dest);
+    } else {
+      UnshuffleBytes<8>(src, num_values, dest);
+    }
+  });
+}
+
+}  // namespace internal
+}  // namespace riegeli
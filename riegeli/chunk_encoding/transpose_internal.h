@@ -15,9 +15,12 @@
 #ifndef RIEGELI_CHUNK_ENCODING_TRANSPOSE_INTERNAL_H_
 #define RIEGELI_CHUNK_ENCODING_TRANSPOSE_INTERNAL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer_utils.h"
 
 namespace riegeli {
@@ -54,6 +57,11 @@ enum class WireType : uint32_t {
   // kSubmessage does marks the end of a submessage, distinguishing it from the
   // end of a string or bytes field, which is encoded using kLengthDelimited.
   kSubmessage = 6,
+  // kEncodedBuffer marks a field whose data buffer is stored in a special
+  // form: byte shuffled for kFixed32 and kFixed64, dictionary encoded or
+  // packed for kLengthDelimited. Such a tag is followed by EncodedBufferByte()
+  // in place of the subtype.
+  kEncodedBuffer = 7,
 };
 
 inline uint32_t operator-(WireType a, WireType b) {
@@ -74,11 +82,52 @@ enum class Subtype : uint8_t {
   // Varint of the given value, inline.
   kVarintInline0 = static_cast<uint8_t>(kVarintMax) + 1,
   kVarintInlineMax = static_cast<uint8_t>(kVarintInline0) + 0x7f,
+  // Varint of the given length, in a delta encoded buffer.
+  //
+  // A delta encoded buffer stores, in the order of reading the buffer, varints
+  // of ZigZag encoded differences between consecutive values, starting from 0
+  // before the first value. The decoder replaces such a buffer with values in
+  // the usual form before decoding, so values must have canonical varint
+  // representations.
+  kVarintDelta1 = static_cast<uint8_t>(kVarintInlineMax) + 1,
+  kVarintDeltaMax =
+      static_cast<uint8_t>(kVarintDelta1) + kMaxLengthVarint64 - 1,
+
+  // Subtypes of kFixed32 and kFixed64:
+  kFixedPlain = 0,
+  // Value in a byte shuffled buffer, encoded as WireType::kEncodedBuffer.
+  //
+  // A byte shuffled buffer of N values of width W stores W planes of N bytes
+  // each: plane j consists of byte j of each value, in the order of reading the
+  // buffer. The decoder replaces such a buffer with values in the usual form
+  // before decoding.
+  kFixedByteShuffled = 1,
 
   // Subtypes of kLengthDelimited:
   kLengthDelimitedString = 0,
   kLengthDelimitedStartOfSubmessage = 1,
   kLengthDelimitedEndOfSubmessage = 2,
+  // String in a dictionary encoded buffer, encoded as WireType::kEncodedBuffer.
+  //
+  // A dictionary encoded buffer stores the number of distinct values (varint),
+  // followed by distinct values in the usual form (length varint followed by
+  // contents), followed by indices of values (varints) in the order of reading
+  // the buffer. The decoder replaces such a buffer with values in the usual
+  // form before decoding.
+  kLengthDelimitedDictionary = 3,
+  // Packed repeated field in a packed buffer, encoded as
+  // WireType::kEncodedBuffer.
+  //
+  // A packed buffer stores the number of values (varint), followed by the
+  // number of elements of each value (varints), followed by elements of all
+  // values. Elements are varints for kLengthDelimitedPackedVarint, and byte
+  // shuffled like in a fixed32 or fixed64 buffer for
+  // kLengthDelimitedPackedFixed32 and kLengthDelimitedPackedFixed64. The
+  // decoder replaces such a buffer with values in the usual form before
+  // decoding.
+  kLengthDelimitedPackedVarint = 4,
+  kLengthDelimitedPackedFixed32 = 5,
+  kLengthDelimitedPackedFixed64 = 6,
 };
 
 inline Subtype operator+(Subtype a, uint8_t b) {
@@ -89,20 +138,97 @@ inline uint8_t operator-(Subtype a, Subtype b) {
   return static_cast<uint8_t>(a) - static_cast<uint8_t>(b);
 }
 
+// Returns whether "subtype" of a kVarint tag denotes a value in a delta
+// encoded buffer.
+inline bool IsVarintDelta(Subtype subtype) {
+  return subtype >= Subtype::kVarintDelta1 &&
+         subtype <= Subtype::kVarintDeltaMax;
+}
+
+// ZigZag encoding maps differences between values, which can be negative when
+// interpreted as signed, to unsigned numbers, so that small differences in
+// either direction have short varints.
+inline uint64_t EncodeZigZag64(uint64_t value) {
+  return (value << 1) ^
+         static_cast<uint64_t>(static_cast<int64_t>(value) >> 63);
+}
+
+inline uint64_t DecodeZigZag64(uint64_t value) {
+  return (value >> 1) ^ (~(value & 1) + 1);
+}
+
+// Maximum depth of the nested message we break into columns. Submessages with
+// deeper nesting are encoded as strings.
+constexpr int kMaxRecursionDepth = 100;
+
+// Returns true if "record" is a valid protocol buffer message in the canonical
+// encoding. The purpose of this method is to distinguish string from a
+// submessage in the proto wire format and to perform validity checks that are
+// asserted later (such as that double proto field is followed by at least 8
+// bytes of data).
+// Note: Protocol buffer with suboptimal varint encoded tags and values (such as
+// 0x87,0x00 instead of 0x07) would parse successfully with the default proto
+// parser. This can happen for binary strings in proto. However, we need to
+// produce exactly the same bytes in the output so we reject message encoded
+// in non-canonical way.
+bool IsProtoMessage(Reader* record);
+
+// Rearranges a buffer of values of the given width (4 or 8) into byte planes,
+// which compress better if corresponding bytes of consecutive values are
+// similar, e.g. in floating point numbers. The size of the buffer must be a
+// multiple of width.
+void ShuffleBytes(size_t width, Chain* buffer);
+
+// Reverses ShuffleBytes(). The size of the buffer must be a multiple of width.
+void UnshuffleBytes(size_t width, Chain* buffer);
+
+// Returns whether "tag"/"subtype" pair has a data buffer stored in a special
+// form, which is encoded as WireType::kEncodedBuffer.
+// Precondition: "tag" is a valid proto tag.
+inline bool HasEncodedBuffer(uint32_t tag, Subtype subtype) {
+  switch (static_cast<WireType>(tag & 7)) {
+    case WireType::kFixed32:
+    case WireType::kFixed64:
+      return subtype == Subtype::kFixedByteShuffled;
+    case WireType::kLengthDelimited:
+      return subtype >= Subtype::kLengthDelimitedDictionary &&
+             subtype <= Subtype::kLengthDelimitedPackedFixed64;
+    default:
+      return false;
+  }
+}
+
+// Returns the byte which follows a tag encoded as WireType::kEncodedBuffer:
+// the actual wire type in the lowest 3 bits, and the form of the buffer of a
+// kLengthDelimited field in the remaining bits.
+// Precondition: HasEncodedBuffer(tag, subtype) for a tag with "wire_type".
+constexpr uint8_t EncodedBufferByte(WireType wire_type, Subtype subtype) {
+  return static_cast<uint8_t>(
+      static_cast<uint8_t>(wire_type) |
+      (wire_type == WireType::kLengthDelimited
+           ? (static_cast<uint8_t>(subtype) -
+              static_cast<uint8_t>(Subtype::kLengthDelimitedDictionary))
+                 << 3
+           : 0));
+}
+
 // Returns whether "tag"/"subtype" pair has a data buffer.
 // Precondition: "tag" is a valid proto tag.
 inline bool HasDataBuffer(uint32_t tag, Subtype subtype) {
   switch (static_cast<WireType>(tag & 7)) {
     case WireType::kVarint:
       // Protocol buffer has buffer if value is not inlined.
-      return subtype < Subtype::kVarintInline0;
+      return subtype < Subtype::kVarintInline0 ||
+             subtype > Subtype::kVarintInlineMax;
     case WireType::kFixed32:
     case WireType::kFixed64:
       return true;
     case WireType::kLengthDelimited:
       // If subtype is kLengthDelimitedStartOfSubmessage or
       // kLengthDelimitedEndOfSubmessage we have no buffer.
-      return subtype == Subtype::kLengthDelimitedString;
+      return subtype == Subtype::kLengthDelimitedString ||
+             (subtype >= Subtype::kLengthDelimitedDictionary &&
+              subtype <= Subtype::kLengthDelimitedPackedFixed64);
     case WireType::kStartGroup:
     case WireType::kEndGroup:
       return false;
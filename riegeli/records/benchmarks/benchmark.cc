@@ -480,6 +480,7 @@ int main(int argc, char** argv) {
       "brotli:6 "
       "brotli:6,parallelism:10 "
       "zstd:9 "
+      "lz4 "
       "transpose,uncompressed "
       "transpose,brotli:6 "
       "transpose,brotli:6,parallelism:10 "
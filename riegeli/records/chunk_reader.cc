@@ -23,6 +23,7 @@
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
@@ -411,6 +412,12 @@ bool DefaultChunkReaderBase::Size(Position* size) {
   return true;
 }
 
+void DefaultChunkReaderBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Object::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(chunk_.data);
+}
+
 bool DefaultChunkReaderBase::SeekToChunkContaining(Position new_pos) {
   return SeekToChunk<WhichChunk::kContaining>(new_pos);
 }
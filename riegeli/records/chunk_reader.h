@@ -22,6 +22,7 @@
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
@@ -138,6 +139,8 @@ class DefaultChunkReaderBase : public Object {
   //  * false - failure (!healthy())
   bool Size(Position* size);
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  protected:
   explicit DefaultChunkReaderBase(State state) : Object(state) {}
 
@@ -258,6 +261,7 @@ class DefaultChunkReader : public DefaultChunkReaderBase {
   const Src& src() const { return src_.manager(); }
   Reader* src_reader() override { return src_.ptr(); }
   const Reader* src_reader() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -319,6 +323,13 @@ void DefaultChunkReader<Src>::Done() {
   }
 }
 
+template <typename Src>
+void DefaultChunkReader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  DefaultChunkReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
 extern template class DefaultChunkReader<Reader*>;
 extern template class DefaultChunkReader<std::unique_ptr<Reader>>;
 
@@ -23,6 +23,7 @@
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk.h"
@@ -164,6 +165,7 @@ class DefaultChunkWriter : public DefaultChunkWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   Writer* dest_writer() override { return dest_.ptr(); }
   const Writer* dest_writer() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -222,6 +224,13 @@ void DefaultChunkWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+void DefaultChunkWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  DefaultChunkWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class DefaultChunkWriter<Writer*>;
 extern template class DefaultChunkWriter<std::unique_ptr<Writer>>;
 
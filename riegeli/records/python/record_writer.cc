@@ -932,17 +932,31 @@ riegeli::RecordWriterBase::Options::FromString()):
     "uncompressed" |
     "brotli" (":" brotli_level)? |
     "zstd" (":" zstd_level)? |
+    "lz4" (":" lz4_level)? |
     "window_log" ":" window_log |
     "chunk_size" ":" chunk_size |
     "bucket_fraction" ":" bucket_fraction |
+    "frame_size" ":" frame_size |
+    "checkpoint_interval" ":" checkpoint_interval |
+    "delta_encoding" (":" ("true" | "false"))? |
+    "byte_shuffle" (":" ("true" | "false"))? |
+    "dictionary_encoding" (":" ("true" | "false"))? |
+    "packed_fields" (":" ("true" | "false"))? |
+    "use_record_type" (":" ("true" | "false"))? |
+    "nonproto_fallback" (":" ("true" | "false"))? |
     "pad_to_block_boundary" (":" ("true" | "false"))? |
+    "parallel_compression" (":" ("true" | "false"))? |
     "parallelism" ":" parallelism
   brotli_level ::= integer 0..11 (default 9)
   zstd_level ::= integer -32..22 (default 9)
+  lz4_level ::= integer -32..12 (default 0)
   window_log ::= "auto" or integer 10..31
   chunk_size ::=
     integer expressed as real with optional suffix [BkKMGTPE], 1..
   bucket_fraction ::= real 0..1
+  frame_size ::=
+    integer expressed as real with optional suffix [BkKMGTPE], 0..
+  checkpoint_interval ::= integer 0..
   parallelism ::= integer 0..
 
 If transpose is true or empty, records should be serialized proto messages (but
@@ -955,12 +969,13 @@ Supported compression algorithms:
  * uncompressed
  * brotli, compression level defaults to 9
  * zstd, compression level defaults to 9
+ * lz4, compression level defaults to 0; much faster but compresses worse
 Default: brotli.
 
 window_log sets the logarithm of the LZ77 sliding window size. This tunes the
 tradeoff between compression density and memory usage (higher = better density
 but more memory). Special value auto means to keep the default (brotli: 22,
-zstd: derived from compression level and chunk size). For uncompressed,
+zstd: derived from compression level and chunk size). For uncompressed and lz4,
 window_log must be auto. For brotli, window_log must be auto or between 10 and
 30. For zstd, window_log must be auto or between 10 and 30 in 32-bit build, 31
 in 64-bit build. Default: auto.
@@ -975,10 +990,53 @@ bucket_fraction sets the desired uncompressed size of a bucket which groups
 values of several fields of the given wire type to be compressed together,
 relative to the desired chunk size, on the scale between 0.0 (compress each
 field separately) to 1.0 (put all fields of the same wire type in the same
-bucket. This is meaningful if transpose and compression are enabled. A larger
+bucket). This is meaningful if transpose and compression are enabled. A larger
 bucket size improves compression density; a smaller bucket size makes reading
 with projection faster, allowing to skip decompression of values of fields which
-are not included. Default 1.0.
+are not included. Default: 1.0.
+
+frame_size sets the desired uncompressed size of a frame of record values which
+are compressed independently within a chunk, or 0 to compress all record values
+of a chunk together. This is meaningful if transpose is disabled and compression
+is enabled. A larger frame size improves compression density; a smaller frame
+size makes reading a single record after seeking faster, allowing to decompress
+only the frame containing it. Default: 0.
+
+checkpoint_interval sets the number of records between decoder checkpoints
+stored in a chunk, or 0 to store no checkpoints. This is meaningful if transpose
+is enabled. A checkpoint makes the header of a chunk larger; more frequent
+checkpoints make reading a single record after seeking faster, allowing to
+decode only the range of records between checkpoints containing it. Default: 0.
+
+The following options change the layout of buffers of transposed chunks so
+that they compress better. Each of them is meaningful if transpose is enabled,
+and is not applied to chunks with decoder checkpoints. Files written with any of
+them cannot be read by versions of Riegeli which do not support it.
+Default: false.
+ * delta_encoding: buffers of varint fields whose values mostly change by small
+   steps, e.g. timestamps and sequence numbers, store differences between
+   consecutive values, if this makes them smaller.
+ * byte_shuffle: buffers of fixed32 and fixed64 fields, e.g. float and double,
+   store each byte of their values separately: first byte 0 of all values, then
+   byte 1 etc.
+ * dictionary_encoding: buffers of string fields with few distinct values, e.g.
+   country codes, store each distinct value once, followed by indices of values,
+   if this makes them smaller.
+ * packed_fields: buffers of string fields whose values all parse as packed
+   repeated fixed32, fixed64, or varint fields store element counts separately
+   from elements, and fixed width elements are byte shuffled.
+
+If use_record_type is true or empty and metadata specify the record type (see
+set_record_type()), field types from the record type decide which
+length-delimited fields are broken down into columns as submessages, instead of
+guessing this from field contents. This is meaningful if transpose is enabled.
+Records not matching the record type are still written losslessly. This does
+not change the file format. Default: false.
+
+If nonproto_fallback is true or empty, chunks are written without transposition
+while recent records are mostly not proto messages, because transposing them
+costs time without making them smaller. This is meaningful if transpose is
+enabled. This does not change the file format. Default: false.
 
 If pad_to_block_boundary is true or empty, padding is written to reach a 64KB
 block boundary when the RecordWriter is created, before close() or __exit__(),
@@ -990,6 +1048,12 @@ and before flush(). Consequences:
  * Up to 64KB is wasted when padding is written.
 Default: false.
 
+If parallel_compression is true or empty, data buckets of a transposed chunk are
+compressed concurrently in background threads, which reduces the latency of
+closing a single large chunk at the cost of using more threads. The number of
+threads compressing buckets of a chunk is bounded by the number of hardware
+threads, divided by parallelism if parallelism > 0. Default: false.
+
 parallelism sets the maximum number of chunks being encoded in parallel in
 background. Larger parallelism can increase throughput, up to a point where it
 no longer matters; smaller parallelism reduces memory usage. If parallelism > 0,
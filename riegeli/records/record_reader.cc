@@ -32,6 +32,7 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
@@ -39,7 +40,9 @@
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/column_values.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/chunk_encoding/transpose_decoder.h"
 #include "riegeli/records/chunk_reader.h"
 #include "riegeli/records/record_position.h"
@@ -118,8 +121,11 @@ void RecordReaderBase::Initialize(ChunkReader* src, Options&& options) {
          "null ChunkReader pointer";
   if (ABSL_PREDICT_FALSE(!src->healthy())) Fail(*src);
   chunk_begin_ = src->pos();
-  chunk_decoder_ = ChunkDecoder(ChunkDecoder::Options().set_field_projection(
-      std::move(options.field_projection_)));
+  chunk_decoder_ = ChunkDecoder(
+      ChunkDecoder::Options()
+          .set_field_projection(std::move(options.field_projection_))
+          .set_flat_values(options.flat_values_)
+          .set_parallel_decompression(options.parallel_decompression_));
   recovery_ = std::move(options.recovery_);
 }
 
@@ -289,6 +295,37 @@ template bool RecordReaderBase::ReadRecordSlow(std::string* record,
 template bool RecordReaderBase::ReadRecordSlow(Chain* record,
                                                RecordPosition* key);
 
+bool RecordReaderBase::ScanField(const Field& field, ColumnValues* values,
+                                 Position* chunk_begin) {
+  if (ABSL_PREDICT_FALSE(!healthy())) {
+    if (!TryRecovery()) return false;
+  }
+  ChunkReader* const src = src_chunk_reader();
+  for (;;) {
+    chunk_begin_ = src->pos();
+    Chunk chunk;
+    if (ABSL_PREDICT_FALSE(!src->ReadChunk(&chunk))) {
+      chunk_decoder_.Reset();
+      if (ABSL_PREDICT_FALSE(!src->healthy())) {
+        recoverable_ = Recoverable::kRecoverChunkReader;
+        Fail(*src);
+        if (!TryRecovery()) return false;
+        continue;
+      }
+      return false;
+    }
+    if (ABSL_PREDICT_FALSE(!chunk_decoder_.ScanField(chunk, field, values))) {
+      recoverable_ = Recoverable::kRecoverChunkDecoder;
+      Fail(chunk_decoder_);
+      if (!TryRecovery()) return false;
+      continue;
+    }
+    if (chunk_decoder_.num_records() == 0) continue;
+    if (chunk_begin != nullptr) *chunk_begin = chunk_begin_;
+    return true;
+  }
+}
+
 bool RecordReaderBase::Recover(SkippedRegion* skipped_region) {
   if (recoverable_ == Recoverable::kNo) return false;
   ChunkReader* const src = src_chunk_reader();
@@ -421,6 +458,12 @@ inline bool RecordReaderBase::ReadChunk() {
   return true;
 }
 
+void RecordReaderBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Object::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(chunk_decoder_);
+}
+
 template class RecordReader<Reader*>;
 template class RecordReader<std::unique_ptr<Reader>>;
 template class RecordReader<ChunkReader*>;
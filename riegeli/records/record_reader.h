@@ -27,10 +27,12 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/column_values.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/records/chunk_reader.h"
 #include "riegeli/records/chunk_reader_dependency.h"
@@ -90,6 +92,33 @@ class RecordReaderBase : public Object {
       return std::move(set_field_projection(std::move(field_projection)));
     }
 
+    // If true, values of all records of a chunk are decoded into a single flat
+    // array, so that ReadRecord(string_view*) never copies a record. This
+    // allocates the whole decoded chunk at once.
+    //
+    // Default: false
+    Options& set_flat_values(bool flat_values) & {
+      flat_values_ = flat_values;
+      return *this;
+    }
+    Options&& set_flat_values(bool flat_values) && {
+      return std::move(set_flat_values(flat_values));
+    }
+
+    // If true, data buckets of a transposed chunk are decompressed
+    // concurrently in background threads. This reduces the latency of reading
+    // from a large chunk, e.g. after seeking, at the cost of using more
+    // threads.
+    //
+    // Default: false
+    Options& set_parallel_decompression(bool parallel_decompression) & {
+      parallel_decompression_ = parallel_decompression;
+      return *this;
+    }
+    Options&& set_parallel_decompression(bool parallel_decompression) && {
+      return std::move(set_parallel_decompression(parallel_decompression));
+    }
+
     // Sets the recovery function to be called after skipping over invalid file
     // contents.
     //
@@ -129,6 +158,8 @@ class RecordReaderBase : public Object {
     friend class RecordReaderBase;
 
     FieldProjection field_projection_ = FieldProjection::All();
+    bool flat_values_ = false;
+    bool parallel_decompression_ = false;
     std::function<bool(const SkippedRegion&)> recovery_;
   };
 
@@ -188,6 +219,28 @@ class RecordReaderBase : public Object {
   bool ReadRecord(std::string* record, RecordPosition* key = nullptr);
   bool ReadRecord(Chain* record, RecordPosition* key = nullptr);
 
+  // Scans values of a single field in records of the next chunk which has
+  // records, instead of reading the records. Records of the current chunk which
+  // have not been read yet are skipped.
+  //
+  // Values in a transposed chunk are read directly from data of the field,
+  // without decoding records, which makes aggregating a single field much
+  // faster than reading and parsing records. Field projection is not applied.
+  // See ChunkDecoder::ScanField() for details.
+  //
+  // If chunk_begin != nullptr, *chunk_begin is set to the position of the chunk
+  // on success. The canonical record position of the value with index i is
+  // then RecordPosition(*chunk_begin, values->record_indices[i]).
+  //
+  // Precondition: !field.path().empty()
+  //
+  // Return values:
+  //  * true                    - success (*values is set)
+  //  * false (when healthy())  - source ends
+  //  * false (when !healthy()) - failure
+  bool ScanField(const Field& field, ColumnValues* values,
+                 Position* chunk_begin = nullptr);
+
   // If !healthy() and the failure was caused by invalid file contents, then
   // Recover() tries to recover from the failure and allow reading again by
   // skipping over the invalid region.
@@ -209,6 +262,7 @@ class RecordReaderBase : public Object {
   //  * ReadMetadata()
   //  * ReadSerializedMetadata()
   //  * ReadRecord() - should be retried if Recover() returns true
+  //  * ScanField()  - should be retried if Recover() returns true
   //  * Seek()
   //
   // Return values:
@@ -252,6 +306,8 @@ class RecordReaderBase : public Object {
   //  * false - failure (!healthy())
   bool Size(Position* size);
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
 #if 0
   // Searches the region between the current position and end of file for a
   // desired record. What is desired is specified by a function, which should
@@ -401,6 +457,7 @@ class RecordReader : public RecordReaderBase {
   const Src& src() const { return src_.manager(); }
   ChunkReader* src_chunk_reader() override { return src_.ptr(); }
   const ChunkReader* src_chunk_reader() const override { return src_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
   // An optimized implementation in a derived class, avoiding a virtual call.
   RecordPosition pos() const;
@@ -535,6 +592,13 @@ inline RecordPosition RecordReader<Src>::pos() const {
   return RecordPosition(src_->pos(), 0);
 }
 
+template <typename Src>
+void RecordReader<Src>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  RecordReaderBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(src_.manager());
+}
+
 extern template class RecordReader<Reader*>;
 extern template class RecordReader<std::unique_ptr<Reader>>;
 extern template class RecordReader<ChunkReader*>;
@@ -16,6 +16,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <chrono>
 #include <cmath>
 #include <deque>
 #include <future>
@@ -39,10 +40,12 @@
 #include "google/protobuf/repeated_field.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/options_parser.h"
 #include "riegeli/base/parallelism.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/message_parse.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
@@ -65,6 +68,9 @@ constexpr int RecordWriterBase::Options::kDefaultBrotli;
 constexpr int RecordWriterBase::Options::kMinZstd;
 constexpr int RecordWriterBase::Options::kMaxZstd;
 constexpr int RecordWriterBase::Options::kDefaultZstd;
+constexpr int RecordWriterBase::Options::kMinLz4;
+constexpr int RecordWriterBase::Options::kMaxLz4;
+constexpr int RecordWriterBase::Options::kDefaultLz4;
 constexpr int RecordWriterBase::Options::kMinWindowLog;
 constexpr int RecordWriterBase::Options::kMaxWindowLog;
 constexpr int RecordWriterBase::Options::kDefaultWindowLog;
@@ -103,6 +109,43 @@ inline size_t RecordSize(const google::protobuf::MessageLite& record) {
   return record.ByteSizeLong();
 }
 
+inline bool IsTransposable(const google::protobuf::MessageLite& record) {
+  return true;
+}
+
+inline bool IsTransposable(absl::string_view record) {
+  return TransposeEncoder::IsTransposable(record);
+}
+
+inline bool IsTransposable(const std::string& record) {
+  return TransposeEncoder::IsTransposable(absl::string_view(record));
+}
+
+inline bool IsTransposable(const Chain& record) {
+  return TransposeEncoder::IsTransposable(record);
+}
+
+// Builds the descriptor of the record type from metadata into *pool.
+//
+// Returns nullptr if metadata do not specify the record type or it cannot be
+// built.
+const google::protobuf::Descriptor* BuildRecordType(
+    const RecordsMetadata& metadata,
+    std::unique_ptr<google::protobuf::DescriptorPool>* pool) {
+  if (metadata.record_type_name().empty() ||
+      metadata.file_descriptor().empty()) {
+    return nullptr;
+  }
+  *pool = absl::make_unique<google::protobuf::DescriptorPool>();
+  for (const google::protobuf::FileDescriptorProto& file_descriptor :
+       metadata.file_descriptor()) {
+    if (ABSL_PREDICT_FALSE((*pool)->BuildFile(file_descriptor) == nullptr)) {
+      return nullptr;
+    }
+  }
+  return (*pool)->FindMessageTypeByName(metadata.record_type_name());
+}
+
 }  // namespace
 
 void SetRecordType(RecordsMetadata* metadata,
@@ -126,16 +169,52 @@ bool RecordWriterBase::Options::FromString(absl::string_view text,
                            ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("brotli", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("zstd", ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("lz4", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("window_log", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption(
       "chunk_size", ValueParser::Bytes(&chunk_size_, 1,
                                        std::numeric_limits<uint64_t>::max()));
   options_parser.AddOption("bucket_fraction",
                            ValueParser::Real(&bucket_fraction_, 0.0, 1.0));
+  options_parser.AddOption(
+      "frame_size", ValueParser::Bytes(&frame_size_, 0,
+                                       std::numeric_limits<uint64_t>::max()));
+  options_parser.AddOption(
+      "checkpoint_interval",
+      ValueParser::Int(&checkpoint_interval_, 0,
+                       std::numeric_limits<uint64_t>::max()));
+  options_parser.AddOption(
+      "delta_encoding",
+      ValueParser::Enum(&delta_encoding_,
+                        {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "byte_shuffle",
+      ValueParser::Enum(&byte_shuffle_,
+                        {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "dictionary_encoding",
+      ValueParser::Enum(&dictionary_encoding_,
+                        {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "packed_fields",
+      ValueParser::Enum(&packed_fields_,
+                        {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "use_record_type",
+      ValueParser::Enum(&use_record_type_,
+                        {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "nonproto_fallback",
+      ValueParser::Enum(&nonproto_fallback_,
+                        {{"", true}, {"true", true}, {"false", false}}));
   options_parser.AddOption(
       "pad_to_block_boundary",
       ValueParser::Enum(&pad_to_block_boundary_,
                         {{"", true}, {"true", true}, {"false", false}}));
+  options_parser.AddOption(
+      "parallel_compression",
+      ValueParser::Enum(&parallel_compression_,
+                        {{"", true}, {"true", true}, {"false", false}}));
   options_parser.AddOption(
       "parallelism",
       ValueParser::Int(&parallelism_, 0, std::numeric_limits<int>::max()));
@@ -153,8 +232,14 @@ class RecordWriterBase::Worker : public Object {
   explicit Worker(ChunkWriter* chunk_writer, Options&& options)
       : Object(State::kOpen),
         options_(std::move(options)),
-        chunk_writer_(RIEGELI_ASSERT_NOTNULL(chunk_writer)),
-        chunk_encoder_(MakeChunkEncoder()) {
+        chunk_writer_(RIEGELI_ASSERT_NOTNULL(chunk_writer)) {
+    if (options_.transpose_ && options_.use_record_type_) {
+      InitializeRecordType();
+    }
+    if (options_.transpose_ && options_.nonproto_fallback_) {
+      num_records_to_sample_ = kNumSampledRecords;
+    }
+    chunk_encoder_ = MakeChunkEncoder();
     if (ABSL_PREDICT_FALSE(!chunk_writer_->healthy())) Fail(*chunk_writer_);
   }
 
@@ -181,12 +266,23 @@ class RecordWriterBase::Worker : public Object {
 
   virtual FutureRecordPosition Pos() const = 0;
 
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  protected:
   void Initialize(Position initial_pos);
   virtual bool WriteSignature() = 0;
   virtual bool WriteMetadata() = 0;
   virtual bool PadToBlockBoundary() = 0;
 
+  void InitializeRecordType();
+  // For options_.nonproto_fallback_, decides whether the next chunk is
+  // transposed, based on records sampled in the chunk just closed, and
+  // prepares sampling records of the next chunk.
+  //
+  // Returns true if this changed, i.e. "chunk_encoder_" must be replaced.
+  bool UpdateNonProtoFallback();
+  template <typename Record>
+  void SampleRecord(const Record& record);
   std::unique_ptr<ChunkEncoder> MakeChunkEncoder();
   void EncodeSignature(Chunk* chunk);
   bool EncodeMetadata(Chunk* chunk);
@@ -195,12 +291,46 @@ class RecordWriterBase::Worker : public Object {
   Options options_;
   // Invariant: chunk_writer_ != nullptr
   ChunkWriter* chunk_writer_;
+  // Owns the descriptor of the record type if options_.use_record_type_.
+  std::unique_ptr<google::protobuf::DescriptorPool> record_type_pool_;
+  // Type of records passed to TransposeEncoder, or nullptr if unknown.
+  const google::protobuf::Descriptor* record_type_ = nullptr;
+
+  // Number of records sampled from the beginning of a chunk, checked whether
+  // they are proto messages, for options_.nonproto_fallback_.
+  static constexpr size_t kNumSampledRecords = 64;
+  // Number of consecutive chunks of mostly non-proto records after which
+  // chunks are no longer transposed.
+  static constexpr int kNumNonProtoChunksToFallBack = 4;
+  // While chunks are not transposed, records are sampled in one chunk of this
+  // many.
+  static constexpr int kProbeInterval = 16;
+
+  // Number of records of the current chunk which remain to be sampled.
+  size_t num_records_to_sample_ = 0;
+  // Number of records sampled in the current chunk, and how many of them were
+  // not proto messages.
+  size_t num_sampled_records_ = 0;
+  size_t num_sampled_nonproto_records_ = 0;
+  // Number of consecutive sampled chunks of mostly non-proto records.
+  int num_nonproto_chunks_ = 0;
+  // Whether chunks are not transposed despite options_.transpose_, because
+  // recent records were mostly not proto messages.
+  bool fell_back_ = false;
+  // Number of chunks since records were last sampled, while "fell_back_".
+  int num_chunks_since_probe_ = 0;
   // Invariant: if chunk is open then chunk_encoder_ != nullptr
   std::unique_ptr<ChunkEncoder> chunk_encoder_;
 };
 
 RecordWriterBase::Worker::~Worker() {}
 
+void RecordWriterBase::Worker::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Object::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(chunk_encoder_);
+}
+
 inline void RecordWriterBase::Worker::Initialize(Position initial_pos) {
   if (initial_pos == 0) {
     if (ABSL_PREDICT_FALSE(!WriteSignature())) return;
@@ -218,10 +348,60 @@ inline bool RecordWriterBase::Worker::MaybePadToBlockBoundary() {
   }
 }
 
+inline void RecordWriterBase::Worker::InitializeRecordType() {
+  if (options_.serialized_metadata_.empty()) {
+    record_type_ = BuildRecordType(options_.metadata_, &record_type_pool_);
+    return;
+  }
+  RecordsMetadata metadata;
+  // Failing to parse metadata is not an error here: then records are
+  // transposed without knowing their type.
+  if (ParseFromChain(&metadata, options_.serialized_metadata_)) {
+    record_type_ = BuildRecordType(metadata, &record_type_pool_);
+  }
+}
+
+inline bool RecordWriterBase::Worker::UpdateNonProtoFallback() {
+  if (!options_.transpose_ || !options_.nonproto_fallback_) return false;
+  const bool fell_back_before = fell_back_;
+  if (num_sampled_records_ > 0) {
+    // A chunk has mostly non-proto records if at least 90% of sampled records
+    // are not proto messages.
+    const bool mostly_nonproto =
+        num_sampled_nonproto_records_ * 10 >= num_sampled_records_ * 9;
+    if (!fell_back_) {
+      num_nonproto_chunks_ = mostly_nonproto ? num_nonproto_chunks_ + 1 : 0;
+      if (num_nonproto_chunks_ >= kNumNonProtoChunksToFallBack) {
+        fell_back_ = true;
+        num_chunks_since_probe_ = 0;
+      }
+    } else if (!mostly_nonproto) {
+      fell_back_ = false;
+      num_nonproto_chunks_ = 0;
+    }
+    num_sampled_records_ = 0;
+    num_sampled_nonproto_records_ = 0;
+  }
+  if (fell_back_ && ++num_chunks_since_probe_ < kProbeInterval) {
+    num_records_to_sample_ = 0;
+  } else {
+    num_chunks_since_probe_ = 0;
+    num_records_to_sample_ = kNumSampledRecords;
+  }
+  return fell_back_ != fell_back_before;
+}
+
+template <typename Record>
+inline void RecordWriterBase::Worker::SampleRecord(const Record& record) {
+  --num_records_to_sample_;
+  ++num_sampled_records_;
+  if (!IsTransposable(record)) ++num_sampled_nonproto_records_;
+}
+
 inline std::unique_ptr<ChunkEncoder>
 RecordWriterBase::Worker::MakeChunkEncoder() {
   std::unique_ptr<ChunkEncoder> chunk_encoder;
-  if (options_.transpose_) {
+  if (options_.transpose_ && !fell_back_) {
     const long double long_double_bucket_size =
         std::round(static_cast<long double>(options_.chunk_size_) *
                    static_cast<long double>(options_.bucket_fraction_));
@@ -233,11 +413,29 @@ RecordWriterBase::Worker::MakeChunkEncoder() {
             : ABSL_PREDICT_TRUE(long_double_bucket_size >= 1.0L)
                   ? static_cast<uint64_t>(long_double_bucket_size)
                   : uint64_t{1};
+    int compression_parallelism = 1;
+    if (options_.parallel_compression_) {
+      // With parallelism > 0 up to parallelism chunks are encoded
+      // concurrently, so they share hardware threads.
+      compression_parallelism = IntCast<int>(UnsignedMin(
+          internal::HardwareConcurrency() /
+              UnsignedMax(IntCast<size_t>(options_.parallelism_), size_t{1}),
+          size_t{std::numeric_limits<int>::max()}));
+    }
     chunk_encoder = absl::make_unique<TransposeEncoder>(
-        options_.compressor_options_, bucket_size);
+        options_.compressor_options_, bucket_size,
+        TransposeEncoder::Options()
+            .set_checkpoint_interval(options_.checkpoint_interval_)
+            .set_delta_encoding(options_.delta_encoding_)
+            .set_byte_shuffle(options_.byte_shuffle_)
+            .set_dictionary_encoding(options_.dictionary_encoding_)
+            .set_packed_fields(options_.packed_fields_)
+            .set_record_type(record_type_)
+            .set_compression_parallelism(compression_parallelism));
   } else {
     chunk_encoder = absl::make_unique<SimpleEncoder>(
-        options_.compressor_options_, options_.chunk_size_);
+        options_.compressor_options_, options_.chunk_size_,
+        options_.frame_size_);
   }
   if (options_.parallelism_ == 0) {
     return chunk_encoder;
@@ -276,6 +474,7 @@ inline bool RecordWriterBase::Worker::EncodeMetadata(Chunk* chunk) {
 template <typename Record>
 inline bool RecordWriterBase::Worker::AddRecord(Record&& record) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (num_records_to_sample_ > 0) SampleRecord(record);
   if (ABSL_PREDICT_FALSE(
           !chunk_encoder_->AddRecord(std::forward<Record>(record)))) {
     return Fail(*chunk_encoder_);
@@ -305,7 +504,13 @@ class RecordWriterBase::SerialWorker : public Worker {
  public:
   explicit SerialWorker(ChunkWriter* chunk_writer, Options&& options);
 
-  void OpenChunk() override { chunk_encoder_->Reset(); }
+  void OpenChunk() override {
+    if (UpdateNonProtoFallback()) {
+      chunk_encoder_ = MakeChunkEncoder();
+    } else {
+      chunk_encoder_->Reset();
+    }
+  }
   bool CloseChunk() override;
   bool Flush(FlushType flush_type) override;
   FutureRecordPosition Pos() const override;
@@ -387,10 +592,14 @@ class RecordWriterBase::ParallelWorker : public Worker {
 
   ~ParallelWorker();
 
-  void OpenChunk() override { chunk_encoder_ = MakeChunkEncoder(); }
+  void OpenChunk() override {
+    UpdateNonProtoFallback();
+    chunk_encoder_ = MakeChunkEncoder();
+  }
   bool CloseChunk() override;
   bool Flush(FlushType flush_type) override;
   FutureRecordPosition Pos() const override;
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -410,7 +619,12 @@ class RecordWriterBase::ParallelWorker : public Worker {
   };
   struct WriteChunkRequest {
     std::shared_future<ChunkHeader> chunk_header;
-    std::future<Chunk> chunk;
+    // Shared so that RegisterSubobjects() can inspect an encoded chunk.
+    std::shared_future<Chunk> chunk;
+    // Memory held by the chunk until it is encoded, estimated as the size of
+    // records in it, because the chunk encoder is in use by another thread.
+    // Memory of an encoded chunk is estimated from the chunk itself.
+    size_t memory = 0;
   };
   struct PadToBlockBoundaryRequest {};
   struct FlushRequest {
@@ -444,7 +658,7 @@ inline RecordWriterBase::ParallelWorker::ParallelWorker(
         // If !healthy(), the chunk must still be waited for, to ensure that
         // the chunk encoder thread exits before the chunk writer thread
         // responds to DoneRequest.
-        const Chunk chunk = request.chunk.get();
+        const Chunk& chunk = request.chunk.get();
         if (ABSL_PREDICT_FALSE(!self->healthy())) return true;
         if (ABSL_PREDICT_FALSE(!self->chunk_writer_->WriteChunk(chunk))) {
           self->Fail(*self->chunk_writer_);
@@ -561,12 +775,14 @@ bool RecordWriterBase::ParallelWorker::WriteMetadata() {
 bool RecordWriterBase::ParallelWorker::CloseChunk() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   ChunkEncoder* const chunk_encoder = chunk_encoder_.release();
+  const size_t memory = UnsignedMin(chunk_encoder->decoded_data_size(),
+                                    std::numeric_limits<size_t>::max());
   ChunkPromises* const chunk_promises = new ChunkPromises();
   mutex_.LockWhen(
       absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
   chunk_writer_requests_.emplace_back(
       WriteChunkRequest{chunk_promises->chunk_header.get_future(),
-                        chunk_promises->chunk.get_future()});
+                        chunk_promises->chunk.get_future(), memory});
   mutex_.Unlock();
   internal::DefaultThreadPool().Schedule([this, chunk_encoder, chunk_promises] {
     Chunk chunk;
@@ -625,6 +841,25 @@ FutureRecordPosition RecordWriterBase::ParallelWorker::Pos() const {
       chunk_encoder_ == nullptr ? uint64_t{0} : chunk_encoder_->num_records());
 }
 
+void RecordWriterBase::ParallelWorker::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Worker::RegisterSubobjects(memory_estimator);
+  absl::MutexLock lock(&mutex_);
+  for (const ChunkWriterRequest& request : chunk_writer_requests_) {
+    const WriteChunkRequest* const write_chunk_request =
+        absl::get_if<WriteChunkRequest>(&request);
+    if (write_chunk_request != nullptr) {
+      if (write_chunk_request->chunk.wait_for(std::chrono::seconds(0)) ==
+          std::future_status::ready) {
+        memory_estimator->RegisterSubobjects(
+            write_chunk_request->chunk.get().data);
+      } else {
+        memory_estimator->RegisterMemory(write_chunk_request->memory);
+      }
+    }
+  }
+}
+
 RecordWriterBase::RecordWriterBase(State state) noexcept : Object(state) {}
 
 RecordWriterBase::RecordWriterBase(RecordWriterBase&& that) noexcept
@@ -728,6 +963,12 @@ FutureRecordPosition RecordWriterBase::Pos() const {
   return worker_->Pos();
 }
 
+void RecordWriterBase::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  Object::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(worker_);
+}
+
 template class RecordWriter<Writer*>;
 template class RecordWriter<std::unique_ptr<Writer>>;
 template class RecordWriter<ChunkWriter*>;
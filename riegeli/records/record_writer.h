@@ -28,6 +28,7 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/stable_dependency.h"
 #include "riegeli/bytes/writer.h"
@@ -63,17 +64,31 @@ class RecordWriterBase : public Object {
     //     "uncompressed" |
     //     "brotli" (":" brotli_level)? |
     //     "zstd" (":" zstd_level)? |
+    //     "lz4" (":" lz4_level)? |
     //     "window_log" ":" window_log |
     //     "chunk_size" ":" chunk_size |
     //     "bucket_fraction" ":" bucket_fraction |
+    //     "frame_size" ":" frame_size |
+    //     "checkpoint_interval" ":" checkpoint_interval |
+    //     "delta_encoding" (":" ("true" | "false"))? |
+    //     "byte_shuffle" (":" ("true" | "false"))? |
+    //     "dictionary_encoding" (":" ("true" | "false"))? |
+    //     "packed_fields" (":" ("true" | "false"))? |
+    //     "use_record_type" (":" ("true" | "false"))? |
+    //     "nonproto_fallback" (":" ("true" | "false"))? |
     //     "pad_to_block_boundary" (":" ("true" | "false"))? |
+    //     "parallel_compression" (":" ("true" | "false"))? |
     //     "parallelism" ":" parallelism
     //   brotli_level ::= integer 0..11 (default 9)
     //   zstd_level ::= integer -32..22 (default 9)
+    //   lz4_level ::= integer -32..12 (default 0)
     //   window_log ::= "auto" or integer 10..31
     //   chunk_size ::=
     //     integer expressed as real with optional suffix [BkKMGTPE], 1..
     //   bucket_fraction ::= real 0..1
+    //   frame_size ::=
+    //     integer expressed as real with optional suffix [BkKMGTPE], 0..
+    //   checkpoint_interval ::= integer 0..
     //   parallelism ::= integer 0..
     //
     // Return values:
@@ -141,6 +156,27 @@ class RecordWriterBase : public Object {
       return std::move(set_zstd(compression_level));
     }
 
+    // Changes compression algorithm to LZ4. Sets compression level which tunes
+    // the tradeoff between compression density and compression speed (higher =
+    // better density but slower).
+    //
+    // LZ4 is much faster than Brotli or Zstd but compresses worse. It is
+    // suitable for short-lived data where throughput matters more than size.
+    //
+    // compression_level must be between kMinLz4 (-32) and kMaxLz4 (12).
+    // Negative levels select the fast acceleration mode, levels 3 and above
+    // select the high compression mode. Default: kDefaultLz4 (0).
+    static constexpr int kMinLz4 = CompressorOptions::kMinLz4;
+    static constexpr int kMaxLz4 = CompressorOptions::kMaxLz4;
+    static constexpr int kDefaultLz4 = CompressorOptions::kDefaultLz4;
+    Options& set_lz4(int compression_level = kDefaultLz4) & {
+      compressor_options_.set_lz4(compression_level);
+      return *this;
+    }
+    Options&& set_lz4(int compression_level = kDefaultLz4) && {
+      return std::move(set_lz4(compression_level));
+    }
+
     // Logarithm of the LZ77 sliding window size. This tunes the tradeoff
     // between compression density and memory usage (higher = better density but
     // more memory).
@@ -148,7 +184,7 @@ class RecordWriterBase : public Object {
     // Special value kDefaultWindowLog (-1) means to keep the default
     // (brotli: 22, zstd: derived from compression level and chunk size).
     //
-    // For uncompressed, window_log must be kDefaultWindowLog (-1).
+    // For uncompressed and lz4, window_log must be kDefaultWindowLog (-1).
     //
     // For brotli, window_log must be kDefaultWindowLog (-1) or between
     // BrotliWriterBase::Options::kMinWindowLog (10) and
@@ -221,6 +257,142 @@ class RecordWriterBase : public Object {
       return std::move(set_bucket_fraction(fraction));
     }
 
+    // Sets the desired uncompressed size of a frame of record values which are
+    // compressed independently within a chunk, or 0 to compress all record
+    // values of a chunk together.
+    //
+    // This is meaningful if transpose is disabled and compression is enabled.
+    // A larger frame size improves compression density; a smaller frame size
+    // makes reading a single record after seeking faster, allowing to
+    // decompress only the frame containing it.
+    //
+    // Default: 0
+    Options& set_frame_size(uint64_t size) & {
+      frame_size_ = size;
+      return *this;
+    }
+    Options&& set_frame_size(uint64_t size) && {
+      return std::move(set_frame_size(size));
+    }
+
+    // Sets the number of records between decoder checkpoints stored in a
+    // chunk, or 0 to store no checkpoints.
+    //
+    // This is meaningful if transpose is enabled. A checkpoint makes the
+    // header of a chunk larger; more frequent checkpoints make reading a single
+    // record after seeking faster, allowing to decode only the range of records
+    // between checkpoints containing it.
+    //
+    // Default: 0
+    Options& set_checkpoint_interval(uint64_t num_records) & {
+      checkpoint_interval_ = num_records;
+      return *this;
+    }
+    Options&& set_checkpoint_interval(uint64_t num_records) && {
+      return std::move(set_checkpoint_interval(num_records));
+    }
+
+    // The following four buffer encodings change the layout of buffers of
+    // transposed chunks so that they compress better. Each of them is
+    // meaningful if transpose is enabled, and is not applied to chunks with
+    // decoder checkpoints (see set_checkpoint_interval()). Files written with
+    // any of them cannot be read by versions of Riegeli which do not support
+    // it.
+
+    // If true, buffers of varint fields whose values mostly change by small
+    // steps, e.g. timestamps and sequence numbers, store differences between
+    // consecutive values, if this makes them smaller.
+    //
+    // Default: false
+    Options& set_delta_encoding(bool delta_encoding) & {
+      delta_encoding_ = delta_encoding;
+      return *this;
+    }
+    Options&& set_delta_encoding(bool delta_encoding) && {
+      return std::move(set_delta_encoding(delta_encoding));
+    }
+
+    // If true, buffers of fixed32 and fixed64 fields, e.g. float and double,
+    // store each byte of their values separately: first byte 0 of all values,
+    // then byte 1 etc. This usually makes them compress better, because
+    // corresponding bytes of similar values are similar, e.g. exponents.
+    //
+    // Default: false
+    Options& set_byte_shuffle(bool byte_shuffle) & {
+      byte_shuffle_ = byte_shuffle;
+      return *this;
+    }
+    Options&& set_byte_shuffle(bool byte_shuffle) && {
+      return std::move(set_byte_shuffle(byte_shuffle));
+    }
+
+    // If true, buffers of string fields with few distinct values, e.g. country
+    // codes or enum-like labels, store each distinct value once, followed by
+    // indices of values, if this makes them smaller.
+    //
+    // Default: false
+    Options& set_dictionary_encoding(bool dictionary_encoding) & {
+      dictionary_encoding_ = dictionary_encoding;
+      return *this;
+    }
+    Options&& set_dictionary_encoding(bool dictionary_encoding) && {
+      return std::move(set_dictionary_encoding(dictionary_encoding));
+    }
+
+    // If true, buffers of string fields whose values all parse as packed
+    // repeated fixed32, fixed64, or varint fields store element counts
+    // separately from elements, and fixed width elements are byte shuffled.
+    // This gives packed repeated fields, e.g. feature vectors, a columnar
+    // layout similar to other numeric fields.
+    //
+    // Default: false
+    Options& set_packed_fields(bool packed_fields) & {
+      packed_fields_ = packed_fields;
+      return *this;
+    }
+    Options&& set_packed_fields(bool packed_fields) && {
+      return std::move(set_packed_fields(packed_fields));
+    }
+
+    // If true and metadata specify the record type (see SetRecordType()),
+    // field types from the record type decide which length-delimited fields
+    // are broken down into columns as submessages, instead of guessing this
+    // from field contents. String fields are not parsed then, which speeds up
+    // encoding, and they are never mistaken for submessages, which keeps the
+    // layout of columns stable.
+    //
+    // This is meaningful if transpose is enabled. Records not matching the
+    // record type are still written losslessly. This does not change the file
+    // format.
+    //
+    // Default: false
+    Options& set_use_record_type(bool use_record_type) & {
+      use_record_type_ = use_record_type;
+      return *this;
+    }
+    Options&& set_use_record_type(bool use_record_type) && {
+      return std::move(set_use_record_type(use_record_type));
+    }
+
+    // If true, chunks are written without transposition while recent records
+    // are mostly not proto messages, because transposing them costs time
+    // without making them smaller. Some records of each chunk are checked
+    // whether they are proto messages. After several chunks of mostly non-proto
+    // records chunks are written as if transpose was disabled, and records are
+    // checked again only periodically, until proto messages come back.
+    //
+    // This is meaningful if transpose is enabled. This does not change the file
+    // format.
+    //
+    // Default: false
+    Options& set_nonproto_fallback(bool nonproto_fallback) & {
+      nonproto_fallback_ = nonproto_fallback;
+      return *this;
+    }
+    Options&& set_nonproto_fallback(bool nonproto_fallback) && {
+      return std::move(set_nonproto_fallback(nonproto_fallback));
+    }
+
     // Sets file metadata to be written at the beginning (if metadata has any
     // fields set).
     //
@@ -273,6 +445,24 @@ class RecordWriterBase : public Object {
       return std::move(set_pad_to_block_boundary(pad_to_block_boundary));
     }
 
+    // If true, data buckets of a transposed chunk (see set_bucket_fraction())
+    // are compressed concurrently in background threads, which reduces the
+    // latency of closing a single large chunk at the cost of using more
+    // threads.
+    //
+    // The number of threads compressing buckets of a chunk is bounded by the
+    // number of hardware threads, divided by parallelism if parallelism > 0,
+    // because then several chunks are already encoded concurrently.
+    //
+    // Default: false
+    Options& set_parallel_compression(bool parallel_compression) & {
+      parallel_compression_ = parallel_compression;
+      return *this;
+    }
+    Options&& set_parallel_compression(bool parallel_compression) && {
+      return std::move(set_parallel_compression(parallel_compression));
+    }
+
     // Sets the maximum number of chunks being encoded in parallel in
     // background. Larger parallelism can increase throughput, up to a point
     // where it no longer matters; smaller parallelism reduces memory usage.
@@ -300,9 +490,18 @@ class RecordWriterBase : public Object {
     CompressorOptions compressor_options_;
     uint64_t chunk_size_ = kDefaultChunkSize;
     double bucket_fraction_ = 1.0;
+    uint64_t frame_size_ = 0;
+    uint64_t checkpoint_interval_ = 0;
+    bool delta_encoding_ = false;
+    bool byte_shuffle_ = false;
+    bool dictionary_encoding_ = false;
+    bool packed_fields_ = false;
+    bool use_record_type_ = false;
+    bool nonproto_fallback_ = false;
     RecordsMetadata metadata_;
     Chain serialized_metadata_;
     bool pad_to_block_boundary_ = false;
+    bool parallel_compression_ = false;
     int parallelism_ = 0;
   };
 
@@ -364,6 +563,11 @@ class RecordWriterBase : public Object {
   // appending in the case of Close()).
   FutureRecordPosition Pos() const;
 
+  // Includes chunks queued for encoding and writing if parallelism is used.
+  // A chunk which is still being encoded is estimated as the size of its
+  // records.
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
+
  protected:
   explicit RecordWriterBase(State state) noexcept;
 
@@ -439,6 +643,7 @@ class RecordWriter : public RecordWriterBase {
   const Dest& dest() const { return dest_.manager(); }
   ChunkWriter* dest_chunk_writer() override { return dest_.ptr(); }
   const ChunkWriter* dest_chunk_writer() const override { return dest_.ptr(); }
+  void RegisterSubobjects(MemoryEstimator* memory_estimator) const override;
 
  protected:
   void Done() override;
@@ -502,6 +707,13 @@ void RecordWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+void RecordWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator* memory_estimator) const {
+  RecordWriterBase::RegisterSubobjects(memory_estimator);
+  memory_estimator->RegisterSubobjects(dest_.manager());
+}
+
 extern template class RecordWriter<Writer*>;
 extern template class RecordWriter<std::unique_ptr<Writer>>;
 extern template class RecordWriter<ChunkWriter*>;
@@ -0,0 +1,531 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Write-then-read tests of RecordWriter options which change how chunks are
+// encoded. Each test writes records with several sets of options and checks
+// that RecordReader reads back exactly the same records.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/message_serialize.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/records/records_metadata.pb.h"
+
+namespace riegeli {
+namespace {
+
+void AppendVarint(uint64_t value, std::string* dest) {
+  while (value >= 0x80) {
+    dest->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  dest->push_back(static_cast<char>(value));
+}
+
+void AppendTag(uint32_t field, uint32_t wire_type, std::string* dest) {
+  AppendVarint(uint64_t{field} << 3 | wire_type, dest);
+}
+
+void AppendVarintField(uint32_t field, uint64_t value, std::string* dest) {
+  AppendTag(field, 0, dest);
+  AppendVarint(value, dest);
+}
+
+void AppendFixed64Field(uint32_t field, uint64_t value, std::string* dest) {
+  AppendTag(field, 1, dest);
+  for (int i = 0; i < 8; ++i) {
+    dest->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+void AppendStringField(uint32_t field, absl::string_view value,
+                       std::string* dest) {
+  AppendTag(field, 2, dest);
+  AppendVarint(value.size(), dest);
+  dest->append(value.data(), value.size());
+}
+
+void AppendGroupField(uint32_t field, absl::string_view contents,
+                      std::string* dest) {
+  AppendTag(field, 3, dest);
+  dest->append(contents.data(), contents.size());
+  AppendTag(field, 4, dest);
+}
+
+std::string PackedVarints(uint64_t first, size_t count) {
+  std::string packed;
+  for (size_t i = 0; i < count; ++i) AppendVarint(first + i * 1000, &packed);
+  return packed;
+}
+
+// Reads "records" from "file" with "reader_options", first sequentially and
+// then seeking to each record in reverse order.
+void CheckRead(const Chain& file, RecordReaderBase::Options reader_options,
+               absl::string_view description,
+               const std::vector<std::string>& records) {
+  RecordReader<ChainReader<>> reader(ChainReader<>(&file),
+                                     std::move(reader_options));
+  std::vector<RecordPosition> keys;
+  std::string record;
+  for (size_t i = 0; i < records.size(); ++i) {
+    RecordPosition key;
+    RIEGELI_CHECK(reader.ReadRecord(&record, &key))
+        << description << ": reading record " << i
+        << " failed: " << reader.message();
+    RIEGELI_CHECK(record == records[i])
+        << description << ": record " << i << " differs";
+    keys.push_back(key);
+  }
+  RIEGELI_CHECK(!reader.ReadRecord(&record))
+      << description << ": too many records";
+  for (size_t i = records.size(); i > 0; --i) {
+    RIEGELI_CHECK(reader.Seek(keys[i - 1]))
+        << description << ": seeking to record " << i - 1
+        << " failed: " << reader.message();
+    RIEGELI_CHECK(reader.ReadRecord(&record))
+        << description << ": reading record " << i - 1
+        << " after seeking failed: " << reader.message();
+    RIEGELI_CHECK(record == records[i - 1])
+        << description << ": record " << i - 1 << " differs after seeking";
+  }
+  RIEGELI_CHECK(reader.Close()) << description << ": " << reader.message();
+}
+
+// Writes "records" with "options", reads them back, and checks that they are
+// unchanged. Returns the written file.
+//
+// Records are read both with flat values, which decodes each chunk at once,
+// and without them, which decodes chunks with decoder checkpoints on demand.
+Chain CheckWriteThenRead(RecordWriterBase::Options options,
+                         absl::string_view description,
+                         const std::vector<std::string>& records) {
+  Chain file;
+  RecordWriter<ChainWriter<>> writer(ChainWriter<>(&file), std::move(options));
+  for (const std::string& record : records) {
+    RIEGELI_CHECK(writer.WriteRecord(record))
+        << description << ": " << writer.message();
+  }
+  RIEGELI_CHECK(writer.Close()) << description << ": " << writer.message();
+
+  CheckRead(file, RecordReaderBase::Options(), description, records);
+  CheckRead(file, RecordReaderBase::Options().set_flat_values(true),
+            absl::StrCat(description, " (flat values)"), records);
+  return file;
+}
+
+RecordWriterBase::Options ParseOptions(absl::string_view options_text) {
+  RecordWriterBase::Options options;
+  std::string error_message;
+  RIEGELI_CHECK(options.FromString(options_text, &error_message))
+      << "Invalid options " << options_text << ": " << error_message;
+  return options;
+}
+
+void CheckWriteThenRead(absl::string_view options_text,
+                        const std::vector<std::string>& records) {
+  CheckWriteThenRead(ParseOptions(options_text), options_text, records);
+}
+
+void CheckWriteThenRead(const std::vector<absl::string_view>& options_texts,
+                        const std::vector<std::string>& records) {
+  for (const absl::string_view options_text : options_texts) {
+    CheckWriteThenRead(options_text, records);
+  }
+}
+
+void TestPackedFields() {
+  std::vector<std::string> records;
+  // A record which used to make the packed layout unreadable: it has nested
+  // groups, packed varints in a group and in a submessage, fixed64, and empty
+  // and 16-byte length-delimited values.
+  records.push_back(absl::HexStringToBytes(
+      "535310fdffffffffffffffff01210000000000706a4010a70110feffffffffffffffff01"
+      "089688babbc82e089988babbc82e3202d20154089988babbc82e423b5a005a10f3b36f95"
+      "c146694f3ec8cd08092d078c32076bd603cb02810532077ed7079405f006089d88babbc8"
+      "2e4a0855231d5e43f67b8cc0bb011810324a02b6ce1db49b0edc54"));
+  // A value which ends inside a varint is not a packed varint field.
+  records.push_back(absl::HexStringToBytes("4a02b6ce"));
+  for (uint64_t i = 0; i < 1000; ++i) {
+    std::string group;
+    AppendStringField(6, PackedVarints(i, i % 4), &group);
+    AppendFixed64Field(4, i * 0x0101010101, &group);
+    std::string nested_group;
+    AppendStringField(6, PackedVarints(i * 7, 2), &nested_group);
+    AppendGroupField(10, nested_group, &group);
+    std::string submessage;
+    AppendStringField(6, PackedVarints(i * 3, i % 3 + 1), &submessage);
+    AppendStringField(11, i % 2 == 0 ? std::string() : std::string(16, 'x'),
+                      &submessage);
+    std::string record;
+    AppendVarintField(1, i, &record);
+    AppendGroupField(10, group, &record);
+    AppendStringField(8, submessage, &record);
+    // Varying lengths of a field whose values are sometimes truncated varints.
+    AppendStringField(9, i % 5 == 0 ? "\xb6\xce" : "\x01\x02", &record);
+    records.push_back(std::move(record));
+  }
+  CheckWriteThenRead({"transpose,packed_fields,uncompressed",
+                      "transpose,packed_fields,brotli",
+                      "transpose,packed_fields,zstd",
+                      "transpose,packed_fields,lz4",
+                      "transpose,packed_fields,zstd,chunk_size:4096",
+                      "transpose,packed_fields,zstd,parallelism:2,"
+                      "chunk_size:8192",
+                      "transpose,packed_fields,dictionary_encoding,"
+                      "byte_shuffle,delta_encoding"},
+                     records);
+}
+
+// Returns the size of "records" written with options parsed from
+// "options_text", after checking that they are read back unchanged.
+size_t WrittenSize(absl::string_view options_text,
+                   const std::vector<std::string>& records) {
+  return CheckWriteThenRead(ParseOptions(options_text), options_text, records)
+      .size();
+}
+
+void TestDeltaEncoding() {
+  std::vector<std::string> records;
+  for (uint64_t i = 0; i < 3000; ++i) {
+    std::string record;
+    // Timestamps increasing by small steps.
+    AppendVarintField(1, uint64_t{1500000000000} + i * 1000 + i % 7, &record);
+    // Values decreasing by small steps.
+    AppendVarintField(2, 1000000 - i * 3, &record);
+    // Values differing by large steps, including wrapping around.
+    AppendVarintField(3, i % 3 == 0 ? 0 : ~uint64_t{0} - i, &record);
+    // Values which are not changing by small steps.
+    AppendVarintField(4, i * 0x9e3779b97f4a7c15 >> 20, &record);
+    records.push_back(std::move(record));
+  }
+  CheckWriteThenRead({"transpose,delta_encoding,brotli",
+                      "transpose,delta_encoding,zstd,chunk_size:4096",
+                      "transpose,delta_encoding,lz4,checkpoint_interval:10"},
+                     records);
+  RIEGELI_CHECK_LT(
+      WrittenSize("transpose,delta_encoding,uncompressed", records),
+      WrittenSize("transpose,uncompressed", records))
+      << "delta_encoding did not make timestamps smaller";
+}
+
+void TestByteShuffle() {
+  std::vector<std::string> records;
+  for (uint64_t i = 0; i < 3000; ++i) {
+    const double value64 = 1000.0 + static_cast<double>(i) * 0.25;
+    uint64_t bits64;
+    std::memcpy(&bits64, &value64, sizeof(bits64));
+    const float value32 = static_cast<float>(i % 100) / 3.0f;
+    uint32_t bits32;
+    std::memcpy(&bits32, &value32, sizeof(bits32));
+    std::string record;
+    AppendFixed64Field(1, bits64, &record);
+    AppendTag(2, 5, &record);
+    for (int j = 0; j < 4; ++j) {
+      record.push_back(static_cast<char>(bits32 >> (8 * j)));
+    }
+    if (i % 3 == 0) AppendFixed64Field(3, i, &record);
+    records.push_back(std::move(record));
+  }
+  CheckWriteThenRead({"transpose,byte_shuffle,uncompressed",
+                      "transpose,byte_shuffle,brotli",
+                      "transpose,byte_shuffle,zstd,chunk_size:4096",
+                      "transpose,byte_shuffle,lz4,checkpoint_interval:10"},
+                     records);
+  RIEGELI_CHECK_LT(WrittenSize("transpose,byte_shuffle,zstd", records),
+                   WrittenSize("transpose,zstd", records))
+      << "byte_shuffle did not make doubles compress better";
+}
+
+void TestDictionaryEncoding() {
+  const absl::string_view kLabels[] = {"US", "DE", "PL", "JP", "BR"};
+  std::vector<std::string> records;
+  for (uint64_t i = 0; i < 3000; ++i) {
+    std::string record;
+    // Few distinct values.
+    AppendStringField(1, kLabels[i * i % 5], &record);
+    // Distinct values.
+    AppendStringField(2, absl::StrCat("unique ", i), &record);
+    // Few distinct values, including an empty value.
+    AppendStringField(3, i % 4 == 0 ? "" : std::string(i % 4, 'x'), &record);
+    records.push_back(std::move(record));
+  }
+  CheckWriteThenRead({"transpose,dictionary_encoding,brotli",
+                      "transpose,dictionary_encoding,zstd,chunk_size:4096",
+                      "transpose,dictionary_encoding,lz4,"
+                      "checkpoint_interval:10"},
+                     records);
+  RIEGELI_CHECK_LT(
+      WrittenSize("transpose,dictionary_encoding,uncompressed", records),
+      WrittenSize("transpose,uncompressed", records))
+      << "dictionary_encoding did not make labels smaller";
+}
+
+// Returns records with the same structure, and occasionally a record which is
+// not a proto message.
+std::vector<std::string> SampleRecords(size_t num_records) {
+  std::vector<std::string> records;
+  for (uint64_t i = 0; i < num_records; ++i) {
+    std::string record;
+    if (i % 97 == 13) {
+      record = absl::StrCat("not a proto ", i);
+    } else {
+      AppendVarintField(1, i * i, &record);
+      AppendFixed64Field(2, i, &record);
+      std::string submessage;
+      AppendStringField(1, absl::StrCat("name", i % 10), &submessage);
+      AppendVarintField(2, i % 3, &submessage);
+      AppendStringField(3, submessage, &record);
+      if (i % 2 == 0) AppendStringField(4, std::string(i % 50, 'a'), &record);
+    }
+    records.push_back(std::move(record));
+  }
+  return records;
+}
+
+void TestCheckpoints() {
+  RecordWriterBase::Options options;
+  RIEGELI_CHECK(!options.FromString("checkpoint_interval:4K"))
+      << "checkpoint_interval accepted a byte suffix";
+  RIEGELI_CHECK(options.FromString("checkpoint_interval:4096"));
+
+  const std::vector<std::string> records = SampleRecords(1000);
+  CheckWriteThenRead({"transpose,uncompressed",
+                      "transpose,uncompressed,checkpoint_interval:1",
+                      "transpose,uncompressed,checkpoint_interval:7",
+                      "transpose,zstd,checkpoint_interval:100",
+                      "transpose,brotli,checkpoint_interval:1000",
+                      "transpose,lz4,checkpoint_interval:5000",
+                      "transpose,zstd,chunk_size:4096,checkpoint_interval:10",
+                      "transpose,zstd,checkpoint_interval:10,delta_encoding,"
+                      "byte_shuffle,dictionary_encoding,packed_fields",
+                      "transpose,zstd,checkpoint_interval:10,parallelism:2,"
+                      "chunk_size:8192"},
+                     records);
+}
+
+void TestChangingStateMachines() {
+  // Consecutive chunks alternate between a few record structures, and the
+  // number of buffers changes while the structure stays the same, so that a
+  // state machine of a previous chunk is reused only when it matches.
+  std::vector<std::string> records;
+  for (uint64_t i = 0; i < 3000; ++i) {
+    std::string record;
+    switch (i / 100 % 4) {
+      case 0:
+        AppendVarintField(1, i, &record);
+        AppendStringField(2, "a", &record);
+        break;
+      case 1:
+        AppendVarintField(1, i, &record);
+        AppendStringField(2, "b", &record);
+        AppendFixed64Field(3, i, &record);
+        break;
+      case 2:
+        AppendVarintField(1, i, &record);
+        AppendStringField(2, absl::StrCat(i), &record);
+        break;
+      case 3:
+        record = absl::StrCat("not a proto ", i);
+        break;
+    }
+    records.push_back(std::move(record));
+  }
+  CheckWriteThenRead({"transpose,uncompressed,chunk_size:1000",
+                      "transpose,zstd,chunk_size:1000,bucket_fraction:0.1",
+                      "transpose,zstd,chunk_size:1000,delta_encoding,"
+                      "byte_shuffle,dictionary_encoding,packed_fields",
+                      "transpose,zstd,chunk_size:1000,checkpoint_interval:10"},
+                     records);
+}
+
+void TestParallelCompression() {
+  RecordWriterBase::Options options;
+  RIEGELI_CHECK(options.FromString("parallel_compression"));
+  RIEGELI_CHECK(!options.FromString("parallel_compression:2"))
+      << "parallel_compression accepted an integer";
+
+  // Small buckets make several buckets per chunk, which are compressed
+  // concurrently.
+  const std::vector<std::string> records = SampleRecords(3000);
+  CheckWriteThenRead({"transpose,uncompressed,parallel_compression,"
+                      "bucket_fraction:0.01",
+                      "transpose,zstd,parallel_compression,bucket_fraction:0",
+                      "transpose,brotli,parallel_compression,"
+                      "bucket_fraction:0.01",
+                      "transpose,lz4,parallel_compression,bucket_fraction:0.01",
+                      "transpose,zstd,parallel_compression,bucket_fraction:0,"
+                      "chunk_size:16384,parallelism:2",
+                      "transpose,zstd,parallel_compression,bucket_fraction:0,"
+                      "chunk_size:16384,parallelism:1000",
+                      "transpose,zstd,parallel_compression,bucket_fraction:0,"
+                      "checkpoint_interval:100"},
+                     records);
+}
+
+void TestUseRecordType() {
+  RecordsMetadata metadata;
+  SetRecordType(&metadata, RecordsMetadata::descriptor());
+  Chain serialized_metadata;
+  RIEGELI_CHECK(SerializeToChain(metadata, &serialized_metadata));
+
+  // Records of the declared type, with occasional records of another structure
+  // or not a proto message, which must be encoded losslessly anyway.
+  const std::vector<std::string> sample_records = SampleRecords(300);
+  std::vector<std::string> records;
+  for (size_t i = 0; i < 1000; ++i) {
+    if (i % 10 == 3) {
+      records.push_back(sample_records[i % sample_records.size()]);
+      continue;
+    }
+    RecordsMetadata record;
+    record.set_record_type_name(absl::StrCat("type", i % 7));
+    record.set_num_records(i * i);
+    if (i % 2 == 0) record.set_file_comment(std::string(i % 40, 'c'));
+    if (i % 5 == 0) record.set_record_writer_options("transpose");
+    records.push_back(record.SerializeAsString());
+  }
+  for (const absl::string_view options_text :
+       {"transpose,use_record_type,uncompressed",
+        "transpose,use_record_type,zstd",
+        "transpose,use_record_type,zstd,chunk_size:4096,parallelism:2",
+        "transpose,use_record_type,zstd,checkpoint_interval:10",
+        "transpose,use_record_type,zstd,delta_encoding,byte_shuffle,"
+        "dictionary_encoding,packed_fields"}) {
+    CheckWriteThenRead(ParseOptions(options_text).set_metadata(metadata),
+                       options_text, records);
+    CheckWriteThenRead(
+        ParseOptions(options_text).set_serialized_metadata(serialized_metadata),
+        absl::StrCat(options_text, " (serialized metadata)"), records);
+  }
+  // A record type which cannot be found is ignored.
+  RecordsMetadata unknown_type = metadata;
+  unknown_type.set_record_type_name("riegeli.NoSuchType");
+  CheckWriteThenRead(
+      ParseOptions("transpose,use_record_type").set_metadata(unknown_type),
+      "transpose,use_record_type (unknown record type)", records);
+}
+
+// Returns the number of chunks of "chunk_type" in "file".
+size_t CountChunks(const Chain& file, ChunkType chunk_type) {
+  DefaultChunkReader<ChainReader<>> chunk_reader((ChainReader<>(&file)));
+  size_t num_chunks = 0;
+  Chunk chunk;
+  while (chunk_reader.ReadChunk(&chunk)) {
+    if (chunk.header.chunk_type() == chunk_type) ++num_chunks;
+  }
+  RIEGELI_CHECK(chunk_reader.Close()) << chunk_reader.message();
+  return num_chunks;
+}
+
+void TestNonProtoFallback() {
+  // Phases of proto records, mostly non-proto records, proto records again,
+  // and an even mix, each spanning many chunks.
+  const std::vector<std::string> sample_records = SampleRecords(3000);
+  std::vector<std::string> records;
+  for (size_t i = 0; i < 2000; ++i) {
+    records.push_back(sample_records[i]);
+  }
+  for (size_t i = 0; i < 4000; ++i) {
+    records.push_back(i % 50 == 0 ? sample_records[i % 3000]
+                                  : absl::StrCat("\xff text record ", i));
+  }
+  for (size_t i = 0; i < 3000; ++i) {
+    records.push_back(sample_records[i]);
+  }
+  for (size_t i = 0; i < 2000; ++i) {
+    records.push_back(i % 2 == 0 ? sample_records[i]
+                                 : absl::StrCat("\xff text record ", i));
+  }
+
+  for (const absl::string_view options_text :
+       {"transpose,nonproto_fallback,chunk_size:4000",
+        "transpose,nonproto_fallback,zstd,chunk_size:4000,parallelism:2",
+        "transpose,nonproto_fallback,zstd,chunk_size:4000,"
+        "checkpoint_interval:10"}) {
+    const Chain file =
+        CheckWriteThenRead(ParseOptions(options_text), options_text, records);
+    // Mostly non-proto chunks were written as simple chunks, and later chunks
+    // were transposed again.
+    RIEGELI_CHECK_GT(CountChunks(file, ChunkType::kSimple), 0u)
+        << options_text << ": no fallback to simple chunks";
+    RIEGELI_CHECK_GT(CountChunks(file, ChunkType::kTransposed), 0u)
+        << options_text << ": no transposed chunks";
+  }
+  // Without nonproto_fallback all chunks are transposed.
+  const Chain file = CheckWriteThenRead(
+      ParseOptions("transpose,chunk_size:4000"), "transpose", records);
+  RIEGELI_CHECK_EQ(CountChunks(file, ChunkType::kSimple), 0u)
+      << "Simple chunks written without nonproto_fallback";
+  // nonproto_fallback without transpose has no effect.
+  CheckWriteThenRead("nonproto_fallback,chunk_size:4000", records);
+}
+
+void TestEstimateMemoryWithParallelism() {
+  Chain file;
+  RecordWriter<ChainWriter<>> writer(
+      ChainWriter<>(&file),
+      RecordWriterBase::Options().set_parallelism(4).set_chunk_size(1 << 12));
+  const std::string record(100, 'x');
+  for (int i = 0; i < 2000; ++i) {
+    RIEGELI_CHECK(writer.WriteRecord(record)) << writer.message();
+    // Queued chunks are either being encoded or already encoded; both must be
+    // safe to inspect from this thread.
+    if (i % 100 == 0) RIEGELI_CHECK_GT(EstimateMemory(writer), 0u);
+  }
+  RIEGELI_CHECK(writer.Close()) << writer.message();
+
+  RecordReader<ChainReader<>> reader((ChainReader<>(&file)));
+  std::string read_record;
+  for (int i = 0; i < 2000; ++i) {
+    RIEGELI_CHECK(reader.ReadRecord(&read_record)) << reader.message();
+    RIEGELI_CHECK(read_record == record) << "record " << i << " differs";
+  }
+  RIEGELI_CHECK(!reader.ReadRecord(&read_record)) << "too many records";
+  RIEGELI_CHECK(reader.Close()) << reader.message();
+}
+
+}  // namespace
+}  // namespace riegeli
+
+int main() {
+  riegeli::TestPackedFields();
+  riegeli::TestDeltaEncoding();
+  riegeli::TestByteShuffle();
+  riegeli::TestDictionaryEncoding();
+  riegeli::TestCheckpoints();
+  riegeli::TestChangingStateMachines();
+  riegeli::TestParallelCompression();
+  riegeli::TestUseRecordType();
+  riegeli::TestNonProtoFallback();
+  riegeli::TestEstimateMemoryWithParallelism();
+  return 0;
+}